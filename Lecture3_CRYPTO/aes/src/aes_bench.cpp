@@ -0,0 +1,402 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/AES.h"
+
+// 替换全局operator new，统计每次调用的堆分配次数和字节数
+static std::atomic<size_t> g_alloc_count(0), g_alloc_bytes(0);
+
+void* operator new(size_t size) {
+    g_alloc_count++;
+    g_alloc_bytes += size;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// 不内联到operator delete中，否则编译器会认为operator new的内存被free()释放而报-Wmismatched-new-delete
+__attribute__((noinline)) static void CountedFree(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+
+// 所有后端都参与测试（CPU不支持的后端除外）
+static const std::vector<AESBackend> kBackendList = {AESBackend::REFERENCE, AESBackend::TTABLE, AESBackend::AESNI, AESBackend::BITSLICED};
+
+enum class BenchMode {
+    ECB_ENCRYPT, ECB_DECRYPT, CBC_ENCRYPT, CBC_DECRYPT, CFB_ENCRYPT, CFB_DECRYPT, CTR_ENCRYPT, CTR_DECRYPT, GCM_ENCRYPT, GCM_DECRYPT
+};
+
+static const std::vector<std::pair<BenchMode, std::string>> kModeList = {
+    {BenchMode::ECB_ENCRYPT, "ECB encrypt"}, {BenchMode::ECB_DECRYPT, "ECB decrypt"},
+    {BenchMode::CBC_ENCRYPT, "CBC encrypt"}, {BenchMode::CBC_DECRYPT, "CBC decrypt"},
+    {BenchMode::CFB_ENCRYPT, "CFB encrypt"}, {BenchMode::CFB_DECRYPT, "CFB decrypt"},
+    {BenchMode::CTR_ENCRYPT, "CTR encrypt"}, {BenchMode::CTR_DECRYPT, "CTR decrypt"},
+    {BenchMode::GCM_ENCRYPT, "GCM encrypt"}, {BenchMode::GCM_DECRYPT, "GCM decrypt"},
+};
+
+// CBC和CFB加密的每个分组依赖上一个密文分组，不能分给多个线程
+bool IsParallelizable(BenchMode mode) {
+    return mode != BenchMode::CBC_ENCRYPT && mode != BenchMode::CFB_ENCRYPT;
+}
+
+struct KnownAnswer {
+    const char* name;
+    BenchMode encrypt;
+    BenchMode decrypt;
+    AESKeyLength key_length;
+    const char* key;
+    const char* iv;
+    const char* plain;
+    const char* cipher;
+    const char* aad = "";  // 仅GCM
+    const char* tag = "";  // 仅GCM
+};
+
+static const char* kIv = "000102030405060708090a0b0c0d0e0f";
+static const char* kKey128 = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char* kKey192 = "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b";
+static const char* kKey256 = "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4";
+static const char* kCounter = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char* kGcmKey = "feffe9928665731c6d6a8f9467308308";
+static const char* kGcmAad = "feedfacedeadbeeffeedfacedeadbeefabaddad2";
+static const char* kGcmPlain =
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39";
+static const char* kPlain =
+    "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+
+// FIPS-197 Appendix C、NIST SP 800-38A Appendix F和GCM规范（McGrew & Viega）Appendix B的测试向量，所有后端共用
+static const std::vector<KnownAnswer> kKnownAnswerList = {
+    {"FIPS-197 C.1", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_128,
+        "000102030405060708090a0b0c0d0e0f", kIv, "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a"},
+    {"FIPS-197 C.2", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_192,
+        "000102030405060708090a0b0c0d0e0f1011121314151617", kIv, "00112233445566778899aabbccddeeff",
+        "dda97ca4864cdfe06eaf70a0ec0d7191"},
+    {"FIPS-197 C.3", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_256,
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", kIv, "00112233445566778899aabbccddeeff",
+        "8ea2b7ca516745bfeafc49904b496089"},
+    {"SP 800-38A F.1.1", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_128, kKey128, kIv, kPlain,
+        "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf"
+        "43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4"},
+    {"SP 800-38A F.1.3", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_192, kKey192, kIv, kPlain,
+        "bd334f1d6e45f25ff712a214571fa5cc974104846d0ad3ad7734ecb3ecee4eef"
+        "ef7afd2270e2e60adce0ba2face6444e9a4b41ba738d6c72fb16691603c18e0e"},
+    {"SP 800-38A F.1.5", BenchMode::ECB_ENCRYPT, BenchMode::ECB_DECRYPT, AESKeyLength::AES_256, kKey256, kIv, kPlain,
+        "f3eed1bdb5d2a03c064b5a7e3db181f8591ccb10d410ed26dc5ba74a31362870"
+        "b6ed21b99ca6f4f9f153e7b1beafed1d23304b7a39f9f3ff067d8d8f9e24ecc7"},
+    {"SP 800-38A F.2.1", BenchMode::CBC_ENCRYPT, BenchMode::CBC_DECRYPT, AESKeyLength::AES_128, kKey128, kIv, kPlain,
+        "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+        "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7"},
+    {"SP 800-38A F.2.5", BenchMode::CBC_ENCRYPT, BenchMode::CBC_DECRYPT, AESKeyLength::AES_256, kKey256, kIv, kPlain,
+        "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"
+        "39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b"},
+    {"SP 800-38A F.3.13", BenchMode::CFB_ENCRYPT, BenchMode::CFB_DECRYPT, AESKeyLength::AES_128, kKey128, kIv, kPlain,
+        "3b3fd92eb72dad20333449f8e83cfb4ac8a64537a0b3a93fcde3cdad9f1ce58b"
+        "26751f67a3cbb140b1808cf187a4f4dfc04b05357c5d1c0eeac4c66f9ff7f2e6"},
+    {"SP 800-38A F.3.17", BenchMode::CFB_ENCRYPT, BenchMode::CFB_DECRYPT, AESKeyLength::AES_256, kKey256, kIv, kPlain,
+        "dc7e84bfda79164b7ecd8486985d386039ffed143b28b1c832113c6331e5407b"
+        "df10132415e54b92a13ed0a8267ae2f975a385741ab9cef82031623d55b1e471"},
+    {"SP 800-38A F.5.1", BenchMode::CTR_ENCRYPT, BenchMode::CTR_DECRYPT, AESKeyLength::AES_128, kKey128, kCounter, kPlain,
+        "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+        "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"},
+    {"SP 800-38A F.5.5", BenchMode::CTR_ENCRYPT, BenchMode::CTR_DECRYPT, AESKeyLength::AES_256, kKey256, kCounter, kPlain,
+        "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+        "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6"},
+    {"GCM Test Case 2", BenchMode::GCM_ENCRYPT, BenchMode::GCM_DECRYPT, AESKeyLength::AES_128,
+        "00000000000000000000000000000000", "000000000000000000000000", "00000000000000000000000000000000",
+        "0388dace60b6a392f328c2b971b2fe78", "", "ab6e47d42cec13bdf53a67b21257bddf"},
+    {"GCM Test Case 4", BenchMode::GCM_ENCRYPT, BenchMode::GCM_DECRYPT, AESKeyLength::AES_128, kGcmKey, "cafebabefacedbaddecaf888",
+        kGcmPlain,
+        "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+        "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+        kGcmAad, "5bc94fbc3221a5db94fae95ae7121a47"},
+    {"GCM Test Case 5", BenchMode::GCM_ENCRYPT, BenchMode::GCM_DECRYPT, AESKeyLength::AES_128, kGcmKey, "cafebabefacedbad", kGcmPlain,
+        "61353b4c2806934a777ff51fa22a4755699b2a714fcdc6f83766e5f97b6c7423"
+        "73806900e49f24b22b097544d4896b424989b5e1ebac0f07c23f4598",
+        kGcmAad, "3612d2e79e3b0785561be14aaca2fccb"},
+    {"GCM Test Case 16", BenchMode::GCM_ENCRYPT, BenchMode::GCM_DECRYPT, AESKeyLength::AES_256,
+        "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", kGcmPlain,
+        "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+        "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+        kGcmAad, "76fc6ece0f4e1768cddf8853bb2d551b"},
+};
+
+std::vector<unsigned char> HexToBytes(const std::string& hex) {
+    std::vector<unsigned char> bytes(hex.size() / 2);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<unsigned char>(std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+// GCM加密时把tag写入tag，解密时用tag验证（不一致时抛出std::runtime_error）
+unsigned char* RunMode(AES& aes, BenchMode mode, const std::vector<unsigned char>& data, const std::vector<unsigned char>& key,
+                       const std::vector<unsigned char>& iv, const std::vector<unsigned char>& aad, std::vector<unsigned char>& tag) {
+    const unsigned int len = static_cast<unsigned int>(data.size());
+    const unsigned int iv_len = static_cast<unsigned int>(iv.size()), aad_len = static_cast<unsigned int>(aad.size());
+    tag.resize(16);
+    switch (mode) {
+        case BenchMode::ECB_ENCRYPT: return aes.EncryptECB(data.data(), len, key.data());
+        case BenchMode::ECB_DECRYPT: return aes.DecryptECB(data.data(), len, key.data());
+        case BenchMode::CBC_ENCRYPT: return aes.EncryptCBC(data.data(), len, key.data(), iv.data());
+        case BenchMode::CBC_DECRYPT: return aes.DecryptCBC(data.data(), len, key.data(), iv.data());
+        case BenchMode::CFB_ENCRYPT: return aes.EncryptCFB(data.data(), len, key.data(), iv.data());
+        case BenchMode::CFB_DECRYPT: return aes.DecryptCFB(data.data(), len, key.data(), iv.data());
+        case BenchMode::CTR_ENCRYPT: return aes.EncryptCTR(data.data(), len, key.data(), iv.data());
+        case BenchMode::CTR_DECRYPT: return aes.DecryptCTR(data.data(), len, key.data(), iv.data());
+        case BenchMode::GCM_ENCRYPT: return aes.EncryptGCM(data.data(), len, key.data(), iv.data(), iv_len, aad.data(), aad_len, tag.data());
+        case BenchMode::GCM_DECRYPT: return aes.DecryptGCM(data.data(), len, key.data(), iv.data(), iv_len, aad.data(), aad_len, tag.data());
+    }
+    return nullptr;
+}
+
+// 用测试向量检查每个后端在各模式下的加密和解密
+bool RunKnownAnswerTests(AESBackend backend) {
+    bool passed = true;
+    for (const KnownAnswer& kat : kKnownAnswerList) {
+        AES aes(kat.key_length, backend);
+        std::vector<unsigned char> key = HexToBytes(kat.key), iv = HexToBytes(kat.iv);
+        std::vector<unsigned char> plain = HexToBytes(kat.plain), cipher = HexToBytes(kat.cipher);
+        std::vector<unsigned char> aad = HexToBytes(kat.aad), expected_tag = HexToBytes(kat.tag), tag;
+        unsigned char* encrypted = RunMode(aes, kat.encrypt, plain, key, iv, aad, tag);
+        bool tag_matched = expected_tag.empty() || tag == expected_tag;
+        tag = expected_tag;
+        unsigned char* decrypted = RunMode(aes, kat.decrypt, cipher, key, iv, aad, tag);
+        if (std::memcmp(encrypted, cipher.data(), cipher.size()) != 0 || std::memcmp(decrypted, plain.data(), plain.size()) != 0 ||
+            !tag_matched) {
+            std::cout << "KAT failed: backend = " << AESBackendName(backend) << ", " << kat.name << std::endl;
+            passed = false;
+        }
+        delete[] encrypted;
+        delete[] decrypted;
+    }
+    return passed;
+}
+
+// GCM解密的输入必须是密文和它的tag：先加密data得到，解密的输出即为data
+std::vector<unsigned char> PrepareInput(AES& aes, BenchMode mode, const std::vector<unsigned char>& data, const std::vector<unsigned char>& key,
+                                        const std::vector<unsigned char>& iv, const std::vector<unsigned char>& aad,
+                                        std::vector<unsigned char>& tag) {
+    if (mode != BenchMode::GCM_DECRYPT) {
+        return data;
+    }
+    unsigned char* cipher = RunMode(aes, BenchMode::GCM_ENCRYPT, data, key, iv, aad, tag);
+    std::vector<unsigned char> input(cipher, cipher + data.size());
+    delete[] cipher;
+    return input;
+}
+
+// 返回吞吐量[MB/s]，并检查输出与expected一致（expected为空时保存输出）
+double BenchThroughput(AESBackend backend, unsigned int threads, BenchMode mode, const std::vector<unsigned char>& data,
+                       const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv, int repeat,
+                       std::vector<unsigned char>& expected, bool& correct) {
+    AES aes(AESKeyLength::AES_128, backend, threads);
+    // GCM以iv为附加数据
+    std::vector<unsigned char> tag;
+    std::vector<unsigned char> input = PrepareInput(aes, mode, data, key, iv, iv, tag);
+    // 第一次运行不计时，只用来检查输出
+    unsigned char* out = RunMode(aes, mode, input, key, iv, iv, tag);
+    std::vector<unsigned char> output(out, out + data.size());
+    delete[] out;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        delete[] RunMode(aes, mode, input, key, iv, iv, tag);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    if (expected.empty()) {
+        expected = output;
+    }
+    correct = (output == expected);
+    return data.size() * static_cast<double>(repeat) / seconds / (1024.0 * 1024.0);
+}
+
+// 小消息（如每次GetEncryption RPC）的加解密时间：每次调用都展开密钥，或者复用ExpandKey得到的AESKey
+static const std::vector<size_t> kSmallMessageSizes = {16, 64, 256, 1024, 4096};
+static const size_t kSmallMessageBytes = 1 << 20;
+
+// 返回每条消息的平均时间[ns]
+double BenchSmallMessages(AESBackend backend, BenchMode mode, size_t size, bool reuse_key, const std::vector<unsigned char>& data,
+                          const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv) {
+    AES aes(AESKeyLength::AES_128, backend, 1);
+    const AESKey round_keys = aes.ExpandKey(key);
+    const unsigned int len = static_cast<unsigned int>(size);
+    const size_t messages = kSmallMessageBytes / size;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t m = 0; m < messages; ++m) {
+        unsigned char* out = nullptr;
+        if (mode == BenchMode::CBC_ENCRYPT) {
+            out = reuse_key ? aes.EncryptCBC(data.data(), len, round_keys, iv.data()) : aes.EncryptCBC(data.data(), len, key.data(), iv.data());
+        } else {
+            out = reuse_key ? aes.DecryptCBC(data.data(), len, round_keys, iv.data()) : aes.DecryptCBC(data.data(), len, key.data(), iv.data());
+        }
+        delete[] out;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return seconds / messages * 1e9;
+}
+
+// 同一个CBC加密的四种调用方式：返回vector、返回new[]的数组、写入调用者的缓冲区、原地加密
+enum class CallStyle { VECTOR, NEW_ARRAY, CALLER_BUFFER, IN_PLACE };
+
+static const std::vector<std::pair<CallStyle, std::string>> kCallStyleList = {
+    {CallStyle::VECTOR, "vector"}, {CallStyle::NEW_ARRAY, "new[] result"},
+    {CallStyle::CALLER_BUFFER, "caller buffer"}, {CallStyle::IN_PLACE, "in-place"},
+};
+
+// 返回每次调用的平均时间[ns]，以及堆分配次数和字节数（除输出本身外都是输入、密钥和IV的拷贝）
+double BenchCallStyle(CallStyle style, size_t size, const std::vector<unsigned char>& data, const std::vector<unsigned char>& key,
+                      const std::vector<unsigned char>& iv, double& allocs, double& alloc_bytes) {
+    AES aes(AESKeyLength::AES_128, AESBackend::AUTO, 1);
+    const AESKey round_keys = aes.ExpandKey(key);
+    const std::vector<unsigned char> input(data.begin(), data.begin() + size);
+    std::vector<unsigned char> buffer = input;
+    const unsigned int len = static_cast<unsigned int>(size);
+    const size_t calls = std::max<size_t>(16, (16 << 20) / size);
+
+    const size_t count_before = g_alloc_count, bytes_before = g_alloc_bytes;
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < calls; ++c) {
+        switch (style) {
+            case CallStyle::VECTOR: aes.EncryptCBC(input, key, iv); break;
+            case CallStyle::NEW_ARRAY: delete[] aes.EncryptCBC(input.data(), len, round_keys, iv.data()); break;
+            case CallStyle::CALLER_BUFFER: aes.EncryptCBC(input.data(), buffer.data(), len, round_keys, iv.data()); break;
+            case CallStyle::IN_PLACE: aes.EncryptCBC(buffer.data(), buffer.data(), len, round_keys, iv.data()); break;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    allocs = static_cast<double>(g_alloc_count - count_before) / calls;
+    alloc_bytes = static_cast<double>(g_alloc_bytes - bytes_before) / calls;
+    return seconds / calls * 1e9;
+}
+
+// 每种模式下与参考实现的输出比较，长度覆盖不足一组的剩余分组
+bool RunConsistencyTests(AESBackend backend, const std::vector<unsigned char>& data,
+                         const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv) {
+    bool passed = true;
+    for (const auto& mode : kModeList) {
+        for (size_t blocks = 1; blocks <= 20; ++blocks) {
+            AES reference(AESKeyLength::AES_128, AESBackend::REFERENCE), aes(AESKeyLength::AES_128, backend);
+            std::vector<unsigned char> expected_tag, tag;
+            std::vector<unsigned char> input(data.begin(), data.begin() + blocks * 16);
+            input = PrepareInput(reference, mode.first, input, key, iv, iv, expected_tag);
+            tag = expected_tag;
+            unsigned char* expected = RunMode(reference, mode.first, input, key, iv, iv, expected_tag);
+            unsigned char* output = RunMode(aes, mode.first, input, key, iv, iv, tag);
+            if (std::memcmp(expected, output, input.size()) != 0 || tag != expected_tag) {
+                std::cout << mode.second << " failed: backend = " << AESBackendName(backend) << ", blocks = " << blocks << std::endl;
+                passed = false;
+            }
+            delete[] expected;
+            delete[] output;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    // Expect the following args: [size in MB] [repeat] [threads]
+    size_t size_mb = 16;
+    int repeat = 3;
+    unsigned int threads = std::thread::hardware_concurrency();
+    if (argc > 1) {
+        size_mb = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        repeat = std::atoi(argv[2]);
+    }
+    if (argc > 3) {
+        threads = std::strtoul(argv[3], nullptr, 10);
+    }
+    if (size_mb == 0 || repeat <= 0 || threads == 0) {
+        std::cerr << "Usage: " << argv[0] << " [size in MB] [repeat] [threads]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 gen(2024);
+    std::uniform_int_distribution<int> dis(0, 255);
+    std::vector<unsigned char> data(size_mb * 1024 * 1024), key(16), iv(16);
+    for (unsigned char& c : data) c = static_cast<unsigned char>(dis(gen));
+    for (unsigned char& c : key) c = static_cast<unsigned char>(dis(gen));
+    for (unsigned char& c : iv) c = static_cast<unsigned char>(dis(gen));
+
+    bool all_passed = true;
+    for (AESBackend backend : kBackendList) {
+        if (!AESBackendSupported(backend)) {
+            std::cout << "KAT, " << std::setw(9) << AESBackendName(backend) << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        bool passed = RunKnownAnswerTests(backend) && RunConsistencyTests(backend, data, key, iv);
+        std::cout << "KAT, " << std::setw(9) << AESBackendName(backend) << ": " << (passed ? "passed" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+
+    std::cout << "AES-128, " << size_mb << " MB x " << repeat << ", " << threads << " threads" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& mode : kModeList) {
+        std::vector<unsigned char> expected;
+        double reference_mbps = 0;
+        for (AESBackend backend : kBackendList) {
+            if (!AESBackendSupported(backend)) continue;
+            bool correct = false;
+            double mbps = BenchThroughput(backend, 1, mode.first, data, key, iv, repeat, expected, correct);
+            if (backend == AESBackend::REFERENCE) {
+                reference_mbps = mbps;
+            }
+            std::cout << mode.second << ", " << std::setw(9) << AESBackendName(backend) << ": " << std::setw(8) << mbps << " [MB/s], speedup = "
+                        << std::setprecision(2) << mbps / reference_mbps << "x" << std::setprecision(1);
+            // 可并行的模式再用threads个线程测一次
+            if (IsParallelizable(mode.first) && threads > 1) {
+                bool parallel_correct = false;
+                double parallel_mbps = BenchThroughput(backend, threads, mode.first, data, key, iv, repeat, expected, parallel_correct);
+                std::cout << ", " << threads << " threads: " << std::setw(8) << parallel_mbps << " [MB/s]";
+                correct = correct && parallel_correct;
+            }
+            std::cout << (correct ? "" : ", MISMATCH") << std::endl;
+            all_passed = all_passed && correct;
+        }
+    }
+
+    std::cout << "AES-128 small messages, " << kSmallMessageBytes / (1024 * 1024) << " MB per size" << std::endl;
+    for (BenchMode mode : {BenchMode::CBC_ENCRYPT, BenchMode::CBC_DECRYPT}) {
+        const std::string name = mode == BenchMode::CBC_ENCRYPT ? "CBC encrypt" : "CBC decrypt";
+        for (size_t size : kSmallMessageSizes) {
+            for (AESBackend backend : kBackendList) {
+                if (!AESBackendSupported(backend)) continue;
+                double per_call_ns = BenchSmallMessages(backend, mode, size, false, data, key, iv);
+                double reuse_ns = BenchSmallMessages(backend, mode, size, true, data, key, iv);
+                std::cout << name << " " << std::setw(4) << size << " B, " << std::setw(9) << AESBackendName(backend) << ": key per call "
+                          << std::setw(8) << per_call_ns << " [ns], AESKey " << std::setw(8) << reuse_ns << " [ns], speedup = "
+                          << std::setprecision(2) << per_call_ns / reuse_ns << "x" << std::setprecision(1) << std::endl;
+            }
+        }
+    }
+
+    std::cout << "AES-128 CBC encrypt, " << AESBackendName(AES().GetBackend()) << ", heap allocations per call" << std::endl;
+    for (size_t size : {size_t(64), size_t(4096), size_t(1) << 20}) {
+        if (size > data.size()) continue;
+        for (const auto& style : kCallStyleList) {
+            double allocs = 0, alloc_bytes = 0;
+            double ns = BenchCallStyle(style.first, size, data, key, iv, allocs, alloc_bytes);
+            std::cout << std::setw(7) << size << " B, " << std::setw(13) << style.second << ": " << std::setw(4) << allocs << " allocs, "
+                      << std::setw(9) << alloc_bytes << " bytes, " << std::setw(10) << ns << " [ns]" << std::endl;
+        }
+    }
+
+    return all_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
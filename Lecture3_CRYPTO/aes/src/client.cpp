@@ -1,21 +1,32 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <memory>
 #include <string>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <grpcpp/grpcpp.h>
 
 #include "utils/AES.h"
 #include "utils/util.hpp"
+#include "utils/handshake.hpp"
 #include "DiffieHellman.grpc.pb.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
+using grpc::ClientWriter;
 using grpc::Status;
 using google::protobuf::Empty;
 using DiffieHellman::DiffieHellmanService;
 using DiffieHellman::DiffieHellmanParams;
 using DiffieHellman::DiffieHellmanRg;
 using DiffieHellman::EncryptData;
+using DiffieHellman::UploadResult;
+using DiffieHellman::HandshakeRequest;
+using DiffieHellman::HandshakeResponse;
   
 class DiffieHellmanClient {  
 public:  
@@ -32,6 +43,7 @@ public:
         if (status.ok()) {
             p = response.p();
             g = response.g();
+            session_id = response.session_id();
             // std::cout << "Received Diffie-Hellman parameters:" << std::endl;
             // std::cout << "\t" << "p: " << response.p() << std::endl;
             // std::cout << "\t" << "g: " << response.g() << std::endl;
@@ -53,6 +65,7 @@ public:
 
         // 从gRPC服务获取Diffie-Hellman参数  
         request.set_rg_mod_p(B);
+        request.set_session_id(session_id);
         Status status = stub_->GetRandom(&context, request, &response);
   
         if (!status.ok()) {
@@ -75,12 +88,13 @@ public:
         return shared_secret_key;
     }
 
-    void SendEncryptData(const std::vector<unsigned char>& encrypt_data) {
+    void SendEncryptData(std::string encrypt_data) {
         EncryptData request;
         Empty response;
         ClientContext context;
 
-        request.set_data(std::string(encrypt_data.begin(), encrypt_data.end()));
+        request.set_data(std::move(encrypt_data));
+        request.set_session_id(session_id);
         Status status = stub_->GetEncryption(&context, request, &response);
   
         if (!status.ok()) {
@@ -92,56 +106,210 @@ public:
         std::cout << "Send encrypt data size: " << request.ByteSizeLong() << " [byte]." << std::endl;
     }
 
-    void AesTest(const std::string& message) {
-        std::vector<unsigned char> aes_key, aes_iv;
+    // 一轮握手：发送X25519临时公钥和随机数（若有票据则一并出示以恢复会话），
+    // 再由共享密钥和双方随机数用HKDF-SHA256导出AES密钥和IV
+    void Handshake(std::vector<unsigned char>& aes_key, std::vector<unsigned char>& aes_iv) {
+        HandshakeRequest request;
+        HandshakeResponse response;
+        ClientContext context;
+
+        std::vector<unsigned char> client_private = random_bytes(X25519::keyBytesLen);
+        std::vector<unsigned char> client_public(X25519::keyBytesLen);
+        X25519::PublicKey(client_private.data(), client_public.data());
+        std::vector<unsigned char> client_random = random_bytes(HANDSHAKE_RANDOM_BYTES);
+        request.set_client_public(std::string(client_public.begin(), client_public.end()));
+        request.set_client_random(std::string(client_random.begin(), client_random.end()));
+        if (resume_session && !ticket.empty()) {
+            request.set_ticket(ticket);
+        }
+
+        Status status = stub_->Handshake(&context, request, &response);
+        if (!status.ok()) {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            std::cout << "Failed to perform handshake with server." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
 
-        // perform key exchange twice to obtain AES keys (128bit)
-        for (int i=0; i<2; ++i) {
-            uint64_t aes_key_64bit = PerformKeyExchange();
-            std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(aes_key_64bit);
-            aes_key.insert(aes_key.end(), aes_tmp.begin(), aes_tmp.end());
+        // 恢复会话时用上次的恢复密钥，否则计算X25519共享密钥
+        std::vector<unsigned char> shared_secret(resumption_secret);
+        if (!response.resumed()) {
+            shared_secret.resize(X25519::keyBytesLen);
+            if (response.server_public().size() != X25519::keyBytesLen ||
+                !X25519::SharedSecret(client_private.data(),
+                                      reinterpret_cast<const unsigned char*>(response.server_public().data()),
+                                      shared_secret.data())) {
+                std::cerr << "Invalid server public key." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
         }
+        SessionKeys keys = derive_session_keys(shared_secret, client_random,
+                                               stringToUnsignedVector(response.server_random()));
+
+        session_id = response.session_id();
+        ticket = response.ticket();
+        resumption_secret = keys.resumption_secret;
+        aes_key = keys.aes_key;
+        aes_iv = keys.aes_iv;
+        std::cout << (response.resumed() ? "Resumed" : "Full") << " handshake, session id: " << session_id << std::endl;
+    }
+
+    // use_handshake：用一轮握手代替4次Diffie-Hellman交换；resume：握手时出示票据以恢复会话
+    void SetKeyAgreement(bool use_handshake, bool resume) {
+        handshake = use_handshake;
+        resume_session = resume;
+    }
 
-        // perform key exchange twice to obtain AES IV (128bit)
-        for (int i=0; i<2; ++i) {
-            uint64_t aes_iv_64bit = PerformKeyExchange();
-            std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(aes_iv_64bit);
-            aes_iv.insert(aes_iv.end(), aes_tmp.begin(), aes_tmp.end());
+    void ExchangeAesKey(std::vector<unsigned char>& aes_key, std::vector<unsigned char>& aes_iv) {
+        aes_key.clear();
+        aes_iv.clear();
+        if (handshake) {
+            Handshake(aes_key, aes_iv);
+        } else {
+            // receive p, g and a new session for this transfer
+            GetParams();
+
+            // perform key exchange twice to obtain AES keys (128bit)
+            for (int i=0; i<2; ++i) {
+                uint64_t aes_key_64bit = PerformKeyExchange();
+                std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(aes_key_64bit);
+                aes_key.insert(aes_key.end(), aes_tmp.begin(), aes_tmp.end());
+            }
+
+            // perform key exchange twice to obtain AES IV (128bit)
+            for (int i=0; i<2; ++i) {
+                uint64_t aes_iv_64bit = PerformKeyExchange();
+                std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(aes_iv_64bit);
+                aes_iv.insert(aes_iv.end(), aes_tmp.begin(), aes_tmp.end());
+            }
         }
 
         // print the aes key and iv
         assert(16==aes_iv.size() && 16==aes_key.size());
         printUnsignedVectorInHex(aes_key, "aes_key");
         printUnsignedVectorInHex(aes_iv, "aes_iv ");
+    }
+
+    void AesTest(std::istream& input) {
+        std::vector<unsigned char> aes_key, aes_iv;
+        ExchangeAesKey(aes_key, aes_iv);
 
         // create AES encrytor
         AES aes(AESKeyLength::AES_128);
 
-        // use CBC mode to encrypt the input message
-        std::vector<unsigned char> plain_data = stringToUnsignedVector(message);
-        if (plain_data.size()%16 != 0) {
-            std::cout << "[BEFORE Padding] plain_data.size() = " << plain_data.size() << std::endl;
-            for (int c=plain_data.size()%16; c<16; ++c) {
-                plain_data.emplace_back('\0');
-            }
-            std::cout << "[AFTER Padding] plain_data.size() = " << plain_data.size() << std::endl;
+        // use CBC mode to encrypt the input chunk by chunk, Final() adds the PKCS#7 padding
+        AESEncryptor encryptor(aes, AESMode::CBC, aes.ExpandKey(aes_key), aes_iv.data());
+        std::vector<char> plain_chunk(STREAM_CHUNK_BYTES);
+        std::vector<unsigned char> encrypt_chunk(STREAM_CHUNK_BYTES + 16);
+        // 一元RPC仍需把整个密文放进一个请求
+        std::string encrypt_data;
+        size_t plain_size = 0;
+        while (input.read(plain_chunk.data(), plain_chunk.size()) || input.gcount() > 0) {
+            size_t n = encryptor.Update(reinterpret_cast<const unsigned char*>(plain_chunk.data()),
+                                        input.gcount(), encrypt_chunk.data());
+            encrypt_data.append(reinterpret_cast<const char*>(encrypt_chunk.data()), n);
+            plain_size += input.gcount();
+        }
+        size_t n = encryptor.Final(encrypt_chunk.data());
+        encrypt_data.append(reinterpret_cast<const char*>(encrypt_chunk.data()), n);
+
+        // print the encrypted message (only when it is short)
+        std::cout << "plain_data.size() = " << plain_size << ", encrypt_data.size() = " << encrypt_data.size() << std::endl;
+        if (encrypt_data.size() <= 256) {
+            printUnsignedVectorInHex(stringToUnsignedVector(encrypt_data), "encrypt_data");
         }
-        std::vector<unsigned char> encrypt_data = aes.EncryptCBC(plain_data, aes_key, aes_iv);
-        
-        // print the encrypted message
-        std::cout << "message: " << message << std::endl;
-        printUnsignedVectorInHex(encrypt_data, "encrypt_data");
 
         // send the encrypted message to server via gRPC
-        SendEncryptData(encrypt_data);
+        SendEncryptData(std::move(encrypt_data));
+    }
+
+    // 流式上传：加密线程通过read_chunk分块读取明文并加密，当前线程同时发送密文块
+    void UploadEncrypted(const std::function<size_t(char*, size_t)>& read_chunk) {
+        std::vector<unsigned char> aes_key, aes_iv;
+        ExchangeAesKey(aes_key, aes_iv);
+
+        // use CBC mode to encrypt the input chunk by chunk, Final() adds the PKCS#7 padding
+        AES aes(AESKeyLength::AES_128);
+        AESEncryptor encryptor(aes, AESMode::CBC, aes.ExpandKey(aes_key), aes_iv.data());
+
+        UploadResult response;
+        ClientContext context;
+        std::unique_ptr<ClientWriter<EncryptData>> writer(stub_->UploadEncrypted(&context, &response));
+
+        // 队列长度限制了占用的内存
+        BoundedQueue<EncryptData> queue(4);
+        uint64_t plain_size = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::thread encrypt_thread([&] {
+            std::vector<char> plain_chunk(STREAM_CHUNK_BYTES);
+            EncryptData chunk;
+            // 只有第一块需要带上会话id
+            chunk.set_session_id(session_id);
+            size_t n;
+            while ((n = read_chunk(plain_chunk.data(), plain_chunk.size())) > 0) {
+                std::string* data = chunk.mutable_data();
+                data->resize(n + 16);
+                data->resize(encryptor.Update(reinterpret_cast<const unsigned char*>(plain_chunk.data()),
+                                              n, reinterpret_cast<unsigned char*>(&(*data)[0])));
+                plain_size += n;
+                if (!queue.Push(std::move(chunk))) {
+                    return;
+                }
+            }
+            std::string* data = chunk.mutable_data();
+            data->resize(16);
+            data->resize(encryptor.Final(reinterpret_cast<unsigned char*>(&(*data)[0])));
+            queue.Push(std::move(chunk));
+            queue.Close();
+        });
+
+        EncryptData chunk;
+        while (queue.Pop(chunk)) {
+            if (!writer->Write(chunk)) {
+                // 服务端已经结束了该RPC，停止加密
+                queue.Close();
+                break;
+            }
+        }
+        encrypt_thread.join();
+        writer->WritesDone();
+        Status status = writer->Finish();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (!status.ok()) {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            std::cout << "Failed to upload encrypt data." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::cout << "Upload plain data size: " << plain_size << " [byte], encrypt data size: "
+                  << response.encrypt_size() << " [byte], " << seconds << " [s], "
+                  << plain_size / 1e6 / seconds << " [MB/s]." << std::endl;
     }
 
 private:
     uint64_t p, g;
+    uint64_t session_id = 0;
+    bool handshake = false;
+    bool resume_session = true;
+    // 上次握手得到的会话票据和对应的恢复密钥
+    std::string ticket;
+    std::vector<unsigned char> resumption_secret;
     std::unique_ptr<DiffieHellmanService::Stub> stub_;
 };
   
 int main(int argc, char** argv) { 
+    // ``-x``（可放在任意位置）：用X25519一轮握手代替4次Diffie-Hellman交换来建立AES密钥
+    bool use_handshake = false;
+    int rest = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-x") {
+            use_handshake = true;
+        } else {
+            argv[rest++] = argv[i];
+        }
+    }
+    argc = rest;
+
     std::string ip_address("localhost");
     if (argc > 1) {
         ip_address = std::string(argv[1]);
@@ -151,16 +319,69 @@ int main(int argc, char** argv) {
     std::cout << "Connect with server: IP " << ip_address << " at PORT " << PORT << std::endl; 
      
     DiffieHellmanClient client(grpc::CreateChannel(ip_address, grpc::InsecureChannelCredentials()));
+    client.SetKeyAgreement(use_handshake, true);
     
-    // receive p and g
-    client.GetParams();
-
-    // perform AES encryption/decryption test
-    std::string message("Talk is cheap, show me the code.");
-    if (argc > 2) {
-        message = std::string(argv[2]);
+    // perform AES encryption/decryption test on a message, upload a file given by ``-f <path>``,
+    // measure the upload throughput by ``-b [max size in MB]``,
+    // or measure the latency of setting up the AES key by ``-s [count]``
+    if (argc > 3 && std::string(argv[2]) == "-f") {
+        std::ifstream file(argv[3], std::ios::binary);
+        if (!file) {
+            std::cerr << "Failed to open file: " << argv[3] << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "file: " << argv[3] << std::endl;
+        client.UploadEncrypted([&file](char* buf, size_t n) {
+            file.read(buf, n);
+            return static_cast<size_t>(file.gcount());
+        });
+    } else if (argc > 2 && std::string(argv[2]) == "-b") {
+        // 依次上传1MB到10GB的全零数据（不超过给定的上限）
+        uint64_t max_mb = argc > 3 ? std::stoull(argv[3]) : 10240;
+        for (uint64_t size_mb : {1, 10, 100, 1024, 10240}) {
+            if (size_mb > max_mb) {
+                break;
+            }
+            std::cout << "== " << size_mb << " MB" << std::endl;
+            uint64_t remaining = size_mb << 20;
+            client.UploadEncrypted([&remaining](char* buf, size_t n) {
+                size_t len = std::min<uint64_t>(n, remaining);
+                remaining -= len;
+                return len;
+            });
+        }
+    } else if (argc > 2 && std::string(argv[2]) == "-s") {
+        // 比较建立AES密钥的平均延迟：4次Diffie-Hellman交换、X25519完整握手、用票据恢复会话
+        int count = argc > 3 ? std::stoi(argv[3]) : 100;
+        struct {
+            const char* name;
+            bool use_handshake;
+            bool resume;
+        } setups[] = {{"4 DH exchanges", false, false},
+                      {"full handshake", true, false},
+                      {"resumed handshake", true, true}};
+        for (const auto& setup : setups) {
+            client.SetKeyAgreement(setup.use_handshake, setup.resume);
+            std::vector<unsigned char> aes_key, aes_iv;
+            // 屏蔽密钥交换过程中的打印
+            std::cout.setstate(std::ios::failbit);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < count; ++i) {
+                client.ExchangeAesKey(aes_key, aes_iv);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout.clear();
+            std::cout << setup.name << ": " << seconds * 1e3 / count << " [ms] per key setup" << std::endl;
+        }
+    } else {
+        std::string message("Talk is cheap, show me the code.");
+        if (argc > 2) {
+            message = std::string(argv[2]);
+        }
+        std::cout << "message: " << message << std::endl;
+        std::istringstream input(message);
+        client.AesTest(input);
     }
-    client.AesTest(message);
 
 
     return 0;
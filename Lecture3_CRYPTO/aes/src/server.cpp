@@ -1,32 +1,57 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <memory>
 #include <string>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
 #include <grpcpp/grpcpp.h>
 
 
 #include "utils/AES.h"
 #include "utils/util.hpp"
+#include "utils/session_store.hpp"
+#include "utils/handshake.hpp"
 #include "DiffieHellman.grpc.pb.h" 
   
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
+using grpc::ServerReader;
 using grpc::Status;
 using google::protobuf::Empty;
 using DiffieHellman::DiffieHellmanService;
 using DiffieHellman::DiffieHellmanParams;
 using DiffieHellman::DiffieHellmanRg;
 using DiffieHellman::EncryptData;
+using DiffieHellman::UploadResult;
+using DiffieHellman::HandshakeRequest;
+using DiffieHellman::HandshakeResponse;
+
+// 会话在最后一次访问之后的有效时间
+const int SESSION_TTL_SECONDS = 60;
+// 会话票据的有效时间，过期后客户端需重新完整握手
+const int TICKET_LIFETIME_SECONDS = 3600;
   
+// 各个请求在gRPC的线程上并发处理：每条日志先写入局部的std::ostringstream，再一次写入std::cout，
+// 因此不同请求的日志不会交错，也不会竞争std::cout的格式状态（十六进制、填充字符等）
 class DiffieHellmanServiceImpl final : public DiffieHellmanService::Service {
+public:
+    // 若output_path非空，解密结果写入该文件，否则打印到屏幕
+    // verbose时打印每个会话的共享密钥、AES密钥和IV（仅用于调试）
+    DiffieHellmanServiceImpl(const std::string& output_path, bool verbose)
+        : output_path_(output_path), verbose_(verbose), sessions_(std::chrono::seconds(SESSION_TTL_SECONDS)),
+          ticket_aes_(AESKeyLength::AES_128), ticket_key_(ticket_aes_.ExpandKey(random_bytes(16))) {}
+
+private:
     Status GetParams(ServerContext* context, const Empty* request,  
                         DiffieHellmanParams* response) override {
-        // 这里可以随机生成p和g，或者使用预定义的  
-        p = 797546779;// 示例质数  
-        g = 3; // 示例生成元  
         response->set_p(p);
         response->set_g(g);
+        response->set_session_id(sessions_.Create());
 
         // std::cout << "Generated Diffie-Hellman parameters:" << std::endl;
         // std::cout << "\t" << "p: " << p << std::endl;
@@ -48,14 +73,61 @@ class DiffieHellmanServiceImpl final : public DiffieHellmanService::Service {
         // 计算共享密钥 B^a%p  
         uint64_t shared_secret_key = mod_pow(B, a, p);
 
-        std::cout << std::hex;
-        // std::cout << "Server private key: " << a << std::endl;
-        // std::cout << "Server public key: " << A << std::endl;
-        // std::cout << "Client public key: " << B << std::endl;
-        std::cout << "Shared secret key: 0x" << std::setw(8) << std::setfill('0') << shared_secret_key << std::endl;
-        std::cout << std::dec;
+        if (verbose_) {
+            std::ostringstream log;
+            log << std::hex;
+            // log << "Server private key: " << a << std::endl;
+            // log << "Server public key: " << A << std::endl;
+            // log << "Client public key: " << B << std::endl;
+            log << "Shared secret key: 0x" << std::setw(8) << std::setfill('0') << shared_secret_key << std::endl;
+            std::cout << log.str() << std::flush;
+        }
+
+        if (!sessions_.AddSharedKey(request->session_id(), shared_secret_key)) {
+            return Status(grpc::StatusCode::FAILED_PRECONDITION, "unknown or expired session, or key exchange already done");
+        }
+
+        return Status::OK;
+    }
+
+    // 一轮握手：交换X25519公钥和双方随机数，用HKDF-SHA256导出AES密钥和IV，
+    // 代替GetParams后4次GetRandom的Diffie-Hellman交换；
+    // 客户端带回有效的会话票据时跳过X25519，由票据中的恢复密钥导出新的密钥
+    Status Handshake(ServerContext* context, const HandshakeRequest* request,
+                        HandshakeResponse* response) override {
+        const std::string& client_random = request->client_random();
+        if (client_random.size() != HANDSHAKE_RANDOM_BYTES) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "client random must be 16 bytes");
+        }
+        std::vector<unsigned char> server_random = random_bytes(HANDSHAKE_RANDOM_BYTES);
+
+        std::vector<unsigned char> ikm;
+        bool resumed = !request->ticket().empty() && OpenTicket(request->ticket(), ikm);
+        if (!resumed) {
+            const std::string& client_public = request->client_public();
+            if (client_public.size() != X25519::keyBytesLen) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "client public key must be 32 bytes");
+            }
+            std::vector<unsigned char> private_key = random_bytes(X25519::keyBytesLen);
+            unsigned char server_public[X25519::keyBytesLen];
+            X25519::PublicKey(private_key.data(), server_public);
+            ikm.resize(X25519::keyBytesLen);
+            if (!X25519::SharedSecret(private_key.data(),
+                                      reinterpret_cast<const unsigned char*>(client_public.data()), ikm.data())) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "invalid client public key");
+            }
+            response->set_server_public(server_public, X25519::keyBytesLen);
+        }
+
+        SessionKeys keys = derive_session_keys(ikm, stringToUnsignedVector(client_random), server_random);
+        response->set_session_id(sessions_.Create(std::move(keys.aes_key), std::move(keys.aes_iv)));
+        response->set_server_random(server_random.data(), server_random.size());
+        response->set_ticket(SealTicket(keys.resumption_secret));
+        response->set_resumed(resumed);
 
-        shared_secret_key_list.emplace_back(shared_secret_key);
+        std::ostringstream log;
+        log << (resumed ? "Resumed" : "Full") << " handshake, session id: " << response->session_id() << std::endl;
+        std::cout << log.str() << std::flush;
 
         return Status::OK;
     }
@@ -63,57 +135,245 @@ class DiffieHellmanServiceImpl final : public DiffieHellmanService::Service {
     Status GetEncryption(ServerContext* context, const EncryptData* request,  
                         Empty* response) override {
         
-        std::string received_data = request->data();
-        std::vector<unsigned char> encrypt_data = stringToUnsignedVector(received_data);
+        const std::string& encrypt_data = request->data();
 
         // initialize aes key & iv
-        assert(4 == shared_secret_key_list.size());
         std::vector<unsigned char> aes_key, aes_iv;
+        Status status = TakeAesKey(request->session_id(), aes_key, aes_iv);
+        if (!status.ok()) {
+            return status;
+        }
 
-        /// initialize AES key (128bit)
-        for (int i=0; i<=1; ++i) {
-            std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(shared_secret_key_list[i]);
-            aes_key.insert(aes_key.end(), aes_tmp.begin(), aes_tmp.end());
+        // create AES decryptor
+        AES aes(AESKeyLength::AES_128);
+
+        // print the encrypted message (only when it is short)
+        std::ostringstream log;
+        if (encrypt_data.size() <= 256) {
+            printUnsignedVectorInHex(log, stringToUnsignedVector(encrypt_data), "encrypt_data");
         }
+        log << "Receive encrypt data size: " << request->ByteSizeLong() << " [byte]." << std::endl;
 
-        /// initialize AES IV (128bit)
-        for (int i=2; i<=3; ++i) {
-            std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(shared_secret_key_list[i]);
-            aes_iv.insert(aes_iv.end(), aes_tmp.begin(), aes_tmp.end());
+        // use CBC mode to decrypt the received data chunk by chunk, Final() checks and removes the PKCS#7 padding
+        AESDecryptor decryptor(aes, AESMode::CBC, aes.ExpandKey(aes_key), aes_iv.data());
+        const unsigned char* encrypt_bytes = reinterpret_cast<const unsigned char*>(encrypt_data.data());
+        std::vector<unsigned char> plain_chunk(STREAM_CHUNK_BYTES + 16);
+        std::ofstream output_file;
+        if (!output_path_.empty()) {
+            output_file.open(PartPath(request->session_id()), std::ios::binary | std::ios::trunc);
+        } else {
+            log << "message: ";
+        }
+        // 打印到屏幕时，消息和日志一起写出
+        std::ostream& output = output_path_.empty() ? static_cast<std::ostream&>(log) : output_file;
+        size_t plain_size = 0;
+        try {
+            for (size_t offset = 0; offset < encrypt_data.size(); offset += STREAM_CHUNK_BYTES) {
+                size_t len = std::min(STREAM_CHUNK_BYTES, encrypt_data.size() - offset);
+                size_t n = decryptor.Update(encrypt_bytes + offset, len, plain_chunk.data());
+                output.write(reinterpret_cast<const char*>(plain_chunk.data()), n);
+                plain_size += n;
+            }
+            size_t n = decryptor.Final(plain_chunk.data());
+            output.write(reinterpret_cast<const char*>(plain_chunk.data()), n);
+            plain_size += n;
+        } catch (const std::exception& e) {
+            log << std::endl;
+            std::cout << log.str() << std::flush;
+            std::cerr << std::string("Failed to decrypt data: ") + e.what() + "\n" << std::flush;
+            FinishOutput(output_file, request->session_id(), 0, false);
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+        }
+        if (output_path_.empty()) {
+            log << std::endl;
         }
+        std::cout << log.str() << std::flush;
+        FinishOutput(output_file, request->session_id(), plain_size, true);
 
-        /// print the aes key and iv
-        assert(16==aes_iv.size() && 16==aes_key.size());
-        printUnsignedVectorInHex(aes_key, "aes_key");
-        printUnsignedVectorInHex(aes_iv, "aes_iv ");
+        return Status::OK;
+    }
 
-        // create AES decryptor
+    Status UploadEncrypted(ServerContext* context, ServerReader<EncryptData>* reader,
+                        UploadResult* response) override {
+        // 第一块带有会话id
+        EncryptData first;
+        if (!reader->Read(&first)) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "no data received");
+        }
+        uint64_t session_id = first.session_id();
+
+        // initialize aes key & iv
+        std::vector<unsigned char> aes_key, aes_iv;
+        Status status = TakeAesKey(session_id, aes_key, aes_iv);
+        if (!status.ok()) {
+            return status;
+        }
+
+        // use CBC mode to decrypt the received chunks, Final() checks and removes the PKCS#7 padding
         AES aes(AESKeyLength::AES_128);
+        AESDecryptor decryptor(aes, AESMode::CBC, aes.ExpandKey(aes_key), aes_iv.data());
+        std::ofstream output_file;
+        if (!output_path_.empty()) {
+            output_file.open(PartPath(session_id), std::ios::binary | std::ios::trunc);
+        }
 
-        // use CBC mode to encrypt the input message
-        std::vector<unsigned char> plain_data = aes.DecryptCBC(encrypt_data, aes_key, aes_iv);
-        std::string message(plain_data.begin(), plain_data.end());
-        
-        // print the encrypted message
-        std::cout << "message: " << message << std::endl;
-        printUnsignedVectorInHex(encrypt_data, "encrypt_data");
-        std::cout << "Receive encrypt data size: " << request->ByteSizeLong() << " [byte]." << std::endl;
+        // 接收线程读取密文块放入队列，当前线程同时解密，队列长度限制了占用的内存
+        BoundedQueue<EncryptData> queue(4);
+        queue.Push(std::move(first));
+        std::thread receiver([&] {
+            EncryptData chunk;
+            while (reader->Read(&chunk)) {
+                if (!queue.Push(std::move(chunk))) {
+                    break;
+                }
+            }
+            queue.Close();
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<unsigned char> plain_chunk;
+        uint64_t encrypt_size = 0, plain_size = 0;
+        try {
+            EncryptData chunk;
+            while (queue.Pop(chunk)) {
+                const std::string& data = chunk.data();
+                plain_chunk.resize(data.size() + 16);
+                size_t n = decryptor.Update(reinterpret_cast<const unsigned char*>(data.data()),
+                                            data.size(), plain_chunk.data());
+                if (output_file.is_open()) {
+                    output_file.write(reinterpret_cast<const char*>(plain_chunk.data()), n);
+                }
+                encrypt_size += data.size();
+                plain_size += n;
+            }
+            plain_chunk.resize(16);
+            size_t n = decryptor.Final(plain_chunk.data());
+            if (output_file.is_open()) {
+                output_file.write(reinterpret_cast<const char*>(plain_chunk.data()), n);
+            }
+            plain_size += n;
+        } catch (const std::exception& e) {
+            // 取消RPC，使接收线程的Read返回
+            queue.Close();
+            context->TryCancel();
+            receiver.join();
+            std::cerr << std::string("Failed to decrypt data: ") + e.what() + "\n" << std::flush;
+            FinishOutput(output_file, session_id, 0, false);
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+        }
+        receiver.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-        // clear the shared secret keys
-        shared_secret_key_list.clear();
+        std::ostringstream log;
+        log << "Receive encrypt data size: " << encrypt_size << " [byte], plain data size: " << plain_size
+            << " [byte], " << plain_size / 1e6 / seconds << " [MB/s]." << std::endl;
+        std::cout << log.str() << std::flush;
+        FinishOutput(output_file, session_id, plain_size, true);
+        response->set_encrypt_size(encrypt_size);
+        response->set_plain_size(plain_size);
 
         return Status::OK;
     }
 
-private:
-    uint64_t p, g;
-    std::vector<uint64_t> shared_secret_key_list;
+    // 取出会话中由4个共享密钥组成的AES密钥和IV，会话随之删除
+    Status TakeAesKey(uint64_t session_id, std::vector<unsigned char>& aes_key, std::vector<unsigned char>& aes_iv) {
+        if (!sessions_.Take(session_id, aes_key, aes_iv)) {
+            return Status(grpc::StatusCode::FAILED_PRECONDITION, "unknown or expired session, or key exchange not done");
+        }
+
+        /// print the aes key and iv
+        assert(16==aes_iv.size() && 16==aes_key.size());
+        if (verbose_) {
+            std::ostringstream log;
+            printUnsignedVectorInHex(log, aes_key, "aes_key");
+            printUnsignedVectorInHex(log, aes_iv, "aes_iv ");
+            std::cout << log.str() << std::flush;
+        }
+
+        return Status::OK;
+    }
+
+    // 每次传输先写入该会话自己的临时文件，成功后再改名为输出文件，
+    // 因此并发的传输不会交错写入，输出文件总是某一次完整传输的结果
+    std::string PartPath(uint64_t session_id) const {
+        return output_path_ + "." + std::to_string(session_id) + ".part";
+    }
+
+    void FinishOutput(std::ofstream& output_file, uint64_t session_id, uint64_t plain_size, bool success) {
+        if (!output_file.is_open()) {
+            return;
+        }
+        output_file.close();
+        if (success && std::rename(PartPath(session_id).c_str(), output_path_.c_str()) == 0) {
+            std::ostringstream log;
+            log << "Write " << plain_size << " [byte] to " << output_path_ << std::endl;
+            std::cout << log.str() << std::flush;
+        } else {
+            std::remove(PartPath(session_id).c_str());
+        }
+    }
+
+    // 会话票据：nonce(12) || AES-GCM加密的[恢复密钥(32) || 到期时间(8)] || tag(16)
+    // 票据密钥只在服务器内存中，服务器重启后旧票据全部失效，客户端回退到完整握手
+    std::string SealTicket(const std::vector<unsigned char>& resumption_secret) {
+        std::vector<unsigned char> plain(resumption_secret);
+        uint64_t expire = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() + TICKET_LIFETIME_SECONDS;
+        for (int i = 7; i >= 0; --i) {
+            plain.push_back(static_cast<unsigned char>(expire >> (8 * i)));
+        }
+        std::vector<unsigned char> nonce = random_bytes(TICKET_NONCE_BYTES);
+        std::string ticket(TICKET_NONCE_BYTES + plain.size() + 16, '\0');
+        unsigned char* out = reinterpret_cast<unsigned char*>(&ticket[0]);
+        std::copy(nonce.begin(), nonce.end(), out);
+        ticket_aes_.EncryptGCM(plain.data(), out + TICKET_NONCE_BYTES, plain.size(), ticket_key_,
+                               nonce.data(), TICKET_NONCE_BYTES, nullptr, 0, out + TICKET_NONCE_BYTES + plain.size());
+        return ticket;
+    }
+
+    // 解开会话票据得到恢复密钥；票据被篡改、格式不对或已过期时返回false
+    bool OpenTicket(const std::string& ticket, std::vector<unsigned char>& resumption_secret) {
+        const size_t plain_size = SHA256::digestBytesLen + 8;
+        if (ticket.size() != TICKET_NONCE_BYTES + plain_size + 16) {
+            return false;
+        }
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(ticket.data());
+        std::vector<unsigned char> plain(plain_size);
+        try {
+            ticket_aes_.DecryptGCM(in + TICKET_NONCE_BYTES, plain.data(), plain_size, ticket_key_,
+                                   in, TICKET_NONCE_BYTES, nullptr, 0, in + TICKET_NONCE_BYTES + plain_size);
+        } catch (const std::exception&) {
+            return false;
+        }
+        uint64_t expire = 0;
+        for (size_t i = SHA256::digestBytesLen; i < plain_size; ++i) {
+            expire = (expire << 8) | plain[i];
+        }
+        uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (expire <= now) {
+            return false;
+        }
+        resumption_secret.assign(plain.begin(), plain.begin() + SHA256::digestBytesLen);
+        return true;
+    }
+
+    // 这里可以随机生成p和g，或者使用预定义的  
+    const uint64_t p = 797546779; // 示例质数  
+    const uint64_t g = 3; // 示例生成元  
+    std::string output_path_;
+    bool verbose_;
+    SessionStore sessions_;
+    // 加密会话票据的AES-128-GCM密钥，服务器启动时随机生成
+    static constexpr size_t TICKET_NONCE_BYTES = 12;
+    AES ticket_aes_;
+    AESKey ticket_key_;
 };
   
-void RunServer() {
+void RunServer(const std::string& output_path, bool verbose) {
     std::string server_address("0.0.0.0:");
     server_address += std::to_string(PORT);
-    DiffieHellmanServiceImpl service;
+    DiffieHellmanServiceImpl service(output_path, verbose);
 
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
@@ -125,7 +385,17 @@ void RunServer() {
 }
   
 int main(int argc, char** argv) {
-    RunServer();
+    // 可选参数：解密结果的输出文件；``-v``（可放在任意位置）打印每个会话的密钥
+    std::string output_path;
+    bool verbose = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-v") {
+            verbose = true;
+        } else if (output_path.empty()) {
+            output_path = std::string(argv[i]);
+        }
+    }
+    RunServer(output_path, verbose);
 
     return 0;
 }
\ No newline at end of file
@@ -2,7 +2,1122 @@
 
 #include "AES.h"
 
-AES::AES(const AESKeyLength keyLength) {
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline uint32_t RotateRight(uint32_t x, unsigned int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t LoadBigEndian(const unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void StoreBigEndian(unsigned char *p, uint32_t x) {
+  p[0] = (unsigned char)(x >> 24);
+  p[1] = (unsigned char)(x >> 16);
+  p[2] = (unsigned char)(x >> 8);
+  p[3] = (unsigned char)x;
+}
+
+/// Te[k][x] is the column that byte x of row k contributes to after
+/// SubBytes and MixColumns, Td[k][x] the same for InvSubBytes and
+/// InvMixColumns; Te[k] (Td[k]) is Te[0] (Td[0]) rotated by k bytes.
+struct TTables {
+  uint32_t Te[4][256];
+  uint32_t Td[4][256];
+  unsigned char S[256];
+  unsigned char Si[256];
+
+  TTables() {
+    for (unsigned int x = 0; x < 256; x++) {
+      const unsigned char s = sbox[x / 16][x % 16];
+      const unsigned char si = inv_sbox[x / 16][x % 16];
+      S[x] = s;
+      Si[x] = si;
+      Te[0][x] = ((uint32_t)GF_MUL_TABLE[2][s] << 24) | ((uint32_t)s << 16) |
+                 ((uint32_t)s << 8) | (uint32_t)GF_MUL_TABLE[3][s];
+      Td[0][x] = ((uint32_t)GF_MUL_TABLE[14][si] << 24) |
+                 ((uint32_t)GF_MUL_TABLE[9][si] << 16) |
+                 ((uint32_t)GF_MUL_TABLE[13][si] << 8) |
+                 (uint32_t)GF_MUL_TABLE[11][si];
+      for (unsigned int k = 1; k < 4; k++) {
+        Te[k][x] = RotateRight(Te[0][x], 8 * k);
+        Td[k][x] = RotateRight(Td[0][x], 8 * k);
+      }
+    }
+  }
+};
+
+const TTables &GetTTables() {
+  static const TTables tables;
+  return tables;
+}
+
+#ifdef AES_X86
+
+bool CpuHasAesNi() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  // GCM takes PCLMULQDQ, which came with AES-NI
+  return (ecx & bit_AES) != 0 && (ecx & bit_SSE4_1) != 0 &&
+         (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSSE3) != 0;
+}
+
+/// key ^ key << 32 ^ key << 64 ^ key << 96, the running xor of the key words
+__attribute__((target("aes,sse4.1"))) inline __m128i PrefixXor(__m128i key) {
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, _mm_slli_si128(key, 8));
+}
+
+// the round constant is an immediate of _mm_aeskeygenassist_si128
+template <int Rcon>
+__attribute__((target("aes,sse4.1"))) inline __m128i AesNiExpand128(
+    __m128i key) {
+  __m128i assist = _mm_aeskeygenassist_si128(key, Rcon);
+  return _mm_xor_si128(PrefixXor(key),
+                       _mm_shuffle_epi32(assist, 0xff));
+}
+
+template <int Rcon>
+__attribute__((target("aes,sse4.1"))) inline void AesNiExpand192(
+    __m128i &low, __m128i &high) {
+  __m128i assist = _mm_aeskeygenassist_si128(high, Rcon);
+  low = _mm_xor_si128(PrefixXor(low), _mm_shuffle_epi32(assist, 0x55));
+  high = _mm_xor_si128(high, _mm_slli_si128(high, 4));
+  high = _mm_xor_si128(high, _mm_shuffle_epi32(low, 0xff));
+}
+
+// the first half of the next 256-bit key
+template <int Rcon>
+__attribute__((target("aes,sse4.1"))) inline void AesNiExpand256(
+    __m128i &low, __m128i high) {
+  __m128i assist = _mm_aeskeygenassist_si128(high, Rcon);
+  low = _mm_xor_si128(PrefixXor(low), _mm_shuffle_epi32(assist, 0xff));
+}
+
+// the second half, which has SubWord but no RotWord and no round constant
+__attribute__((target("aes,sse4.1"))) inline void AesNiExpand256High(
+    __m128i low, __m128i &high) {
+  __m128i assist = _mm_aeskeygenassist_si128(low, 0);
+  high = _mm_xor_si128(PrefixXor(high), _mm_shuffle_epi32(assist, 0xaa));
+}
+
+/// the high 64 bits of a, and the low 64 bits of b
+__attribute__((target("aes,sse4.1"))) inline __m128i HighLow(__m128i a,
+                                                           __m128i b) {
+  return _mm_castpd_si128(
+      _mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), 1));
+}
+
+__attribute__((target("aes,sse4.1"))) inline __m128i LowLow(__m128i a,
+                                                          __m128i b) {
+  return _mm_castpd_si128(
+      _mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), 0));
+}
+
+__attribute__((target("aes,sse4.1"))) void AesNiExpandKey(
+    const unsigned char key[], unsigned int Nk, unsigned int Nr,
+    unsigned char encKeys[], unsigned char decKeys[]) {
+  __m128i rk[15];
+  if (Nk == 4) {
+    rk[0] = _mm_loadu_si128((const __m128i *)key);
+    rk[1] = AesNiExpand128<0x01>(rk[0]);
+    rk[2] = AesNiExpand128<0x02>(rk[1]);
+    rk[3] = AesNiExpand128<0x04>(rk[2]);
+    rk[4] = AesNiExpand128<0x08>(rk[3]);
+    rk[5] = AesNiExpand128<0x10>(rk[4]);
+    rk[6] = AesNiExpand128<0x20>(rk[5]);
+    rk[7] = AesNiExpand128<0x40>(rk[6]);
+    rk[8] = AesNiExpand128<0x80>(rk[7]);
+    rk[9] = AesNiExpand128<0x1b>(rk[8]);
+    rk[10] = AesNiExpand128<0x36>(rk[9]);
+  } else if (Nk == 6) {
+    // six key words per step, so the round keys straddle the steps
+    __m128i low = _mm_loadu_si128((const __m128i *)key);
+    __m128i high = _mm_loadl_epi64((const __m128i *)(key + 16));
+    rk[0] = low;
+    rk[1] = high;
+    AesNiExpand192<0x01>(low, high);
+    rk[1] = LowLow(rk[1], low);
+    rk[2] = HighLow(low, high);
+    AesNiExpand192<0x02>(low, high);
+    rk[3] = low;
+    rk[4] = high;
+    AesNiExpand192<0x04>(low, high);
+    rk[4] = LowLow(rk[4], low);
+    rk[5] = HighLow(low, high);
+    AesNiExpand192<0x08>(low, high);
+    rk[6] = low;
+    rk[7] = high;
+    AesNiExpand192<0x10>(low, high);
+    rk[7] = LowLow(rk[7], low);
+    rk[8] = HighLow(low, high);
+    AesNiExpand192<0x20>(low, high);
+    rk[9] = low;
+    rk[10] = high;
+    AesNiExpand192<0x40>(low, high);
+    rk[10] = LowLow(rk[10], low);
+    rk[11] = HighLow(low, high);
+    AesNiExpand192<0x80>(low, high);
+    rk[12] = low;
+  } else {
+    __m128i low = _mm_loadu_si128((const __m128i *)key);
+    __m128i high = _mm_loadu_si128((const __m128i *)(key + 16));
+    rk[0] = low;
+    rk[1] = high;
+    AesNiExpand256<0x01>(low, high);
+    AesNiExpand256High(low, high);
+    rk[2] = low;
+    rk[3] = high;
+    AesNiExpand256<0x02>(low, high);
+    AesNiExpand256High(low, high);
+    rk[4] = low;
+    rk[5] = high;
+    AesNiExpand256<0x04>(low, high);
+    AesNiExpand256High(low, high);
+    rk[6] = low;
+    rk[7] = high;
+    AesNiExpand256<0x08>(low, high);
+    AesNiExpand256High(low, high);
+    rk[8] = low;
+    rk[9] = high;
+    AesNiExpand256<0x10>(low, high);
+    AesNiExpand256High(low, high);
+    rk[10] = low;
+    rk[11] = high;
+    AesNiExpand256<0x20>(low, high);
+    AesNiExpand256High(low, high);
+    rk[12] = low;
+    rk[13] = high;
+    AesNiExpand256<0x40>(low, high);
+    rk[14] = low;
+  }
+
+  for (unsigned int round = 0; round <= Nr; round++) {
+    __m128i k = rk[Nr - round];
+    if (round != 0 && round != Nr) {
+      k = _mm_aesimc_si128(k);
+    }
+    _mm_storeu_si128((__m128i *)(encKeys + 16 * round), rk[round]);
+    _mm_storeu_si128((__m128i *)(decKeys + 16 * round), k);
+  }
+}
+
+/// Encrypt (Decrypt == false) or decrypt n blocks, the independent blocks of
+/// a group go through each round together, so their instructions overlap
+template <bool Decrypt>
+__attribute__((target("aes,sse4.1"))) void AesNiCryptBlocks(
+    const unsigned char keys[], unsigned int Nr, const unsigned char in[],
+    unsigned char out[], size_t n) {
+  constexpr size_t group = 8;
+  const __m128i *rk = (const __m128i *)keys;
+  size_t i = 0;
+  for (; i + group <= n; i += group) {
+    __m128i b[group];
+#pragma GCC unroll 8
+    for (size_t j = 0; j < group; j++) {
+      b[j] = _mm_xor_si128(
+          _mm_loadu_si128((const __m128i *)(in + 16 * (i + j))), rk[0]);
+    }
+    for (unsigned int round = 1; round < Nr; round++) {
+      const __m128i k = _mm_load_si128(rk + round);
+#pragma GCC unroll 8
+      for (size_t j = 0; j < group; j++) {
+        b[j] = Decrypt ? _mm_aesdec_si128(b[j], k) : _mm_aesenc_si128(b[j], k);
+      }
+    }
+    const __m128i k = _mm_load_si128(rk + Nr);
+#pragma GCC unroll 8
+    for (size_t j = 0; j < group; j++) {
+      b[j] = Decrypt ? _mm_aesdeclast_si128(b[j], k)
+                     : _mm_aesenclast_si128(b[j], k);
+      _mm_storeu_si128((__m128i *)(out + 16 * (i + j)), b[j]);
+    }
+  }
+  for (; i < n; i++) {
+    __m128i b = _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *)(in + 16 * i)), rk[0]);
+    for (unsigned int round = 1; round < Nr; round++) {
+      b = Decrypt ? _mm_aesdec_si128(b, rk[round])
+                  : _mm_aesenc_si128(b, rk[round]);
+    }
+    b = Decrypt ? _mm_aesdeclast_si128(b, rk[Nr])
+                : _mm_aesenclast_si128(b, rk[Nr]);
+    _mm_storeu_si128((__m128i *)(out + 16 * i), b);
+  }
+}
+
+#endif  // AES_X86
+
+/// Bitsliced AES: the state of 4 blocks is held in 8 64-bit words, word k
+/// has bit k of every byte, at bit 4 * p + j for byte p of block j. The byte
+/// p = r + 4 * c of row r and column c sits in nibble p, so a column is a
+/// 16-bit group and a row is every fourth nibble. All the steps are fixed
+/// sequences of boolean operations and shifts, without table lookups or
+/// branches on the data or the key. W is uint64_t (4 blocks) or a vector of
+/// two 64-bit lanes (8 blocks in an SSE2 or NEON register), which runs the
+/// same code on 4 blocks per lane.
+#if defined(__GNUC__)
+typedef uint64_t BitsliceWide __attribute__((vector_size(16)));
+#else
+typedef uint64_t BitsliceWide;
+#endif
+
+inline uint64_t LoadLittleEndian64(const unsigned char *p) {
+  return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+         ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) |
+         ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) |
+         ((uint64_t)p[7] << 56);
+}
+
+inline void StoreLittleEndian64(unsigned char *p, uint64_t x) {
+  p[0] = (unsigned char)x;
+  p[1] = (unsigned char)(x >> 8);
+  p[2] = (unsigned char)(x >> 16);
+  p[3] = (unsigned char)(x >> 24);
+  p[4] = (unsigned char)(x >> 32);
+  p[5] = (unsigned char)(x >> 40);
+  p[6] = (unsigned char)(x >> 48);
+  p[7] = (unsigned char)(x >> 56);
+}
+
+/// exchange the bits of lo at the positions of mask << Shift with the bits of
+/// hi at the positions of mask
+template <unsigned int Shift, typename W>
+inline void BitsliceSwapWords(W &lo, W &hi, uint64_t mask) {
+  const W t = ((lo >> Shift) ^ hi) & mask;
+  hi ^= t;
+  lo ^= t << Shift;
+}
+
+/// exchange the bits of x at the positions of mask with the ones Shift higher
+template <unsigned int Shift, typename W>
+inline W BitsliceSwapBits(W x, uint64_t mask) {
+  const W t = (x ^ (x >> Shift)) & mask;
+  return x ^ t ^ (t << Shift);
+}
+
+/// word m of a 64-byte lane holds bit k of byte p of block j at word 2j +
+/// p / 8, bit 8 * (p % 8) + k. The swaps exchange the word and bit indexes
+/// (a bit-matrix transpose), after which word 4 * k1 + 2 * k0 + k2 holds bit
+/// 4 * (2 * (p % 8) + p / 8) + j, and the nibbles are unshuffled to 4 * p + j.
+template <typename W>
+inline void BitsliceOrtho(W *q) {
+  for (unsigned int m = 0; m < 8; m += 2) {
+    BitsliceSwapWords<4>(q[m], q[m + 1], 0x0F0F0F0F0F0F0F0FULL);
+  }
+  for (unsigned int m : {0u, 1u, 4u, 5u}) {
+    BitsliceSwapWords<1>(q[m], q[m + 2], 0x5555555555555555ULL);
+  }
+  for (unsigned int m = 0; m < 4; m++) {
+    BitsliceSwapWords<2>(q[m], q[m + 4], 0x3333333333333333ULL);
+  }
+}
+
+inline unsigned int BitsliceOrthoWord(unsigned int k) {
+  return 4 * ((k >> 1) & 1) + 2 * (k & 1) + (k >> 2);
+}
+
+/// the 8 words of n blocks, 4 per 64-bit lane; missing blocks are zero
+template <typename W>
+inline void BitsliceLoad(const unsigned char in[], size_t n, W *q) {
+  constexpr size_t lanes = sizeof(W) / sizeof(uint64_t);
+  unsigned char padded[64 * lanes];
+  if (n < 4 * lanes) {
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, in, 16 * n);
+    in = padded;
+  }
+  W w[8];
+  for (unsigned int m = 0; m < 8; m++) {
+    for (size_t l = 0; l < lanes; l++) {
+      const uint64_t x = LoadLittleEndian64(in + 64 * l + 8 * m);
+      memcpy((unsigned char *)&w[m] + sizeof(uint64_t) * l, &x,
+             sizeof(uint64_t));
+    }
+  }
+  BitsliceOrtho(w);
+  for (unsigned int k = 0; k < 8; k++) {
+    W x = w[BitsliceOrthoWord(k)];
+    x = BitsliceSwapBits<4>(x, 0x00F000F000F000F0ULL);
+    x = BitsliceSwapBits<8>(x, 0x0000FF000000FF00ULL);
+    q[k] = BitsliceSwapBits<16>(x, 0x00000000FFFF0000ULL);
+  }
+}
+
+template <typename W>
+inline void BitsliceStore(const W *q, size_t n, unsigned char out[]) {
+  constexpr size_t lanes = sizeof(W) / sizeof(uint64_t);
+  W w[8];
+  for (unsigned int k = 0; k < 8; k++) {
+    W x = BitsliceSwapBits<16>(q[k], 0x00000000FFFF0000ULL);
+    x = BitsliceSwapBits<8>(x, 0x0000FF000000FF00ULL);
+    w[BitsliceOrthoWord(k)] = BitsliceSwapBits<4>(x, 0x00F000F000F000F0ULL);
+  }
+  BitsliceOrtho(w);
+  unsigned char padded[64 * lanes];
+  unsigned char *dst = n < 4 * lanes ? padded : out;
+  for (unsigned int m = 0; m < 8; m++) {
+    for (size_t l = 0; l < lanes; l++) {
+      uint64_t x;
+      memcpy(&x, (const unsigned char *)&w[m] + sizeof(uint64_t) * l,
+             sizeof(uint64_t));
+      StoreLittleEndian64(dst + 64 * l + 8 * m, x);
+    }
+  }
+  if (dst != out) {
+    memcpy(out, padded, 16 * n);
+  }
+}
+
+/// The S-box as a circuit of 113 XOR, AND and NOT gates (Boyar and Peralta,
+/// "A depth-16 circuit for the AES S-box"), on the 8 bits of every byte
+template <typename W>
+inline void BitsliceSbox(W *q) {
+  W x0, x1, x2, x3, x4, x5, x6, x7;
+  W y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  W y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  W y20, y21;
+  W z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  W z10, z11, z12, z13, z14, z15, z16, z17;
+  W t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  W t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  W t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  W t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  W t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  W t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  W t60, t61, t62, t63, t64, t65, t66, t67;
+  W s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  // top linear transformation
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // non-linear section
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // bottom linear transformation
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+/// y ^ 0x63 followed by the inverse affine transform of the S-box, so that
+/// InvSbox(y) is this, the S-box and this again (the S-box is the affine
+/// transform of the field inverse, which is its own inverse)
+template <typename W>
+inline void BitsliceInvAffine(W *q) {
+  const W q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+  const W q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+  q[7] = q1 ^ q4 ^ q6;
+  q[6] = q0 ^ q3 ^ q5;
+  q[5] = q7 ^ q2 ^ q4;
+  q[4] = q6 ^ q1 ^ q3;
+  q[3] = q5 ^ q0 ^ q2;
+  q[2] = q4 ^ q7 ^ q1;
+  q[1] = q3 ^ q6 ^ q0;
+  q[0] = q2 ^ q5 ^ q7;
+}
+
+template <typename W>
+inline void BitsliceInvSbox(W *q) {
+  BitsliceInvAffine(q);
+  BitsliceSbox(q);
+  BitsliceInvAffine(q);
+}
+
+template <unsigned int N, typename W>
+inline W BitsliceRotateRight(W x) {
+  return (x >> N) | (x << (64 - N));
+}
+
+// row r moves left by r columns, i.e. right by 16 * r bits
+template <typename W>
+inline void BitsliceShiftRows(W *q) {
+  for (unsigned int k = 0; k < 8; k++) {
+    const W x = q[k];
+    q[k] = (x & 0x000F000F000F000FULL) |
+           BitsliceRotateRight<16>(x & 0x00F000F000F000F0ULL) |
+           BitsliceRotateRight<32>(x & 0x0F000F000F000F00ULL) |
+           BitsliceRotateRight<48>(x & 0xF000F000F000F000ULL);
+  }
+}
+
+template <typename W>
+inline void BitsliceInvShiftRows(W *q) {
+  for (unsigned int k = 0; k < 8; k++) {
+    const W x = q[k];
+    q[k] = (x & 0x000F000F000F000FULL) |
+           BitsliceRotateRight<48>(x & 0x00F000F000F000F0ULL) |
+           BitsliceRotateRight<32>(x & 0x0F000F000F000F00ULL) |
+           BitsliceRotateRight<16>(x & 0xF000F000F000F000ULL);
+  }
+}
+
+/// row r of each column takes row r + N of the same column
+template <unsigned int N, typename W>
+inline W BitsliceRotateRows(W x) {
+  constexpr uint64_t mask = (0xFFFFULL >> (4 * N)) * 0x0001000100010001ULL;
+  return ((x >> (4 * N)) & mask) | ((x << (16 - 4 * N)) & ~mask);
+}
+
+/// 2 * a[r] ^ 3 * a[r + 1] ^ a[r + 2] ^ a[r + 3] is xtime(b[r]) ^ a[r + 1] ^
+/// b[r + 2] with b[r] = a[r] ^ a[r + 1]; xtime takes bit k - 1, and the
+/// reduction by 0x1b adds bit 7 to bits 0, 1, 3 and 4
+template <typename W>
+inline void BitsliceMixColumns(W *q) {
+  W b[8];
+  for (unsigned int k = 0; k < 8; k++) {
+    const W a1 = BitsliceRotateRows<1>(q[k]);
+    b[k] = q[k] ^ a1;
+    q[k] = a1 ^ BitsliceRotateRows<2>(b[k]);
+  }
+  q[0] ^= b[7];
+  q[1] ^= b[0] ^ b[7];
+  q[2] ^= b[1];
+  q[3] ^= b[2] ^ b[7];
+  q[4] ^= b[3] ^ b[7];
+  q[5] ^= b[4];
+  q[6] ^= b[5];
+  q[7] ^= b[6];
+}
+
+/// InvMixColumns is MixColumns after a[r] ^= 4 * (a[r] ^ a[r + 2]), since
+/// the inverse matrix is the product of the MixColumns matrix with the
+/// circulant (5, 0, 4, 0)
+template <typename W>
+inline void BitsliceInvMixColumns(W *q) {
+  W t[8];
+  for (unsigned int k = 0; k < 8; k++) {
+    t[k] = q[k] ^ BitsliceRotateRows<2>(q[k]);
+  }
+  // multiply t by x^2: bit k comes from bit k - 2, bits 6 and 7 are reduced
+  q[0] ^= t[6];
+  q[1] ^= t[7] ^ t[6];
+  q[2] ^= t[0] ^ t[7];
+  q[3] ^= t[1] ^ t[6];
+  q[4] ^= t[2] ^ t[7] ^ t[6];
+  q[5] ^= t[3] ^ t[7];
+  q[6] ^= t[4];
+  q[7] ^= t[5];
+  BitsliceMixColumns(q);
+}
+
+template <typename W>
+inline void BitsliceAddRoundKey(W *q, const uint64_t *roundKey) {
+  for (unsigned int k = 0; k < 8; k++) {
+    q[k] ^= roundKey[k];
+  }
+}
+
+/// Encrypt (Decrypt == false) or decrypt the n <= 4 * lanes blocks of one
+/// word; roundKeys has 8 words per round, the same key for all 4 blocks
+template <bool Decrypt, typename W>
+void BitsliceCryptWord(const uint64_t roundKeys[], unsigned int Nr,
+                       const unsigned char in[], unsigned char out[],
+                       size_t n) {
+  W q[8];
+  BitsliceLoad(in, n, q);
+
+  if (!Decrypt) {
+    BitsliceAddRoundKey(q, roundKeys);
+    for (unsigned int round = 1; round < Nr; round++) {
+      BitsliceSbox(q);
+      BitsliceShiftRows(q);
+      BitsliceMixColumns(q);
+      BitsliceAddRoundKey(q, roundKeys + 8 * round);
+    }
+    BitsliceSbox(q);
+    BitsliceShiftRows(q);
+    BitsliceAddRoundKey(q, roundKeys + 8 * Nr);
+  } else {
+    BitsliceAddRoundKey(q, roundKeys + 8 * Nr);
+    for (unsigned int round = Nr - 1; round >= 1; round--) {
+      BitsliceInvShiftRows(q);
+      BitsliceInvSbox(q);
+      BitsliceAddRoundKey(q, roundKeys + 8 * round);
+      BitsliceInvMixColumns(q);
+    }
+    BitsliceInvShiftRows(q);
+    BitsliceInvSbox(q);
+    BitsliceAddRoundKey(q, roundKeys);
+  }
+
+  BitsliceStore(q, n, out);
+}
+
+/// full groups take the wide type, and a tail of up to 4 blocks (such as the
+/// single blocks of CBC and CFB encryption) the 64-bit one, which skips the
+/// packing of the unused lane
+template <bool Decrypt>
+void BitsliceCryptBlocks(const uint64_t roundKeys[], unsigned int Nr,
+                         const unsigned char in[], unsigned char out[],
+                         size_t n) {
+  constexpr size_t group = 4 * sizeof(BitsliceWide) / sizeof(uint64_t);
+  size_t i = 0;
+  for (; i + group <= n; i += group) {
+    BitsliceCryptWord<Decrypt, BitsliceWide>(roundKeys, Nr, in + 16 * i,
+                                             out + 16 * i, group);
+  }
+  if (n - i > 4) {
+    BitsliceCryptWord<Decrypt, BitsliceWide>(roundKeys, Nr, in + 16 * i,
+                                             out + 16 * i, n - i);
+  } else if (n > i) {
+    BitsliceCryptWord<Decrypt, uint64_t>(roundKeys, Nr, in + 16 * i,
+                                         out + 16 * i, n - i);
+  }
+}
+
+/// Worker threads shared by all AES objects, started on first use. A
+/// ParallelFor hands its tasks to them and works on them itself, so callers
+/// on several threads cannot starve each other.
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned int size) {
+    for (unsigned int i = 0; i < size; i++) {
+      workers.emplace_back([this] { Work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  /// fn(0), ..., fn(n - 1) on up to `threads` threads, the caller included
+  void ParallelFor(size_t n, unsigned int threads,
+                   const std::function<void(size_t)> &fn) {
+    std::atomic<size_t> next(0);
+    auto run = [&] {
+      for (size_t i = next++; i < n; i = next++) {
+        fn(i);
+      }
+    };
+
+    size_t helpers = std::min<size_t>({threads - 1, n - 1, workers.size()});
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+    size_t running = helpers;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < helpers; i++) {
+        tasks.push([&] {
+          run();
+          std::lock_guard<std::mutex> doneLock(doneMutex);
+          if (--running == 0) {
+            doneCv.notify_one();
+          }
+        });
+      }
+    }
+    cv.notify_all();
+    run();
+    std::unique_lock<std::mutex> doneLock(doneMutex);
+    doneCv.wait(doneLock, [&] { return running == 0; });
+  }
+
+ private:
+  void Work() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping = false;
+};
+
+ThreadPool &GetThreadPool() {
+  static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) -
+                         1);
+  return pool;
+}
+
+/// counter + n, as a big-endian integer of the 16 bytes, or of the last 4
+/// bytes only (inc32 of GCM, which wraps around without a carry)
+inline void AddCounter(unsigned char counter[], uint64_t n, bool inc32) {
+  for (int i = 15; i >= (inc32 ? 12 : 0) && n != 0; i--) {
+    n += counter[i];
+    counter[i] = (unsigned char)n;
+    n >>= 8;
+  }
+}
+
+inline uint64_t LoadBigEndian64(const unsigned char *p) {
+  return ((uint64_t)LoadBigEndian(p) << 32) | LoadBigEndian(p + 4);
+}
+
+inline void StoreBigEndian64(unsigned char *p, uint64_t x) {
+  StoreBigEndian(p, (uint32_t)(x >> 32));
+  StoreBigEndian(p + 4, (uint32_t)x);
+}
+
+/// The low 64 bits of the carry-less product, from integer multiplications
+/// of every fourth bit: a sum of at most 15 ones stays inside its 4-bit
+/// hole, so no carry reaches the next bit of the same class.
+inline uint64_t ClmulLow64(uint64_t x, uint64_t y) {
+  const uint64_t m0 = 0x1111111111111111ULL, m1 = 0x2222222222222222ULL;
+  const uint64_t m2 = 0x4444444444444444ULL, m3 = 0x8888888888888888ULL;
+  const uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+  const uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+  const uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+  const uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+  const uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+  const uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+  return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+}
+
+inline uint64_t Reverse64(uint64_t x) {
+  x = ((x & 0x5555555555555555ULL) << 1) | ((x >> 1) & 0x5555555555555555ULL);
+  x = ((x & 0x3333333333333333ULL) << 2) | ((x >> 2) & 0x3333333333333333ULL);
+  x = ((x & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+  x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+  x = ((x & 0x0000FFFF0000FFFFULL) << 16) |
+      ((x >> 16) & 0x0000FFFF0000FFFFULL);
+  return (x << 32) | (x >> 32);
+}
+
+/// y = (y ^ X_i) * H for each 16-byte block X_i of data (the last one padded
+/// with zeros), in constant time without tables. GHASH bits are reflected,
+/// so the low halves of the 128x128-bit Karatsuba product come from
+/// ClmulLow64 and the high halves from ClmulLow64 of the reversed operands.
+void GhashPortable(unsigned char y[], const unsigned char h[],
+                   const unsigned char data[], size_t len) {
+  uint64_t y1 = LoadBigEndian64(y), y0 = LoadBigEndian64(y + 8);
+  const uint64_t h1 = LoadBigEndian64(h), h0 = LoadBigEndian64(h + 8);
+  const uint64_t h0r = Reverse64(h0), h1r = Reverse64(h1);
+  const uint64_t h2 = h0 ^ h1, h2r = h0r ^ h1r;
+  for (size_t i = 0; i < len; i += 16) {
+    unsigned char block[16] = {0};
+    memcpy(block, data + i, std::min<size_t>(len - i, 16));
+    y1 ^= LoadBigEndian64(block);
+    y0 ^= LoadBigEndian64(block + 8);
+
+    const uint64_t y0r = Reverse64(y0), y1r = Reverse64(y1);
+    const uint64_t y2 = y0 ^ y1, y2r = y0r ^ y1r;
+    const uint64_t z0 = ClmulLow64(y0, h0), z1 = ClmulLow64(y1, h1);
+    uint64_t z2 = ClmulLow64(y2, h2);
+    uint64_t z0h = ClmulLow64(y0r, h0r), z1h = ClmulLow64(y1r, h1r);
+    uint64_t z2h = ClmulLow64(y2r, h2r);
+    z2 ^= z0 ^ z1;
+    z2h ^= z0h ^ z1h;
+    z0h = Reverse64(z0h) >> 1;
+    z1h = Reverse64(z1h) >> 1;
+    z2h = Reverse64(z2h) >> 1;
+
+    // the 256-bit product, shifted left by one for the reflected bits
+    uint64_t v0 = z0, v1 = z0h ^ z2, v2 = z1 ^ z2h, v3 = z1h;
+    v3 = (v3 << 1) | (v2 >> 63);
+    v2 = (v2 << 1) | (v1 >> 63);
+    v1 = (v1 << 1) | (v0 >> 63);
+    v0 = v0 << 1;
+
+    // reduction modulo x^128 + x^7 + x^2 + x + 1
+    v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+    v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+    v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+    v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+    y0 = v2;
+    y1 = v3;
+  }
+  StoreBigEndian64(y, y1);
+  StoreBigEndian64(y + 8, y0);
+}
+
+#ifdef AES_X86
+
+/// counter + 1, as the big-endian integer hi:lo, or of its last 32 bits only
+/// (inc32 of GCM)
+inline void IncrementCounter(uint64_t &hi, uint64_t &lo, bool inc32) {
+  if (inc32) {
+    lo = (lo & 0xFFFFFFFF00000000ULL) | (uint32_t)(lo + 1);
+  } else {
+    lo++;
+    hi += (lo == 0);
+  }
+}
+
+/// CTR on AES-NI: the counter blocks are built in registers and the input is
+/// xored with the key stream as it leaves the last round, 8 blocks at a time
+/// as in AesNiCryptBlocks, so the key stream never goes through memory
+__attribute__((target("aes,sse4.1"))) void AesNiCryptCTR(
+    const unsigned char keys[], unsigned int Nr, const unsigned char in[],
+    unsigned char out[], size_t len, const unsigned char counter[],
+    bool inc32) {
+  constexpr size_t group = 8;
+  const __m128i *rk = (const __m128i *)keys;
+  const __m128i reverse =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  uint64_t hi = LoadBigEndian64(counter), lo = LoadBigEndian64(counter + 8);
+  size_t i = 0;
+  for (; i + 16 * group <= len; i += 16 * group) {
+    __m128i b[group];
+#pragma GCC unroll 8
+    for (size_t j = 0; j < group; j++) {
+      b[j] = _mm_xor_si128(
+          _mm_shuffle_epi8(_mm_set_epi64x((long long)hi, (long long)lo),
+                           reverse),
+          rk[0]);
+      IncrementCounter(hi, lo, inc32);
+    }
+    for (unsigned int round = 1; round < Nr; round++) {
+      const __m128i k = _mm_load_si128(rk + round);
+#pragma GCC unroll 8
+      for (size_t j = 0; j < group; j++) {
+        b[j] = _mm_aesenc_si128(b[j], k);
+      }
+    }
+    const __m128i k = _mm_load_si128(rk + Nr);
+#pragma GCC unroll 8
+    for (size_t j = 0; j < group; j++) {
+      const __m128i x = _mm_loadu_si128((const __m128i *)(in + i + 16 * j));
+      _mm_storeu_si128((__m128i *)(out + i + 16 * j),
+                       _mm_xor_si128(x, _mm_aesenclast_si128(b[j], k)));
+    }
+  }
+  for (; i < len; i += 16) {
+    __m128i b = _mm_xor_si128(
+        _mm_shuffle_epi8(_mm_set_epi64x((long long)hi, (long long)lo), reverse),
+        rk[0]);
+    IncrementCounter(hi, lo, inc32);
+    for (unsigned int round = 1; round < Nr; round++) {
+      b = _mm_aesenc_si128(b, rk[round]);
+    }
+    b = _mm_aesenclast_si128(b, rk[Nr]);
+    if (len - i >= 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+      _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(x, b));
+    } else {
+      unsigned char stream[16];
+      _mm_storeu_si128((__m128i *)stream, b);
+      for (size_t j = 0; j < len - i; j++) {
+        out[i + j] = in[i + j] ^ stream[j];
+      }
+    }
+  }
+}
+
+/// the unreduced 256-bit carry-less product hi:lo of byte-reversed GHASH
+/// values with PCLMULQDQ (Intel, "Carry-Less Multiplication and Its Usage
+/// for Computing the GCM Mode")
+__attribute__((target("pclmul,ssse3"))) inline void ClmulProduct(
+    __m128i a, __m128i b, __m128i &lo, __m128i &hi) {
+  __m128i t3, t4, t5, t6;
+  t3 = _mm_clmulepi64_si128(a, b, 0x00);
+  t4 = _mm_clmulepi64_si128(a, b, 0x10);
+  t5 = _mm_clmulepi64_si128(a, b, 0x01);
+  t6 = _mm_clmulepi64_si128(a, b, 0x11);
+  t4 = _mm_xor_si128(t4, t5);
+  t5 = _mm_slli_si128(t4, 8);
+  t4 = _mm_srli_si128(t4, 8);
+  lo = _mm_xor_si128(t3, t5);
+  hi = _mm_xor_si128(t6, t4);
+}
+
+/// the product hi:lo reduced to a GHASH value; the reduction is linear, so a
+/// sum of several products takes a single one
+__attribute__((target("pclmul,ssse3"))) inline __m128i ClmulReduce(
+    __m128i lo, __m128i hi) {
+  __m128i t2, t3 = lo, t4, t5, t6 = hi, t7, t8, t9;
+
+  // shift the 256-bit product left by one for the reflected bits
+  t7 = _mm_srli_epi32(t3, 31);
+  t8 = _mm_srli_epi32(t6, 31);
+  t3 = _mm_slli_epi32(t3, 1);
+  t6 = _mm_slli_epi32(t6, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  t3 = _mm_or_si128(t3, t7);
+  t6 = _mm_or_si128(t6, t8);
+  t6 = _mm_or_si128(t6, t9);
+
+  // reduction modulo x^128 + x^7 + x^2 + x + 1
+  t7 = _mm_slli_epi32(t3, 31);
+  t8 = _mm_slli_epi32(t3, 30);
+  t9 = _mm_slli_epi32(t3, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  t3 = _mm_xor_si128(t3, t7);
+  t2 = _mm_srli_epi32(t3, 1);
+  t4 = _mm_srli_epi32(t3, 2);
+  t5 = _mm_srli_epi32(t3, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  t3 = _mm_xor_si128(t3, t2);
+  return _mm_xor_si128(t6, t3);
+}
+
+__attribute__((target("pclmul,ssse3"))) inline __m128i ClmulGfMultiply(
+    __m128i a, __m128i b) {
+  __m128i lo, hi;
+  ClmulProduct(a, b, lo, hi);
+  return ClmulReduce(lo, hi);
+}
+
+__attribute__((target("pclmul,ssse3"))) void GhashClmul(
+    unsigned char y[], const unsigned char h[], const unsigned char data[],
+    size_t len) {
+  const __m128i reverse =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i hv =
+      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), reverse);
+  __m128i yv = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)y), reverse);
+  size_t i = 0;
+  if (len >= 64) {
+    // 4 blocks per reduction: y = (y ^ X1) * H^4 ^ X2 * H^3 ^ X3 * H^2 ^ X4 * H
+    __m128i hp[4];
+    hp[3] = hv;
+    hp[2] = ClmulGfMultiply(hv, hv);
+    hp[1] = ClmulGfMultiply(hp[2], hv);
+    hp[0] = ClmulGfMultiply(hp[1], hv);
+    for (; i + 64 <= len; i += 64) {
+      __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+#pragma GCC unroll 4
+      for (size_t j = 0; j < 4; j++) {
+        __m128i xv = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(data + i + 16 * j)), reverse);
+        if (j == 0) {
+          xv = _mm_xor_si128(xv, yv);
+        }
+        __m128i plo, phi;
+        ClmulProduct(xv, hp[j], plo, phi);
+        lo = _mm_xor_si128(lo, plo);
+        hi = _mm_xor_si128(hi, phi);
+      }
+      yv = ClmulReduce(lo, hi);
+    }
+  }
+  for (; i < len; i += 16) {
+    unsigned char block[16] = {0};
+    const unsigned char *x = data + i;
+    if (len - i < 16) {
+      memcpy(block, x, len - i);
+      x = block;
+    }
+    const __m128i xv =
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x), reverse);
+    yv = ClmulGfMultiply(_mm_xor_si128(yv, xv), hv);
+  }
+  _mm_storeu_si128((__m128i *)y, _mm_shuffle_epi8(yv, reverse));
+}
+
+#endif  // AES_X86
+
+}  // namespace
+
+const char *AESBackendName(AESBackend backend) {
+  switch (backend) {
+    case AESBackend::AUTO:
+      return "auto";
+    case AESBackend::REFERENCE:
+      return "reference";
+    case AESBackend::TTABLE:
+      return "ttable";
+    case AESBackend::AESNI:
+      return "aesni";
+    case AESBackend::BITSLICED:
+      return "bitsliced";
+  }
+  return "unknown";
+}
+
+bool AESBackendSupported(AESBackend backend) {
+  if (backend != AESBackend::AESNI) {
+    return true;
+  }
+#ifdef AES_X86
+  static const bool hasAesNi = CpuHasAesNi();
+  return hasAesNi;
+#else
+  return false;
+#endif
+}
+
+AES::AES(const AESKeyLength keyLength, const AESBackend backend,
+         const unsigned int threads)
+    : backend(backend), threads(threads) {
+  if (threads == 0) {
+    this->threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  if (backend == AESBackend::AUTO) {
+    this->backend = AESBackendSupported(AESBackend::AESNI)
+                        ? AESBackend::AESNI
+                        : AESBackend::BITSLICED;
+  } else if (!AESBackendSupported(backend)) {
+    throw std::invalid_argument(std::string("AES backend is not supported: ") +
+                                AESBackendName(backend));
+  }
+
   switch (keyLength) {
     case AESKeyLength::AES_128:
       this->Nk = 4;
@@ -19,116 +1134,479 @@ AES::AES(const AESKeyLength keyLength) {
   }
 }
 
-unsigned char *AES::EncryptECB(const unsigned char in[], unsigned int inLen,
-                               const unsigned char key[]) {
-  CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-  KeyExpansion(key, roundKeys);
-  for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(in + i, out + i, roundKeys);
+/// fn(offset, len) for each chunk of a buffer; a template, so that the
+/// serial path calls fn without allocating a std::function
+template <typename F>
+void AES::ForEachChunk(unsigned int len, const F &fn) {
+  const unsigned int chunks =
+      (len + parallelChunkBytes - 1) / parallelChunkBytes;
+  auto run = [&](size_t c) {
+    const unsigned int offset = (unsigned int)c * parallelChunkBytes;
+    fn(offset, std::min(len - offset, parallelChunkBytes));
+  };
+  if (threads <= 1 || chunks <= 1) {
+    for (unsigned int c = 0; c < chunks; c++) {
+      run(c);
+    }
+    return;
   }
+  GetThreadPool().ParallelFor(chunks, threads, run);
+}
 
-  delete[] roundKeys;
-
-  return out;
+/// the ciphertext block before each chunk of a buffer but the first, at the
+/// offset of its chunk, kept before in-place decryption of the previous chunk
+/// overwrites it; empty (and not allocated) for a single chunk
+std::vector<unsigned char> AES::ChunkIvs(const unsigned char in[],
+                                         unsigned int len) {
+  const unsigned int chunks =
+      (len + parallelChunkBytes - 1) / parallelChunkBytes;
+  std::vector<unsigned char> ivs;
+  if (chunks > 1) {
+    ivs.resize(blockBytesLen * chunks);
+    for (unsigned int c = 1; c < chunks; c++) {
+      memcpy(ivs.data() + c * blockBytesLen,
+             in + c * parallelChunkBytes - blockBytesLen, blockBytesLen);
+    }
+  }
+  return ivs;
 }
 
-unsigned char *AES::DecryptECB(const unsigned char in[], unsigned int inLen,
-                               const unsigned char key[]) {
-  CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
+AESKey AES::ExpandKey(const unsigned char key[]) {
+  AESKey roundKeys;
+  roundKeys.Nr = Nr;
+  roundKeys.backend = backend;
   KeyExpansion(key, roundKeys);
-  for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-    DecryptBlock(in + i, out + i, roundKeys);
+  return roundKeys;
+}
+
+AESKey AES::ExpandKey(const std::vector<unsigned char> &key) {
+  if (key.size() != 4 * Nk) {
+    throw std::length_error("Key length must be " + std::to_string(4 * Nk));
   }
+  return ExpandKey(key.data());
+}
 
-  delete[] roundKeys;
+unsigned char *AES::EncryptECB(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[]) {
+  return EncryptECB(in, inLen, ExpandKey(key));
+}
 
-  return out;
+unsigned char *AES::DecryptECB(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[]) {
+  return DecryptECB(in, inLen, ExpandKey(key));
 }
 
 unsigned char *AES::EncryptCBC(const unsigned char in[], unsigned int inLen,
                                const unsigned char key[],
                                const unsigned char *iv) {
-  CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
-  unsigned char block[blockBytesLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-  KeyExpansion(key, roundKeys);
-  memcpy(block, iv, blockBytesLen);
-  for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-    XorBlocks(block, in + i, block, blockBytesLen);
-    EncryptBlock(block, out + i, roundKeys);
-    memcpy(block, out + i, blockBytesLen);
-  }
+  return EncryptCBC(in, inLen, ExpandKey(key), iv);
+}
+
+unsigned char *AES::DecryptCBC(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[],
+                               const unsigned char *iv) {
+  return DecryptCBC(in, inLen, ExpandKey(key), iv);
+}
 
-  delete[] roundKeys;
+unsigned char *AES::EncryptCFB(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[],
+                               const unsigned char *iv) {
+  return EncryptCFB(in, inLen, ExpandKey(key), iv);
+}
 
-  return out;
+unsigned char *AES::DecryptCFB(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[],
+                               const unsigned char *iv) {
+  return DecryptCFB(in, inLen, ExpandKey(key), iv);
 }
 
-unsigned char *AES::DecryptCBC(const unsigned char in[], unsigned int inLen,
+unsigned char *AES::EncryptCTR(const unsigned char in[], unsigned int inLen,
                                const unsigned char key[],
                                const unsigned char *iv) {
-  CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
-  unsigned char block[blockBytesLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-  KeyExpansion(key, roundKeys);
-  memcpy(block, iv, blockBytesLen);
-  for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-    DecryptBlock(in + i, out + i, roundKeys);
-    XorBlocks(block, out + i, out + i, blockBytesLen);
-    memcpy(block, in + i, blockBytesLen);
-  }
+  return EncryptCTR(in, inLen, ExpandKey(key), iv);
+}
 
-  delete[] roundKeys;
+unsigned char *AES::DecryptCTR(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[],
+                               const unsigned char *iv) {
+  return DecryptCTR(in, inLen, ExpandKey(key), iv);
+}
 
-  return out;
+unsigned char *AES::EncryptGCM(const unsigned char in[], unsigned int inLen,
+                               const unsigned char key[],
+                               const unsigned char iv[], unsigned int ivLen,
+                               const unsigned char aad[], unsigned int aadLen,
+                               unsigned char tag[]) {
+  return EncryptGCM(in, inLen, ExpandKey(key), iv, ivLen, aad, aadLen, tag);
 }
 
-unsigned char *AES::EncryptCFB(const unsigned char in[], unsigned int inLen,
+unsigned char *AES::DecryptGCM(const unsigned char in[], unsigned int inLen,
                                const unsigned char key[],
+                               const unsigned char iv[], unsigned int ivLen,
+                               const unsigned char aad[], unsigned int aadLen,
+                               const unsigned char tag[]) {
+  return DecryptGCM(in, inLen, ExpandKey(key), iv, ivLen, aad, aadLen, tag);
+}
+
+unsigned char *AES::EncryptECB(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  EncryptECB(in, out.get(), inLen, roundKeys);
+  return out.release();
+}
+
+unsigned char *AES::DecryptECB(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  DecryptECB(in, out.get(), inLen, roundKeys);
+  return out.release();
+}
+
+unsigned char *AES::EncryptCBC(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  EncryptCBC(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::DecryptCBC(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
                                const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  DecryptCBC(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::EncryptCFB(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  EncryptCFB(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::DecryptCFB(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  DecryptCFB(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::EncryptCTR(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  EncryptCTR(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::DecryptCTR(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char *iv) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  DecryptCTR(in, out.get(), inLen, roundKeys, iv);
+  return out.release();
+}
+
+unsigned char *AES::EncryptGCM(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char iv[], unsigned int ivLen,
+                               const unsigned char aad[], unsigned int aadLen,
+                               unsigned char tag[]) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  EncryptGCM(in, out.get(), inLen, roundKeys, iv, ivLen, aad, aadLen, tag);
+  return out.release();
+}
+
+unsigned char *AES::DecryptGCM(const unsigned char in[], unsigned int inLen,
+                               const AESKey &roundKeys,
+                               const unsigned char iv[], unsigned int ivLen,
+                               const unsigned char aad[], unsigned int aadLen,
+                               const unsigned char tag[]) {
+  std::unique_ptr<unsigned char[]> out(new unsigned char[inLen]);
+  DecryptGCM(in, out.get(), inLen, roundKeys, iv, ivLen, aad, aadLen, tag);
+  return out.release();
+}
+
+void AES::EncryptECB(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys) {
+  CheckKey(roundKeys);
+  CheckLength(inLen);
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int len) {
+    EncryptBlocks(in + offset, out + offset, len / blockBytesLen, roundKeys);
+  });
+}
+
+void AES::DecryptECB(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys) {
+  CheckKey(roundKeys);
+  CheckLength(inLen);
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int len) {
+    DecryptBlocks(in + offset, out + offset, len / blockBytesLen, roundKeys);
+  });
+}
+
+void AES::EncryptCBC(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  CheckKey(roundKeys);
   CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
   unsigned char block[blockBytesLen];
-  unsigned char encryptedBlock[blockBytesLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-  KeyExpansion(key, roundKeys);
   memcpy(block, iv, blockBytesLen);
   for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(block, encryptedBlock, roundKeys);
-    XorBlocks(in + i, encryptedBlock, out + i, blockBytesLen);
+    XorBlocks(block, in + i, block, blockBytesLen);
+    EncryptBlock(block, out + i, roundKeys);
     memcpy(block, out + i, blockBytesLen);
   }
+}
 
-  delete[] roundKeys;
-
-  return out;
+void AES::DecryptCBC(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  CheckKey(roundKeys);
+  CheckLength(inLen);
+  const std::vector<unsigned char> chunkIvs = ChunkIvs(in, inLen);
+  // the blocks decrypt independently, each is xored with its previous
+  // ciphertext afterwards; a group of ciphertexts is copied first, as
+  // in-place decryption overwrites them
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int chunkLen) {
+    unsigned char cipher[parallelBlocks * blockBytesLen];
+    unsigned char prev[blockBytesLen];
+    const unsigned int c = offset / parallelChunkBytes;
+    memcpy(prev, c == 0 ? iv : &chunkIvs[c * blockBytesLen], blockBytesLen);
+    for (unsigned int i = offset; i < offset + chunkLen;
+         i += parallelBlocks * blockBytesLen) {
+      const unsigned int len =
+          std::min(offset + chunkLen - i, parallelBlocks * blockBytesLen);
+      memcpy(cipher, in + i, len);
+      DecryptBlocks(cipher, out + i, len / blockBytesLen, roundKeys);
+      XorBlocks(prev, out + i, out + i, blockBytesLen);
+      XorBlocks(cipher, out + i + blockBytesLen, out + i + blockBytesLen,
+                len - blockBytesLen);
+      memcpy(prev, cipher + len - blockBytesLen, blockBytesLen);
+    }
+  });
 }
 
-unsigned char *AES::DecryptCFB(const unsigned char in[], unsigned int inLen,
-                               const unsigned char key[],
-                               const unsigned char *iv) {
+void AES::EncryptCFB(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  CheckKey(roundKeys);
   CheckLength(inLen);
-  unsigned char *out = new unsigned char[inLen];
   unsigned char block[blockBytesLen];
   unsigned char encryptedBlock[blockBytesLen];
-  unsigned char *roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-  KeyExpansion(key, roundKeys);
   memcpy(block, iv, blockBytesLen);
   for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
     EncryptBlock(block, encryptedBlock, roundKeys);
     XorBlocks(in + i, encryptedBlock, out + i, blockBytesLen);
-    memcpy(block, in + i, blockBytesLen);
+    memcpy(block, out + i, blockBytesLen);
   }
+}
 
-  delete[] roundKeys;
+void AES::DecryptCFB(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  CheckKey(roundKeys);
+  CheckLength(inLen);
+  const std::vector<unsigned char> chunkIvs = ChunkIvs(in, inLen);
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int chunkLen) {
+    // the previous ciphertexts of a group of blocks, encrypted together; the
+    // last one is kept before in-place decryption overwrites it
+    unsigned char feedback[parallelBlocks * blockBytesLen];
+    unsigned char prev[blockBytesLen];
+    const unsigned int c = offset / parallelChunkBytes;
+    memcpy(prev, c == 0 ? iv : &chunkIvs[c * blockBytesLen], blockBytesLen);
+    for (unsigned int i = offset; i < offset + chunkLen;
+         i += parallelBlocks * blockBytesLen) {
+      const unsigned int len =
+          std::min(offset + chunkLen - i, parallelBlocks * blockBytesLen);
+      memcpy(feedback, prev, blockBytesLen);
+      memcpy(feedback + blockBytesLen, in + i, len - blockBytesLen);
+      memcpy(prev, in + i + len - blockBytesLen, blockBytesLen);
+      EncryptBlocks(feedback, feedback, len / blockBytesLen, roundKeys);
+      XorBlocks(in + i, feedback, out + i, len);
+    }
+  });
+}
 
-  return out;
+void AES::EncryptCTR(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  CheckKey(roundKeys);
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int len) {
+    unsigned char counter[blockBytesLen];
+    memcpy(counter, iv, blockBytesLen);
+    AddCounter(counter, offset / blockBytesLen, false);
+    CryptCTR(in + offset, out + offset, len, counter, false, roundKeys);
+  });
+}
+
+void AES::DecryptCTR(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char *iv) {
+  EncryptCTR(in, out, inLen, roundKeys, iv);
+}
+
+void AES::EncryptGCM(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char iv[], unsigned int ivLen,
+                     const unsigned char aad[], unsigned int aadLen,
+                     unsigned char tag[]) {
+  CryptGCM(false, in, out, inLen, roundKeys, iv, ivLen, aad, aadLen, tag);
+}
+
+void AES::DecryptGCM(const unsigned char in[], unsigned char out[],
+                     unsigned int inLen, const AESKey &roundKeys,
+                     const unsigned char iv[], unsigned int ivLen,
+                     const unsigned char aad[], unsigned int aadLen,
+                     const unsigned char tag[]) {
+  unsigned char expected[blockBytesLen];
+  CryptGCM(true, in, out, inLen, roundKeys, iv, ivLen, aad, aadLen, expected);
+  // compare all bytes, so the time does not tell how many matched
+  unsigned char diff = 0;
+  for (unsigned int i = 0; i < blockBytesLen; i++) {
+    diff |= expected[i] ^ tag[i];
+  }
+  if (diff != 0) {
+    memset(out, 0, inLen);
+    throw std::runtime_error("GCM tag mismatch");
+  }
+}
+
+void AES::CryptGCM(bool decrypt, const unsigned char in[], unsigned char out[],
+                   unsigned int inLen, const AESKey &roundKeys,
+                   const unsigned char iv[], unsigned int ivLen,
+                   const unsigned char aad[], unsigned int aadLen,
+                   unsigned char tag[]) {
+  CheckKey(roundKeys);
+  unsigned char h[blockBytesLen], j0[blockBytesLen], lengths[blockBytesLen];
+  GcmSetup(roundKeys, iv, ivLen, h, j0);
+
+  // each chunk hashes its ciphertext from zero, the hashes are chained
+  // afterwards: GHASH(X || Y) = GHASH(X) * H^(blocks of Y) ^ GHASH(Y)
+  const unsigned int chunks =
+      (inLen + parallelChunkBytes - 1) / parallelChunkBytes;
+  unsigned char single[blockBytesLen] = {0};
+  std::vector<unsigned char> many(chunks > 1 ? blockBytesLen * chunks : 0, 0);
+  unsigned char *partial = chunks > 1 ? many.data() : single;
+  ForEachChunk(inLen, [&](unsigned int offset, unsigned int len) {
+    unsigned char counter[blockBytesLen];
+    memcpy(counter, j0, blockBytesLen);
+    AddCounter(counter, 1 + offset / blockBytesLen, true);
+    unsigned char *y = partial + blockBytesLen * (offset / parallelChunkBytes);
+    if (decrypt) {
+      Ghash(y, h, in + offset, len);
+    }
+    CryptCTR(in + offset, out + offset, len, counter, true, roundKeys);
+    if (!decrypt) {
+      Ghash(y, h, out + offset, len);
+    }
+  });
+
+  unsigned char s[blockBytesLen] = {0}, power[blockBytesLen];
+  Ghash(s, h, aad, aadLen);
+  GhashPower(power, h, parallelChunkBytes / blockBytesLen);
+  for (unsigned int c = 0; c < chunks; c++) {
+    const unsigned int len =
+        std::min(inLen - c * parallelChunkBytes, parallelChunkBytes);
+    if (len != parallelChunkBytes) {
+      GhashPower(power, h, (len + blockBytesLen - 1) / blockBytesLen);
+    }
+    GhashMultiply(s, power);
+    XorBlocks(s, partial + blockBytesLen * c, s, blockBytesLen);
+  }
+  StoreBigEndian64(lengths, (uint64_t)aadLen * 8);
+  StoreBigEndian64(lengths + 8, (uint64_t)inLen * 8);
+  Ghash(s, h, lengths, blockBytesLen);
+
+  EncryptBlock(j0, tag, roundKeys);
+  XorBlocks(tag, s, tag, blockBytesLen);
+}
+
+/// the hash key H = E(0), and the pre-counter block J0
+void AES::GcmSetup(const AESKey &roundKeys, const unsigned char iv[],
+                   unsigned int ivLen, unsigned char h[], unsigned char j0[]) {
+  if (ivLen == 0) {
+    throw std::length_error("GCM IV must not be empty");
+  }
+  memset(h, 0, blockBytesLen);
+  memset(j0, 0, blockBytesLen);
+  EncryptBlock(h, h, roundKeys);
+  if (ivLen == 12) {
+    memcpy(j0, iv, ivLen);
+    j0[15] = 1;
+  } else {
+    unsigned char lengths[blockBytesLen];
+    Ghash(j0, h, iv, ivLen);
+    StoreBigEndian64(lengths, 0);
+    StoreBigEndian64(lengths + 8, (uint64_t)ivLen * 8);
+    Ghash(j0, h, lengths, blockBytesLen);
+  }
+}
+
+/// xor in with the key stream of the counter blocks from counter on, and
+/// encrypt the counters in groups so the parallel backends see many blocks
+void AES::CryptCTR(const unsigned char in[], unsigned char out[],
+                   unsigned int len, const unsigned char counter[], bool inc32,
+                   const AESKey &roundKeys) {
+#ifdef AES_X86
+  if (backend == AESBackend::AESNI) {
+    AesNiCryptCTR((const unsigned char *)roundKeys.encRoundKeys, Nr, in, out,
+                  len, counter, inc32);
+    return;
+  }
+#endif
+  constexpr unsigned int groupBytes = 4 * parallelBlocks * blockBytesLen;
+  unsigned char ctr[blockBytesLen], stream[groupBytes];
+  memcpy(ctr, counter, blockBytesLen);
+  for (unsigned int i = 0; i < len; i += groupBytes) {
+    const unsigned int n = std::min(len - i, groupBytes);
+    const unsigned int blocks = (n + blockBytesLen - 1) / blockBytesLen;
+    for (unsigned int b = 0; b < blocks; b++) {
+      memcpy(stream + b * blockBytesLen, ctr, blockBytesLen);
+      AddCounter(ctr, 1, inc32);
+    }
+    EncryptBlocks(stream, stream, blocks, roundKeys);
+    XorBlocks(in + i, stream, out + i, n);
+  }
+}
+
+/// the PCLMULQDQ GHASH goes with the AES-NI backend, the constant-time
+/// portable one with the others
+void AES::Ghash(unsigned char y[], const unsigned char h[],
+                const unsigned char data[], size_t len) {
+#ifdef AES_X86
+  if (backend == AESBackend::AESNI) {
+    GhashClmul(y, h, data, len);
+    return;
+  }
+#endif
+  GhashPortable(y, h, data, len);
+}
+
+void AES::GhashMultiply(unsigned char y[], const unsigned char x[]) {
+  static const unsigned char zero[blockBytesLen] = {0};
+  Ghash(y, x, zero, blockBytesLen);
+}
+
+/// h^n for n >= 1, by square and multiply; 1 has only the first bit set, as
+/// the GHASH bits are reflected
+void AES::GhashPower(unsigned char out[], const unsigned char h[],
+                     uint64_t n) {
+  unsigned char base[blockBytesLen];
+  memcpy(base, h, blockBytesLen);
+  memset(out, 0, blockBytesLen);
+  out[0] = 0x80;
+  for (; n != 0; n >>= 1) {
+    if (n & 1) {
+      GhashMultiply(out, base);
+    }
+    unsigned char square[blockBytesLen];
+    memcpy(square, base, blockBytesLen);
+    GhashMultiply(base, square);
+  }
 }
 
 void AES::CheckLength(unsigned int len) {
@@ -138,8 +1616,60 @@ void AES::CheckLength(unsigned int len) {
   }
 }
 
+void AES::CheckKey(const AESKey &roundKeys) {
+  if (roundKeys.Nr != Nr || roundKeys.backend != backend) {
+    throw std::invalid_argument(
+        "AESKey was expanded for another key length or backend");
+  }
+}
+
+void AES::EncryptBlocks(const unsigned char in[], unsigned char out[],
+                        unsigned int n, const AESKey &roundKeys) {
+#ifdef AES_X86
+  if (backend == AESBackend::AESNI) {
+    AesNiCryptBlocks<false>((const unsigned char *)roundKeys.encRoundKeys, Nr,
+                            in, out, n);
+    return;
+  }
+#endif
+  if (backend == AESBackend::BITSLICED) {
+    BitsliceCryptBlocks<false>(roundKeys.bitsliceRoundKeys, Nr, in, out, n);
+    return;
+  }
+  for (unsigned int i = 0; i < n; i++) {
+    EncryptBlock(in + i * blockBytesLen, out + i * blockBytesLen, roundKeys);
+  }
+}
+
+void AES::DecryptBlocks(const unsigned char in[], unsigned char out[],
+                        unsigned int n, const AESKey &roundKeys) {
+#ifdef AES_X86
+  if (backend == AESBackend::AESNI) {
+    AesNiCryptBlocks<true>((const unsigned char *)roundKeys.decRoundKeys, Nr,
+                           in, out, n);
+    return;
+  }
+#endif
+  if (backend == AESBackend::BITSLICED) {
+    BitsliceCryptBlocks<true>(roundKeys.bitsliceRoundKeys, Nr, in, out, n);
+    return;
+  }
+  for (unsigned int i = 0; i < n; i++) {
+    DecryptBlock(in + i * blockBytesLen, out + i * blockBytesLen, roundKeys);
+  }
+}
+
 void AES::EncryptBlock(const unsigned char in[], unsigned char out[],
-                       unsigned char *roundKeys) {
+                       const AESKey &roundKeys) {
+  if (backend == AESBackend::TTABLE) {
+    EncryptBlockTTable(in, out, roundKeys);
+    return;
+  }
+  if (backend == AESBackend::AESNI || backend == AESBackend::BITSLICED) {
+    EncryptBlocks(in, out, 1, roundKeys);
+    return;
+  }
+
   unsigned char state[4][Nb];
   unsigned int i, j, round;
 
@@ -149,18 +1679,18 @@ void AES::EncryptBlock(const unsigned char in[], unsigned char out[],
     }
   }
 
-  AddRoundKey(state, roundKeys);
+  AddRoundKey(state, roundKeys.w);
 
   for (round = 1; round <= Nr - 1; round++) {
     SubBytes(state);
     ShiftRows(state);
     MixColumns(state);
-    AddRoundKey(state, roundKeys + round * 4 * Nb);
+    AddRoundKey(state, roundKeys.w + round * 4 * Nb);
   }
 
   SubBytes(state);
   ShiftRows(state);
-  AddRoundKey(state, roundKeys + Nr * 4 * Nb);
+  AddRoundKey(state, roundKeys.w + Nr * 4 * Nb);
 
   for (i = 0; i < 4; i++) {
     for (j = 0; j < Nb; j++) {
@@ -170,7 +1700,16 @@ void AES::EncryptBlock(const unsigned char in[], unsigned char out[],
 }
 
 void AES::DecryptBlock(const unsigned char in[], unsigned char out[],
-                       unsigned char *roundKeys) {
+                       const AESKey &roundKeys) {
+  if (backend == AESBackend::TTABLE) {
+    DecryptBlockTTable(in, out, roundKeys);
+    return;
+  }
+  if (backend == AESBackend::AESNI || backend == AESBackend::BITSLICED) {
+    DecryptBlocks(in, out, 1, roundKeys);
+    return;
+  }
+
   unsigned char state[4][Nb];
   unsigned int i, j, round;
 
@@ -180,18 +1719,18 @@ void AES::DecryptBlock(const unsigned char in[], unsigned char out[],
     }
   }
 
-  AddRoundKey(state, roundKeys + Nr * 4 * Nb);
+  AddRoundKey(state, roundKeys.w + Nr * 4 * Nb);
 
   for (round = Nr - 1; round >= 1; round--) {
     InvSubBytes(state);
     InvShiftRows(state);
-    AddRoundKey(state, roundKeys + round * 4 * Nb);
+    AddRoundKey(state, roundKeys.w + round * 4 * Nb);
     InvMixColumns(state);
   }
 
   InvSubBytes(state);
   InvShiftRows(state);
-  AddRoundKey(state, roundKeys);
+  AddRoundKey(state, roundKeys.w);
 
   for (i = 0; i < 4; i++) {
     for (j = 0; j < Nb; j++) {
@@ -255,7 +1794,7 @@ void AES::MixColumns(unsigned char state[4][Nb]) {
   }
 }
 
-void AES::AddRoundKey(unsigned char state[4][Nb], unsigned char *key) {
+void AES::AddRoundKey(unsigned char state[4][Nb], const unsigned char *key) {
   unsigned int i, j;
   for (i = 0; i < 4; i++) {
     for (j = 0; j < Nb; j++) {
@@ -265,6 +1804,24 @@ void AES::AddRoundKey(unsigned char state[4][Nb], unsigned char *key) {
 }
 
 void AES::SubWord(unsigned char *a) {
+  // the bitsliced backend keeps the key out of table indexes too
+  if (backend == AESBackend::BITSLICED) {
+    uint64_t q[8];
+    for (unsigned int k = 0; k < 8; k++) {
+      q[k] = 0;
+      for (unsigned int j = 0; j < 4; j++) {
+        q[k] |= (uint64_t)((a[j] >> k) & 1) << j;
+      }
+    }
+    BitsliceSbox(q);
+    for (unsigned int j = 0; j < 4; j++) {
+      a[j] = 0;
+      for (unsigned int k = 0; k < 8; k++) {
+        a[j] |= (unsigned char)(((q[k] >> j) & 1) << k);
+      }
+    }
+    return;
+  }
   int i;
   for (i = 0; i < 4; i++) {
     a[i] = sbox[a[i] / 16][a[i] % 16];
@@ -297,7 +1854,18 @@ void AES::Rcon(unsigned char *a, unsigned int n) {
   a[1] = a[2] = a[3] = 0;
 }
 
-void AES::KeyExpansion(const unsigned char key[], unsigned char w[]) {
+void AES::KeyExpansion(const unsigned char key[], AESKey &roundKeys) {
+#ifdef AES_X86
+  // the AES-NI backend only uses its own round keys
+  if (backend == AESBackend::AESNI) {
+    AesNiExpandKey(key, Nk, Nr, (unsigned char *)roundKeys.encRoundKeys,
+                   (unsigned char *)roundKeys.decRoundKeys);
+    return;
+  }
+#endif
+
+  unsigned char *w = roundKeys.w;
+
   unsigned char temp[4];
   unsigned char rcon[4];
 
@@ -329,6 +1897,133 @@ void AES::KeyExpansion(const unsigned char key[], unsigned char w[]) {
     w[i + 3] = w[i + 3 - 4 * Nk] ^ temp[3];
     i += 4;
   }
+
+  if (backend == AESBackend::TTABLE) {
+    ExpandTTableKeys(roundKeys);
+  } else if (backend == AESBackend::BITSLICED) {
+    ExpandBitsliceKeys(roundKeys);
+  }
+}
+
+void AES::ExpandBitsliceKeys(AESKey &roundKeys) {
+  // the round key as each of the 4 blocks of a word
+  unsigned char keys[4 * blockBytesLen];
+  for (unsigned int round = 0; round <= Nr; round++) {
+    for (unsigned int j = 0; j < 4; j++) {
+      memcpy(keys + j * blockBytesLen, roundKeys.w + round * blockBytesLen,
+             blockBytesLen);
+    }
+    BitsliceLoad<uint64_t>(keys, 4, roundKeys.bitsliceRoundKeys + 8 * round);
+  }
+}
+
+void AES::ExpandTTableKeys(AESKey &roundKeys) {
+  const TTables &t = GetTTables();
+  const unsigned int words = Nb * (Nr + 1);
+  uint32_t *encRoundKeys = roundKeys.encRoundKeys;
+  uint32_t *decRoundKeys = roundKeys.decRoundKeys;
+  for (unsigned int i = 0; i < words; i++) {
+    encRoundKeys[i] = LoadBigEndian(roundKeys.w + 4 * i);
+  }
+
+  // reverse the rounds, and apply InvMixColumns to the inner ones: Td[k][S[x]]
+  // is InvMixColumns of byte x alone, since InvSubBytes undoes S
+  for (unsigned int round = 0; round <= Nr; round++) {
+    for (unsigned int c = 0; c < Nb; c++) {
+      uint32_t k = encRoundKeys[(Nr - round) * Nb + c];
+      if (round != 0 && round != Nr) {
+        k = t.Td[0][t.S[k >> 24]] ^ t.Td[1][t.S[(k >> 16) & 0xff]] ^
+            t.Td[2][t.S[(k >> 8) & 0xff]] ^ t.Td[3][t.S[k & 0xff]];
+      }
+      decRoundKeys[round * Nb + c] = k;
+    }
+  }
+}
+
+void AES::EncryptBlockTTable(const unsigned char in[], unsigned char out[],
+                             const AESKey &roundKeys) {
+  const TTables &t = GetTTables();
+  const uint32_t *rk = roundKeys.encRoundKeys;
+  uint32_t s0 = LoadBigEndian(in) ^ rk[0];
+  uint32_t s1 = LoadBigEndian(in + 4) ^ rk[1];
+  uint32_t s2 = LoadBigEndian(in + 8) ^ rk[2];
+  uint32_t s3 = LoadBigEndian(in + 12) ^ rk[3];
+  uint32_t t0, t1, t2, t3;
+
+  // column c of a round takes row k from column c + k (ShiftRows)
+  for (unsigned int round = 1; round < Nr; round++) {
+    rk += Nb;
+    t0 = t.Te[0][s0 >> 24] ^ t.Te[1][(s1 >> 16) & 0xff] ^
+         t.Te[2][(s2 >> 8) & 0xff] ^ t.Te[3][s3 & 0xff] ^ rk[0];
+    t1 = t.Te[0][s1 >> 24] ^ t.Te[1][(s2 >> 16) & 0xff] ^
+         t.Te[2][(s3 >> 8) & 0xff] ^ t.Te[3][s0 & 0xff] ^ rk[1];
+    t2 = t.Te[0][s2 >> 24] ^ t.Te[1][(s3 >> 16) & 0xff] ^
+         t.Te[2][(s0 >> 8) & 0xff] ^ t.Te[3][s1 & 0xff] ^ rk[2];
+    t3 = t.Te[0][s3 >> 24] ^ t.Te[1][(s0 >> 16) & 0xff] ^
+         t.Te[2][(s1 >> 8) & 0xff] ^ t.Te[3][s2 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  // the last round has no MixColumns
+  rk += Nb;
+  t0 = ((uint32_t)t.S[s0 >> 24] << 24) ^ ((uint32_t)t.S[(s1 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.S[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)t.S[s3 & 0xff] ^ rk[0];
+  t1 = ((uint32_t)t.S[s1 >> 24] << 24) ^ ((uint32_t)t.S[(s2 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.S[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)t.S[s0 & 0xff] ^ rk[1];
+  t2 = ((uint32_t)t.S[s2 >> 24] << 24) ^ ((uint32_t)t.S[(s3 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.S[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)t.S[s1 & 0xff] ^ rk[2];
+  t3 = ((uint32_t)t.S[s3 >> 24] << 24) ^ ((uint32_t)t.S[(s0 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.S[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)t.S[s2 & 0xff] ^ rk[3];
+  StoreBigEndian(out, t0);
+  StoreBigEndian(out + 4, t1);
+  StoreBigEndian(out + 8, t2);
+  StoreBigEndian(out + 12, t3);
+}
+
+void AES::DecryptBlockTTable(const unsigned char in[], unsigned char out[],
+                             const AESKey &roundKeys) {
+  const TTables &t = GetTTables();
+  const uint32_t *rk = roundKeys.decRoundKeys;
+  uint32_t s0 = LoadBigEndian(in) ^ rk[0];
+  uint32_t s1 = LoadBigEndian(in + 4) ^ rk[1];
+  uint32_t s2 = LoadBigEndian(in + 8) ^ rk[2];
+  uint32_t s3 = LoadBigEndian(in + 12) ^ rk[3];
+  uint32_t t0, t1, t2, t3;
+
+  // column c of a round takes row k from column c - k (InvShiftRows)
+  for (unsigned int round = 1; round < Nr; round++) {
+    rk += Nb;
+    t0 = t.Td[0][s0 >> 24] ^ t.Td[1][(s3 >> 16) & 0xff] ^
+         t.Td[2][(s2 >> 8) & 0xff] ^ t.Td[3][s1 & 0xff] ^ rk[0];
+    t1 = t.Td[0][s1 >> 24] ^ t.Td[1][(s0 >> 16) & 0xff] ^
+         t.Td[2][(s3 >> 8) & 0xff] ^ t.Td[3][s2 & 0xff] ^ rk[1];
+    t2 = t.Td[0][s2 >> 24] ^ t.Td[1][(s1 >> 16) & 0xff] ^
+         t.Td[2][(s0 >> 8) & 0xff] ^ t.Td[3][s3 & 0xff] ^ rk[2];
+    t3 = t.Td[0][s3 >> 24] ^ t.Td[1][(s2 >> 16) & 0xff] ^
+         t.Td[2][(s1 >> 8) & 0xff] ^ t.Td[3][s0 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  // the last round has no InvMixColumns
+  rk += Nb;
+  t0 = ((uint32_t)t.Si[s0 >> 24] << 24) ^ ((uint32_t)t.Si[(s3 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.Si[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)t.Si[s1 & 0xff] ^ rk[0];
+  t1 = ((uint32_t)t.Si[s1 >> 24] << 24) ^ ((uint32_t)t.Si[(s0 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.Si[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)t.Si[s2 & 0xff] ^ rk[1];
+  t2 = ((uint32_t)t.Si[s2 >> 24] << 24) ^ ((uint32_t)t.Si[(s1 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.Si[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)t.Si[s3 & 0xff] ^ rk[2];
+  t3 = ((uint32_t)t.Si[s3 >> 24] << 24) ^ ((uint32_t)t.Si[(s2 >> 16) & 0xff] << 16) ^
+       ((uint32_t)t.Si[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)t.Si[s0 & 0xff] ^ rk[3];
+  StoreBigEndian(out, t0);
+  StoreBigEndian(out + 4, t1);
+  StoreBigEndian(out + 8, t2);
+  StoreBigEndian(out + 12, t3);
 }
 
 void AES::InvSubBytes(unsigned char state[4][Nb]) {
@@ -387,70 +2082,293 @@ void AES::printHexVector(std::vector<unsigned char> a) {
   }
 }
 
-std::vector<unsigned char> AES::ArrayToVector(unsigned char *a,
-                                              unsigned int len) {
-  std::vector<unsigned char> v(a, a + len * sizeof(unsigned char));
-  return v;
+std::vector<unsigned char> AES::EncryptECB(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key) {
+  std::vector<unsigned char> out(in.size());
+  EncryptECB(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key));
+  return out;
 }
 
-unsigned char *AES::VectorToArray(std::vector<unsigned char> &a) {
-  return a.data();
+std::vector<unsigned char> AES::DecryptECB(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key) {
+  std::vector<unsigned char> out(in.size());
+  DecryptECB(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key));
+  return out;
 }
 
-std::vector<unsigned char> AES::EncryptECB(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key) {
-  unsigned char *out = EncryptECB(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key));
-  std::vector<unsigned char> v = ArrayToVector(out, in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::EncryptCBC(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCBC(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
 }
 
-std::vector<unsigned char> AES::DecryptECB(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key) {
-  unsigned char *out = DecryptECB(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key));
-  std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::DecryptCBC(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCBC(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
 }
 
-std::vector<unsigned char> AES::EncryptCBC(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key,
-                                           std::vector<unsigned char> iv) {
-  unsigned char *out = EncryptCBC(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key), VectorToArray(iv));
-  std::vector<unsigned char> v = ArrayToVector(out, in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::EncryptCFB(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCFB(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
 }
 
-std::vector<unsigned char> AES::DecryptCBC(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key,
-                                           std::vector<unsigned char> iv) {
-  unsigned char *out = DecryptCBC(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key), VectorToArray(iv));
-  std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::DecryptCFB(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCFB(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
 }
 
-std::vector<unsigned char> AES::EncryptCFB(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key,
-                                           std::vector<unsigned char> iv) {
-  unsigned char *out = EncryptCFB(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key), VectorToArray(iv));
-  std::vector<unsigned char> v = ArrayToVector(out, in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::EncryptCTR(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCTR(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
 }
 
-std::vector<unsigned char> AES::DecryptCFB(std::vector<unsigned char> in,
-                                           std::vector<unsigned char> key,
-                                           std::vector<unsigned char> iv) {
-  unsigned char *out = DecryptCFB(VectorToArray(in), (unsigned int)in.size(),
-                                  VectorToArray(key), VectorToArray(iv));
-  std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-  delete[] out;
-  return v;
+std::vector<unsigned char> AES::DecryptCTR(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCTR(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data());
+  return out;
+}
+
+std::vector<unsigned char> AES::EncryptGCM(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv,
+    const std::vector<unsigned char> &aad,
+    std::vector<unsigned char> &tag) {
+  std::vector<unsigned char> out(in.size());
+  tag.resize(blockBytesLen);
+  EncryptGCM(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data(), (unsigned int)iv.size(), aad.data(),
+             (unsigned int)aad.size(), tag.data());
+  return out;
+}
+
+std::vector<unsigned char> AES::DecryptGCM(
+    const std::vector<unsigned char> &in,
+    const std::vector<unsigned char> &key,
+    const std::vector<unsigned char> &iv,
+    const std::vector<unsigned char> &aad,
+    const std::vector<unsigned char> &tag) {
+  if (tag.size() != blockBytesLen) {
+    throw std::length_error("GCM tag must be " + std::to_string(blockBytesLen) +
+                            " bytes");
+  }
+  std::vector<unsigned char> out(in.size());
+  DecryptGCM(in.data(), out.data(), (unsigned int)in.size(), ExpandKey(key),
+             iv.data(), (unsigned int)iv.size(), aad.data(),
+             (unsigned int)aad.size(), tag.data());
+  return out;
+}
+
+AESStream::AESStream(const AES &cipher, AESMode streamMode, bool decrypting,
+                     const AESKey &key, const unsigned char iv[],
+                     unsigned int ivLen, const unsigned char aad[],
+                     unsigned int aadLen)
+    : aes(cipher), roundKeys(key), mode(streamMode), decrypt(decrypting) {
+  aes.CheckKey(roundKeys);
+  if (mode == AESMode::GCM) {
+    aes.GcmSetup(roundKeys, iv, ivLen, h, j0);
+    memset(s, 0, blockBytesLen);
+    aes.Ghash(s, h, aad, aadLen);
+    aadBytes = aadLen;
+    memcpy(chain, j0, blockBytesLen);
+    AddCounter(chain, 1, true);
+  } else {
+    memcpy(chain, iv, blockBytesLen);
+  }
+}
+
+size_t AESStream::Update(const unsigned char in[], size_t inLen,
+                         unsigned char out[]) {
+  if (finished) {
+    throw std::logic_error("AES stream is already finished");
+  }
+  if (inLen == 0) {
+    return 0;
+  }
+  if (mode == AESMode::GCM) {
+    // SP 800-38D allows at most 2^39 - 256 bits of plaintext
+    if (inLen > ((uint64_t)1 << 36) - 32 - dataBytes) {
+      throw std::length_error("GCM message is too long");
+    }
+    dataBytes += inLen;
+  }
+
+  // CBC decryption keeps the last whole block, it may hold the padding
+  const bool holdBack = mode == AESMode::CBC && decrypt;
+  size_t written = 0;
+  if (pendingLen > 0) {
+    const size_t n = std::min<size_t>(blockBytesLen - pendingLen, inLen);
+    memcpy(pending + pendingLen, in, n);
+    pendingLen += n;
+    in += n;
+    inLen -= n;
+    if (pendingLen < blockBytesLen || (holdBack && inLen == 0)) {
+      return 0;
+    }
+    Process(pending, out, blockBytesLen);
+    written = blockBytesLen;
+    pendingLen = 0;
+  }
+
+  size_t full = inLen - inLen % blockBytesLen;
+  if (holdBack && full == inLen && full > 0) {
+    full -= blockBytesLen;
+  }
+  Process(in, out + written, full);
+  memcpy(pending, in + full, inLen - full);
+  pendingLen = inLen - full;
+  return written + full;
+}
+
+/// whole blocks, except for the last call of CTR and GCM
+void AESStream::Process(const unsigned char in[], unsigned char out[],
+                        size_t len) {
+  // the mode functions take unsigned int lengths
+  constexpr size_t pieceBytes = (size_t)1 << 30;
+  for (size_t i = 0; i < len; i += pieceBytes) {
+    const unsigned int n = (unsigned int)std::min(len - i, pieceBytes);
+    const unsigned char *src = in + i;
+    unsigned char *dst = out + i;
+    switch (mode) {
+      case AESMode::CBC:
+        if (decrypt) {
+          aes.DecryptCBC(src, dst, n, roundKeys, chain);
+        } else {
+          aes.EncryptCBC(src, dst, n, roundKeys, chain);
+        }
+        memcpy(chain, (decrypt ? src : dst) + n - blockBytesLen,
+               blockBytesLen);
+        break;
+      case AESMode::CFB:
+        if (decrypt) {
+          aes.DecryptCFB(src, dst, n, roundKeys, chain);
+        } else {
+          aes.EncryptCFB(src, dst, n, roundKeys, chain);
+        }
+        memcpy(chain, (decrypt ? src : dst) + n - blockBytesLen,
+               blockBytesLen);
+        break;
+      case AESMode::CTR:
+        aes.EncryptCTR(src, dst, n, roundKeys, chain);
+        AddCounter(chain, n / blockBytesLen, false);
+        break;
+      case AESMode::GCM:
+        if (decrypt) {
+          aes.Ghash(s, h, src, n);
+        }
+        aes.CryptCTR(src, dst, n, chain, true, roundKeys);
+        if (!decrypt) {
+          aes.Ghash(s, h, dst, n);
+        }
+        AddCounter(chain, n / blockBytesLen, true);
+        break;
+    }
+  }
+}
+
+size_t AESStream::Finish(unsigned char out[], unsigned char tag[],
+                         const unsigned char expectedTag[]) {
+  if (finished) {
+    throw std::logic_error("AES stream is already finished");
+  }
+  if (mode == AESMode::GCM && (decrypt ? !expectedTag : !tag)) {
+    throw std::invalid_argument("GCM stream needs a tag");
+  }
+  finished = true;
+
+  size_t written = pendingLen;
+  switch (mode) {
+    case AESMode::CBC:
+      if (!decrypt) {
+        // PKCS#7: 1 to 16 bytes, each holding their count
+        const unsigned char pad = blockBytesLen - pendingLen;
+        memset(pending + pendingLen, pad, pad);
+        Process(pending, out, blockBytesLen);
+        written = blockBytesLen;
+      } else {
+        if (pendingLen != blockBytesLen) {
+          throw std::length_error("Ciphertext length must be divisible by " +
+                                  std::to_string(blockBytesLen));
+        }
+        unsigned char block[blockBytesLen];
+        Process(pending, block, blockBytesLen);
+        // check all bytes, so the time does not tell where the padding broke
+        const unsigned int pad = block[blockBytesLen - 1];
+        unsigned int bad = (pad == 0) | (pad > blockBytesLen);
+        for (unsigned int i = 0; i < blockBytesLen; i++) {
+          bad |= (unsigned int)(blockBytesLen - i <= pad) * (block[i] ^ pad);
+        }
+        if (bad != 0) {
+          memset(block, 0, blockBytesLen);
+          throw std::runtime_error("CBC padding is invalid");
+        }
+        written = blockBytesLen - pad;
+        memcpy(out, block, written);
+      }
+      break;
+    case AESMode::CFB:
+      if (pendingLen > 0) {
+        // the partial last block uses only the start of its key stream
+        unsigned char stream[blockBytesLen];
+        aes.EncryptBlock(chain, stream, roundKeys);
+        aes.XorBlocks(pending, stream, out, pendingLen);
+      }
+      break;
+    case AESMode::CTR:
+    case AESMode::GCM:
+      Process(pending, out, pendingLen);
+      break;
+  }
+
+  if (mode == AESMode::GCM) {
+    unsigned char lengths[blockBytesLen], computed[blockBytesLen];
+    StoreBigEndian64(lengths, aadBytes * 8);
+    StoreBigEndian64(lengths + 8, dataBytes * 8);
+    aes.Ghash(s, h, lengths, blockBytesLen);
+    aes.EncryptBlock(j0, computed, roundKeys);
+    aes.XorBlocks(computed, s, computed, blockBytesLen);
+    if (!decrypt) {
+      memcpy(tag, computed, blockBytesLen);
+    } else {
+      unsigned char diff = 0;
+      for (unsigned int i = 0; i < blockBytesLen; i++) {
+        diff |= computed[i] ^ expectedTag[i];
+      }
+      if (diff != 0) {
+        memset(out, 0, written);
+        throw std::runtime_error("GCM tag mismatch");
+      }
+    }
+  }
+  return written;
 }
@@ -3,6 +3,7 @@
 #ifndef _AES_H_
 #define _AES_H_
 
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
@@ -12,13 +13,66 @@
 
 enum class AESKeyLength { AES_128, AES_192, AES_256 };
 
+/// Implementation of the block cipher behind the same API, the modes and
+/// outputs are identical. REFERENCE runs the byte-wise rounds on a 4x4 state,
+/// TTABLE runs each round as 16 lookups of 32-bit T-tables (SubBytes,
+/// ShiftRows and MixColumns combined) on the four columns, AESNI runs the
+/// AES instructions of x86 CPUs on several blocks at a time, BITSLICED runs
+/// the rounds as boolean operations on the bit planes of 8 blocks at a time,
+/// with no table lookups. AUTO picks AESNI if the CPU supports it (checked at
+/// runtime), and BITSLICED otherwise: REFERENCE and TTABLE index tables with
+/// the key and data, which leaks them through the cache timing.
+enum class AESBackend { AUTO, REFERENCE, TTABLE, AESNI, BITSLICED };
+
+const char *AESBackendName(AESBackend backend);
+
+bool AESBackendSupported(AESBackend backend);
+
+/// The round keys of one key, expanded by AES::ExpandKey for the key length
+/// and backend of that AES object, and accepted by its methods (and those of
+/// any AES object with the same key length and backend). Expanding a key once
+/// and reusing it saves the key expansion of every call, which costs as much
+/// as encrypting a few blocks. An AESKey is not changed by the calls, so they
+/// can share it across threads.
+class AESKey {
+ private:
+  friend class AES;
+
+  static constexpr unsigned int maxRounds = 14;
+
+  unsigned int Nr = 0;
+  AESBackend backend = AESBackend::AUTO;
+
+  /// round keys of the reference backend (w of FIPS-197)
+  alignas(16) unsigned char w[16 * (maxRounds + 1)];
+  /// round keys of the T-table (big-endian column words) and AES-NI (16-byte
+  /// blocks) backends; the decryption ones are in reverse order with
+  /// InvMixColumns applied to the inner rounds (equivalent inverse cipher)
+  alignas(16) uint32_t encRoundKeys[4 * (maxRounds + 1)];
+  alignas(16) uint32_t decRoundKeys[4 * (maxRounds + 1)];
+  /// round keys of the bitsliced backend, 8 words per round with the key
+  /// repeated for the 4 blocks of a word; decryption uses them in reverse
+  alignas(16) uint64_t bitsliceRoundKeys[8 * (maxRounds + 1)];
+};
+
 class AES {
  private:
+  friend class AESStream;
+
   static constexpr unsigned int Nb = 4;
   static constexpr unsigned int blockBytesLen = 4 * Nb * sizeof(unsigned char);
 
+  /// blocks processed together by the parallelizable modes, which hides the
+  /// latency of the AES instructions
+  static constexpr unsigned int parallelBlocks = 8;
+  /// bytes per task when a buffer is split across the thread pool, smaller
+  /// buffers stay on the calling thread
+  static constexpr unsigned int parallelChunkBytes = 256 * 1024;
+
   unsigned int Nk;
   unsigned int Nr;
+  AESBackend backend;
+  unsigned int threads;
 
   void SubBytes(unsigned char state[4][Nb]);
 
@@ -31,7 +85,7 @@ class AES {
 
   void MixColumns(unsigned char state[4][Nb]);
 
-  void AddRoundKey(unsigned char state[4][Nb], unsigned char *key);
+  void AddRoundKey(unsigned char state[4][Nb], const unsigned char *key);
 
   void SubWord(unsigned char *a);
 
@@ -49,23 +103,78 @@ class AES {
 
   void CheckLength(unsigned int len);
 
-  void KeyExpansion(const unsigned char key[], unsigned char w[]);
+  void CheckKey(const AESKey &roundKeys);
+
+  void KeyExpansion(const unsigned char key[], AESKey &roundKeys);
 
   void EncryptBlock(const unsigned char in[], unsigned char out[],
-                    unsigned char *roundKeys);
+                    const AESKey &roundKeys);
 
   void DecryptBlock(const unsigned char in[], unsigned char out[],
-                    unsigned char *roundKeys);
+                    const AESKey &roundKeys);
+
+  void EncryptBlocks(const unsigned char in[], unsigned char out[],
+                     unsigned int n, const AESKey &roundKeys);
+
+  void DecryptBlocks(const unsigned char in[], unsigned char out[],
+                     unsigned int n, const AESKey &roundKeys);
+
+  void ExpandTTableKeys(AESKey &roundKeys);
+
+  void ExpandBitsliceKeys(AESKey &roundKeys);
+
+  template <typename F>
+  void ForEachChunk(unsigned int len, const F &fn);
+
+  std::vector<unsigned char> ChunkIvs(const unsigned char in[],
+                                      unsigned int len);
+
+  void CryptCTR(const unsigned char in[], unsigned char out[],
+                unsigned int len, const unsigned char counter[], bool inc32,
+                const AESKey &roundKeys);
+
+  void Ghash(unsigned char y[], const unsigned char h[],
+             const unsigned char data[], size_t len);
+
+  void GhashMultiply(unsigned char y[], const unsigned char x[]);
+
+  void GhashPower(unsigned char out[], const unsigned char h[], uint64_t n);
+
+  void GcmSetup(const AESKey &roundKeys, const unsigned char iv[],
+                unsigned int ivLen, unsigned char h[], unsigned char j0[]);
+
+  void CryptGCM(bool decrypt, const unsigned char in[], unsigned char out[],
+                unsigned int inLen, const AESKey &roundKeys,
+                const unsigned char iv[], unsigned int ivLen,
+                const unsigned char aad[], unsigned int aadLen,
+                unsigned char tag[]);
+
+  void EncryptBlockTTable(const unsigned char in[], unsigned char out[],
+                          const AESKey &roundKeys);
+
+  void DecryptBlockTTable(const unsigned char in[], unsigned char out[],
+                          const AESKey &roundKeys);
 
   void XorBlocks(const unsigned char *a, const unsigned char *b,
                  unsigned char *c, unsigned int len);
 
-  std::vector<unsigned char> ArrayToVector(unsigned char *a, unsigned int len);
+ public:
+  /// threads is the number of threads (the calling one included) that the
+  /// parallelizable modes split large buffers across, 0 for all hardware
+  /// threads. An AES object keeps no state between calls, so concurrent
+  /// calls may share it.
+  explicit AES(const AESKeyLength keyLength = AESKeyLength::AES_256,
+               const AESBackend backend = AESBackend::AUTO,
+               const unsigned int threads = 0);
+
+  AESBackend GetBackend() const { return backend; }
 
-  unsigned char *VectorToArray(std::vector<unsigned char> &a);
+  unsigned int GetThreads() const { return threads; }
 
- public:
-  explicit AES(const AESKeyLength keyLength = AESKeyLength::AES_256);
+  /// the round keys of key for the overloads below that take an AESKey
+  AESKey ExpandKey(const unsigned char key[]);
+
+  AESKey ExpandKey(const std::vector<unsigned char> &key);
 
   unsigned char *EncryptECB(const unsigned char in[], unsigned int inLen,
                             const unsigned char key[]);
@@ -85,33 +194,239 @@ class AES {
   unsigned char *DecryptCFB(const unsigned char in[], unsigned int inLen,
                             const unsigned char key[], const unsigned char *iv);
 
-  std::vector<unsigned char> EncryptECB(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key);
+  /// CTR (NIST SP 800-38A): iv is the first counter block, incremented as a
+  /// 128-bit big-endian integer. inLen needs no padding, and decryption is
+  /// the same operation.
+  unsigned char *EncryptCTR(const unsigned char in[], unsigned int inLen,
+                            const unsigned char key[], const unsigned char *iv);
+
+  unsigned char *DecryptCTR(const unsigned char in[], unsigned int inLen,
+                            const unsigned char key[], const unsigned char *iv);
 
-  std::vector<unsigned char> DecryptECB(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key);
+  /// GCM (NIST SP 800-38D): CTR encryption, and a 16-byte tag that
+  /// authenticates aad and the ciphertext. Any inLen and ivLen > 0 are
+  /// accepted, 12-byte IVs are the fast path. An IV must never be reused
+  /// with the same key.
+  unsigned char *EncryptGCM(const unsigned char in[], unsigned int inLen,
+                            const unsigned char key[], const unsigned char iv[],
+                            unsigned int ivLen, const unsigned char aad[],
+                            unsigned int aadLen, unsigned char tag[]);
+
+  /// throws std::runtime_error, and returns nothing, if the tag does not match
+  unsigned char *DecryptGCM(const unsigned char in[], unsigned int inLen,
+                            const unsigned char key[], const unsigned char iv[],
+                            unsigned int ivLen, const unsigned char aad[],
+                            unsigned int aadLen, const unsigned char tag[]);
+
+  /// the modes above with the round keys of ExpandKey, which throw
+  /// std::invalid_argument for an AESKey of another key length or backend
+  unsigned char *EncryptECB(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys);
+
+  unsigned char *DecryptECB(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys);
 
-  std::vector<unsigned char> EncryptCBC(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key,
-                                        std::vector<unsigned char> iv);
+  unsigned char *EncryptCBC(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
 
-  std::vector<unsigned char> DecryptCBC(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key,
-                                        std::vector<unsigned char> iv);
+  unsigned char *DecryptCBC(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
 
-  std::vector<unsigned char> EncryptCFB(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key,
-                                        std::vector<unsigned char> iv);
+  unsigned char *EncryptCFB(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
 
-  std::vector<unsigned char> DecryptCFB(std::vector<unsigned char> in,
-                                        std::vector<unsigned char> key,
-                                        std::vector<unsigned char> iv);
+  unsigned char *DecryptCFB(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
+
+  unsigned char *EncryptCTR(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
+
+  unsigned char *DecryptCTR(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char *iv);
+
+  unsigned char *EncryptGCM(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char iv[],
+                            unsigned int ivLen, const unsigned char aad[],
+                            unsigned int aadLen, unsigned char tag[]);
+
+  unsigned char *DecryptGCM(const unsigned char in[], unsigned int inLen,
+                            const AESKey &roundKeys, const unsigned char iv[],
+                            unsigned int ivLen, const unsigned char aad[],
+                            unsigned int aadLen, const unsigned char tag[]);
+
+  /// the modes above writing inLen bytes to the caller's out, which may be in
+  /// itself (in-place); they allocate nothing for a buffer of up to 256 KB.
+  /// DecryptGCM zeroes out before it throws.
+  void EncryptECB(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys);
+
+  void DecryptECB(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys);
+
+  void EncryptCBC(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void DecryptCBC(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void EncryptCFB(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void DecryptCFB(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void EncryptCTR(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void DecryptCTR(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char *iv);
+
+  void EncryptGCM(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char iv[], unsigned int ivLen,
+                  const unsigned char aad[], unsigned int aadLen,
+                  unsigned char tag[]);
+
+  void DecryptGCM(const unsigned char in[], unsigned char out[],
+                  unsigned int inLen, const AESKey &roundKeys,
+                  const unsigned char iv[], unsigned int ivLen,
+                  const unsigned char aad[], unsigned int aadLen,
+                  const unsigned char tag[]);
+
+  std::vector<unsigned char> EncryptECB(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key);
+
+  std::vector<unsigned char> DecryptECB(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key);
+
+  std::vector<unsigned char> EncryptCBC(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> DecryptCBC(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> EncryptCFB(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> DecryptCFB(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> EncryptCTR(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> DecryptCTR(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv);
+
+  std::vector<unsigned char> EncryptGCM(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv,
+                                        const std::vector<unsigned char> &aad,
+                                        std::vector<unsigned char> &tag);
+
+  std::vector<unsigned char> DecryptGCM(const std::vector<unsigned char> &in,
+                                        const std::vector<unsigned char> &key,
+                                        const std::vector<unsigned char> &iv,
+                                        const std::vector<unsigned char> &aad,
+                                        const std::vector<unsigned char> &tag);
 
   void printHexArray(unsigned char a[], unsigned int n);
 
   void printHexVector(std::vector<unsigned char> a);
 };
 
+/// modes of AESEncryptor and AESDecryptor
+enum class AESMode { CBC, CFB, CTR, GCM };
+
+/// Encryption or decryption of a message of any length, fed in pieces of any
+/// size to Update() and completed by Final(). CBC pads the message with
+/// PKCS#7; CFB, CTR and GCM need no padding, their output is as long as their
+/// input. At most one block is kept between calls (CBC decryption holds back
+/// the last one for its padding), so the memory does not grow with the
+/// message, and the output of Update() may lag its input by up to a block:
+/// out needs room for inLen + 16 bytes in Update() and 16 bytes in Final(),
+/// and must not overlap in. The AES object and key are copied.
+class AESStream {
+ public:
+  /// returns the number of bytes written to out
+  size_t Update(const unsigned char in[], size_t inLen, unsigned char out[]);
+
+ protected:
+  AESStream(const AES &aes, AESMode mode, bool decrypt, const AESKey &roundKeys,
+            const unsigned char iv[], unsigned int ivLen,
+            const unsigned char aad[], unsigned int aadLen);
+
+  size_t Finish(unsigned char out[], unsigned char tag[],
+                const unsigned char expectedTag[]);
+
+ private:
+  static constexpr unsigned int blockBytesLen = 16;
+
+  void Process(const unsigned char in[], unsigned char out[], size_t len);
+
+  AES aes;
+  AESKey roundKeys;
+  AESMode mode;
+  bool decrypt;
+  bool finished = false;
+
+  /// the previous ciphertext block (CBC, CFB), or the next counter block
+  /// (CTR, GCM)
+  unsigned char chain[blockBytesLen];
+  unsigned char pending[blockBytesLen];
+  unsigned int pendingLen = 0;
+
+  /// GCM: the hash key, the pre-counter block, the hash so far and the
+  /// lengths for the last hash block
+  unsigned char h[blockBytesLen];
+  unsigned char j0[blockBytesLen];
+  unsigned char s[blockBytesLen];
+  uint64_t aadBytes = 0;
+  uint64_t dataBytes = 0;
+};
+
+class AESEncryptor : public AESStream {
+ public:
+  /// iv is the IV (CBC, CFB), the first counter block (CTR), or the GCM IV
+  /// of ivLen bytes with aad authenticated along
+  AESEncryptor(const AES &aes, AESMode mode, const AESKey &roundKeys,
+               const unsigned char iv[], unsigned int ivLen = 16,
+               const unsigned char aad[] = nullptr, unsigned int aadLen = 0)
+      : AESStream(aes, mode, false, roundKeys, iv, ivLen, aad, aadLen) {}
+
+  /// returns the number of bytes written to out; GCM writes its 16-byte tag
+  size_t Final(unsigned char out[], unsigned char tag[] = nullptr) {
+    return Finish(out, tag, nullptr);
+  }
+};
+
+class AESDecryptor : public AESStream {
+ public:
+  AESDecryptor(const AES &aes, AESMode mode, const AESKey &roundKeys,
+               const unsigned char iv[], unsigned int ivLen = 16,
+               const unsigned char aad[] = nullptr, unsigned int aadLen = 0)
+      : AESStream(aes, mode, true, roundKeys, iv, ivLen, aad, aadLen) {}
+
+  /// returns the number of bytes written to out. Throws std::runtime_error
+  /// if the CBC padding or the GCM tag is wrong, and std::length_error if a
+  /// CBC ciphertext is not made of whole blocks; the output of Update() is
+  /// not authenticated before Final() returns.
+  size_t Final(unsigned char out[], const unsigned char tag[] = nullptr) {
+    return Finish(out, nullptr, tag);
+  }
+};
+
 const unsigned char sbox[16][16] = {
     {0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
      0xfe, 0xd7, 0xab, 0x76},
@@ -0,0 +1,189 @@
+#include "SHA256.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline uint32_t Rotr(uint32_t x, unsigned int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+}  // namespace
+
+SHA256::SHA256() {
+  static const uint32_t h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                 0x1f83d9ab, 0x5be0cd19};
+  memcpy(state, h0, sizeof(state));
+}
+
+void SHA256::Update(const unsigned char data[], size_t len) {
+  totalLen += len;
+  if (bufferLen > 0) {
+    const size_t n = std::min<size_t>(blockBytesLen - bufferLen, len);
+    memcpy(buffer + bufferLen, data, n);
+    bufferLen += n;
+    data += n;
+    len -= n;
+    if (bufferLen < blockBytesLen) {
+      return;
+    }
+    Transform(buffer);
+    bufferLen = 0;
+  }
+  for (; len >= blockBytesLen; data += blockBytesLen, len -= blockBytesLen) {
+    Transform(data);
+  }
+  if (len > 0) {
+    memcpy(buffer, data, len);
+  }
+  bufferLen = len;
+}
+
+void SHA256::Final(unsigned char digest[]) {
+  // a 1 bit, zeros up to 56 bytes of the last block, and the bit length
+  const uint64_t bits = totalLen * 8;
+  unsigned char pad[blockBytesLen + 8] = {0x80};
+  const unsigned int padLen = (bufferLen < 56 ? 56 : 120) - bufferLen;
+  for (unsigned int i = 0; i < 8; i++) {
+    pad[padLen + i] = (unsigned char)(bits >> (56 - 8 * i));
+  }
+  Update(pad, padLen + 8);
+  for (unsigned int i = 0; i < 8; i++) {
+    digest[4 * i] = (unsigned char)(state[i] >> 24);
+    digest[4 * i + 1] = (unsigned char)(state[i] >> 16);
+    digest[4 * i + 2] = (unsigned char)(state[i] >> 8);
+    digest[4 * i + 3] = (unsigned char)state[i];
+  }
+}
+
+void SHA256::Hash(const unsigned char data[], size_t len,
+                  unsigned char digest[]) {
+  SHA256 sha;
+  sha.Update(data, len);
+  sha.Final(digest);
+}
+
+void SHA256::Transform(const unsigned char block[]) {
+  uint32_t w[64];
+  for (unsigned int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+           ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for (unsigned int i = 16; i < 64; i++) {
+    const uint32_t s0 =
+        Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 =
+        Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (unsigned int i = 0; i < 64; i++) {
+    const uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+    const uint32_t ch = (e & f) ^ (~e & g);
+    const uint32_t t1 = h + s1 + ch + K[i] + w[i];
+    const uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+    const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void HmacSha256(const unsigned char key[], size_t keyLen,
+                const unsigned char data[], size_t len, unsigned char mac[]) {
+  // keys longer than a block are hashed first, shorter ones padded with zeros
+  unsigned char k[SHA256::blockBytesLen] = {0};
+  if (keyLen > SHA256::blockBytesLen) {
+    SHA256::Hash(key, keyLen, k);
+  } else {
+    memcpy(k, key, keyLen);
+  }
+
+  unsigned char pad[SHA256::blockBytesLen];
+  unsigned char inner[SHA256::digestBytesLen];
+  for (unsigned int i = 0; i < SHA256::blockBytesLen; i++) {
+    pad[i] = k[i] ^ 0x36;
+  }
+  SHA256 sha;
+  sha.Update(pad, SHA256::blockBytesLen);
+  sha.Update(data, len);
+  sha.Final(inner);
+
+  for (unsigned int i = 0; i < SHA256::blockBytesLen; i++) {
+    pad[i] = k[i] ^ 0x5c;
+  }
+  SHA256 outer;
+  outer.Update(pad, SHA256::blockBytesLen);
+  outer.Update(inner, SHA256::digestBytesLen);
+  outer.Final(mac);
+}
+
+void HkdfExtract(const unsigned char salt[], size_t saltLen,
+                 const unsigned char ikm[], size_t ikmLen,
+                 unsigned char prk[]) {
+  // no salt means a salt of 32 zeros
+  static const unsigned char zeros[SHA256::digestBytesLen] = {0};
+  if (saltLen == 0) {
+    HmacSha256(zeros, SHA256::digestBytesLen, ikm, ikmLen, prk);
+  } else {
+    HmacSha256(salt, saltLen, ikm, ikmLen, prk);
+  }
+}
+
+void HkdfExpand(const unsigned char prk[], const unsigned char info[],
+                size_t infoLen, unsigned char okm[], size_t okmLen) {
+  if (okmLen > 255 * SHA256::digestBytesLen) {
+    throw std::length_error("HKDF output must be at most 8160 bytes");
+  }
+  // T(i) = HMAC(PRK, T(i - 1) || info || i), T(0) is empty
+  std::vector<unsigned char> input(SHA256::digestBytesLen + infoLen + 1);
+  unsigned char t[SHA256::digestBytesLen];
+  size_t tLen = 0;
+  for (unsigned int i = 1; okmLen > 0; i++) {
+    memcpy(input.data(), t, tLen);
+    if (infoLen > 0) {
+      memcpy(input.data() + tLen, info, infoLen);
+    }
+    input[tLen + infoLen] = (unsigned char)i;
+    HmacSha256(prk, SHA256::digestBytesLen, input.data(), tLen + infoLen + 1,
+               t);
+    tLen = SHA256::digestBytesLen;
+    const size_t n = std::min<size_t>(okmLen, tLen);
+    memcpy(okm, t, n);
+    okm += n;
+    okmLen -= n;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/// SHA-256 of FIPS 180-4, fed by Update() in pieces of any size
+class SHA256 {
+ public:
+  static constexpr unsigned int digestBytesLen = 32;
+  static constexpr unsigned int blockBytesLen = 64;
+
+  SHA256();
+
+  void Update(const unsigned char data[], size_t len);
+
+  /// writes the 32-byte digest; the object must not be updated afterwards
+  void Final(unsigned char digest[]);
+
+  static void Hash(const unsigned char data[], size_t len,
+                   unsigned char digest[]);
+
+ private:
+  void Transform(const unsigned char block[]);
+
+  uint32_t state[8];
+  unsigned char buffer[blockBytesLen];
+  unsigned int bufferLen = 0;
+  uint64_t totalLen = 0;
+};
+
+/// HMAC-SHA256 of RFC 2104, writes a 32-byte mac
+void HmacSha256(const unsigned char key[], size_t keyLen,
+                const unsigned char data[], size_t len, unsigned char mac[]);
+
+/// HKDF-SHA256 of RFC 5869: Extract turns the input keying material into a
+/// 32-byte pseudorandom key, Expand stretches that into okmLen bytes (at most
+/// 255 * 32) bound to info
+void HkdfExtract(const unsigned char salt[], size_t saltLen,
+                 const unsigned char ikm[], size_t ikmLen,
+                 unsigned char prk[]);
+
+void HkdfExpand(const unsigned char prk[], const unsigned char info[],
+                size_t infoLen, unsigned char okm[], size_t okmLen);
+
+#endif
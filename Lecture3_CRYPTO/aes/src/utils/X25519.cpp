@@ -0,0 +1,262 @@
+#include "X25519.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+/// an element of GF(2^255 - 19) as five 51-bit limbs, little-endian; the
+/// limbs may exceed 51 bits between operations
+typedef uint64_t Fe[5];
+typedef unsigned __int128 uint128_t;
+
+const uint64_t mask51 = ((uint64_t)1 << 51) - 1;
+
+inline uint64_t Load64(const unsigned char *p) {
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; i--) {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+inline void Store64(unsigned char *p, uint64_t x) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (unsigned char)(x >> (8 * i));
+  }
+}
+
+/// the top bit of the u-coordinate is ignored
+void FeFromBytes(Fe h, const unsigned char s[]) {
+  h[0] = Load64(s) & mask51;
+  h[1] = (Load64(s + 6) >> 3) & mask51;
+  h[2] = (Load64(s + 12) >> 6) & mask51;
+  h[3] = (Load64(s + 19) >> 1) & mask51;
+  h[4] = (Load64(s + 24) >> 12) & mask51;
+}
+
+/// the unique representative below p
+void FeToBytes(unsigned char s[], const Fe f) {
+  uint64_t t[5] = {f[0], f[1], f[2], f[3], f[4]};
+  for (int pass = 0; pass < 2; pass++) {
+    t[1] += t[0] >> 51;
+    t[0] &= mask51;
+    t[2] += t[1] >> 51;
+    t[1] &= mask51;
+    t[3] += t[2] >> 51;
+    t[2] &= mask51;
+    t[4] += t[3] >> 51;
+    t[3] &= mask51;
+    t[0] += 19 * (t[4] >> 51);
+    t[4] &= mask51;
+  }
+  // t is below 2^255 now; adding 19 carries into bit 255 iff t >= p
+  t[0] += 19;
+  t[1] += t[0] >> 51;
+  t[0] &= mask51;
+  t[2] += t[1] >> 51;
+  t[1] &= mask51;
+  t[3] += t[2] >> 51;
+  t[2] &= mask51;
+  t[4] += t[3] >> 51;
+  t[3] &= mask51;
+  t[0] += 19 * (t[4] >> 51);
+  t[4] &= mask51;
+  // add 2^255 - 19 to undo the 19 and drop bit 255
+  t[0] += mask51 + 1 - 19;
+  t[1] += mask51;
+  t[2] += mask51;
+  t[3] += mask51;
+  t[4] += mask51;
+  t[1] += t[0] >> 51;
+  t[0] &= mask51;
+  t[2] += t[1] >> 51;
+  t[1] &= mask51;
+  t[3] += t[2] >> 51;
+  t[2] &= mask51;
+  t[4] += t[3] >> 51;
+  t[3] &= mask51;
+  t[4] &= mask51;
+
+  Store64(s, t[0] | (t[1] << 51));
+  Store64(s + 8, (t[1] >> 13) | (t[2] << 38));
+  Store64(s + 16, (t[2] >> 26) | (t[3] << 25));
+  Store64(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+inline void FeAdd(Fe h, const Fe f, const Fe g) {
+  for (int i = 0; i < 5; i++) {
+    h[i] = f[i] + g[i];
+  }
+}
+
+/// f - g + 8p, so the limbs stay positive for limbs of g below 2^54
+inline void FeSub(Fe h, const Fe f, const Fe g) {
+  h[0] = f[0] + 0x3fffffffffff68ULL - g[0];
+  for (int i = 1; i < 5; i++) {
+    h[i] = f[i] + 0x3ffffffffffff8ULL - g[i];
+  }
+}
+
+/// carries the 128-bit limb products down to limbs of about 51 bits;
+/// 2^255 = 19 mod p folds the top carry back into the lowest limb
+inline void FeCarry(Fe h, uint128_t r[5]) {
+  r[1] += r[0] >> 51;
+  r[2] += r[1] >> 51;
+  r[3] += r[2] >> 51;
+  r[4] += r[3] >> 51;
+  const uint128_t h0 = ((uint64_t)r[0] & mask51) + 19 * (r[4] >> 51);
+  h[1] = ((uint64_t)r[1] & mask51) + (uint64_t)(h0 >> 51);
+  h[0] = (uint64_t)h0 & mask51;
+  h[2] = (uint64_t)r[2] & mask51;
+  h[3] = (uint64_t)r[3] & mask51;
+  h[4] = (uint64_t)r[4] & mask51;
+}
+
+void FeMul(Fe h, const Fe f, const Fe g) {
+  const uint64_t g1 = 19 * g[1], g2 = 19 * g[2], g3 = 19 * g[3],
+                 g4 = 19 * g[4];
+  uint128_t r[5];
+  r[0] = (uint128_t)f[0] * g[0] + (uint128_t)f[1] * g4 +
+         (uint128_t)f[2] * g3 + (uint128_t)f[3] * g2 + (uint128_t)f[4] * g1;
+  r[1] = (uint128_t)f[0] * g[1] + (uint128_t)f[1] * g[0] +
+         (uint128_t)f[2] * g4 + (uint128_t)f[3] * g3 + (uint128_t)f[4] * g2;
+  r[2] = (uint128_t)f[0] * g[2] + (uint128_t)f[1] * g[1] +
+         (uint128_t)f[2] * g[0] + (uint128_t)f[3] * g4 + (uint128_t)f[4] * g3;
+  r[3] = (uint128_t)f[0] * g[3] + (uint128_t)f[1] * g[2] +
+         (uint128_t)f[2] * g[1] + (uint128_t)f[3] * g[0] +
+         (uint128_t)f[4] * g4;
+  r[4] = (uint128_t)f[0] * g[4] + (uint128_t)f[1] * g[3] +
+         (uint128_t)f[2] * g[2] + (uint128_t)f[3] * g[1] +
+         (uint128_t)f[4] * g[0];
+  FeCarry(h, r);
+}
+
+inline void FeSquare(Fe h, const Fe f) {
+  FeMul(h, f, f);
+}
+
+/// n squarings in a row
+void FeSquareTimes(Fe h, const Fe f, int n) {
+  FeSquare(h, f);
+  for (int i = 1; i < n; i++) {
+    FeSquare(h, h);
+  }
+}
+
+void FeMulSmall(Fe h, const Fe f, uint64_t c) {
+  uint128_t r[5];
+  for (int i = 0; i < 5; i++) {
+    r[i] = (uint128_t)f[i] * c;
+  }
+  FeCarry(h, r);
+}
+
+/// f^(p - 2) = 1 / f, by the addition chain of 254 squarings and 11
+/// multiplications
+void FeInvert(Fe out, const Fe z) {
+  Fe a, b, c, t;
+  FeSquare(a, z);               // 2
+  FeSquareTimes(t, a, 2);       // 8
+  FeMul(b, t, z);               // 9
+  FeMul(a, b, a);               // 11
+  FeSquare(t, a);               // 22
+  FeMul(b, t, b);               // 2^5 - 1
+  FeSquareTimes(t, b, 5);       // 2^10 - 2^5
+  FeMul(b, t, b);               // 2^10 - 1
+  FeSquareTimes(t, b, 10);      // 2^20 - 2^10
+  FeMul(c, t, b);               // 2^20 - 1
+  FeSquareTimes(t, c, 20);      // 2^40 - 2^20
+  FeMul(t, t, c);               // 2^40 - 1
+  FeSquareTimes(t, t, 10);      // 2^50 - 2^10
+  FeMul(b, t, b);               // 2^50 - 1
+  FeSquareTimes(t, b, 50);      // 2^100 - 2^50
+  FeMul(c, t, b);               // 2^100 - 1
+  FeSquareTimes(t, c, 100);     // 2^200 - 2^100
+  FeMul(t, t, c);               // 2^200 - 1
+  FeSquareTimes(t, t, 50);      // 2^250 - 2^50
+  FeMul(t, t, b);               // 2^250 - 1
+  FeSquareTimes(t, t, 5);       // 2^255 - 2^5
+  FeMul(out, t, a);             // 2^255 - 21
+}
+
+/// swaps f and g if swap is 1, with the same memory accesses either way
+inline void FeCswap(Fe f, Fe g, uint64_t swap) {
+  const uint64_t mask = 0 - swap;
+  for (int i = 0; i < 5; i++) {
+    const uint64_t x = mask & (f[i] ^ g[i]);
+    f[i] ^= x;
+    g[i] ^= x;
+  }
+}
+
+}  // namespace
+
+void X25519::ScalarMult(const unsigned char scalar[],
+                        const unsigned char point[], unsigned char out[]) {
+  // clamp: a multiple of the cofactor 8, with the top bit 254 set
+  unsigned char k[keyBytesLen];
+  memcpy(k, scalar, keyBytesLen);
+  k[0] &= 248;
+  k[31] &= 127;
+  k[31] |= 64;
+
+  // the Montgomery ladder of RFC 7748, on projective u-coordinates
+  Fe x1, x2 = {1}, z2 = {0}, x3, z3 = {1};
+  FeFromBytes(x1, point);
+  memcpy(x3, x1, sizeof(Fe));
+  uint64_t swap = 0;
+  for (int t = 254; t >= 0; t--) {
+    const uint64_t bit = (k[t >> 3] >> (t & 7)) & 1;
+    swap ^= bit;
+    FeCswap(x2, x3, swap);
+    FeCswap(z2, z3, swap);
+    swap = bit;
+
+    Fe a, aa, b, bb, e, c, d, da, cb;
+    FeAdd(a, x2, z2);
+    FeSquare(aa, a);
+    FeSub(b, x2, z2);
+    FeSquare(bb, b);
+    FeSub(e, aa, bb);
+    FeAdd(c, x3, z3);
+    FeSub(d, x3, z3);
+    FeMul(da, d, a);
+    FeMul(cb, c, b);
+
+    FeAdd(x3, da, cb);
+    FeSquare(x3, x3);
+    FeSub(z3, da, cb);
+    FeSquare(z3, z3);
+    FeMul(z3, z3, x1);
+    FeMul(x2, aa, bb);
+    // z2 = E * (AA + a24 * E), a24 = (486662 - 2) / 4
+    FeMulSmall(z2, e, 121665);
+    FeAdd(z2, z2, aa);
+    FeMul(z2, z2, e);
+  }
+  FeCswap(x2, x3, swap);
+  FeCswap(z2, z3, swap);
+
+  FeInvert(z2, z2);
+  FeMul(x2, x2, z2);
+  FeToBytes(out, x2);
+  memset(k, 0, keyBytesLen);
+}
+
+void X25519::PublicKey(const unsigned char privateKey[],
+                       unsigned char publicKey[]) {
+  static const unsigned char basePoint[keyBytesLen] = {9};
+  ScalarMult(privateKey, basePoint, publicKey);
+}
+
+bool X25519::SharedSecret(const unsigned char privateKey[],
+                          const unsigned char peerPublicKey[],
+                          unsigned char sharedSecret[]) {
+  ScalarMult(privateKey, peerPublicKey, sharedSecret);
+  unsigned char bits = 0;
+  for (unsigned int i = 0; i < keyBytesLen; i++) {
+    bits |= sharedSecret[i];
+  }
+  return bits != 0;
+}
@@ -0,0 +1,27 @@
+#ifndef _X25519_H_
+#define _X25519_H_
+
+/// Diffie-Hellman on Curve25519 of RFC 7748. Private keys are 32 random
+/// bytes (clamped on use), public keys and shared secrets are 32-byte
+/// u-coordinates. The Montgomery ladder takes the same steps and memory
+/// accesses for every key.
+class X25519 {
+ public:
+  static constexpr unsigned int keyBytesLen = 32;
+
+  /// publicKey = privateKey * 9, the base point
+  static void PublicKey(const unsigned char privateKey[],
+                        unsigned char publicKey[]);
+
+  /// sharedSecret = privateKey * peerPublicKey; returns false if it is all
+  /// zeros, i.e. the peer sent a point of small order
+  static bool SharedSecret(const unsigned char privateKey[],
+                           const unsigned char peerPublicKey[],
+                           unsigned char sharedSecret[]);
+
+ private:
+  static void ScalarMult(const unsigned char scalar[],
+                         const unsigned char point[], unsigned char out[]);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HANDSHAKE_HPP
+#define HANDSHAKE_HPP
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "SHA256.h"
+#include "X25519.h"
+
+// 一轮握手中双方各自生成的随机数长度
+extern const size_t HANDSHAKE_RANDOM_BYTES = 16;
+
+// 用std::random_device生成n个随机字节，用作私钥、随机数等
+std::vector<unsigned char> random_bytes(size_t n) {
+    std::random_device rd;
+    std::vector<unsigned char> bytes(n);
+    for (size_t i = 0; i < n; i += 4) {
+        unsigned int r = rd();
+        for (size_t j = i; j < n && j < i + 4; ++j) {
+            bytes[j] = static_cast<unsigned char>(r);
+            r >>= 8;
+        }
+    }
+    return bytes;
+}
+
+// 握手导出的密钥
+struct SessionKeys {
+    std::vector<unsigned char> aes_key;            // AES密钥（128bit）
+    std::vector<unsigned char> aes_iv;             // AES IV（128bit）
+    std::vector<unsigned char> resumption_secret;  // 恢复密钥（256bit），下次握手时由会话票据带回
+};
+
+// 由共享密钥ikm（X25519的共享密钥，或恢复会话时上次的恢复密钥）和双方的随机数，
+// 用HKDF-SHA256导出AES密钥、IV和新的恢复密钥；双方随机数作为salt，每次握手的密钥都不同
+SessionKeys derive_session_keys(const std::vector<unsigned char>& ikm,
+                                const std::vector<unsigned char>& client_random,
+                                const std::vector<unsigned char>& server_random) {
+    std::vector<unsigned char> salt(client_random);
+    salt.insert(salt.end(), server_random.begin(), server_random.end());
+    unsigned char prk[SHA256::digestBytesLen];
+    HkdfExtract(salt.data(), salt.size(), ikm.data(), ikm.size(), prk);
+
+    static const std::string key_info = "DiffieHellman aes key and iv";
+    static const std::string resumption_info = "DiffieHellman resumption";
+    unsigned char okm[32];
+    HkdfExpand(prk, reinterpret_cast<const unsigned char*>(key_info.data()), key_info.size(), okm, 32);
+    SessionKeys keys;
+    keys.aes_key.assign(okm, okm + 16);
+    keys.aes_iv.assign(okm + 16, okm + 32);
+    keys.resumption_secret.resize(SHA256::digestBytesLen);
+    HkdfExpand(prk, reinterpret_cast<const unsigned char*>(resumption_info.data()), resumption_info.size(),
+               keys.resumption_secret.data(), keys.resumption_secret.size());
+    return keys;
+}
+
+#endif // HANDSHAKE_HPP
@@ -0,0 +1,117 @@
+#ifndef SESSION_STORE_HPP
+#define SESSION_STORE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "util.hpp"
+
+// 每个客户端的会话：由Diffie-Hellman密钥交换逐步得到的AES密钥和IV
+struct Session {
+    std::vector<unsigned char> aes_key;  // 前两次交换的共享密钥（128bit）
+    std::vector<unsigned char> aes_iv;   // 后两次交换的共享密钥（128bit）
+    std::chrono::steady_clock::time_point expire_time;
+};
+
+// 会话id到会话的并发映射表
+// 按id分成多个分片，每个分片有自己的锁，不同分片上的操作互不阻塞；
+// 会话在最后一次访问ttl之后过期，过期的会话在访问时或插入时被清除
+class SessionStore {
+public:
+    explicit SessionStore(std::chrono::seconds ttl) : ttl_(ttl) {}
+
+    // 新建会话，返回随机的会话id；一轮握手已经导出了AES密钥和IV，可直接存入
+    uint64_t Create(std::vector<unsigned char> aes_key = {}, std::vector<unsigned char> aes_iv = {}) {
+        std::random_device rd;
+        uint64_t id;
+        do {
+            id = (static_cast<uint64_t>(rd()) << 32) | rd();
+        } while (id == 0);
+
+        Shard& shard = ShardOf(id);
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // 每插入若干次清除一次该分片中过期的会话
+        if (++shard.inserts % EVICT_INTERVAL == 0) {
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+                it = it->second.expire_time <= now ? shard.sessions.erase(it) : std::next(it);
+            }
+        }
+        Session& session = shard.sessions[id];
+        session.aes_key = std::move(aes_key);
+        session.aes_iv = std::move(aes_iv);
+        session.expire_time = now + ttl_;
+        return id;
+    }
+
+    // 把一次密钥交换得到的共享密钥加入会话，先填满AES密钥再填IV
+    // 会话不存在、已过期或密钥和IV都已填满时返回false
+    bool AddSharedKey(uint64_t id, uint64_t shared_secret_key) {
+        Shard& shard = ShardOf(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Session* session = Find(shard, id);
+        if (session == nullptr) {
+            return false;
+        }
+        std::vector<unsigned char>& target = session->aes_key.size() < 16 ? session->aes_key : session->aes_iv;
+        if (target.size() >= 16) {
+            return false;
+        }
+        std::vector<unsigned char> aes_tmp = uint64_to_uint8_vector(shared_secret_key);
+        target.insert(target.end(), aes_tmp.begin(), aes_tmp.end());
+        session->expire_time = std::chrono::steady_clock::now() + ttl_;
+        return true;
+    }
+
+    // 取出会话的AES密钥和IV并删除该会话，一个会话只用于一次传输
+    // 会话不存在、已过期或密钥交换未完成时返回false
+    bool Take(uint64_t id, std::vector<unsigned char>& aes_key, std::vector<unsigned char>& aes_iv) {
+        Shard& shard = ShardOf(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Session* session = Find(shard, id);
+        if (session == nullptr || session->aes_iv.size() < 16) {
+            return false;
+        }
+        aes_key = std::move(session->aes_key);
+        aes_iv = std::move(session->aes_iv);
+        shard.sessions.erase(id);
+        return true;
+    }
+
+private:
+    static constexpr size_t SHARDS = 64;
+    static constexpr size_t EVICT_INTERVAL = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Session> sessions;
+        size_t inserts = 0;
+    };
+
+    Shard& ShardOf(uint64_t id) {
+        return shards_[id % SHARDS];
+    }
+
+    // 查找未过期的会话，过期的会话被删除；调用者需持有分片的锁
+    Session* Find(Shard& shard, uint64_t id) {
+        auto it = shard.sessions.find(id);
+        if (it == shard.sessions.end()) {
+            return nullptr;
+        }
+        if (it->second.expire_time <= std::chrono::steady_clock::now()) {
+            shard.sessions.erase(it);
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    std::chrono::seconds ttl_;
+    std::array<Shard, SHARDS> shards_;
+};
+
+#endif // SESSION_STORE_HPP
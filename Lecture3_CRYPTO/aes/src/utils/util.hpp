@@ -6,8 +6,13 @@
 #include <cstdint>
 #include <vector>
 #include <iomanip>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
 
 extern const int PORT = 50051;
+// 流式加解密时每次处理的数据块大小
+extern const size_t STREAM_CHUNK_BYTES = 64 * 1024;
 
 uint64_t mod_pow(uint64_t base, uint64_t exponent, uint64_t modulus);
 uint64_t sample_random(uint64_t from, uint64_t to);
@@ -65,20 +70,71 @@ std::vector<unsigned char> stringToUnsignedVector(const std::string& str) {
     return vec;  
 }  
 
-void printUnsignedVectorInHex(const std::vector<unsigned char>& vec, const std::string& var_name) {
+// 打印到指定的输出流；多线程时传入局部的std::ostringstream，避免修改std::cout的格式状态
+void printUnsignedVectorInHex(std::ostream& os, const std::vector<unsigned char>& vec, const std::string& var_name) {
     if (!var_name.empty())
-        std::cout << var_name << ": ";
+        os << var_name << ": ";
     size_t idx = 1; 
     for (unsigned char byte : vec) {  
         // 使用 std::hex 设置输出为十六进制格式  
         // 使用 std::setw(2) 和 std::setfill('0') 来确保每个字节占两个字符，不足时前面补0  
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+        os << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
         if (idx%4 == 0) {
-            std::cout << " ";
+            os << " ";
         }
         ++idx;
     }  
-    std::cout << std::dec << std::endl; // 打印完所有字节后换行  
+    os << std::dec << std::setfill(' ') << std::endl; // 打印完所有字节后换行，并恢复格式
 }  
 
+void printUnsignedVectorInHex(const std::vector<unsigned char>& vec, const std::string& var_name) {
+    printUnsignedVectorInHex(std::cout, vec, var_name);
+}
+
+// 有界的阻塞队列，用于在线程之间流水线式地传递数据块
+// Push在队列满时等待，Pop在队列空时等待；Close之后Push失败，Pop取完剩余元素后失败
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::queue<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
 #endif // UTIL_HPP
\ No newline at end of file
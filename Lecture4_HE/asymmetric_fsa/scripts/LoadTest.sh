@@ -0,0 +1,28 @@
+#!/bin/bash
+
+ORIGINAL_DIR=$(pwd)
+cd ../build
+name=Tom
+n=256
+dim=128
+window=16
+seed=1
+query_file=query.bin
+
+# Generate the query workload once, so that every offered load replays the same query objects
+if [ ! -f $query_file ]; then
+    ./datagen --n=$n --dim=$dim --seed=$seed --output=$query_file > /dev/null
+fi
+
+# Report the tail latency and throughput against the offered load (Poisson arrivals)
+for qps in 1 2 4 8 16 32; do
+    echo "qps = ${qps}"
+    ./user --ip-file=../configuration/ip.txt --name=$name --query-file=$query_file --window=$window --qps=$qps --seed=$seed | grep -E "latency mean|throughput"
+
+    if [ ${PIPESTATUS[0]} -ne 0 ]; then  
+        echo "Query user ${name} with qps ${qps} FAIL"  
+        exit 1  
+    fi 
+done
+
+cd "$ORIGINAL_DIR"
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+ORIGINAL_DIR=$(pwd)
+cd ../build
+name=Tom
+n=64
+dim=128
+
+# Report the query throughput against the number of queries in flight
+for window in 1 2 4 8 16; do
+    ./user --ip-file=../configuration/ip.txt --name=$name --n=$n --dim=$dim --window=$window | grep "throughput"
+
+    if [ ${PIPESTATUS[0]} -ne 0 ]; then  
+        echo "Query user ${name} with window ${window} FAIL"  
+        exit 1  
+    fi 
+done
+
+cd "$ORIGINAL_DIR"
@@ -5,8 +5,9 @@ cd ../build
 name=Tom
 n=10
 dim=128
+window=1
 
-./user --ip-file=../configuration/ip.txt --name=$name --n=$n --dim=$dim
+./user --ip-file=../configuration/ip.txt --name=$name --n=$n --dim=$dim --window=$window
 
 if [ $? -ne 0 ]; then  
     echo "Query user ${name} FAIL"  
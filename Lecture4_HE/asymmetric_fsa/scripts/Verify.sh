@@ -0,0 +1,50 @@
+#!/bin/bash
+
+ORIGINAL_DIR=$(pwd)
+cd ../build
+name=Tom
+n=1000
+dim=128
+query_num=100
+window=4
+query_file=query.bin
+answer_file=answer.txt
+# none, sq8 or pq: the accuracy of the quantized scan depends on the number of re-ranked candidates
+quantize=none
+rerank=64
+# number of shards per data holder, e.g., the number of cores
+shards=1
+
+# Generate the datasets of the data holders and the query workload
+silo_num=$(head -n 1 ../configuration/ip.txt)
+data_file_list=""
+for ((silo_id=0; silo_id<silo_num; silo_id++)); do
+    ./datagen --n=$n --dim=$dim --seed=$((silo_id + 1)) --output=silo${silo_id}.bin > /dev/null
+    data_file_list="$data_file_list silo${silo_id}.bin"
+done
+./datagen --n=$query_num --dim=$dim --seed=$((silo_num + 1)) --output=$query_file > /dev/null
+
+# Start the data holders in the order of the IP address file
+holder_pid_list=""
+silo_id=0
+while read ipaddr silo_name; do
+    port=${ipaddr##*:}
+    ./holder --id=$silo_id --ip=localhost --port=$port --name=$silo_name --data-file=silo${silo_id}.bin --quantize=$quantize --rerank=$rerank --shards=$shards > silo${silo_id}.log 2>&1 &
+    holder_pid_list="$holder_pid_list $!"
+    silo_id=$((silo_id + 1))
+done < <(tail -n +2 ../configuration/ip.txt)
+sleep 2
+
+./user --ip-file=../configuration/ip.txt --name=$name --query-file=$query_file --answer-file=$answer_file --window=$window > user.log
+status=$?
+kill $holder_pid_list
+
+if [ $status -ne 0 ]; then  
+    echo "Query user ${name} FAIL"  
+    exit 1  
+fi 
+
+# Compare the query answers with the exact nearest neighbors
+./verifier --query-file=$query_file --data-file $data_file_list --answer-file=$answer_file
+
+cd "$ORIGINAL_DIR"
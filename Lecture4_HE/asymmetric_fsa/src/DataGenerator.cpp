@@ -0,0 +1,89 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <exception>
+
+#include <boost/program_options.hpp>
+namespace bpo = boost::program_options;
+
+#include "utils/DataType.hpp"
+#include "utils/VectorFile.hpp"
+
+/*
+Generate a vector file (dataset or query workload) with values drawn uniformly from [1, 100],
+which is the same distribution used by the data holders and the query user.
+*/
+void GenerateVectorFile(const int n, const int dim, const unsigned int seed, const std::string& output_filename) {
+    if (n <= 0) {
+        throw std::invalid_argument("n must be a positive integer");
+    }
+    if (dim <= 1) {
+        throw std::invalid_argument("dim must be larger than 1");
+    }
+
+    const int base = 100;
+    std::random_device rd;
+    std::mt19937_64 eng((seed == 0) ? rd() : seed);
+    VectorValueDistribution distribution(1, base);
+
+    VectorFileWriter writer(output_filename, dim);
+    VectorDataType vector_data(dim);
+    for (int data_id=0; data_id<n; ++data_id) {
+        for (int j=0; j<dim; ++j) {
+            vector_data.data[j] = distribution(eng);
+        }
+        vector_data.SetVid(data_id);
+        writer.Append(vector_data);
+        if (data_id < 10)
+            std::cout << "Data " << vector_data.to_string() << std::endl;
+        else if (data_id == 10)
+            std::cout << "Data ......" << std::endl;
+    }
+    writer.Close();
+
+    std::cout << "Write " << n << " vectors of dimension " << dim << " into " << output_filename << std::endl;
+}
+
+int main(int argc, char** argv) {
+    // Expect the following args: --n=1000 --dim=128 --output=query.bin
+    int n, dim;
+    unsigned int seed;
+    std::string output_filename;
+
+    try {
+        bpo::options_description option_description("Required options");
+        option_description.add_options()
+            ("help", "produce help message")
+            ("n", bpo::value<int>(&n)->default_value(1000), "Number of vectors")
+            ("dim", bpo::value<int>(&dim)->default_value(128), "Dimension of vectors")
+            ("seed", bpo::value<unsigned int>(&seed)->default_value(0), "Random seed (0 for a random seed)")
+            ("output", bpo::value<std::string>(), "Output vector file")
+        ;
+
+        bpo::variables_map variable_map;
+        bpo::store(bpo::parse_command_line(argc, argv, option_description), variable_map);
+        bpo::notify(variable_map);
+
+        if (variable_map.count("help")) {
+            std::cout << option_description << std::endl;
+            return 0;
+        }
+
+        if (variable_map.count("output")) {
+            output_filename = variable_map["output"].as<std::string>();
+            std::cout << "Output vector file was set to " << output_filename << "\n";
+        } else {
+            throw std::invalid_argument("Output vector file was not set");
+        }
+
+        GenerateVectorFile(n, dim, seed, output_filename);
+
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
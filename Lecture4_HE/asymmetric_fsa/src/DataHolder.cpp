@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <iterator>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <sstream>
@@ -9,6 +11,9 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
 #include <cctype>
 #include <cstdlib>
 #include <random>
@@ -22,10 +27,21 @@
 namespace bpo = boost::program_options;
 
 #include <grpcpp/grpcpp.h>
+#include <google/protobuf/io/coded_stream.h>
 #include "seal/seal.h"
 
 #include "utils/BenchLogger.hpp"
 #include "utils/DataType.hpp"
+#include "utils/VectorFile.hpp"
+#include "utils/ShardPool.hpp"
+#include "utils/ShardedVectorStore.hpp"
+#include "utils/Quantizer.hpp"
+#include "utils/Snapshot.hpp"
+#include "utils/PackedVector.hpp"
+#include "utils/HeScheme.hpp"
+// count the heap allocations of the HE paths, see BenchLogger's "HE heap" counters
+#define ALLOC_COUNTER_REPLACE_NEW
+#include "utils/AllocCounter.hpp"
 #include "FedSql.grpc.pb.h"
 
 
@@ -46,6 +62,14 @@ using FedSql::FedSqlService;
 using FedSql::QueryObject;
 using FedSql::EncryptDistance;
 using FedSql::QueryAnswer;
+using FedSql::QueryId;
+using FedSql::PerturbRequest;
+using FedSql::VectorBatch;
+using FedSql::VidList;
+using FedSql::UpdateReply;
+using FedSql::RangeQuery;
+using FedSql::RangeFetch;
+using FedSql::AnswerChunk;
 
 
 // #define LOCAL_DEBUG
@@ -62,16 +86,23 @@ using Encryptor = seal::Encryptor;
 using Evaluator = seal::Evaluator;
 using Decryptor = seal::Decryptor;
 using BatchEncoder = seal::BatchEncoder;
+using CKKSEncoder = seal::CKKSEncoder;
 using scheme_type = seal::scheme_type;
 using CoeffModulus = seal::CoeffModulus;
 using PlainModulus = seal::PlainModulus;
 using Plaintext = seal::Plaintext;
 using Ciphertext = seal::Ciphertext;
+using MemoryPoolHandle = seal::MemoryPoolHandle;
 
 public:
-    explicit FedSqlImpl(const int silo_id, const std::string& silo_ipaddr, const std::string& silo_name)
-                        : m_silo_id(silo_id), m_silo_ipaddr(silo_ipaddr), m_silo_name(silo_name) {
-
+    explicit FedSqlImpl(const int silo_id, const std::string& silo_ipaddr, const std::string& silo_name, const size_t shard_num=1, const HeScheme scheme=HeScheme::BGV)
+                        : m_silo_id(silo_id), m_silo_ipaddr(silo_ipaddr), m_silo_name(silo_name), m_scheme(scheme) {
+
+        m_shard_pool = std::make_unique<ShardPool>(shard_num);
+        m_store = std::make_unique<ShardedVectorStore>(*m_shard_pool);
+        m_rerank = 0;
+        m_update_count = 0;
+        m_saved_update_count = 0;
         m_logger.Init();
         m_InitSealParams();
     }
@@ -85,53 +116,232 @@ public:
         }
 
         m_dim = dim;
-        m_data_list.clear();
-        std::vector<VectorDimensionType> arr(dim);
-        const int base = 100;
-        std::random_device rd;  // 用于获取随机数种子  
-        std::default_random_engine eng(rd());  // 使用随机种子初始化引擎  
-        // 创建均匀分布的整数随机数生成器，范围在 [1, 100]  
-        std::uniform_int_distribution<> distribution(1, base);  
+        m_data_source = m_DataSource("", n, dim);
+        // each shard generates its own range of the dataset on its worker
+        m_store->Load(dim, n, [dim](const VidType begin, const VidType end) {
+            std::vector<VectorDataType> data_list;
+            std::vector<VectorDimensionType> arr(dim);
+            const int base = 100;
+            std::random_device rd;  // 用于获取随机数种子  
+            std::default_random_engine eng(rd());  // 使用随机种子初始化引擎  
+            // 创建均匀分布的整数随机数生成器，范围在 [1, 100]  
+            VectorValueDistribution distribution(1, base);  
+
+            data_list.reserve(end - begin);
+            for (VidType data_id=begin; data_id<end; ++data_id) {
+                for (int j=0; j<dim; ++j) {
+                    arr[j] = distribution(eng);
+                }
+                data_list.emplace_back(dim, data_id, arr);
+                if (data_id < 10)
+                    std::cout << "Data " << data_list.back().to_string() << std::endl;
+                else if (data_id == 10)
+                    std::cout << "Data ......" << std::endl;
+            }
+            return data_list;
+        });
+        std::cout << "Generate " << n << " data objects of dimension " << dim << " in " << m_store->ShardNum() << " shards" << std::endl;
+    }
 
-        for (int data_id=0; data_id<n; ++data_id) {
-            for (int j=0; j<dim; ++j) {
-                arr[j] = distribution(eng);
+    /*
+    Load the dataset from a vector file, so that the query answers can be verified against the same data.
+    */
+    void InitDataHolder(const std::string& data_filename) {
+        VectorFileReader data_file(data_filename);
+        const int n = data_file.Size();
+        const int dim = data_file.Dimension();
+        if (n <= 0) {
+            throw std::invalid_argument("There are no data objects in " + data_filename);
+        }
+        if (dim <= 1) {
+            throw std::invalid_argument("dim must be larger than 1");
+        }
+
+        m_dim = dim;
+        m_data_source = m_DataSource(data_filename, n, dim);
+        m_store->Load(dim, n, [&data_file](const VidType begin, const VidType end) {
+            std::vector<VectorDataType> data_list;
+            data_list.reserve(end - begin);
+            for (VidType data_id=begin; data_id<end; ++data_id) {
+                data_list.emplace_back(data_file.GetVector(data_id, data_id));
+                if (data_id < 10)
+                    std::cout << "Data " << data_list.back().to_string() << std::endl;
+                else if (data_id == 10)
+                    std::cout << "Data ......" << std::endl;
             }
-            VectorDataType vector_data(dim, data_id, arr);
-            m_data_list.emplace_back(vector_data);
-            if (data_id < 10)
-                std::cout << "Data " <<vector_data.to_string() << std::endl;
-            else if (data_id == 10)
-                std::cout << "Data ......" << std::endl;
+            return data_list;
+        });
+        std::cout << "Load " << n << " data objects of dimension " << dim << " from " << data_filename << " in " << m_store->ShardNum() << " shards" << std::endl;
+    }
+
+    /*
+    Keep only the quantized codes in memory. The local scan picks the top-``rerank`` candidates by the approximate distance,
+    and re-ranks them with the exact distances of the full-precision vectors, which stay in the data file on disk.
+    */
+    void InitDataHolder(const std::string& data_filename, const QuantizerType quantizer_type, const size_t pq_subspace_num, const size_t rerank) {
+        if (rerank == 0) {
+            throw std::invalid_argument("rerank must be a positive integer");
+        }
+        m_data_file = std::make_unique<VectorFileReader>(data_filename);
+        const size_t n = m_data_file->Size(), dim = m_data_file->Dimension();
+        if (n == 0) {
+            throw std::invalid_argument("There are no data objects in " + data_filename);
         }
 
-        m_local_nn.data.reserve(m_dim);
-        m_local_nn.data.resize(m_dim);
-        m_query_data.data.reserve(m_dim);
-        m_query_data.data.resize(m_dim);
+        m_dim = dim;
+        m_rerank = rerank;
+        m_quantized_index = std::make_unique<QuantizedIndex>(*m_data_file, quantizer_type, (pq_subspace_num == 0) ? dim/8 : pq_subspace_num);
+        std::cout << "Quantize " << n << " data objects of dimension " << dim << " from " << data_filename << " with " << QuantizerName(quantizer_type)
+                    << ": " << m_quantized_index->CodeBytes()/1024.0 << " [KB] of codes instead of " << n*dim*sizeof(VectorDimensionType)/1024.0 << " [KB]" << std::endl;
+    }
+
+    /*
+    Snapshot the dataset (or the quantizer and its codes) into snapshot_dir, so that a restart restores it instead of rebuilding it.
+    */
+    void SetSnapshotDir(const std::string& snapshot_dir) {
+        m_snapshot_filename = SnapshotPath(snapshot_dir, "holder-" + m_silo_name);
+    }
+
+    /*
+    Restore the data holder from its snapshot, and return false if there is no usable snapshot.
+    A quantized snapshot needs the same quantizer and the data file that it was built from, for the exact re-rank.
+    A full-precision snapshot needs the same data file (or the same n and dim for random data) as the one it was built from.
+    */
+    bool RestoreSnapshot(const int n, const int dim, const std::string& data_filename, const QuantizerType quantizer_type, const size_t rerank) {
+        if (m_snapshot_filename.empty() || !SnapshotReader::Exists(m_snapshot_filename)) {
+            return false;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        SnapshotReader reader(m_snapshot_filename);
+        // a snapshot is only usable with the same encryption parameters
+        std::pair<const char*, size_t> parms_section = reader.Section("seal.parms");
+        if (!SameSealParams(parms_section.first, parms_section.second, m_parms)) {
+            std::cout << "Snapshot " << m_snapshot_filename << " has other encryption parameters, rebuild it" << std::endl;
+            return false;
+        }
+        if ((QuantizerType)reader.GetValue<uint32_t>("holder.quantizer") != quantizer_type) {
+            std::cout << "Snapshot " << m_snapshot_filename << " has another quantizer, rebuild it" << std::endl;
+            return false;
+        }
+        const size_t snapshot_dim = reader.GetValue<uint64_t>("holder.dim");
+
+        if (quantizer_type != QuantizerType::NONE) {
+            if (rerank == 0) {
+                throw std::invalid_argument("rerank must be a positive integer");
+            }
+            auto data_file = std::make_unique<VectorFileReader>(data_filename);
+            auto quantized_index = std::make_unique<QuantizedIndex>(reader);
+            if (data_file->Dimension() != snapshot_dim || data_file->Size() != quantized_index->Size()) {
+                std::cout << "Snapshot " << m_snapshot_filename << " was built from another data file, rebuild it" << std::endl;
+                return false;
+            }
+            m_data_file = std::move(data_file);
+            m_quantized_index = std::move(quantized_index);
+            m_rerank = rerank;
+        } else {
+            const std::string data_source = m_DataSource(data_filename, n, dim);
+            std::string snapshot_source;
+            if (reader.Has("holder.source")) {
+                std::pair<const char*, size_t> source_section = reader.Section("holder.source");
+                snapshot_source.assign(source_section.first, source_section.second);
+            }
+            if (snapshot_source != data_source) {
+                std::cout << "Snapshot " << m_snapshot_filename << " was built from another dataset, rebuild it" << std::endl;
+                return false;
+            }
+            m_data_source = data_source;
+            std::pair<const VidType*, size_t> vid_array = reader.GetArray<VidType>("store.vid");
+            std::pair<const VectorDimensionType*, size_t> data_array = reader.GetArray<VectorDimensionType>("store.data");
+            const size_t snapshot_n = vid_array.second;
+            if (data_array.second != snapshot_n * snapshot_dim) {
+                throw std::invalid_argument("Invalid dataset in snapshot " + m_snapshot_filename);
+            }
+            // each shard copies its rows out of the mapping on its own worker
+            m_store->Load(snapshot_dim, snapshot_n, [&vid_array, &data_array, snapshot_dim](const size_t begin, const size_t end) {
+                std::vector<VectorDataType> data_list;
+                data_list.reserve(end - begin);
+                for (size_t i=begin; i<end; ++i) {
+                    data_list.emplace_back(snapshot_dim, vid_array.first[i]);
+                    std::copy_n(data_array.first + i * snapshot_dim, snapshot_dim, data_list.back().data.begin());
+                }
+                return data_list;
+            });
+        }
+        m_dim = snapshot_dim;
+
+        double restore_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Restore data holder from " << m_snapshot_filename << " in " << restore_time << " [ms]" << std::endl;
+        return true;
+    }
+
+    /*
+    Write the snapshot, skip it if only_if_updated and the dataset has not been updated since the last snapshot.
+    */
+    void SaveSnapshot(const bool only_if_updated=false) {
+        // the updates after this point go into the next snapshot
+        const uint64_t update_count = m_update_count;
+        if (m_snapshot_filename.empty() || (only_if_updated && update_count == m_saved_update_count)) {
+            return;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+
+        SnapshotWriter writer(m_snapshot_filename);
+        std::stringstream parms_sstream;
+        m_parms.save(parms_sstream, seal::compr_mode_type::none);
+        writer.AddSection("seal.parms", parms_sstream.str());
+        writer.AddValue<uint64_t>("holder.dim", m_dim);
+
+        if (m_quantized_index != nullptr) {
+            writer.AddValue<uint32_t>("holder.quantizer", (uint32_t)m_quantized_index->Type());
+            m_quantized_index->Save(writer);
+        } else {
+            writer.AddValue<uint32_t>("holder.quantizer", (uint32_t)QuantizerType::NONE);
+            writer.AddSection("holder.source", m_data_source);
+            // the snapshots keep the segments alive while they are written, the updates meanwhile go into the next snapshot
+            std::vector<std::shared_ptr<const VectorSnapshot>> snapshot_list = m_store->GetSnapshotList();
+            writer.BeginSection("store.vid");
+            for (const auto& snapshot : snapshot_list) {
+                snapshot->ForEach([&writer](const VectorDataType& vector_data) {
+                    writer.Append(&vector_data.vid, sizeof(VidType));
+                });
+            }
+            writer.EndSection();
+            writer.BeginSection("store.data");
+            for (const auto& snapshot : snapshot_list) {
+                snapshot->ForEach([&writer](const VectorDataType& vector_data) {
+                    writer.Append(vector_data.data.data(), vector_data.data.size() * sizeof(VectorDimensionType));
+                });
+            }
+            writer.EndSection();
+        }
+        writer.Commit();
+        // only a committed snapshot keeps the updates, a failed one is retried by the next save
+        m_saved_update_count = update_count;
+
+        double save_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Save data holder to " << m_snapshot_filename << " in " << save_time << " [ms]" << std::endl;
     }
 
     Status BroadcastQueryObject(ServerContext* context,
                                 const QueryObject* request,
                                 Empty* response) override {
 
-        m_logger.SetStartTimer();
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
 
         // Obtain the query object
-        const int dim = request->data_size();
-        if (dim != m_dim) {
-            throw std::invalid_argument("Dimension of query object should be equal to the dimension of data object");
+        std::shared_ptr<QuerySession> session = std::make_shared<QuerySession>(m_dim);
+        Status status = m_CheckScheme(*request);
+        if (status.ok()) {
+            status = m_UnpackQueryData(*request, session->query_data);
         }
-        for (int i=0; i<dim; ++i) {
-            m_query_data.data[i] = request->data(i);
+        if (!status.ok()) {
+            return status;
         }
-
-        // Obtain the ip address of Bob
-        m_other_silo_ipaddr = request->ipaddr();
+        session->query_data.vid = request->qid();
 
         // Obtain the public key
-        std::string pk_str = request->pk();
-        m_LoadPublicKey(pk_str);
+        session->public_key = m_LoadPublicKey(request->pk());
 
         #ifdef LOCAL_DEBUG
         std::string sk_str = request->sk();
@@ -139,42 +349,51 @@ public:
         #endif
 
         // Compute the local nearest neighbor
-        m_local_nn = m_GetLocalNearestNeighbor(m_query_data);
-        std::cout << "Local NN: " << m_local_nn.to_string() << std::endl;
-        std::cout << "Square distance: " << EuclideanSquareDistance(m_local_nn, m_query_data) << std::endl;
+        session->local_nn = m_GetLocalNearestNeighbor(session->query_data);
+        std::cout << "Query #(" << request->qid() << ") Local NN: " << session->local_nn.to_string() << std::endl;
+        std::cout << "Query #(" << request->qid() << ") Square distance: " << EuclideanSquareDistance(session->local_nn, session->query_data) << std::endl;
 
-        double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
+        m_AddSession(request->qid(), session);
 
-        m_logger.SetEndTimer();
-        m_logger.LogAddTime();
+        rpc_logger.SetEndTimer();
+        double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
 
         return Status::OK;
     }
 
+    /*
+    Compare the local nearest distance with the one of the data holder at request->ipaddr().
+    Any data holder can start a comparison, so the query user can run a knockout tournament over many data holders.
+    */
     Status GetEncryptPerturbDistance(ServerContext* context,
-                                const Empty* request,
+                                const PerturbRequest* request,
                                 EncryptDistance* response) override {
 
-        m_logger.SetStartTimer();
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
         float comm_within_holders = 0;
 
+        std::shared_ptr<QuerySession> session = m_GetSession(request->qid());
+        if (session == nullptr) {
+            return Status(grpc::StatusCode::NOT_FOUND, "Query #(" + std::to_string(request->qid()) + ") has not been broadcast");
+        }
+
+        // Check the other data holder before touching the session
+        if (request->ipaddr().empty() || request->ipaddr() == m_silo_ipaddr) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Query #(" + std::to_string(request->qid()) + ") should be compared with another data holder");
+        }
+        
+        std::shared_ptr<FedSqlService::Stub> stub = m_GetPeerStub(request->ipaddr());
+
         // Compute the encrypt distance
-        EncryptDistance encrypt_distance = m_GetEncryptPerturbDistance(m_local_nn, m_query_data);
+        EncryptDistance encrypt_distance;
+        m_GetEncryptPerturbDistance(*session, encrypt_distance);
+        encrypt_distance.set_qid(request->qid());
         
         // Exchange the encrypt distance
-        if (m_silo_id%2 == 1) {
-            std::string error_message("Only data holder with even identifier can enable exchange");
-            PrintLine(__LINE__);
-            std::cerr << error_message << std::endl;
-            throw std::invalid_argument(error_message);
-        }
-        
-        grpc::ChannelArguments args;  
-        args.SetInt(GRPC_ARG_MAX_SEND_MESSAGE_LENGTH, INT_MAX);  
-        args.SetInt(GRPC_ARG_MAX_RECEIVE_MESSAGE_LENGTH, INT_MAX); 
-        std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(m_other_silo_ipaddr, grpc::InsecureChannelCredentials(), args);
-        std::unique_ptr<FedSqlService::Stub> stub(FedSqlService::NewStub(channel));
+        QueryId query_id;
+        query_id.set_qid(request->qid());
         
         EncryptDistance other_encrypt_distance;
 
@@ -185,41 +404,32 @@ public:
             Status status = stub->ExchangeEncryptPerturbDistance(&context, encrypt_distance, &other_encrypt_distance); 
             if (!status.ok()) {
                 std::cerr << "RPC failed: " << status.error_message() << std::endl;
-                std::string error_message;
-                error_message = std::string("Exchange encrypt perturb distance from data silo #(") + std::to_string(m_silo_id^1) + std::string(") failed");
-                throw std::invalid_argument(error_message);
+                return Status(status.error_code(), "Exchange encrypt perturb distance from data silo " + request->ipaddr() + " failed: " + status.error_message());
             }
             double grpc_comm = encrypt_distance.ByteSizeLong() + other_encrypt_distance.ByteSizeLong();
-            m_logger.LogAddComm(grpc_comm);
             comm_within_holders += grpc_comm;
         }
 
         {
             // receive the encrypt double perturb distance from Bob
-            Empty empty_request;
             ClientContext context;
-            Status status = stub->GetEncryptDoublePerturbDistance(&context, empty_request, &encrypt_distance); 
+            Status status = stub->GetEncryptDoublePerturbDistance(&context, query_id, &encrypt_distance); 
             if (!status.ok()) {
                 std::cerr << "RPC failed: " << status.error_message() << std::endl;
-                std::string error_message;
-                error_message = std::string("Get encrypt double perturb distance from data silo #(") + std::to_string(m_silo_id^1) + std::string(") failed");
-                throw std::invalid_argument(error_message);
+                return Status(status.error_code(), "Get encrypt double perturb distance from data silo " + request->ipaddr() + " failed: " + status.error_message());
             }
-            double grpc_comm = empty_request.ByteSizeLong() + encrypt_distance.ByteSizeLong();
-            m_logger.LogAddComm(grpc_comm);
+            double grpc_comm = query_id.ByteSizeLong() + encrypt_distance.ByteSizeLong();
             comm_within_holders += grpc_comm;
         }
 
-        // Double perturb Bob's encrypt distance with Alice's random number
-        other_encrypt_distance = m_DoublePerturbDistance(other_encrypt_distance);
-        encrypt_distance = m_SubtractDoublePerturbDistance(encrypt_distance, other_encrypt_distance);
-        response->set_edist(encrypt_distance.edist());
+        // Double perturb Bob's encrypt distance with Alice's random number, and subtract it from Alice's double perturb distance
+        m_SubtractDoublePerturbDistance(*session, encrypt_distance, other_encrypt_distance, *response);
         response->set_comm(comm_within_holders);
+        response->set_qid(request->qid());
 
+        rpc_logger.SetEndTimer();
         double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
-        m_logger.SetEndTimer();
-        m_logger.LogAddTime();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm + comm_within_holders);
 
         return Status::OK;
     }
@@ -228,62 +438,255 @@ public:
                                             const EncryptDistance* request,
                                             EncryptDistance* response) override {
 
-        m_logger.SetStartTimer();
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
+
+        std::shared_ptr<QuerySession> session = m_GetSession(request->qid());
+        if (session == nullptr) {
+            return Status(grpc::StatusCode::NOT_FOUND, "Query #(" + std::to_string(request->qid()) + ") has not been broadcast");
+        }
 
-        m_other_encrypt_distance.set_edist(request->edist());
+        session->other_encrypt_distance.set_edist(request->edist());
         // Compute the encrypt perturb distance
-        EncryptDistance encrypt_distance = m_GetEncryptPerturbDistance(m_local_nn, m_query_data);
-        response->set_edist(encrypt_distance.edist());
+        m_GetEncryptPerturbDistance(*session, *response);
+        response->set_qid(request->qid());
 
+        rpc_logger.SetEndTimer();
         double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
-        m_logger.SetEndTimer();
-        m_logger.LogAddTime();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
 
         return Status::OK;
     }
 
     Status GetEncryptDoublePerturbDistance(ServerContext* context,
-                                            const Empty* request,
+                                            const QueryId* request,
                                             EncryptDistance* response) override {
 
-        m_logger.SetStartTimer();
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
 
-        EncryptDistance encrypt_distance = m_DoublePerturbDistance(m_other_encrypt_distance);
-        response->set_edist(encrypt_distance.edist());
+        std::shared_ptr<QuerySession> session = m_GetSession(request->qid());
+        if (session == nullptr) {
+            return Status(grpc::StatusCode::NOT_FOUND, "Query #(" + std::to_string(request->qid()) + ") has not been broadcast");
+        }
+
+        if (!session->HasPerturb()) {
+            return Status(grpc::StatusCode::FAILED_PRECONDITION, "Query #(" + std::to_string(request->qid()) + ") has not exchanged its perturb distance");
+        }
+        m_DoublePerturbDistance(*session, session->other_encrypt_distance, *response);
+        response->set_qid(request->qid());
 
+        rpc_logger.SetEndTimer();
         double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
-        m_logger.SetEndTimer();
-        m_logger.LogAddTime();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
 
         return Status::OK;
     }
 
     Status GetQueryAnswer(ServerContext* context,
-                            const Empty* request,
+                            const QueryId* request,
                             QueryAnswer* response) override {
 
-        m_logger.SetStartTimer();
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
 
-        response->set_vid(m_local_nn.vid);
-        for (auto d : m_local_nn.data) {
-            response->add_data(d);
+        std::shared_ptr<QuerySession> session = m_GetSession(request->qid());
+        if (session == nullptr) {
+            return Status(grpc::StatusCode::NOT_FOUND, "Query #(" + std::to_string(request->qid()) + ") has not been broadcast");
         }
-        double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
 
-        m_logger.SetEndTimer();
-        m_logger.LogAddTime();
+        response->set_vid(session->local_nn.vid);
+        const VectorDimensionType* row = session->local_nn.data.data();
+        const PackedDtype dtype = NarrowestPackedDtype(row, m_dim);
+        response->set_dtype((FedSql::VectorDtype)dtype);
+        AppendPackedRow(*response->mutable_packed_data(), dtype, row, m_dim);
+
+        rpc_logger.SetEndTimer();
+        double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
 
         return Status::OK;
     }
 
     Status FinishQueryProcessing(ServerContext* context,
-                            const Empty* request,
+                            const QueryId* request,
                             Empty* response) override {
 
-        m_logger.LogOneQuery();
+        {
+            std::lock_guard<std::mutex> lock(m_session_mutex);
+            m_session_map.erase(request->qid());
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_logger_mutex);
+            m_logger.LogOneQuery();
+        }
+
+        return Status::OK;
+    }
+
+    /*
+    Append the vectors to the dataset while queries are being served, and return their vids.
+    The vectors are either packed (float vectors must be) or in the repeated int64 field.
+    */
+    Status InsertVectors(ServerContext* context,
+                            const VectorBatch* request,
+                            UpdateReply* response) override {
+
+        if (m_quantized_index != nullptr) {
+            return Status(grpc::StatusCode::FAILED_PRECONDITION, "A quantized dataset cannot be updated");
+        }
+        const bool packed = (request->dtype() != FedSql::DTYPE_VARINT);
+        if (packed && !IsPackedDtype(request->dtype())) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Unknown packed vector data type " + std::to_string(request->dtype()));
+        }
+        const size_t row_size = m_dim * (packed ? PackedDtypeSize((PackedDtype)request->dtype()) : 1);
+        const size_t data_size = packed ? request->packed_data().size() : request->data_size();
+        if (request->dim() != m_dim || data_size % row_size != 0) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Dimension of inserted vectors should be equal to the dimension of data object");
+        }
+
+        const int n = data_size / row_size;
+        std::vector<VectorDataType> data_list;
+        data_list.reserve(n);
+        if (packed) {
+            PackedVectorView packed_view(request->packed_data(), request->dtype(), n, m_dim);
+            for (int i=0; i<n; ++i) {
+                data_list.emplace_back(m_dim);
+                packed_view.CopyRow(i, data_list.back().data.data());
+            }
+        } else {
+            for (int i=0; i<n; ++i) {
+                data_list.emplace_back(m_dim);
+                std::copy_n(request->data().begin() + i*m_dim, m_dim, data_list.back().data.begin());
+            }
+        }
+
+        std::vector<VidType> vid_list = m_store->Insert(data_list);
+        ++m_update_count;
+        for (VidType vid : vid_list) {
+            response->add_vid(vid);
+        }
+        response->set_count(vid_list.size());
+        response->set_size(m_store->Size());
+
+        return Status::OK;
+    }
+
+    Status DeleteVectors(ServerContext* context,
+                            const VidList* request,
+                            UpdateReply* response) override {
+
+        if (m_quantized_index != nullptr) {
+            return Status(grpc::StatusCode::FAILED_PRECONDITION, "A quantized dataset cannot be updated");
+        }
+        std::vector<VidType> vid_list(request->vid().begin(), request->vid().end());
+        const size_t delete_count = m_store->Delete(vid_list);
+        response->set_count(delete_count);
+        if (delete_count > 0) {
+            ++m_update_count;
+        }
+        response->set_size(m_store->Size());
+
+        return Status::OK;
+    }
+
+    /*
+    Range query: find all local data objects within the square radius of the query object,
+    and return the encrypted number of answers in slot 0 and their square distances (the nearest first) in the next slots.
+    The query user decrypts them and decides how many answers to fetch from each data holder.
+    */
+    Status GetEncryptRangeDistance(ServerContext* context,
+                                const RangeQuery* request,
+                                EncryptDistance* response) override {
+
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
+
+        if (request->square_radius() < 0 || request->real_square_radius() < 0) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Square radius should be non-negative");
+        }
+        std::shared_ptr<QuerySession> session = std::make_shared<QuerySession>(m_dim);
+        Status status = m_CheckScheme(*request);
+        if (status.ok()) {
+            status = m_UnpackQueryData(*request, session->query_data);
+        }
+        if (!status.ok()) {
+            return status;
+        }
+        session->query_data.vid = request->qid();
+        session->public_key = m_LoadPublicKey(request->pk());
+
+        // the real square radius of a float query user is exact, its truncation is the integer one
+        const VectorDimensionType square_radius = (request->real_square_radius() > 0) ? (VectorDimensionType)request->real_square_radius()
+                                                                                       : (VectorDimensionType)request->square_radius();
+        m_GetLocalRangeNeighbors(*session, square_radius);
+        std::vector<VectorDimensionType> dist_list;
+        for (const auto& range_answer : session->range_answer_list) {
+            dist_list.emplace_back(range_answer.dist);
+        }
+        std::cout << "Query #(" << request->qid() << ") Range answers: " << dist_list.size() << std::endl;
+
+        m_EncryptRangeDistance(*session, dist_list, *response);
+        response->set_qid(request->qid());
+        m_AddSession(request->qid(), session);
+
+        rpc_logger.SetEndTimer();
+        double grpc_comm = request->ByteSizeLong() + response->ByteSizeLong();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
+
+        return Status::OK;
+    }
+
+    /*
+    Stream the nearest ``limit`` range answers in chunks of at most ``chunk_size`` bytes, with the vectors packed as raw bytes.
+    Only one chunk is built at a time, and Write() blocks while the HTTP/2 flow control window of the stream is full,
+    so the memory of a transfer is bounded by the chunk size whatever the size of the result.
+    */
+    Status GetRangeQueryAnswer(ServerContext* context,
+                            const RangeFetch* request,
+                            ServerWriter<AnswerChunk>* writer) override {
+
+        BenchLogger rpc_logger;
+        rpc_logger.SetStartTimer();
+
+        std::shared_ptr<QuerySession> session = m_GetSession(request->qid());
+        if (session == nullptr) {
+            return Status(grpc::StatusCode::NOT_FOUND, "Range query #(" + std::to_string(request->qid()) + ") has not been sent");
+        }
+
+        const size_t answer_num = session->range_answer_list.size();
+        const size_t limit = (request->limit() <= 0) ? answer_num : std::min(answer_num, (size_t)request->limit());
+        // the chunk size is estimated with int64 values, a chunk of narrower values is smaller
+        const size_t row_size = m_dim * sizeof(VectorDimensionType) + sizeof(VidType);
+        const size_t chunk_size = (request->chunk_size() <= 0) ? m_default_chunk_size : (size_t)request->chunk_size();
+        const size_t chunk_row_num = std::max((size_t)1, chunk_size / row_size);
+
+        double grpc_comm = request->ByteSizeLong();
+        AnswerChunk chunk;
+        for (size_t begin=0; begin<limit; begin+=chunk_row_num) {
+            const size_t end = std::min(limit, begin + chunk_row_num);
+            PackedDtype dtype = PackedDtype::INT8;
+            for (size_t i=begin; i<end; ++i) {
+                dtype = std::max(dtype, NarrowestPackedDtype(session->range_answer_list[i].row, m_dim));
+            }
+            chunk.Clear();
+            chunk.set_dim(m_dim);
+            chunk.set_dtype((FedSql::VectorDtype)dtype);
+            std::string* data = chunk.mutable_data();
+            data->reserve((end - begin) * m_dim * PackedDtypeSize(dtype));
+            for (size_t i=begin; i<end; ++i) {
+                const RangeAnswer& range_answer = session->range_answer_list[i];
+                chunk.add_vid(range_answer.vid);
+                AppendPackedRow(*data, dtype, range_answer.row, m_dim);
+            }
+            if (!writer->Write(chunk)) {
+                return Status(grpc::StatusCode::CANCELLED, "Range query #(" + std::to_string(request->qid()) + ") was cancelled");
+            }
+            grpc_comm += chunk.ByteSizeLong();
+        }
+
+        rpc_logger.SetEndTimer();
+        m_LogRpc(rpc_logger.GetDurationTime(), grpc_comm);
 
         return Status::OK;
     }
@@ -292,172 +695,560 @@ public:
         std::stringstream ss;
 
         ss << "-------------- Data Holder #(" << m_silo_id << ") " << m_silo_name << " Log --------------\n";
-        ss << m_logger.to_string();
+        {
+            std::lock_guard<std::mutex> lock(m_logger_mutex);
+            ss << m_logger.to_string();
+        }
+        if (m_quantized_index != nullptr) {
+            ss << m_quantized_index->Size() << " data objects in " << QuantizerName(m_quantized_index->Type()) << " codes, re-rank " << m_rerank << " candidates" << std::endl;
+        } else {
+            ss << m_store->Size() << " data objects in " << m_store->SegmentNum() << " segments, " << m_store->CompactNum() << " compactions" << std::endl;
+        }
+        ss << m_shard_pool->ShardNum() << " shards on " << m_shard_pool->NodeNum() << " NUMA nodes:";
+        for (size_t s=0; s<m_shard_pool->ShardNum(); ++s) {
+            ss << " #" << s << "(node " << m_shard_pool->NodeOf(s) << ", cpu " << m_shard_pool->CpuOf(s);
+            if (m_quantized_index == nullptr) {
+                ss << ", " << m_store->ShardSize(s) << " objects";
+            }
+            ss << ")";
+        }
+        ss << std::endl;
 
         return ss.str();
     }
 
 private:
+    /*
+    A range answer refers to its row in place instead of copying it,
+    the row stays valid as long as the session keeps the snapshot (or the data file) that holds it.
+    */
+    struct RangeAnswer {
+        VectorDimensionType dist;
+        VidType vid;
+        const VectorDimensionType* row;
+    };
+
+    /*
+    The random value of one perturbation and its plaintexts, which are built once and shared by all steps that use the value.
+    add_plain holds the value in slot 0 only (batch encoded), so the other slots of a perturbed distance stay zero.
+    mul_plain is the constant polynomial of the value, i.e., the value in every slot, which needs no batch encoding;
+    multiplying every slot is valid because only slot 0 of a distance is non-zero. It is kept in NTT form,
+    so multiply_plain with the NTT-form ciphertexts of BGV is a pointwise product without any transform.
+    With CKKS, add_plain is at the scale of the distances, and mul_plain holds the integer value at scale 1,
+    so it is exact and the perturbed distances keep their scale and level: the ciphertexts of both data holders
+    stay compatible for the subtraction without any rescale, and the only error is the encryption noise times the random values.
+    */
+    struct PerturbMaterial {
+        VectorDimensionType random_value;
+        Plaintext add_plain;
+        Plaintext mul_plain;
+    };
+
+    /*
+    The state of one in-flight query, so that several queries can be pipelined through the data holder.
+    */
+    struct QuerySession {
+        explicit QuerySession(const int dim) : query_data(dim), local_nn(dim) {}
+
+        // the perturbation of the latest comparison, replaced atomically as the other steps may read it from other threads
+        std::shared_ptr<const PerturbMaterial> GetPerturb() const {
+            std::shared_ptr<const PerturbMaterial> perturb = std::atomic_load(&m_perturb);
+            if (perturb == nullptr) {
+                throw std::invalid_argument("Query #(" + std::to_string(query_data.vid) + ") has not been perturbed");
+            }
+            return perturb;
+        }
+
+        bool HasPerturb() const {
+            return std::atomic_load(&m_perturb) != nullptr;
+        }
+
+        void SetPerturb(std::shared_ptr<const PerturbMaterial> perturb) {
+            std::atomic_store(&m_perturb, std::move(perturb));
+        }
+
+        VectorDataType query_data;
+        VectorDataType local_nn;
+        // the answers of a range query, the nearest first, and the snapshots of the shards that hold them
+        std::vector<RangeAnswer> range_answer_list;
+        std::vector<std::shared_ptr<const VectorSnapshot>> range_snapshot_list;
+        EncryptDistance other_encrypt_distance;
+        std::shared_ptr<const PublicKey> public_key;
+        // refreshed on every access under m_session_mutex, a session of an aborted query is dropped after it expires
+        std::chrono::steady_clock::time_point expire_time;
+
+    private:
+        std::shared_ptr<const PerturbMaterial> m_perturb;
+    };
+
+    /*
+    A query user that fails in the middle of a query never calls FinishQueryProcessing,
+    so the sessions expire m_session_ttl_seconds after their last access, and the expired ones are dropped every few insertions.
+    */
+    void m_AddSession(const VidType qid, std::shared_ptr<QuerySession> session) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_session_mutex);
+        if (++m_session_insert_num % m_session_evict_interval == 0) {
+            for (auto iter = m_session_map.begin(); iter != m_session_map.end();) {
+                iter = (iter->second->expire_time <= now) ? m_session_map.erase(iter) : std::next(iter);
+            }
+        }
+        session->expire_time = now + std::chrono::seconds(m_session_ttl_seconds);
+        m_session_map[qid] = std::move(session);
+    }
+
+    std::shared_ptr<QuerySession> m_GetSession(const VidType qid) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_session_mutex);
+        auto iter = m_session_map.find(qid);
+        if (iter == m_session_map.end()) {
+            return nullptr;
+        }
+        if (iter->second->expire_time <= now) {
+            m_session_map.erase(iter);
+            return nullptr;
+        }
+        iter->second->expire_time = now + std::chrono::seconds(m_session_ttl_seconds);
+        return iter->second;
+    }
+
+    std::shared_ptr<FedSqlService::Stub> m_GetPeerStub(const std::string& ipaddr) {
+        std::lock_guard<std::mutex> lock(m_peer_mutex);
+        auto iter = m_peer_stub_map.find(ipaddr);
+        if (iter != m_peer_stub_map.end()) {
+            return iter->second;
+        }
+
+        grpc::ChannelArguments args;  
+        args.SetInt(GRPC_ARG_MAX_SEND_MESSAGE_LENGTH, INT_MAX);  
+        args.SetInt(GRPC_ARG_MAX_RECEIVE_MESSAGE_LENGTH, INT_MAX); 
+        std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(ipaddr, grpc::InsecureChannelCredentials(), args);
+        std::shared_ptr<FedSqlService::Stub> stub(FedSqlService::NewStub(channel));
+        m_peer_stub_map[ipaddr] = stub;
+        return stub;
+    }
+
+    void m_LogRpc(const double rpc_time, const double rpc_comm) {
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.LogAddComm(rpc_comm);
+        m_logger.LogAddTime(rpc_time);
+    }
+
+    // the public key of a QueryObject or a RangeQuery must be one of the data holder's HE scheme
+    template <typename Message>
+    Status m_CheckScheme(const Message& request) const {
+        if ((HeScheme)request.scheme() != m_scheme) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, std::string("Query #(") + std::to_string(request.qid()) + ") uses the "
+                            + HeSchemeName((HeScheme)request.scheme()) + " scheme, but the data holder uses the " + HeSchemeName(m_scheme) + " scheme");
+        }
+        return Status::OK;
+    }
+
+    /*
+    Read the query object of a QueryObject or a RangeQuery, which is either packed or in the repeated int64 field,
+    a packed one is widened straight from the message bytes.
+    */
+    template <typename Message>
+    Status m_UnpackQueryData(const Message& request, VectorDataType& query_data) {
+        auto start_time = std::chrono::steady_clock::now();
+        size_t data_bytes = 0;
+        if (request.dtype() == FedSql::DTYPE_VARINT) {
+            if (request.data_size() != m_dim) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Dimension of query object should be equal to the dimension of data object");
+            }
+            std::copy(request.data().begin(), request.data().end(), query_data.data.begin());
+            for (auto d : request.data()) {
+                data_bytes += google::protobuf::io::CodedOutputStream::VarintSize64((uint64_t)d);
+            }
+        } else {
+            if (!IsPackedDtype(request.dtype()) || request.packed_data().size() != m_dim * PackedDtypeSize((PackedDtype)request.dtype())) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Packed query object does not match with the dimension of data object");
+            }
+            PackedVectorView(request.packed_data(), request.dtype(), 1, m_dim).CopyRow(0, query_data.data.data());
+            data_bytes = request.packed_data().size();
+        }
+        double decode_time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.AddCounter("query data [bytes]", data_bytes);
+        m_logger.AddCounter("query decode [us]", decode_time);
+        return Status::OK;
+    }
+
     VectorDataType m_GetLocalNearestNeighbor(const VectorDataType& query_data) {
-        VectorDimensionType min_dist = std::numeric_limits<VectorDimensionType>::max();
-        int min_id = -1;
-        const int n = m_data_list.size();
+        if (m_quantized_index != nullptr) {
+            return m_GetQuantizedNearestNeighbor(query_data);
+        }
 
-        for (int i=0; i<n; ++i) {
-            const VectorDataType& vector_data = m_data_list[i];
-            VectorDimensionType dist = EuclideanSquareDistance(vector_data, query_data);
+        // scan the shards in parallel, the snapshot keeps the segments of a shard alive during its scan,
+        // even if they are updated or compacted meanwhile
+        const VectorDistanceFunc dist_func = GetVectorDistanceFunc(DistanceMetric::L2, m_dim);
+        const VectorDimensionType* query_ptr = query_data.data.data();
+        const int dim = m_dim;
+        std::vector<std::pair<VectorDimensionType, VectorDataType>> shard_nn_list = m_store->Scan([dist_func, query_ptr, dim](const size_t shard_id, const VectorSnapshot& snapshot) {
+            VectorDimensionType min_dist = std::numeric_limits<VectorDimensionType>::max();
+            const VectorDataType* min_data = nullptr;
+            snapshot.ForEach([&](const VectorDataType& vector_data) {
+                VectorDimensionType dist = dist_func(vector_data.data.data(), query_ptr, dim);
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    min_data = &vector_data;
+                }
+            });
+            return std::make_pair(min_dist, (min_data == nullptr) ? VectorDataType() : *min_data);
+        });
+
+        // merge the nearest neighbors of the shards, the ties go to the lower shard
+        size_t min_shard = 0;
+        for (size_t s=1; s<shard_nn_list.size(); ++s) {
+            if (shard_nn_list[s].first < shard_nn_list[min_shard].first) min_shard = s;
+        }
+        if (shard_nn_list[min_shard].second.Dimension() == 0) {
+            throw std::invalid_argument("database hasn't been initialized");
+        }
+
+        return shard_nn_list[min_shard].second;
+    }
+
+    VectorDataType m_GetQuantizedNearestNeighbor(const VectorDataType& query_data) {
+        const VectorDimensionType* query_ptr = query_data.data.data();
+        std::vector<VidType> candidate_list;
+        const size_t shard_num = m_shard_pool->ShardNum();
+        if (shard_num == 1) {
+            candidate_list = m_quantized_index->Search(query_ptr, m_rerank);
+        } else {
+            // every shard scans the codes of its own range, and all their candidates are re-ranked
+            const size_t n = m_quantized_index->Size();
+            std::vector<std::vector<VidType>> shard_candidate_list = m_shard_pool->RunAll([this, query_ptr, n, shard_num](const size_t shard_id) {
+                return m_quantized_index->Search(query_ptr, m_rerank, n * shard_id / shard_num, n * (shard_id + 1) / shard_num);
+            });
+            for (const auto& shard_candidate : shard_candidate_list) {
+                candidate_list.insert(candidate_list.end(), shard_candidate.begin(), shard_candidate.end());
+            }
+        }
+
+        // exact re-rank from the full-precision vectors
+        const VectorDistanceFunc dist_func = GetVectorDistanceFunc(DistanceMetric::L2, m_dim);
+        VectorDimensionType min_dist = std::numeric_limits<VectorDimensionType>::max();
+        VidType min_vid = -1;
+        for (VidType vid : candidate_list) {
+            VectorDimensionType dist = dist_func(m_data_file->Row(vid), query_ptr, m_dim);
             if (dist < min_dist) {
                 min_dist = dist;
-                min_id = i;
+                min_vid = vid;
             }
         }
-        if (min_id < 0) {
+        if (min_vid < 0) {
             throw std::invalid_argument("database hasn't been initialized");
         }
 
-        return m_data_list[min_id];
+        return m_data_file->GetVector(min_vid, min_vid);
     }
 
-    EncryptDistance m_GetEncryptPerturbDistance(const VectorDataType& vector_data, const VectorDataType& query_data) {
-        VectorDimensionType dist = EuclideanSquareDistance(vector_data, query_data);
+    /*
+    All data objects within the square radius, sorted by (distance, vid), are kept in the session.
+    The shards are scanned in parallel, and a quantized data holder scans the exact vectors in its data file.
+    */
+    void m_GetLocalRangeNeighbors(QuerySession& session, const VectorDimensionType square_radius) {
+        typedef std::vector<RangeAnswer> RangeList;
+        const VectorDistanceFunc dist_func = GetVectorDistanceFunc(DistanceMetric::L2, m_dim);
+        const VectorDimensionType* query_ptr = session.query_data.data.data();
+        const int dim = m_dim;
+        const size_t shard_num = m_shard_pool->ShardNum();
+
+        std::function<RangeList(size_t)> scan_shard;
+        if (m_quantized_index != nullptr) {
+            const size_t n = m_data_file->Size();
+            scan_shard = [this, dist_func, query_ptr, dim, square_radius, n, shard_num](const size_t shard_id) {
+                RangeList range_list;
+                for (size_t i=n*shard_id/shard_num; i<n*(shard_id+1)/shard_num; ++i) {
+                    const VectorDimensionType* row = m_data_file->Row(i);
+                    VectorDimensionType dist = dist_func(row, query_ptr, dim);
+                    if (dist <= square_radius) {
+                        range_list.push_back({dist, (VidType)i, row});
+                    }
+                }
+                return range_list;
+            };
+        } else {
+            // the session pins the snapshots, so the rows of the answers outlive any later compaction
+            session.range_snapshot_list = m_store->GetSnapshotList();
+            const auto& snapshot_list = session.range_snapshot_list;
+            scan_shard = [&snapshot_list, dist_func, query_ptr, dim, square_radius](const size_t shard_id) {
+                RangeList range_list;
+                snapshot_list[shard_id]->ForEach([&](const VectorDataType& vector_data) {
+                    const VectorDimensionType* row = vector_data.data.data();
+                    VectorDimensionType dist = dist_func(row, query_ptr, dim);
+                    if (dist <= square_radius) {
+                        range_list.push_back({dist, vector_data.vid, row});
+                    }
+                });
+                return range_list;
+            };
+        }
+        std::vector<RangeList> shard_range_list = (shard_num == 1) ? std::vector<RangeList>{scan_shard(0)} : m_shard_pool->RunAll(scan_shard);
 
-        SEALContext context(m_parms);
-        Encryptor encryptor(context, m_public_key);
-        Evaluator evaluator(context);
-        BatchEncoder batch_encoder(context);
-        size_t slot_count = batch_encoder.slot_count();
+        RangeList& range_list = session.range_answer_list;
+        range_list.clear();
+        for (auto& shard_range : shard_range_list) {
+            range_list.insert(range_list.end(), shard_range.begin(), shard_range.end());
+        }
+        std::sort(range_list.begin(), range_list.end(), [](const RangeAnswer& a, const RangeAnswer& b) {
+            return (a.dist != b.dist) ? (a.dist < b.dist) : (a.vid < b.vid);
+        });
+    }
 
-        #ifdef LOCAL_DEBUG
-        Decryptor decryptor(context, m_secret_key);
-        std::vector<int64_t> dist_matrix_tmp;
-        Plaintext dist_decrypted; 
-        size_t row_size = slot_count / 2;
-        #endif
+    /*
+    Per-thread HE state of the RPC handlers, which is reused across queries.
+    The SEAL objects allocate from a thread-local memory pool, which recycles the freed blocks instead of returning them to the heap,
+    and the scratch plaintexts, ciphertexts and slot vector keep their capacity, so a warmed-up thread allocates no new memory
+    except the bytes of the response.
+    */
+    struct HeWorkspace {
+        HeWorkspace(const SEALContext& context, const HeScheme scheme)
+                            : pool(MemoryPoolHandle::ThreadLocal()), evaluator(context),
+                              plain(pool), cipher(context, pool), other_cipher(context, pool), result_cipher(context, pool) {
+            // the BatchEncoder supports BGV only, the CKKSEncoder CKKS only
+            if (scheme == HeScheme::CKKS) {
+                ckks_encoder = std::make_unique<CKKSEncoder>(context);
+                real_slot_matrix.assign(ckks_encoder->slot_count(), 0);
+            } else {
+                batch_encoder = std::make_unique<BatchEncoder>(context);
+                slot_matrix.assign(batch_encoder->slot_count(), 0);
+            }
+        }
+
+        MemoryPoolHandle pool;
+        std::unique_ptr<BatchEncoder> batch_encoder;
+        std::unique_ptr<CKKSEncoder> ckks_encoder;
+        Evaluator evaluator;
+        // the encryptor is rebuilt only when the query user's public key changes
+        std::shared_ptr<const PublicKey> public_key;
+        std::unique_ptr<Encryptor> encryptor;
+        // the slots of the scheme's encoder, all zero between uses, each use resets the slots it sets
+        std::vector<int64_t> slot_matrix;
+        std::vector<double> real_slot_matrix;
+        Plaintext plain;
+        Ciphertext cipher, other_cipher, result_cipher;
+    };
+
+    HeWorkspace& m_GetHeWorkspace(const std::shared_ptr<const PublicKey>& public_key) {
+        thread_local std::unique_ptr<HeWorkspace> workspace;
+        if (workspace == nullptr) {
+            workspace = std::make_unique<HeWorkspace>(*m_context, m_scheme);
+        }
+        if (public_key != nullptr && workspace->public_key != public_key) {
+            workspace->encryptor = std::make_unique<Encryptor>(*m_context, *public_key);
+            workspace->public_key = public_key;
+        }
+        if (workspace->encryptor == nullptr) {
+            throw std::invalid_argument("The public key of the query user has not been received");
+        }
+        return *workspace;
+    }
+
+    /*
+    Sample a new random value and build its plaintexts, once per comparison instead of once per step.
+    */
+    std::shared_ptr<const PerturbMaterial> m_NewPerturbMaterial(HeWorkspace& workspace) {
+        std::shared_ptr<PerturbMaterial> perturb = std::make_shared<PerturbMaterial>();
+        perturb->random_value = m_SampleRandomValue();
+        m_EncodeSlot0(workspace, perturb->random_value, perturb->add_plain);
+
+        if (m_scheme == HeScheme::CKKS) {
+            // a constant is encoded into every slot, at scale 1 the integer random value is exact
+            workspace.ckks_encoder->encode((double)perturb->random_value, m_context->first_parms_id(), 1.0, perturb->mul_plain, workspace.pool);
+            return perturb;
+        }
 
-        std::vector<int64_t> dist_matrix(slot_count, 0);
-        dist_matrix[0] = dist;
-        Plaintext dist_plain;
-        batch_encoder.encode(dist_matrix, dist_plain);
-        Ciphertext dist_encrypted;
-        encryptor.encrypt(dist_plain, dist_encrypted);
+        // a plaintext with one coefficient is the constant polynomial, the random value is far below plain_modulus/2
+        Plaintext scalar_plain(1);
+        scalar_plain[0] = (int64_t)perturb->random_value;
+        workspace.evaluator.transform_to_ntt(scalar_plain, m_context->first_parms_id(), perturb->mul_plain, workspace.pool);
+        return perturb;
+    }
+
+    // encode value into slot 0 of plain, at the scale of the distances with CKKS
+    void m_EncodeSlot0(HeWorkspace& workspace, const VectorDimensionType value, Plaintext& plain) {
+        if (m_scheme == HeScheme::CKKS) {
+            workspace.real_slot_matrix[0] = value;
+            workspace.ckks_encoder->encode(workspace.real_slot_matrix, CkksScale(), plain, workspace.pool);
+            workspace.real_slot_matrix[0] = 0;
+        } else {
+            workspace.slot_matrix[0] = (int64_t)value;
+            workspace.batch_encoder->encode(workspace.slot_matrix, plain);
+            workspace.slot_matrix[0] = 0;
+        }
+    }
+
+    void m_LoadCiphertext(const std::string& edist_str, Ciphertext& cipher) {
+        cipher.load(*m_context, reinterpret_cast<const seal::seal_byte*>(edist_str.data()), edist_str.size());
+    }
+
+    // serialize straight into the message instead of through a stringstream
+    void m_SaveCiphertext(const Ciphertext& cipher, EncryptDistance& encrypt_dist) {
+        std::string* edist = encrypt_dist.mutable_edist();
+        edist->resize(cipher.save_size());
+        size_t edist_size = cipher.save(reinterpret_cast<seal::seal_byte*>(&(*edist)[0]), edist->size());
+        edist->resize(edist_size);
+    }
+
+    void m_LogHeAlloc(const AllocScope& alloc_scope) {
+        AllocStat alloc_stat = alloc_scope.Delta();
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.AddCounter("HE heap allocations", alloc_stat.count);
+        m_logger.AddCounter("HE heap [bytes]", alloc_stat.bytes);
+    }
+
+    #ifdef LOCAL_DEBUG
+    // decode the first slots of a plaintext of either scheme
+    std::vector<double> m_DecodeDebug(HeWorkspace& workspace, const Plaintext& plain) {
+        if (m_scheme == HeScheme::CKKS) {
+            std::vector<double> slot_list;
+            workspace.ckks_encoder->decode(plain, slot_list, workspace.pool);
+            return slot_list;
+        }
+        std::vector<int64_t> slot_list;
+        workspace.batch_encoder->decode(plain, slot_list, workspace.pool);
+        return std::vector<double>(slot_list.begin(), slot_list.end());
+    }
+
+    // decrypt with the query user's secret key, which is sent for debugging
+    std::vector<double> m_DecryptDebug(HeWorkspace& workspace, const Ciphertext& cipher) {
+        Decryptor decryptor(*m_context, m_secret_key);
+        Plaintext plain;
+        decryptor.decrypt(cipher, plain);
+        return m_DecodeDebug(workspace, plain);
+    }
+    #endif
+
+    /*
+    Write the number of answers into slot 0 and their square distances into slots 1, 2, ... (as many as fit),
+    and return the number of slots that are set.
+    */
+    template <typename Value>
+    static size_t m_FillRangeSlots(const std::vector<VectorDimensionType>& dist_list, std::vector<Value>& slot_matrix) {
+        const size_t dist_num = std::min(dist_list.size(), slot_matrix.size() - 1);
+        slot_matrix[0] = (Value)dist_list.size();
+        for (size_t i=0; i<dist_num; ++i) {
+            slot_matrix[i + 1] = (Value)dist_list[i];
+        }
+        return dist_num + 1;
+    }
+
+    /*
+    Slot 0 holds the number of answers, slots 1, 2, ... hold their square distances (as many as fit).
+    */
+    void m_EncryptRangeDistance(const QuerySession& session, const std::vector<VectorDimensionType>& dist_list, EncryptDistance& encrypt_dist) {
+        AllocScope alloc_scope;
+        HeWorkspace& workspace = m_GetHeWorkspace(session.public_key);
+        if (m_scheme == HeScheme::CKKS) {
+            const size_t slot_num = m_FillRangeSlots(dist_list, workspace.real_slot_matrix);
+            workspace.ckks_encoder->encode(workspace.real_slot_matrix, CkksScale(), workspace.plain, workspace.pool);
+            std::fill_n(workspace.real_slot_matrix.begin(), slot_num, 0);
+        } else {
+            const size_t slot_num = m_FillRangeSlots(dist_list, workspace.slot_matrix);
+            workspace.batch_encoder->encode(workspace.slot_matrix, workspace.plain);
+            std::fill_n(workspace.slot_matrix.begin(), slot_num, 0);
+        }
+
+        workspace.encryptor->encrypt(workspace.plain, workspace.cipher, workspace.pool);
+        m_SaveCiphertext(workspace.cipher, encrypt_dist);
+        m_LogHeAlloc(alloc_scope);
+    }
+
+    void m_GetEncryptPerturbDistance(QuerySession& session, EncryptDistance& encrypt_dist) {
+        AllocScope alloc_scope;
+        VectorDimensionType dist = EuclideanSquareDistance(session.local_nn, session.query_data);
+        HeWorkspace& workspace = m_GetHeWorkspace(session.public_key);
+
+        Ciphertext& dist_encrypted = workspace.cipher;
+        m_EncodeSlot0(workspace, dist, workspace.plain);
+        workspace.encryptor->encrypt(workspace.plain, dist_encrypted, workspace.pool);
 
         #ifdef LOCAL_DEBUG
-        decryptor.decrypt(dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix_tmp);
-        PrintMatrix(dist_matrix_tmp, row_size);
+        PrintVector(m_DecryptDebug(workspace, dist_encrypted));
         #endif
 
-        m_random_value = m_SampleRandomValue();
-        std::vector<int64_t> perturb_matrix(slot_count, 0);
-        perturb_matrix[0] = m_random_value;
-        Plaintext perturb_plain;
-        batch_encoder.encode(perturb_matrix, perturb_plain);
+        std::shared_ptr<const PerturbMaterial> perturb = m_NewPerturbMaterial(workspace);
+        session.SetPerturb(perturb);
 
         #ifdef LOCAL_DEBUG
-        batch_encoder.decode(perturb_plain, dist_matrix_tmp);
-        PrintMatrix(dist_matrix_tmp, row_size);
+        PrintVector(m_DecodeDebug(workspace, perturb->add_plain));
         #endif
 
-        Ciphertext perturb_dist_encrypted;
-        evaluator.multiply_plain(dist_encrypted, perturb_plain, perturb_dist_encrypted);
+        Ciphertext& perturb_dist_encrypted = workspace.result_cipher;
+        workspace.evaluator.multiply_plain(dist_encrypted, perturb->mul_plain, perturb_dist_encrypted, workspace.pool);
         #ifdef LOCAL_DEBUG
-        decryptor.decrypt(perturb_dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix_tmp);
-        PrintMatrix(dist_matrix_tmp, row_size);
+        PrintVector(m_DecryptDebug(workspace, perturb_dist_encrypted));
         #endif
 
-        evaluator.add_plain_inplace(perturb_dist_encrypted, perturb_plain);
+        workspace.evaluator.add_plain_inplace(perturb_dist_encrypted, perturb->add_plain, workspace.pool);
         #ifdef LOCAL_DEBUG
-        decryptor.decrypt(perturb_dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix_tmp);
-        PrintMatrix(dist_matrix_tmp, row_size);
+        PrintVector(m_DecryptDebug(workspace, perturb_dist_encrypted));
         #endif
 
-        std::stringstream dist_encrypted_sstream;
-        perturb_dist_encrypted.save(dist_encrypted_sstream);
-        EncryptDistance encrypt_dist;
-        encrypt_dist.set_edist(dist_encrypted_sstream.str());
+        m_SaveCiphertext(perturb_dist_encrypted, encrypt_dist);
 
         #ifdef LOCAL_DEBUG
-        decryptor.decrypt(perturb_dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix_tmp);
-        std::cout << "perturb distance is " << dist_matrix_tmp[0];
-        std::cout << ", random value is " << m_random_value;
-        decryptor.decrypt(dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix_tmp);
-        std::cout << ", raw distance is " << dist_matrix_tmp[0] << std::endl;
+        std::cout << "perturb distance is " << m_DecryptDebug(workspace, perturb_dist_encrypted)[0];
+        std::cout << ", random value is " << perturb->random_value;
+        std::cout << ", raw distance is " << m_DecryptDebug(workspace, dist_encrypted)[0] << std::endl;
         #endif
 
-        return encrypt_dist;
+        m_LogHeAlloc(alloc_scope);
     }
 
-    EncryptDistance m_DoublePerturbDistance(const EncryptDistance& encrypt_distance) {
-        SEALContext context(m_parms);
-        Encryptor encryptor(context, m_public_key);
-        Evaluator evaluator(context);
-        BatchEncoder batch_encoder(context);
-        size_t slot_count = batch_encoder.slot_count();
-
-        std::string edist_str(encrypt_distance.edist());
-        std::stringstream edist_sstream(edist_str);
-
-        Ciphertext dist_encrypted;
-        dist_encrypted.load(context, edist_sstream);
+    void m_DoublePerturbDistance(const QuerySession& session, const EncryptDistance& encrypt_distance, EncryptDistance& ret) {
+        AllocScope alloc_scope;
+        HeWorkspace& workspace = m_GetHeWorkspace(session.public_key);
 
-        std::vector<int64_t> perturb_matrix(slot_count, 0);
-        perturb_matrix[0] = m_random_value;
-        Plaintext perturb_plain;
-        batch_encoder.encode(perturb_matrix, perturb_plain);
+        m_LoadCiphertext(encrypt_distance.edist(), workspace.cipher);
+        workspace.evaluator.multiply_plain(workspace.cipher, session.GetPerturb()->mul_plain, workspace.result_cipher, workspace.pool);
 
-        Ciphertext perturb_dist_encrypted;
-        evaluator.multiply_plain(dist_encrypted, perturb_plain, perturb_dist_encrypted);
-        
-        std::stringstream perturb_dist_encrypted_sstream;
-        perturb_dist_encrypted.save(perturb_dist_encrypted_sstream);
-
-        EncryptDistance ret;
-        ret.set_edist(perturb_dist_encrypted_sstream.str());
-        return ret;
+        m_SaveCiphertext(workspace.result_cipher, ret);
+        m_LogHeAlloc(alloc_scope);
     }
 
-    EncryptDistance m_SubtractDoublePerturbDistance(const EncryptDistance& a_encrypt_distance, const EncryptDistance& b_encrypt_distance) {
-        SEALContext context(m_parms);
-        Encryptor encryptor(context, m_public_key);
-        Evaluator evaluator(context);
-        BatchEncoder batch_encoder(context);
-        size_t slot_count = batch_encoder.slot_count();
+    /*
+    a_encrypt_distance is our distance double perturbed by the other data holder, b_encrypt_distance is the other data holder's
+    perturb distance, which is double perturbed with our random value here before the subtraction, without a round trip through bytes.
+    */
+    void m_SubtractDoublePerturbDistance(const QuerySession& session, const EncryptDistance& a_encrypt_distance, const EncryptDistance& b_encrypt_distance, EncryptDistance& ret) {
+        AllocScope alloc_scope;
+        HeWorkspace& workspace = m_GetHeWorkspace(session.public_key);
 
-        std::string a_edist_str(a_encrypt_distance.edist());
-        std::stringstream a_edist_sstream(a_edist_str);
-        Ciphertext a_dist_encrypted;
-        a_dist_encrypted.load(context, a_edist_sstream);
+        m_LoadCiphertext(b_encrypt_distance.edist(), workspace.other_cipher);
+        workspace.evaluator.multiply_plain_inplace(workspace.other_cipher, session.GetPerturb()->mul_plain, workspace.pool);
 
-        std::string b_edist_str(b_encrypt_distance.edist());
-        std::stringstream b_edist_sstream(b_edist_str);
-        Ciphertext b_dist_encrypted;
-        b_dist_encrypted.load(context, b_edist_sstream);
+        m_LoadCiphertext(a_encrypt_distance.edist(), workspace.cipher);
+        workspace.evaluator.sub(workspace.cipher, workspace.other_cipher, workspace.result_cipher);
 
-        Ciphertext subtraction_encrypted;
-        evaluator.sub(a_dist_encrypted, b_dist_encrypted, subtraction_encrypted);
-        
-        std::stringstream subtraction_encrypted_sstream;
-        subtraction_encrypted.save(subtraction_encrypted_sstream);
+        m_SaveCiphertext(workspace.result_cipher, ret);
+        m_LogHeAlloc(alloc_scope);
+    }
 
-        EncryptDistance ret;
-        ret.set_edist(subtraction_encrypted_sstream.str());
-        return ret;        
+    // where the full-precision dataset came from: the data file and its size in bytes, or n and dim of the random data
+    static std::string m_DataSource(const std::string& data_filename, const int n, const int dim) {
+        if (data_filename.empty()) {
+            return "random n=" + std::to_string(n) + " dim=" + std::to_string(dim);
+        }
+        std::ifstream data_file(data_filename, std::ios::binary | std::ios::ate);
+        return "file " + data_filename + " size=" + std::to_string((long long)data_file.tellg());
     }
 
-    void m_LoadPublicKey(const std::string& pk_str) {
-        // if pk_str is empty, 
-        // we don't have to re-load the public key
-        if (pk_str.empty()) return ;
+    std::shared_ptr<const PublicKey> m_LoadPublicKey(const std::string& pk_str) {
+        std::lock_guard<std::mutex> lock(m_key_mutex);
+
+        // if pk_str is empty or the same key as before, 
+        // we don't have to re-load the public key, and the HE workspaces keep their encryptors
+        if (pk_str.empty() || pk_str == m_public_key_str) return m_public_key;
 
-        SEALContext context(m_parms);
-        std::stringstream bytes_stream(pk_str);
-        PublicKey public_key;
-        public_key.load(context, bytes_stream);
+        std::shared_ptr<PublicKey> public_key = std::make_shared<PublicKey>();
+        public_key->load(*m_context, reinterpret_cast<const seal::seal_byte*>(pk_str.data()), pk_str.size());
         m_public_key = public_key;
+        m_public_key_str = pk_str;
+        return m_public_key;
     }
 
     void m_LoadSecretKey(const std::string& sk_str) {
@@ -465,28 +1256,28 @@ private:
         // we don't have to re-load the public key
         if (sk_str.empty()) return ;
 
-        SEALContext context(m_parms);
+        std::lock_guard<std::mutex> lock(m_key_mutex);
         std::stringstream bytes_stream(sk_str);
         SecretKey secret_key;
-        secret_key.load(context, bytes_stream);
+        secret_key.load(*m_context, bytes_stream);
         m_secret_key = secret_key;
     }
 
     void m_InitSealParams() {
-        /*
-        Note that scheme_type is now "bgv".
-        */
-        m_parms = EncryptionParameters(scheme_type::bgv);
-        m_parms.set_poly_modulus_degree(m_poly_modulus_degree);
+        #ifdef FLOAT_VECTOR
+        if (m_scheme != HeScheme::CKKS) {
+            throw std::invalid_argument("Float vectors need the CKKS scheme, as the BGV scheme only encrypts integer distances");
+        }
+        #endif
 
         /*
-        We can certainly use BFVDefault coeff_modulus. In later parts of this example,
-        we will demonstrate how to choose coeff_modulus that is more useful in BGV.
+        BGV with the BFVDefault coeff_modulus and a batching plain modulus, or CKKS with a short modulus chain (see utils/HeScheme.hpp).
         */
-        m_parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_poly_modulus_degree));
-        m_parms.set_plain_modulus(PlainModulus::Batching(m_poly_modulus_degree, m_batching_size));
+        m_parms = CreateSealParams(m_scheme);
 
-        SEALContext context(m_parms);
+        // one context for all HE paths, its precomputed tables are shared by the threads
+        m_context = std::make_unique<SEALContext>(m_parms);
+        const SEALContext& context = *m_context;
         PrintLine(__LINE__);
         std::cout << "Set encryption parameters and print" << std::endl;
         m_print_parameters(context);
@@ -497,9 +1288,11 @@ private:
         */
         std::cout << "Parameter validation (success): " << context.parameter_error_message() << std::endl;
 
-        BatchEncoder batch_encoder(context);
-        size_t slot_count = batch_encoder.slot_count();
+        size_t slot_count = (m_scheme == HeScheme::CKKS) ? CKKSEncoder(context).slot_count() : BatchEncoder(context).slot_count();
         std::cout << "Slot count: " << slot_count << std::endl;
+        if (m_scheme == HeScheme::CKKS) {
+            std::cout << "Scale of the distances: 2^" << kCkksScaleBits << std::endl;
+        }
     }
 
     /*
@@ -569,28 +1362,68 @@ private:
     int m_silo_id;
     std::string m_silo_ipaddr;
     std::string m_silo_name;
-    std::string m_other_silo_ipaddr;
     int m_dim;
-    EncryptDistance m_other_encrypt_distance;
-    VectorDataType m_query_data;
-    VectorDataType m_local_nn;
-    std::vector<VectorDataType> m_data_list;
+
+    // the dataset is partitioned into shards, each scanned by its own worker pinned to a NUMA node
+    std::unique_ptr<ShardPool> m_shard_pool;
+    std::unique_ptr<ShardedVectorStore> m_store;
+
+    // quantized dataset: codes in memory and the full-precision vectors in the data file
+    std::unique_ptr<VectorFileReader> m_data_file;
+    std::unique_ptr<QuantizedIndex> m_quantized_index;
+    size_t m_rerank;
+
+    // snapshot of the dataset for a fast restart
+    std::string m_snapshot_filename;
+    std::string m_data_source;
+    std::atomic<uint64_t> m_update_count;
+    uint64_t m_saved_update_count;
     BenchLogger m_logger;
-    VectorDimensionType m_random_value;
+    mutable std::mutex m_logger_mutex;
+
+    // in-flight queries and the cached connections to the other data holders
+    std::unordered_map<VidType, std::shared_ptr<QuerySession>> m_session_map;
+    std::mutex m_session_mutex;
+    size_t m_session_insert_num = 0;
+    std::unordered_map<std::string, std::shared_ptr<FedSqlService::Stub>> m_peer_stub_map;
+    std::mutex m_peer_mutex;
 
-    // private members that are related to the BGV scheme
+    // private members that are related to the HE scheme
+    HeScheme m_scheme;
     EncryptionParameters m_parms;
-    PublicKey m_public_key;
+    std::unique_ptr<SEALContext> m_context;
+    std::shared_ptr<const PublicKey> m_public_key;
+    std::string m_public_key_str;
+    std::mutex m_key_mutex;
     SecretKey m_secret_key;
-    static const size_t m_poly_modulus_degree = 8192;
-    static const size_t m_batching_size = 40;
+    // range answers are streamed in chunks of at most this many bytes, unless the query user asks for another size
+    static const size_t m_default_chunk_size = 1 << 20;
+    // the sessions of the queries that were never finished expire this long after their last access
+    static const int m_session_ttl_seconds = 300;
+    static const size_t m_session_evict_interval = 64;
 };
   
 std::unique_ptr<FedSqlImpl> fed_db_ptr = nullptr;
-
-void RunSilo(const int n, const int dim, const int silo_id, const std::string& silo_ipaddr, const std::string& silo_name) {
-    fed_db_ptr = std::make_unique<FedSqlImpl>(silo_id, silo_ipaddr, silo_name);
-    fed_db_ptr->InitDataHolder(n, dim);
+// the running server, which a termination signal shuts down
+Server* silo_server_ptr = nullptr;
+std::mutex silo_server_mutex;
+
+void RunSilo(const int n, const int dim, const std::string& data_filename, const QuantizerType quantizer_type, const size_t pq_subspace_num, const size_t rerank,
+                const size_t shard_num, const HeScheme scheme, const std::string& snapshot_dir, const int silo_id, const std::string& silo_ipaddr, const std::string& silo_name) {
+    fed_db_ptr = std::make_unique<FedSqlImpl>(silo_id, silo_ipaddr, silo_name, shard_num, scheme);
+    if (!snapshot_dir.empty()) {
+        fed_db_ptr->SetSnapshotDir(snapshot_dir);
+    }
+    if (!fed_db_ptr->RestoreSnapshot(n, dim, data_filename, quantizer_type, rerank)) {
+        if (data_filename.empty()) {
+            fed_db_ptr->InitDataHolder(n, dim);
+        } else if (quantizer_type == QuantizerType::NONE) {
+            fed_db_ptr->InitDataHolder(data_filename);
+        } else {
+            fed_db_ptr->InitDataHolder(data_filename, quantizer_type, pq_subspace_num, rerank);
+        }
+        fed_db_ptr->SaveSnapshot();
+    }
 
     ServerBuilder builder;
     builder.AddListeningPort(silo_ipaddr, grpc::InsecureServerCredentials());
@@ -599,29 +1432,48 @@ void RunSilo(const int n, const int dim, const int silo_id, const std::string& s
     builder.SetMaxReceiveMessageSize(INT_MAX);
     std::unique_ptr<Server> server(builder.BuildAndStart());
     std::cout << "Data Holder #(" << silo_id << ") " << silo_name << " is listening on " << silo_ipaddr << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(silo_server_mutex);
+        silo_server_ptr = server.get();
+    }
     
     server->Wait();
+    {
+        std::lock_guard<std::mutex> lock(silo_server_mutex);
+        silo_server_ptr = nullptr;
+    }
 
+    fed_db_ptr->SaveSnapshot(true);
     std::string log_info = fed_db_ptr->to_string();
     std::cout << log_info;
     std::cout.flush();
 }
 
-// Ensure the log file is output, when the program is terminated.
-void SignalHandler(int signal) {
-    if (fed_db_ptr != nullptr) {
-        std::string log_info = fed_db_ptr->to_string();
-        std::cout << log_info;
-        std::cout.flush();
+// Ensure the snapshot and the log file are output, when the program is terminated.
+// Writing them is not async-signal-safe, so a thread waits for the signals and only shuts the server down,
+// then RunSilo() writes them after server->Wait() returns.
+void WaitSignal(sigset_t signal_set) {
+    int signal;
+    while (sigwait(&signal_set, &signal) == 0) {
+        std::lock_guard<std::mutex> lock(silo_server_mutex);
+        if (silo_server_ptr == nullptr) {
+            // the dataset is still being loaded (or the server is already stopping)
+            quick_exit(0);
+        }
+        silo_server_ptr->Shutdown();
     }
-    quick_exit(0);
 }
 
 void ResetSignalHandler() {
-    signal(SIGINT, SignalHandler);
-    signal(SIGQUIT, SignalHandler);
-    signal(SIGTERM, SignalHandler);
-    signal(SIGKILL, SignalHandler);
+    // block the signals before any other thread starts, so that they all inherit the mask and only WaitSignal() receives them
+    // (SIGKILL can be neither caught nor blocked)
+    sigset_t signal_set;
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, SIGINT);
+    sigaddset(&signal_set, SIGQUIT);
+    sigaddset(&signal_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signal_set, nullptr);
+    std::thread(WaitSignal, signal_set).detach();
 }
 
 int main(int argc, char** argv) {
@@ -629,6 +1481,10 @@ int main(int argc, char** argv) {
     int n, dim;
     int silo_port, silo_id;
     std::string silo_ip, silo_ipaddr, silo_name;
+    std::string data_filename, snapshot_dir;
+    QuantizerType quantizer_type = QuantizerType::NONE;
+    size_t pq_subspace_num, rerank, shard_num;
+    HeScheme scheme = HeScheme::BGV;
     
     try { 
         bpo::options_description option_description("Required options");
@@ -640,6 +1496,13 @@ int main(int argc, char** argv) {
             ("name", bpo::value<std::string>(), "Data holder's name")
             ("n", bpo::value<int>(&n)->default_value(500), "Data holder's data size")
             ("dim", bpo::value<int>(&dim)->default_value(128), "Data holder's dimension size")
+            ("data-file", bpo::value<std::string>(), "Vector file of the data holder's dataset (instead of random data)")
+            ("quantize", bpo::value<std::string>()->default_value("none"), "Quantizer of the in-memory dataset: none|sq8|pq (needs --data-file)")
+            ("pq-m", bpo::value<size_t>(&pq_subspace_num)->default_value(0), "Number of PQ subspaces (0 for dim/8)")
+            ("rerank", bpo::value<size_t>(&rerank)->default_value(64), "Number of quantized candidates re-ranked with exact distances")
+            ("shards", bpo::value<size_t>(&shard_num)->default_value(1), "Number of shards of the dataset, each scanned by a thread pinned to a NUMA node")
+            ("snapshot-dir", bpo::value<std::string>(), "Directory of the data holder's snapshot, which is restored on startup if it exists")
+            ("scheme", bpo::value<std::string>()->default_value("bgv"), "HE scheme of the distances: bgv, or ckks for float vectors")
         ;
 
         bpo::variables_map variable_map;
@@ -679,6 +1542,32 @@ int main(int argc, char** argv) {
             options_all_set = false;
         }
 
+        if (variable_map.count("data-file")) {
+            data_filename = variable_map["data-file"].as<std::string>();
+            std::cout << "Data holder's data file was set to " << data_filename << "\n";
+        }
+
+        if (variable_map.count("snapshot-dir")) {
+            snapshot_dir = variable_map["snapshot-dir"].as<std::string>();
+            std::cout << "Data holder's snapshot directory was set to " << snapshot_dir << "\n";
+        }
+
+        quantizer_type = ParseQuantizerType(variable_map["quantize"].as<std::string>());
+        if (quantizer_type != QuantizerType::NONE) {
+            if (data_filename.empty()) {
+                throw std::invalid_argument("--quantize needs the full-precision vectors in --data-file");
+            }
+            std::cout << "Data holder's dataset is quantized by " << QuantizerName(quantizer_type) << ", re-rank " << rerank << " candidates\n";
+        }
+
+        if (shard_num == 0) {
+            throw std::invalid_argument("shards must be a positive integer");
+        }
+        std::cout << "Data holder's dataset is partitioned into " << shard_num << " shards\n";
+
+        scheme = ParseHeScheme(variable_map["scheme"].as<std::string>());
+        std::cout << "Data holder's HE scheme was set to " << HeSchemeName(scheme) << "\n";
+
         if (false == options_all_set) {
             throw std::invalid_argument("Some options were not properly set");
             std::cout.flush();
@@ -694,7 +1583,7 @@ int main(int argc, char** argv) {
 
     ResetSignalHandler();
 
-    RunSilo(n, dim, silo_id, silo_ipaddr, silo_name);
+    RunSilo(n, dim, data_filename, quantizer_type, pq_subspace_num, rerank, shard_num, scheme, snapshot_dir, silo_id, silo_ipaddr, silo_name);
 
     return 0;
 }
\ No newline at end of file
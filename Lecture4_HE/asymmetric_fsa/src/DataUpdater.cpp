@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <exception>
+#include <type_traits>
+
+#include <boost/program_options.hpp>
+namespace bpo = boost::program_options;
+
+#include <grpc/grpc.h>
+#include <grpcpp/grpcpp.h>
+
+#include "utils/BenchLogger.hpp"
+#include "utils/DataType.hpp"
+#include "utils/PackedVector.hpp"
+#include "utils/VectorFile.hpp"
+#include "FedSql.grpc.pb.h"
+
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::Status;
+using FedSql::FedSqlService;
+using FedSql::VectorBatch;
+using FedSql::VidList;
+using FedSql::UpdateReply;
+
+/*
+Stream updates into a running data holder: the vectors of a vector file are inserted batch by batch,
+then the given vids are deleted.
+*/
+class DataUpdater {
+public:
+    explicit DataUpdater(const std::string& silo_ipaddr) : m_silo_ipaddr(silo_ipaddr) {
+        grpc::ChannelArguments args;
+        args.SetInt(GRPC_ARG_MAX_SEND_MESSAGE_LENGTH, INT_MAX);
+        args.SetInt(GRPC_ARG_MAX_RECEIVE_MESSAGE_LENGTH, INT_MAX);
+        std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(silo_ipaddr, grpc::InsecureChannelCredentials(), args);
+        m_stub_ = FedSqlService::NewStub(channel);
+    }
+
+    void InsertVectors(const std::string& insert_filename, const size_t batch_size) {
+        VectorFileReader insert_file(insert_filename);
+        const size_t n = insert_file.Size(), dim = insert_file.Dimension();
+
+        BenchLogger update_logger;
+        update_logger.SetStartTimer();
+        for (size_t begin=0; begin<n; begin+=batch_size) {
+            const size_t end = std::min(n, begin + batch_size);
+            ClientContext context;
+            VectorBatch request;
+            UpdateReply response;
+
+            request.set_dim(dim);
+            if constexpr (std::is_floating_point<VectorDimensionType>::value) {
+                // the repeated int64 field would truncate float vectors
+                request.set_dtype(FedSql::DTYPE_FLOAT32);
+                request.mutable_packed_data()->reserve((end - begin) * dim * sizeof(float));
+                for (size_t i=begin; i<end; ++i) {
+                    AppendPackedRow(*request.mutable_packed_data(), PackedDtype::FLOAT32, insert_file.Row(i), dim);
+                }
+            } else {
+                request.mutable_data()->Add(insert_file.Row(begin), insert_file.Row(end-1) + dim);
+            }
+
+            Status status = m_stub_->InsertVectors(&context, request, &response);
+            if (!status.ok()) {
+                std::cerr << "RPC failed: " << status.error_message() << std::endl;
+                throw std::invalid_argument("Insert vectors into data silo " + m_silo_ipaddr + " failed");
+            }
+            update_logger.LogAddComm(request.ByteSizeLong() + response.ByteSizeLong());
+            std::cout << "Insert " << response.count() << " vectors, " << response.size() << " data objects in data silo " << m_silo_ipaddr << std::endl;
+        }
+        update_logger.SetEndTimer();
+
+        m_PrintThroughput("Insert", n, update_logger);
+    }
+
+    void DeleteVectors(const std::vector<VidType>& vid_list) {
+        BenchLogger update_logger;
+        update_logger.SetStartTimer();
+
+        ClientContext context;
+        VidList request;
+        UpdateReply response;
+        for (VidType vid : vid_list) {
+            request.add_vid(vid);
+        }
+
+        Status status = m_stub_->DeleteVectors(&context, request, &response);
+        if (!status.ok()) {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            throw std::invalid_argument("Delete vectors from data silo " + m_silo_ipaddr + " failed");
+        }
+        update_logger.LogAddComm(request.ByteSizeLong() + response.ByteSizeLong());
+        update_logger.SetEndTimer();
+        std::cout << "Delete " << response.count() << " vectors, " << response.size() << " data objects in data silo " << m_silo_ipaddr << std::endl;
+
+        m_PrintThroughput("Delete", vid_list.size(), update_logger);
+    }
+
+private:
+    void m_PrintThroughput(const std::string& op_name, const size_t n, const BenchLogger& update_logger) {
+        double update_time = update_logger.GetDurationTime();
+        double throughput = (update_time <= 0) ? 0 : (n * 1000.0 / update_time);
+        std::cout << std::fixed << std::setprecision(2)
+                    << op_name << " " << n << " vectors: runtime = " << update_time/1000.0 << " [s], communication = " << update_logger.GetQueryComm()/1024.0
+                    << " [KB], throughput = " << throughput << " [vectors/s]" << std::endl;
+    }
+
+    std::unique_ptr<FedSqlService::Stub> m_stub_;
+    std::string m_silo_ipaddr;
+};
+
+int main(int argc, char** argv) {
+    // Expect the following args: --ipaddr=localhost:50051 --insert-file=insert.bin --delete 0 1 2
+    size_t batch_size;
+    std::string silo_ipaddr, insert_filename;
+    std::vector<VidType> delete_vid_list;
+
+    try {
+        bpo::options_description option_description("Required options");
+        option_description.add_options()
+            ("help", "produce help message")
+            ("ipaddr", bpo::value<std::string>(), "Data holder's IP address and port")
+            ("insert-file", bpo::value<std::string>(), "Vector file of the data objects to insert")
+            ("batch", bpo::value<size_t>(&batch_size)->default_value(100), "Number of data objects per insertion")
+            ("delete", bpo::value<std::vector<VidType>>()->multitoken(), "Identifiers of the data objects to delete")
+        ;
+
+        bpo::variables_map variable_map;
+        bpo::store(bpo::parse_command_line(argc, argv, option_description), variable_map);
+        bpo::notify(variable_map);
+
+        if (variable_map.count("help")) {
+            std::cout << option_description << std::endl;
+            return 0;
+        }
+
+        if (variable_map.count("ipaddr")) {
+            silo_ipaddr = variable_map["ipaddr"].as<std::string>();
+        } else {
+            throw std::invalid_argument("Data holder's IP address was not set");
+        }
+        if (batch_size == 0) {
+            throw std::invalid_argument("batch must be a positive integer");
+        }
+
+        DataUpdater updater(silo_ipaddr);
+        if (variable_map.count("insert-file")) {
+            insert_filename = variable_map["insert-file"].as<std::string>();
+            updater.InsertVectors(insert_filename, batch_size);
+        }
+        if (variable_map.count("delete")) {
+            delete_vid_list = variable_map["delete"].as<std::vector<VidType>>();
+            updater.DeleteVectors(delete_vid_list);
+        }
+
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <exception>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+
+#include <boost/program_options.hpp>
+namespace bpo = boost::program_options;
+
+#include "utils/DataType.hpp"
+#include "utils/DistanceKernel.hpp"
+#include "utils/Quantizer.hpp"
+#include "utils/VectorFile.hpp"
+
+/*
+The previous implementation of EuclideanSquareDistance, which indexes through the bounds-checked operator[].
+It is kept here as the baseline of the benchmark.
+*/
+VectorDimensionType CheckedEuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b) {
+    if (a.Dimension() != b.Dimension()) {
+        throw std::invalid_argument("Vector data must have the same dimension");
+    }
+
+    const size_t dim = a.Dimension();
+    VectorDimensionType sum = 0;
+    for (size_t i = 0; i < dim; ++i) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+/*
+Scan n vectors for one query, repeat it and return the time per distance in nanoseconds.
+*/
+template <typename Func>
+double BenchScan(const std::vector<VectorDataType>& data_list, const VectorDataType& query_data, const int repeat, Func func, double& checksum) {
+    auto start_time = std::chrono::steady_clock::now();
+    checksum = 0;
+    for (int r=0; r<repeat; ++r) {
+        for (const auto& vector_data : data_list) {
+            checksum += func(vector_data, query_data);
+        }
+    }
+    auto end_time = std::chrono::steady_clock::now();
+    double duration = std::chrono::duration<double, std::nano>(end_time - start_time).count();
+    return duration / repeat / data_list.size();
+}
+
+/*
+The integer kernels must agree exactly, the float kernels up to their different summation orders.
+*/
+bool ChecksumMatch(const double checksum, const double expected) {
+    if (std::is_integral<VectorDimensionType>::value) {
+        return checksum == expected;
+    }
+    return std::fabs(checksum - expected) <= 1e-4 * std::max(std::fabs(checksum), std::fabs(expected));
+}
+
+/*
+Train a scalar quantizer on one-dimensional vectors and return the squared round-trip error of each value.
+*/
+std::vector<double> ScalarQuantizerErrors(const std::vector<VectorDimensionType>& value_list) {
+    const std::string file_name = "bench_distance_sq8.vec";
+    {
+        VectorFileWriter writer(file_name, 1);
+        for (size_t i=0; i<value_list.size(); ++i) {
+            writer.Append(VectorDataType(1, i, std::vector<VectorDimensionType>{value_list[i]}));
+        }
+        writer.Close();
+    }
+    ScalarQuantizer quantizer;
+    {
+        VectorFileReader data_file(file_name);
+        quantizer.Train(data_file);
+    }
+    std::remove(file_name.c_str());
+
+    std::vector<double> error_list;
+    std::vector<VectorDimensionType> shifted_query;
+    uint8_t code;
+    for (const VectorDimensionType value : value_list) {
+        quantizer.Encode(&value, &code);
+        quantizer.PrepareQuery(&value, shifted_query);
+        error_list.push_back(quantizer.Distance(shifted_query, &code));
+    }
+    return error_list;
+}
+
+/*
+The boundary ranges of the scalar quantizer: all values of [0, 255] are stored exactly,
+and the maximum of [0, 256] (257 values) must not be clipped to the last code.
+*/
+void CheckScalarQuantizer() {
+    std::vector<VectorDimensionType> value_list(257);
+    std::iota(value_list.begin(), value_list.end(), (VectorDimensionType)0);
+
+    const std::vector<double> error_list = ScalarQuantizerErrors(std::vector<VectorDimensionType>(value_list.begin(), value_list.end() - 1));
+    bool correct = std::all_of(error_list.begin(), error_list.end(), [](double error) { return error <= 1e-6; });
+
+    const std::vector<double> wide_error_list = ScalarQuantizerErrors(value_list);
+    correct = correct && wide_error_list.front() <= 1e-6 && wide_error_list.back() <= 1e-6;
+
+    std::cout << "SQ8 boundary ranges [0, 255] and [0, 256] : " << (correct ? "ok" : "MISMATCH") << std::endl;
+    if (!correct) {
+        throw std::runtime_error("Scalar quantizer does not round-trip its boundary ranges");
+    }
+}
+
+void RunBench(const int n, const int dim, const int repeat) {
+    std::vector<VectorDataType> data_list;
+    std::default_random_engine eng(dim);
+    VectorValueDistribution distribution(1, 100);
+    for (int i=0; i<n; ++i) {
+        data_list.emplace_back(dim, i);
+        for (int j=0; j<dim; ++j) {
+            data_list.back().data[j] = distribution(eng);
+        }
+    }
+    VectorDataType query_data(dim, n);
+    for (int j=0; j<dim; ++j) {
+        query_data.data[j] = distribution(eng);
+    }
+
+    double baseline_checksum;
+    double baseline_time = BenchScan(data_list, query_data, repeat, CheckedEuclideanSquareDistance, baseline_checksum);
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "dim = " << std::setw(4) << dim << ", L2, checked baseline : " << std::setw(8) << baseline_time << " [ns]" << std::endl;
+
+    const DistanceISA best_isa = DetectDistanceISA();
+    const std::vector<std::pair<DistanceMetric, std::string>> metric_list = {
+        {DistanceMetric::L2, "L2"}, {DistanceMetric::IP, "IP"}, {DistanceMetric::L1, "L1"}
+    };
+    for (const auto& metric : metric_list) {
+        double scalar_checksum = 0;
+        for (DistanceISA isa : {DistanceISA::SCALAR, DistanceISA::AVX2, DistanceISA::AVX512}) {
+            if (isa > best_isa) break;
+            const VectorDistanceFunc dist_func = GetVectorDistanceFunc(metric.first, dim, isa);
+            double checksum;
+            double kernel_time = BenchScan(data_list, query_data, repeat, [dist_func, dim](const VectorDataType& a, const VectorDataType& b) {
+                return dist_func(a.data.data(), b.data.data(), dim);
+            }, checksum);
+
+            // every kernel must agree with the scalar one, and the L2 kernels with the baseline
+            if (isa == DistanceISA::SCALAR) scalar_checksum = checksum;
+            bool correct = ChecksumMatch(checksum, scalar_checksum) && (metric.first != DistanceMetric::L2 || ChecksumMatch(checksum, baseline_checksum));
+            std::cout << "dim = " << std::setw(4) << dim << ", " << metric.second << ", " << std::setw(6) << DistanceISAName(isa) << " kernel   : " << std::setw(8) << kernel_time << " [ns]";
+            if (metric.first == DistanceMetric::L2) {
+                std::cout << ", speedup = " << baseline_time / kernel_time << "x";
+            }
+            std::cout << (correct ? "" : ", MISMATCH") << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    // Expect the following args: --n=10000 --repeat=20
+    int n, repeat;
+    std::vector<int> dim_list;
+
+    try {
+        bpo::options_description option_description("Required options");
+        option_description.add_options()
+            ("help", "produce help message")
+            ("n", bpo::value<int>(&n)->default_value(10000), "Number of vectors per scan")
+            ("repeat", bpo::value<int>(&repeat)->default_value(20), "Number of scans")
+            ("dim", bpo::value<std::vector<int>>(&dim_list)->multitoken()->default_value(std::vector<int>{64, 100, 128, 256, 960}, "64 100 128 256 960"), "Dimensions to benchmark")
+        ;
+
+        bpo::variables_map variable_map;
+        bpo::store(bpo::parse_command_line(argc, argv, option_description), variable_map);
+        bpo::notify(variable_map);
+
+        if (variable_map.count("help")) {
+            std::cout << option_description << std::endl;
+            return 0;
+        }
+        if (n <= 0 || repeat <= 0) {
+            throw std::invalid_argument("n and repeat must be positive integers");
+        }
+
+        std::cout << "Best instruction set: " << DistanceISAName(DetectDistanceISA()) << ", vector values: "
+                    << (std::is_integral<VectorDimensionType>::value ? "int64" : "float") << std::endl;
+        CheckScalarQuantizer();
+        for (int dim : dim_list) {
+            RunBench(n, dim, repeat);
+        }
+
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
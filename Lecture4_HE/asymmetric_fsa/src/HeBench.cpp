@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <exception>
+
+#include <boost/program_options.hpp>
+namespace bpo = boost::program_options;
+
+#include "seal/seal.h"
+
+#include "utils/HeScheme.hpp"
+
+using seal::BatchEncoder;
+using seal::CKKSEncoder;
+using seal::Ciphertext;
+using seal::Decryptor;
+using seal::Encryptor;
+using seal::Evaluator;
+using seal::KeyGenerator;
+using seal::MemoryManager;
+using seal::MemoryPoolHandle;
+using seal::Plaintext;
+using seal::PublicKey;
+using seal::SEALContext;
+using seal::SecretKey;
+
+/*
+Benchmark of one comparison of the perturbation protocol between two data holders A and B, as the data holders run it:
+each encrypts its square distance d and perturbs it into r*d + r with its random value r, the other one multiplies it by its own r,
+and A subtracts both, so the query user decrypts r_a*r_b*(d_a - d_b) and only learns the sign.
+The float vectors are compared in CKKS on their real distances, and in BGV on the distances of the vectors quantized to integers,
+both against the sign of the exact float distances.
+*/
+enum HeStep {
+    STEP_ENCRYPT = 0,
+    STEP_PERTURB,
+    STEP_SERIALIZE,
+    STEP_DOUBLE_PERTURB,
+    STEP_SUBTRACT,
+    STEP_DECRYPT,
+    STEP_NUM
+};
+
+static const char* kHeStepName[STEP_NUM] = {"encrypt", "perturb", "serialize", "double perturb", "subtract", "decrypt"};
+
+struct HeBenchStat {
+    double step_time[STEP_NUM] = {0};
+    double save_size = 0;
+    double cipher_bytes = 0;
+    int trial_num = 0;
+    int correct_num = 0;
+    // the largest relative error of the decrypted differences, CKKS only
+    double max_error = 0;
+};
+
+class PerturbComparison {
+public:
+    explicit PerturbComparison(const HeScheme scheme)
+        : m_scheme(scheme), m_context(CreateSealParams(scheme)), m_evaluator(m_context), m_pool(MemoryManager::GetPool()) {
+        KeyGenerator keygen(m_context);
+        m_secret_key = keygen.secret_key();
+        keygen.create_public_key(m_public_key);
+        m_encryptor = std::make_unique<Encryptor>(m_context, m_public_key);
+        m_decryptor = std::make_unique<Decryptor>(m_context, m_secret_key);
+        if (m_scheme == HeScheme::CKKS) {
+            m_ckks_encoder = std::make_unique<CKKSEncoder>(m_context);
+            m_real_slot_matrix.assign(m_ckks_encoder->slot_count(), 0);
+        } else {
+            m_batch_encoder = std::make_unique<BatchEncoder>(m_context);
+            m_slot_matrix.assign(m_batch_encoder->slot_count(), 0);
+        }
+    }
+
+    /*
+    Run one comparison of the distances of A and B with the random values of A and B, and return the decrypted r_a*r_b*(d_a - d_b).
+    */
+    double Compare(const double dist_a, const double dist_b, const int64_t random_a, const int64_t random_b, HeBenchStat& stat) {
+        auto start_time = std::chrono::steady_clock::now();
+        auto lap = [&start_time, &stat](const HeStep step) {
+            auto now = std::chrono::steady_clock::now();
+            stat.step_time[step] += std::chrono::duration<double, std::micro>(now - start_time).count();
+            start_time = now;
+        };
+
+        // A and B encrypt their distances
+        m_EncodeSlot0(dist_a, m_plain);
+        m_encryptor->encrypt(m_plain, m_cipher_a, m_pool);
+        m_EncodeSlot0(dist_b, m_plain);
+        m_encryptor->encrypt(m_plain, m_cipher_b, m_pool);
+        lap(STEP_ENCRYPT);
+
+        // A and B perturb their distances, with the plaintexts of their random values
+        m_Perturb(random_a, m_perturb_a, m_cipher_a);
+        m_Perturb(random_b, m_perturb_b, m_cipher_b);
+        lap(STEP_PERTURB);
+
+        // A sends its perturbed distance to B, and B sends both back to A
+        m_RoundTrip(m_cipher_a, stat);
+        m_RoundTrip(m_cipher_b, stat);
+        lap(STEP_SERIALIZE);
+
+        m_evaluator.multiply_plain_inplace(m_cipher_a, m_perturb_b.mul_plain, m_pool);
+        m_evaluator.multiply_plain_inplace(m_cipher_b, m_perturb_a.mul_plain, m_pool);
+        lap(STEP_DOUBLE_PERTURB);
+
+        m_evaluator.sub_inplace(m_cipher_a, m_cipher_b);
+        lap(STEP_SUBTRACT);
+
+        m_decryptor->decrypt(m_cipher_a, m_plain);
+        double diff;
+        if (m_scheme == HeScheme::CKKS) {
+            m_ckks_encoder->decode(m_plain, m_real_decode_list, m_pool);
+            diff = m_real_decode_list[0];
+        } else {
+            m_batch_encoder->decode(m_plain, m_decode_list, m_pool);
+            diff = (double)m_decode_list[0];
+        }
+        lap(STEP_DECRYPT);
+
+        ++stat.trial_num;
+        return diff;
+    }
+
+private:
+    struct Perturb {
+        Plaintext add_plain;
+        Plaintext mul_plain;
+    };
+
+    // the same plaintexts as the data holders build, see PerturbMaterial in DataHolder.cpp
+    void m_Perturb(const int64_t random_value, Perturb& perturb, Ciphertext& cipher) {
+        m_EncodeSlot0((double)random_value, perturb.add_plain);
+        if (m_scheme == HeScheme::CKKS) {
+            m_ckks_encoder->encode((double)random_value, m_context.first_parms_id(), 1.0, perturb.mul_plain, m_pool);
+        } else {
+            Plaintext scalar_plain(1);
+            scalar_plain[0] = random_value;
+            m_evaluator.transform_to_ntt(scalar_plain, m_context.first_parms_id(), perturb.mul_plain, m_pool);
+        }
+        m_evaluator.multiply_plain_inplace(cipher, perturb.mul_plain, m_pool);
+        m_evaluator.add_plain_inplace(cipher, perturb.add_plain, m_pool);
+    }
+
+    void m_EncodeSlot0(const double value, Plaintext& plain) {
+        if (m_scheme == HeScheme::CKKS) {
+            m_real_slot_matrix[0] = value;
+            m_ckks_encoder->encode(m_real_slot_matrix, CkksScale(), plain, m_pool);
+        } else {
+            m_slot_matrix[0] = (int64_t)value;
+            m_batch_encoder->encode(m_slot_matrix, plain);
+        }
+    }
+
+    void m_RoundTrip(Ciphertext& cipher, HeBenchStat& stat) {
+        const size_t save_size = cipher.save_size();
+        m_buffer.resize(save_size);
+        const size_t cipher_bytes = cipher.save(reinterpret_cast<seal::seal_byte*>(&m_buffer[0]), m_buffer.size());
+        cipher.load(m_context, reinterpret_cast<const seal::seal_byte*>(m_buffer.data()), cipher_bytes);
+        stat.save_size += save_size;
+        stat.cipher_bytes += cipher_bytes;
+    }
+
+    HeScheme m_scheme;
+    SEALContext m_context;
+    Evaluator m_evaluator;
+    MemoryPoolHandle m_pool;
+    SecretKey m_secret_key;
+    PublicKey m_public_key;
+    std::unique_ptr<Encryptor> m_encryptor;
+    std::unique_ptr<Decryptor> m_decryptor;
+    std::unique_ptr<BatchEncoder> m_batch_encoder;
+    std::unique_ptr<CKKSEncoder> m_ckks_encoder;
+    std::vector<int64_t> m_slot_matrix;
+    std::vector<int64_t> m_decode_list;
+    std::vector<double> m_real_slot_matrix;
+    std::vector<double> m_real_decode_list;
+    Perturb m_perturb_a;
+    Perturb m_perturb_b;
+    Plaintext m_plain;
+    Ciphertext m_cipher_a;
+    Ciphertext m_cipher_b;
+    std::string m_buffer;
+};
+
+double SquareDistance(const std::vector<double>& a, const std::vector<double>& b) {
+    double sum = 0;
+    for (size_t i=0; i<a.size(); ++i) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+std::vector<int64_t> Quantize(const std::vector<double>& data, const double scale) {
+    std::vector<int64_t> quantized(data.size());
+    for (size_t i=0; i<data.size(); ++i) {
+        quantized[i] = std::llround(data[i] * scale);
+    }
+    return quantized;
+}
+
+int64_t SquareDistance(const std::vector<int64_t>& a, const std::vector<int64_t>& b) {
+    int64_t sum = 0;
+    for (size_t i=0; i<a.size(); ++i) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+void PrintStat(const std::string& name, const HeBenchStat& stat) {
+    const double trial_num = std::max(stat.trial_num, 1);
+    double total_time = 0;
+    std::cout << std::fixed << std::setprecision(2);
+    for (int step=0; step<STEP_NUM; ++step) {
+        std::cout << name << " " << std::setw(15) << std::left << kHeStepName[step] << std::right << ": " << std::setw(9) << stat.step_time[step] / trial_num << " [us]" << std::endl;
+        total_time += stat.step_time[step];
+    }
+    std::cout << name << " " << std::setw(15) << std::left << "total" << std::right << ": " << std::setw(9) << total_time / trial_num << " [us]" << std::endl;
+    // two ciphertexts are serialized per comparison
+    std::cout << name << " ciphertext     : " << stat.cipher_bytes / trial_num / 2 / 1024.0 << " [KB], save_size bound " << stat.save_size / trial_num / 2 / 1024.0 << " [KB]" << std::endl;
+    std::cout << name << " correct        : " << stat.correct_num << " / " << stat.trial_num;
+    if (name == "CKKS") {
+        std::cout << std::scientific << std::setprecision(2) << ", max relative error = " << stat.max_error << std::fixed;
+    }
+    std::cout << std::endl;
+}
+
+void RunBench(const int trials, const int dim, const double quantize_scale, const double noise, const unsigned int seed) {
+    std::default_random_engine eng(seed);
+    std::uniform_real_distribution<double> value_distribution(0.0, 1.0);
+    std::uniform_real_distribution<double> noise_distribution(-noise, noise);
+    std::uniform_int_distribution<int64_t> random_distribution(1, 100);
+
+    PerturbComparison bgv(HeScheme::BGV), ckks(HeScheme::CKKS);
+    HeBenchStat bgv_stat, ckks_stat;
+    std::vector<double> query_data(dim), a_data(dim), b_data(dim);
+    for (int t=0; t<trials; ++t) {
+        for (int j=0; j<dim; ++j) {
+            query_data[j] = value_distribution(eng);
+            a_data[j] = value_distribution(eng);
+            // with noise, B is near A, so that the distances are close
+            b_data[j] = (noise > 0) ? a_data[j] + noise_distribution(eng) : value_distribution(eng);
+        }
+        const double dist_a = SquareDistance(a_data, query_data), dist_b = SquareDistance(b_data, query_data);
+        const bool a_wins = dist_a < dist_b;
+        const int64_t random_a = random_distribution(eng), random_b = random_distribution(eng);
+
+        const std::vector<int64_t> quantized_query = Quantize(query_data, quantize_scale);
+        const double bgv_diff = bgv.Compare((double)SquareDistance(Quantize(a_data, quantize_scale), quantized_query),
+                                            (double)SquareDistance(Quantize(b_data, quantize_scale), quantized_query), random_a, random_b, bgv_stat);
+        bgv_stat.correct_num += ((bgv_diff < 0) == a_wins);
+
+        const double ckks_diff = ckks.Compare(dist_a, dist_b, random_a, random_b, ckks_stat);
+        ckks_stat.correct_num += ((ckks_diff < 0) == a_wins);
+        const double expected_diff = (double)random_a * random_b * (dist_a - dist_b);
+        ckks_stat.max_error = std::max(ckks_stat.max_error, std::fabs(ckks_diff - expected_diff) / std::max(std::fabs(expected_diff), 1e-12));
+    }
+
+    std::cout << "dim = " << dim << ", trials = " << trials << ", quantization scale = " << quantize_scale << ", noise = " << noise << std::endl;
+    PrintStat("BGV ", bgv_stat);
+    PrintStat("CKKS", ckks_stat);
+}
+
+int main(int argc, char** argv) {
+    // Expect the following args: --trials=200 --dim=128
+    int trials, dim;
+    double quantize_scale, noise;
+    unsigned int seed;
+
+    try {
+        bpo::options_description option_description("Required options");
+        option_description.add_options()
+            ("help", "produce help message")
+            ("trials", bpo::value<int>(&trials)->default_value(200), "Number of comparisons")
+            ("dim", bpo::value<int>(&dim)->default_value(128), "Dimension of the float vectors in [0, 1)")
+            ("quantize-scale", bpo::value<double>(&quantize_scale)->default_value(100), "Scale of the integer vectors of BGV, which are the float vectors times the scale, rounded")
+            ("noise", bpo::value<double>(&noise)->default_value(0.01), "B is A plus uniform noise of this amplitude, which makes the distances close (0 for independent vectors)")
+            ("seed", bpo::value<unsigned int>(&seed)->default_value(1), "Random seed of the vectors")
+        ;
+
+        bpo::variables_map variable_map;
+        bpo::store(bpo::parse_command_line(argc, argv, option_description), variable_map);
+        bpo::notify(variable_map);
+
+        if (variable_map.count("help")) {
+            std::cout << option_description << std::endl;
+            return 0;
+        }
+        if (trials <= 0 || dim <= 0) {
+            throw std::invalid_argument("trials and dim must be positive integers");
+        }
+        if (quantize_scale <= 0 || noise < 0) {
+            throw std::invalid_argument("quantize-scale must be positive and noise non-negative");
+        }
+
+        RunBench(trials, dim, quantize_scale, noise, seed);
+
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
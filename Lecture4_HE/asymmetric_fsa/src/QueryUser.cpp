@@ -9,9 +9,13 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <future>
+#include <mutex>
+#include <atomic>
 #include <cctype>
 #include <cstdlib>
 #include <random>
+#include <numeric>
 #include <limits>
 #include <utility>
 #include <exception>
@@ -23,11 +27,17 @@ namespace bpo = boost::program_options;
 
 #include <grpc/grpc.h>
 #include <grpcpp/grpcpp.h>
+#include <google/protobuf/io/coded_stream.h>
 
 #include "seal/seal.h"
 
 #include "utils/BenchLogger.hpp"
 #include "utils/DataType.hpp"
+#include "utils/DecryptWorkerPool.hpp"
+#include "utils/HeScheme.hpp"
+#include "utils/PackedVector.hpp"
+#include "utils/Snapshot.hpp"
+#include "utils/VectorFile.hpp"
 #include "FedSql.grpc.pb.h"
 
 using grpc::Channel;
@@ -38,6 +48,12 @@ using FedSql::FedSqlService;
 using FedSql::QueryObject;
 using FedSql::EncryptDistance;
 using FedSql::QueryAnswer;
+using FedSql::QueryId;
+using FedSql::PerturbRequest;
+using FedSql::RangeQuery;
+using FedSql::RangeFetch;
+using FedSql::AnswerChunk;
+using grpc::ClientReader;
 
 // related to Microsoft SEAL
 using PublicKey = seal::PublicKey;
@@ -64,11 +80,12 @@ class DataHolderReceiver {
 public:
     DataHolderReceiver(std::shared_ptr<grpc::Channel> channel, const int silo_id, const std::string& silo_ipaddr, const std::string& silo_name) 
         : m_stub_(FedSqlService::NewStub(channel)), m_silo_id(silo_id), m_silo_ipaddr(silo_ipaddr), m_silo_name(silo_name) {
-        
-        m_logger.Init();
     }
 
-    void BroadcastQueryObject(const QueryObject& query_object) {
+    /*
+    Each RPC returns its communication cost, so that several queries can use the same receiver concurrently.
+    */
+    double BroadcastQueryObject(const QueryObject& query_object) {
         ClientContext context;
         Empty response;
 
@@ -80,15 +97,17 @@ public:
             throw std::invalid_argument(error_message);
         }
 
-        float grpc_comm = query_object.ByteSizeLong() + response.ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
+        double grpc_comm = query_object.ByteSizeLong() + response.ByteSizeLong();
+        return grpc_comm;
     }
 
-    void GetEncryptPerturbDistance() {
+    double GetEncryptPerturbDistance(const VidType qid, const std::string& other_silo_ipaddr, EncryptDistance& encrypt_dist) {
         ClientContext context;
-        Empty request;
+        PerturbRequest request;
+        request.set_qid(qid);
+        request.set_ipaddr(other_silo_ipaddr);
 
-        Status status = m_stub_->GetEncryptPerturbDistance(&context, request, &m_encrypt_dist); 
+        Status status = m_stub_->GetEncryptPerturbDistance(&context, request, &encrypt_dist); 
         if (!status.ok()) {
             std::cerr << "RPC failed: " << status.error_message() << std::endl;
             std::string error_message;
@@ -96,15 +115,16 @@ public:
             throw std::invalid_argument(error_message);
         }
 
-        float grpc_comm = request.ByteSizeLong() + m_encrypt_dist.ByteSizeLong();
-        grpc_comm += m_encrypt_dist.comm();
-        m_logger.LogAddComm(grpc_comm);
+        double grpc_comm = request.ByteSizeLong() + encrypt_dist.ByteSizeLong();
+        grpc_comm += encrypt_dist.comm();
+        return grpc_comm;
     }
 
-    VectorDataType GetQueryAnswer() {
+    double GetQueryAnswer(const VidType qid, VectorDataType& query_answer) {
         ClientContext context;
-        Empty request;
+        QueryId request;
         QueryAnswer response;
+        request.set_qid(qid);
 
         Status status = m_stub_->GetQueryAnswer(&context, request, &response); 
         if (!status.ok()) {
@@ -114,21 +134,24 @@ public:
             throw std::invalid_argument(error_message);
         }
 
-        float grpc_comm = request.ByteSizeLong() + response.ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
+        double grpc_comm = request.ByteSizeLong() + response.ByteSizeLong();
 
-        const int dim = response.data_size();
-        VectorDataType ret(dim, response.vid());
-        for (int i=0; i<dim; ++i) {
-            ret.data[i] = response.data(i);
+        query_answer.SetVid(response.vid());
+        if (response.dtype() == FedSql::DTYPE_VARINT) {
+            query_answer.data.assign(response.data().begin(), response.data().end());
+        } else {
+            const size_t dim = response.packed_data().size() / PackedDtypeSize((PackedDtype)response.dtype());
+            query_answer.data.resize(dim);
+            PackedVectorView(response.packed_data(), response.dtype(), 1, dim).CopyRow(0, query_answer.data.data());
         }
-        return ret;
+        return grpc_comm;
     } 
 
-    void FinishQueryProcessing() {
+    double FinishQueryProcessing(const VidType qid) {
         ClientContext context;
-        Empty request;
+        QueryId request;
         Empty response;
+        request.set_qid(qid);
 
         Status status = m_stub_->FinishQueryProcessing(&context, request, &response); 
         if (!status.ok()) {
@@ -138,65 +161,92 @@ public:
             throw std::invalid_argument(error_message);
         }
 
-        float grpc_comm = request.ByteSizeLong() + response.ByteSizeLong();
-        m_logger.LogAddComm(grpc_comm);
+        double grpc_comm = request.ByteSizeLong() + response.ByteSizeLong();
+        return grpc_comm;
     } 
 
-    EncryptDistance PerturbEncryptDistance() const {
-        return m_encrypt_dist;
-    }
+    double GetEncryptRangeDistance(const RangeQuery& range_query, EncryptDistance& encrypt_dist) {
+        ClientContext context;
 
-    double GetQueryComm() const {
-        return m_logger.GetQueryComm();
-    }
+        Status status = m_stub_->GetEncryptRangeDistance(&context, range_query, &encrypt_dist);
+        if (!status.ok()) {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            std::string error_message;
+            error_message = std::string("Get encrypt range distance from data silo #(") + std::to_string(m_silo_id) + std::string(") failed");
+            throw std::invalid_argument(error_message);
+        }
 
-    void InitBenchLogger() {
-        m_logger.Init();
+        double grpc_comm = range_query.ByteSizeLong() + encrypt_dist.ByteSizeLong();
+        return grpc_comm;
     }
 
-    static void ThreadBroadcastQueryObject(DataHolderReceiver* silo_receiver, const QueryObject& query_object) {  
-        silo_receiver->BroadcastQueryObject(query_object);
-    }
+    /*
+    Read the streamed answers of a range query, the nearest ``limit`` ones (0 for all of them),
+    in chunks of at most ``chunk_size`` bytes (0 for the data holder's default), one chunk is unpacked at a time.
+    */
+    double GetRangeQueryAnswer(const VidType qid, const size_t limit, const size_t chunk_size, std::vector<VectorDataType>& answer_list) {
+        ClientContext context;
+        RangeFetch request;
+        AnswerChunk response;
+        request.set_qid(qid);
+        request.set_limit(limit);
+        request.set_chunk_size(chunk_size);
+
+        double grpc_comm = request.ByteSizeLong();
+        std::unique_ptr<ClientReader<AnswerChunk>> reader(m_stub_->GetRangeQueryAnswer(&context, request));
+        while (reader->Read(&response)) {
+            grpc_comm += response.ByteSizeLong();
+            const size_t dim = response.dim();
+            const int dtype = (response.dtype() == FedSql::DTYPE_VARINT) ? FedSql::DTYPE_INT64 : response.dtype();
+            PackedVectorView chunk_view(response.data(), dtype, response.vid_size(), dim);
+            for (int i=0; i<response.vid_size(); ++i) {
+                answer_list.emplace_back(dim, response.vid(i));
+                chunk_view.CopyRow(i, answer_list.back().data.data());
+            }
+        }
+        Status status = reader->Finish();
+        if (!status.ok()) {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            std::string error_message;
+            error_message = std::string("Get range query answer from data silo #(") + std::to_string(m_silo_id) + std::string(") failed");
+            throw std::invalid_argument(error_message);
+        }
 
-    static void ThreadGetEncryptPerturbDistance(DataHolderReceiver* silo_receiver) {  
-        silo_receiver->GetEncryptPerturbDistance();
+        return grpc_comm;
     }
 
-    static void ThreadGetDecryptDistance(DataHolderReceiver* silo_receiver, const std::string& edist_str, const EncryptionParameters& params, const SecretKey& secret_key, VectorDimensionType& dist) {  
-        SEALContext context(params);
-
-        Decryptor decryptor(context, secret_key);
-        BatchEncoder batch_encoder(context);
-
-        std::stringstream edist_sstream(edist_str);
+    static void ThreadGetEncryptRangeDistance(DataHolderReceiver* silo_receiver, const RangeQuery& range_query, EncryptDistance& encrypt_dist, double& grpc_comm) {
+        grpc_comm += silo_receiver->GetEncryptRangeDistance(range_query, encrypt_dist);
+    }
 
-        Ciphertext dist_encrypted;
-        dist_encrypted.load(context, edist_sstream);
+    static void ThreadGetRangeQueryAnswer(DataHolderReceiver* silo_receiver, const VidType qid, const size_t limit, const size_t chunk_size,
+                                            std::vector<VectorDataType>& answer_list, double& grpc_comm) {
+        grpc_comm += silo_receiver->GetRangeQueryAnswer(qid, limit, chunk_size, answer_list);
+    }
 
-        Plaintext dist_decrypted;
-        std::vector<int64_t> dist_matrix;
-        decryptor.decrypt(dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix);
+    static void ThreadBroadcastQueryObject(DataHolderReceiver* silo_receiver, const QueryObject& query_object, double& grpc_comm) {  
+        grpc_comm += silo_receiver->BroadcastQueryObject(query_object);
+    }
 
-        dist = dist_matrix[0];
-    }    
+    static void ThreadGetEncryptPerturbDistance(DataHolderReceiver* silo_receiver, const VidType qid, const std::string& other_silo_ipaddr, EncryptDistance& encrypt_dist, double& grpc_comm) {  
+        grpc_comm += silo_receiver->GetEncryptPerturbDistance(qid, other_silo_ipaddr, encrypt_dist);
+    }
 
-    static void ThreadFinishQueryProcessing(DataHolderReceiver* silo_receiver) {
-        silo_receiver->FinishQueryProcessing();
+    static void ThreadFinishQueryProcessing(DataHolderReceiver* silo_receiver, const VidType qid, double& grpc_comm) {
+        grpc_comm += silo_receiver->FinishQueryProcessing(qid);
     }   
 
 private:
     std::unique_ptr<FedSqlService::Stub> m_stub_;
+    int m_silo_id;
     std::string m_silo_ipaddr;
     std::string m_silo_name;
-    int m_silo_id;
-    EncryptDistance m_encrypt_dist;
-    BenchLogger m_logger;  
 };
 
 class FedSqlServer {
 public:
-    FedSqlServer(const std::string& silo_ip_filename, const std::string& user_name) : m_query_num(0), m_user_name(user_name) {
+    FedSqlServer(const std::string& silo_ip_filename, const std::string& user_name, const std::string& snapshot_dir="", const HeScheme scheme=HeScheme::BGV)
+        : m_user_name(user_name), m_scheme(scheme) {
 
         m_ReadSiloIPaddr(silo_ip_filename, m_silo_ipaddr_list, m_silo_name_list);
         if (m_silo_ipaddr_list.empty()) {
@@ -206,57 +256,245 @@ public:
         std::cout << m_user_name << " is requesting asymmetric nearest neighbor query...\n";
 
         m_CreateSiloReceiver();
-        m_InitSealParams();
+        m_InitSealParams(snapshot_dir);
         m_logger.Init();
+        m_latency_logger.Init();
+        m_window = 1;
+        m_qps = 0;
+        m_square_radius = -1;
+        m_range_limit = 0;
+        m_chunk_size = 0;
+        m_wire_auto = true;
+        m_wire_dtype = PackedDtype::INT64;
+        m_throughput = 0;
     }
 
-    void ProcessANNQ(const int dim) {
-        // Step 0: Initialize local variables
-        m_InitBenchLogger();
-        m_logger.SetStartTimer();
-        m_dim = dim;
+    /*
+    Replay the query objects from a vector file instead of generating them randomly.
+    */
+    void LoadQueryFile(const std::string& query_filename) {
+        m_query_file = std::make_unique<VectorFileReader>(query_filename);
+        if (m_query_file->Size() == 0) {
+            throw std::invalid_argument("There are no query objects in " + query_filename);
+        }
+        std::cout << "Load " << m_query_file->Size() << " query objects of dimension " << m_query_file->Dimension() << " from " << query_filename << std::endl;
+    }
 
-        // Step 1: Generator query object
-        std::vector<VectorDimensionType> arr(dim);
-        const int base = 100;
-        std::random_device rd;  // 用于获取随机数种子  
-        std::default_random_engine eng(rd());  // 使用随机种子初始化引擎  
-        // 创建均匀分布的整数随机数生成器，范围在 [1, 100]  
-        std::uniform_int_distribution<> distribution(1, base); 
-        for (int j=0; j<dim; ++j) {
-            arr[j] = distribution(eng);
+    size_t QueryFileSize() const {
+        return (m_query_file == nullptr) ? 0 : m_query_file->Size();
+    }
+
+    /*
+    Write one line per query answer, which is checked by the verifier against the exact nearest neighbor:
+        qid, data holder's identifier, vid, latency [ms], communication [bytes]
+    The query object of qid is the row (qid % size) of the query file.
+    */
+    void SetAnswerFile(const std::string& answer_filename) {
+        m_answer_file.open(answer_filename);
+        if (!m_answer_file.is_open()) {
+            throw std::invalid_argument("Failed to open answer file for writing: " + answer_filename);
         }
-        VectorDataType query_data(dim, m_query_num++, arr);
-        std::cout << std::endl;
-        std::cout << "Query object " << query_data.to_string() << std::endl;
+        m_answer_file << "# qid silo_id vid latency[ms] comm[bytes]" << std::endl;
+    }
 
-        // Step 2: Broadcast the query object to data holders
-        m_BroadcastQueryObject(query_data);
+    /*
+    The encoding of the query objects on the wire: "varint" for the repeated int64 field, a packed type
+    (int8, int16, int32, int64 or float) which every query object must fit into, or "auto" for the narrowest integer type of each query object.
+    */
+    void SetWireDtype(const std::string& dtype_name) {
+        m_wire_auto = (dtype_name == "auto");
+        if (!m_wire_auto) {
+            m_wire_dtype = ParsePackedDtype(dtype_name);
+        }
+    }
 
-        // Step 3: Get encrypt perturb distance from Alice (not Bob)
-        m_GetEncryptPerturbDistance();
+    /*
+    Pipelined query scheduler: keep up to ``window`` queries in flight, 
+    so that the data holders process query i+1 while the query user is decrypting query i.
+    */
+    void RunQueries(const int n, const int dim, const int window) {
+        if (window <= 0) {
+            throw std::invalid_argument("window must be a positive integer");
+        }
+        m_dim = (m_query_file == nullptr) ? dim : m_query_file->Dimension();
+        m_window = window;
 
-        // Step 3: Decrypt distance difference and determine the nearest one
-        int nearest_silo_id = m_GetDecryptPerturbNearestDistance();
+        BenchLogger service_logger;
+        service_logger.SetStartTimer();
+
+        m_RunQueryWorkers(n, window, [this](const int query_index) {
+            VectorDataType query_data = m_NextQueryObject(query_index);
+            ProcessQuery(query_data, std::chrono::steady_clock::now());
+        });
+
+        service_logger.SetEndTimer();
+        double wall_time = service_logger.GetDurationTime();
+        m_throughput = (wall_time <= 0) ? 0 : (n * 1000.0 / wall_time);
+    }
+
+    /*
+    Open-loop load generator: queries arrive as a Poisson process with rate ``qps``, independently of the completions.
+    Up to ``window`` queries are processed concurrently, and a query that arrives when all of them are busy waits in the queue.
+    The latency of a query is measured from its scheduled arrival time, so the queueing delay is included.
+    */
+    void RunOpenLoopQueries(const int n, const int dim, const int window, const double qps, const unsigned int seed) {
+        if (window <= 0) {
+            throw std::invalid_argument("window must be a positive integer");
+        }
+        if (qps <= 0) {
+            throw std::invalid_argument("qps must be a positive number");
+        }
+        m_dim = (m_query_file == nullptr) ? dim : m_query_file->Dimension();
+        m_window = window;
+        m_qps = qps;
+
+        // Inter-arrival times of a Poisson process are exponentially distributed
+        std::vector<std::chrono::steady_clock::duration> arrival_list(n);
+        std::random_device rd;
+        std::mt19937_64 eng((seed == 0) ? rd() : seed);
+        std::exponential_distribution<double> distribution(qps);
+        double arrival_time = 0;
+        for (int i=0; i<n; ++i) {
+            arrival_time += distribution(eng);
+            arrival_list[i] = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(arrival_time));
+        }
+
+        BenchLogger service_logger;
+        service_logger.SetStartTimer();
+        const auto start_time = std::chrono::steady_clock::now();
+
+        m_RunQueryWorkers(n, window, [this, start_time, &arrival_list](const int query_index) {
+            const auto scheduled_time = start_time + arrival_list[query_index];
+            std::this_thread::sleep_until(scheduled_time);
+            VectorDataType query_data = m_NextQueryObject(query_index);
+            ProcessQuery(query_data, scheduled_time);
+        });
+
+        service_logger.SetEndTimer();
+        double wall_time = service_logger.GetDurationTime();
+        m_throughput = (wall_time <= 0) ? 0 : (n * 1000.0 / wall_time);
+    }
+
+    void ProcessANNQ(const VectorDataType& query_data, const std::chrono::steady_clock::time_point& arrival_time) {
+        // Step 0: Initialize local variables
+        BenchLogger query_logger;
+        query_logger.SetStartTimer();
+        const VidType qid = query_data.vid;
+        std::vector<double> comm_list(m_silo_num, 0.0);
+
+        // Step 1: Broadcast the query object to data holders
+        m_BroadcastQueryObject(query_data, comm_list);
+
+        // Step 2 & 3: Get and decrypt the encrypt perturb distance differences round by round, until the nearest one is determined
+        int nearest_silo_id = m_GetNearestSilo(qid, comm_list);
 
         // Step 4: Obtain query answer from specific data holder
-        VectorDataType query_answer = m_GetQueryAnswer(nearest_silo_id);
+        VectorDataType query_answer;
+        comm_list[nearest_silo_id] += m_silo_receiver_list[nearest_silo_id]->GetQueryAnswer(qid, query_answer);
 
         // Step 5: Finish query processing at each data holder
-        m_FinishQueryProcessing();
+        m_FinishQueryProcessing(qid, comm_list);
 
         // Step 6: Print the log information
-        m_logger.SetEndTimer();
+        query_logger.SetEndTimer();
         double query_comm = 0.0;
         for (int i=0; i<m_silo_num; ++i) {
-            query_comm += m_silo_receiver_list[i]->GetQueryComm();
+            query_comm += comm_list[i];
+        }
+        double query_time = query_logger.GetDurationTime();
+        double query_latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - arrival_time).count();
+
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.LogOneQuery(query_comm, query_time);
+        m_latency_logger.Record(query_latency);
+        if (m_answer_file.is_open()) {
+            m_answer_file << qid << " " << nearest_silo_id << " " << query_answer.vid << " " << query_latency << " " << query_comm << "\n";
         }
-        double query_time = m_logger.GetDurationTime();
-        m_logger.LogOneQuery(query_comm);
-
         std::cout << std::fixed << std::setprecision(6) 
-                    << "Query #(" << query_data.vid << "): runtime = " << query_time/1000.0 << " [s], communication = " << query_comm/1024.0 << " [KB]" << std::endl;
-        std::cout << "Answer #(" << query_data.vid << "): data holder = " << m_silo_name_list[nearest_silo_id] << ", data = " << query_answer.to_string() << std::endl;
+                    << "Query #(" << qid << "): runtime = " << query_time/1000.0 << " [s], latency = " << query_latency/1000.0 << " [s], communication = " << query_comm/1024.0 << " [KB]" << std::endl;
+        std::cout << "Answer #(" << qid << "): data holder = " << m_silo_name_list[nearest_silo_id] << ", data = " << query_answer.to_string() << std::endl;
+    }
+
+    /*
+    Answer range queries instead of nearest neighbor queries: all data objects within the radius of the query object,
+    or only the nearest ``limit`` of them (0 for all). The answers are streamed in chunks of at most ``chunk_size`` bytes.
+    */
+    void SetRangeQuery(const double radius, const size_t limit, const size_t chunk_size=0) {
+        if (radius < 0) {
+            throw std::invalid_argument("radius must be non-negative");
+        }
+        // the data holders compare square distances, which are integers unless the vectors are floats
+        m_square_radius = SquareRadius(radius);
+        m_range_limit = limit;
+        m_chunk_size = chunk_size;
+    }
+
+    void ProcessQuery(const VectorDataType& query_data, const std::chrono::steady_clock::time_point& arrival_time) {
+        if (m_square_radius >= 0) {
+            ProcessRangeQuery(query_data, arrival_time);
+        } else {
+            ProcessANNQ(query_data, arrival_time);
+        }
+    }
+
+    void ProcessRangeQuery(const VectorDataType& query_data, const std::chrono::steady_clock::time_point& arrival_time) {
+        // Step 0: Initialize local variables
+        BenchLogger query_logger;
+        query_logger.SetStartTimer();
+        const VidType qid = query_data.vid;
+        std::vector<double> comm_list(m_silo_num, 0.0);
+
+        // Step 1: Send the range query to data holders, each returns its encrypted number of answers and their distances
+        std::vector<EncryptDistance> encrypt_dist_list = m_SendRangeQuery(query_data, comm_list);
+
+        // Step 2: Decrypt them and decide how many answers to fetch from each data holder
+        std::vector<size_t> fetch_num_list = m_GetRangeFetchNum(encrypt_dist_list);
+
+        // Step 3: Fetch the answers from the data holders with any answers to fetch
+        std::vector<std::vector<VectorDataType>> answer_list(m_silo_num);
+        std::vector<std::future<void>> future_list;
+        for (int i=0; i<m_silo_num; ++i) {
+            if (fetch_num_list[i] == 0) continue;
+            future_list.emplace_back(std::async(std::launch::async, DataHolderReceiver::ThreadGetRangeQueryAnswer, m_silo_receiver_list[i].get(), qid,
+                                        fetch_num_list[i], m_chunk_size, std::ref(answer_list[i]), std::ref(comm_list[i])));
+        }
+        m_WaitAll(future_list);
+
+        // Step 4: Finish query processing at each data holder
+        m_FinishQueryProcessing(qid, comm_list);
+
+        // Step 5: Print the log information
+        query_logger.SetEndTimer();
+        double query_comm = 0.0;
+        size_t answer_num = 0;
+        for (int i=0; i<m_silo_num; ++i) {
+            query_comm += comm_list[i];
+            answer_num += answer_list[i].size();
+        }
+        double query_time = query_logger.GetDurationTime();
+        double query_latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - arrival_time).count();
+
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.LogOneQuery(query_comm, query_time);
+        m_latency_logger.Record(query_latency);
+        if (m_answer_file.is_open()) {
+            for (int i=0; i<m_silo_num; ++i) {
+                for (const auto& answer : answer_list[i]) {
+                    m_answer_file << qid << " " << i << " " << answer.vid << " " << query_latency << " " << query_comm << "\n";
+                }
+            }
+            // a query without answers is still recorded
+            if (answer_num == 0) {
+                m_answer_file << qid << " -1 -1 " << query_latency << " " << query_comm << "\n";
+            }
+        }
+        std::cout << std::fixed << std::setprecision(6)
+                    << "Query #(" << qid << "): runtime = " << query_time/1000.0 << " [s], latency = " << query_latency/1000.0 << " [s], communication = " << query_comm/1024.0 << " [KB]" << std::endl;
+        std::cout << "Answer #(" << qid << "): " << answer_num << " data objects within square distance " << m_square_radius;
+        for (int i=0; i<m_silo_num; ++i) {
+            std::cout << ", " << m_silo_name_list[i] << " = " << answer_list[i].size();
+        }
+        std::cout << std::endl;
     }
 
     std::string to_string() const {
@@ -264,33 +502,97 @@ public:
 
         ss << "\n";
         ss << "-------------- Service Log --------------\n";
-        ss << m_logger.to_string();
+        {
+            std::lock_guard<std::mutex> lock(m_logger_mutex);
+            ss << m_logger.to_string();
+            ss << m_latency_logger.to_string();
+            double data_bytes = m_logger.GetCounter("query data [bytes]"), varint_bytes = m_logger.GetCounter("query data varint [bytes]");
+            if (varint_bytes > 0) {
+                ss << "query data encoding = " << (m_wire_auto ? std::string("auto") : std::string(PackedDtypeName(m_wire_dtype)))
+                    << ": " << data_bytes << " bytes vs. " << varint_bytes << " bytes of varints, saved " << (1.0 - data_bytes / varint_bytes) * 100.0 << "%" << std::endl;
+            }
+        }
+        if (m_qps > 0) {
+            ss << "offered load = " << m_qps << " [queries/s], ";
+        }
+        ss << "window = " << m_window << " queries in flight: throughput = " << m_throughput << " [queries/s]" << std::endl;
 
         return ss.str();
     }
 
 private:
-    void m_GetEncryptPerturbDistance() {
-        const int silo_num = m_silo_ipaddr_list.size();
-        std::vector<std::thread> thread_list(silo_num);
+    VectorDataType m_NextQueryObject(const int query_index) {
+        // replay the query file from the beginning once all its query objects are issued
+        VectorDataType query_data = (m_query_file == nullptr) ? m_GenerateQueryObject(m_dim, query_index)
+                                        : m_query_file->GetVector(query_index % m_query_file->Size(), query_index);
 
-        for (int i=0; i<silo_num; i+=2) {
-            thread_list[i] = std::thread(DataHolderReceiver::ThreadGetEncryptPerturbDistance, m_silo_receiver_list[i].get());
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        std::cout << std::endl;
+        std::cout << "Query object " << query_data.to_string() << std::endl;
+        return query_data;
+    }
+
+    VectorDataType m_GenerateQueryObject(const int dim, const VidType qid) {
+        std::vector<VectorDimensionType> arr(dim);
+        const int base = 100;
+        std::random_device rd;  // 用于获取随机数种子  
+        std::default_random_engine eng(rd());  // 使用随机种子初始化引擎  
+        // 创建均匀分布的整数随机数生成器，范围在 [1, 100]  
+        VectorValueDistribution distribution(1, base); 
+        for (int j=0; j<dim; ++j) {
+            arr[j] = distribution(eng);
         }
-        for (int i=0; i<silo_num; i+=2) {
-            thread_list[i].join();
+        VectorDataType query_data(dim, qid, arr);
+        return query_data;
+    }
+
+    /*
+    Knockout tournament over the data holders: in each round, the remaining candidates are compared in pairs
+    (the last one advances directly if the number is odd), so the nearest one is found after ceil(log2(silo_num)) rounds.
+    */
+    int m_GetNearestSilo(const VidType qid, std::vector<double>& comm_list) {
+        std::vector<int> candidate_list(m_silo_num);
+        std::iota(candidate_list.begin(), candidate_list.end(), 0);
+
+        while (candidate_list.size() > 1) {
+            const int pair_num = candidate_list.size() / 2;
+            std::vector<EncryptDistance> encrypt_dist_list(pair_num);
+            std::vector<std::future<void>> future_list(pair_num);
+
+            // Get encrypt perturb distance difference from the first data holder of each pair
+            for (int k=0; k<pair_num; ++k) {
+                const int silo_id = candidate_list[2*k], other_silo_id = candidate_list[2*k+1];
+                future_list[k] = std::async(std::launch::async, DataHolderReceiver::ThreadGetEncryptPerturbDistance, m_silo_receiver_list[silo_id].get(), qid, 
+                                                std::cref(m_silo_ipaddr_list[other_silo_id]), std::ref(encrypt_dist_list[k]), std::ref(comm_list[silo_id]));
+            }
+            m_WaitAll(future_list);
+
+            std::vector<double> dist_list = m_DecryptDistance(encrypt_dist_list);
+
+            std::vector<int> winner_list;
+            for (int k=0; k<pair_num; ++k) {
+                const int silo_id = candidate_list[2*k], other_silo_id = candidate_list[2*k+1];
+                winner_list.emplace_back((dist_list[k] < 0) ? silo_id : other_silo_id);
+                #ifdef LOCAL_DEBUG
+                std::cout << "Data holder #(" << silo_id << ") " << m_silo_name_list[silo_id] << " vs #(" << other_silo_id << ") " << m_silo_name_list[other_silo_id] << ": " << dist_list[k] << std::endl;
+                #endif
+            }
+            if (candidate_list.size() % 2 == 1) {
+                winner_list.emplace_back(candidate_list.back());
+            }
+            candidate_list.swap(winner_list);
         }
+
+        return candidate_list[0];
     }
 
-    void m_BroadcastQueryObject(const VectorDataType& query_data) {
+    void m_BroadcastQueryObject(const VectorDataType& query_data, std::vector<double>& comm_list) {
         QueryObject query_object;
 
-        std::stringstream m_public_key_sstream;
-        m_public_key.save(m_public_key_sstream);
-        query_object.set_pk(m_public_key_sstream.str());
-        for (int i=0; i<m_dim; ++i) {
-            query_object.add_data(query_data.data[i]);
-        }
+        query_object.set_pk(m_public_key_str);
+        query_object.set_qid(query_data.vid);
+        query_object.set_scheme((FedSql::HeScheme)m_scheme);
+        m_PackQueryData(query_data, query_object);
         #ifdef LOCAL_DEBUG
         std::stringstream m_secret_key_sstream;
         m_secret_key.save(m_secret_key_sstream);
@@ -298,59 +600,202 @@ private:
         #endif
 
         const int silo_num = m_silo_ipaddr_list.size();
-        std::vector<std::thread> thread_list(silo_num);
+        std::vector<std::future<void>> future_list(silo_num);
 
         for (int i=0; i<silo_num; ++i) {
-            std::string other_silo_ipaddr = m_silo_ipaddr_list[i^1];
-            query_object.set_ipaddr(other_silo_ipaddr);
-            thread_list[i] = std::thread(DataHolderReceiver::ThreadBroadcastQueryObject, m_silo_receiver_list[i].get(), query_object);
+            future_list[i] = std::async(std::launch::async, DataHolderReceiver::ThreadBroadcastQueryObject, m_silo_receiver_list[i].get(), query_object, std::ref(comm_list[i]));
         }
-        for (int i=0; i<silo_num; ++i) {
-            thread_list[i].join();
-        }        
+        m_WaitAll(future_list);
     }
 
-    int m_GetDecryptPerturbNearestDistance() {
-        const int silo_num = m_silo_ipaddr_list.size();
-        std::vector<std::thread> thread_list(silo_num);
-        std::vector<VectorDimensionType> dist_list(silo_num);
+    std::vector<double> m_DecryptDistance(const std::vector<EncryptDistance>& encrypt_dist_list) {
+        const int dist_num = encrypt_dist_list.size();
+        std::vector<double> dist_list(dist_num);
+        std::vector<std::future<double>> future_list(dist_num);
 
-        for (int i=0; i<silo_num; i+=2) {
-            EncryptDistance encrypt_dist = m_silo_receiver_list[i]->PerturbEncryptDistance();
-            std::string edist_str = encrypt_dist.edist();
-            thread_list[i] = std::thread(DataHolderReceiver::ThreadGetDecryptDistance, m_silo_receiver_list[i].get(), edist_str, m_parms, m_secret_key, std::ref(dist_list[i]));
+        // Decrypt the distances of all pairs in parallel with the decryption workers,
+        // as real values so that a small CKKS difference keeps its sign
+        for (int i=0; i<dist_num; ++i) {
+            future_list[i] = m_decrypt_pool->SubmitReal(encrypt_dist_list[i].edist());
         }
-        for (int i=0; i<silo_num; i+=2) {
-            thread_list[i].join();
+        for (int i=0; i<dist_num; ++i) {
+            dist_list[i] = future_list[i].get();
         }
+        return dist_list;
+    }
 
-        int nearest_silo_id = 0;
-        for (int i=0; i<silo_num; i+=2) {
-            if (dist_list[i] < 0) {
-                nearest_silo_id = i;
-            } else {
-                nearest_silo_id = i + 1;
+    /*
+    Write the query object into a QueryObject or a RangeQuery in the wire encoding,
+    and count its bytes against the varints of the repeated int64 field.
+    */
+    template <typename Message>
+    void m_PackQueryData(const VectorDataType& query_data, Message& message) {
+        auto start_time = std::chrono::steady_clock::now();
+        const VectorDimensionType* row = query_data.data.data();
+        const PackedDtype dtype = m_wire_auto ? NarrowestPackedDtype(row, m_dim) : m_wire_dtype;
+        size_t data_bytes = 0;
+        if (dtype == PackedDtype::VARINT) {
+            if (!CanPackAs(dtype, row, m_dim)) {
+                throw std::invalid_argument("Vector data does not fit into varint");
+            }
+            for (int i=0; i<m_dim; ++i) {
+                message.add_data(row[i]);
             }
-            #ifdef LOCAL_DEBUG
-            std::cout << "Data holder #(" << i << ") " << m_silo_name_list[i] << ": " << dist_list[i] << std::endl;
-            #endif
+        } else {
+            message.set_dtype((FedSql::VectorDtype)dtype);
+            AppendPackedRow(*message.mutable_packed_data(), dtype, row, m_dim);
+            data_bytes = message.packed_data().size();
+        }
+        double encode_time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+
+        size_t varint_bytes = 0;
+        for (int i=0; i<m_dim; ++i) {
+            varint_bytes += google::protobuf::io::CodedOutputStream::VarintSize64((uint64_t)(int64_t)row[i]);
+        }
+        if (dtype == PackedDtype::VARINT) {
+            data_bytes = varint_bytes;
         }
-        return nearest_silo_id;
+
+        std::lock_guard<std::mutex> lock(m_logger_mutex);
+        m_logger.AddCounter("query data [bytes]", data_bytes);
+        m_logger.AddCounter("query data varint [bytes]", varint_bytes);
+        m_logger.AddCounter("query encode [us]", encode_time);
     }
 
-    VectorDataType m_GetQueryAnswer(const int nearest_silo_id) {
-        return m_silo_receiver_list[nearest_silo_id]->GetQueryAnswer();
+    std::vector<EncryptDistance> m_SendRangeQuery(const VectorDataType& query_data, std::vector<double>& comm_list) {
+        RangeQuery range_query;
+        range_query.set_pk(m_public_key_str);
+        range_query.set_qid(query_data.vid);
+        range_query.set_square_radius((int64_t)m_square_radius);
+        range_query.set_real_square_radius(m_square_radius);
+        range_query.set_scheme((FedSql::HeScheme)m_scheme);
+        m_PackQueryData(query_data, range_query);
+
+        std::vector<EncryptDistance> encrypt_dist_list(m_silo_num);
+        std::vector<std::future<void>> future_list(m_silo_num);
+        for (int i=0; i<m_silo_num; ++i) {
+            future_list[i] = std::async(std::launch::async, DataHolderReceiver::ThreadGetEncryptRangeDistance, m_silo_receiver_list[i].get(), std::cref(range_query),
+                                            std::ref(encrypt_dist_list[i]), std::ref(comm_list[i]));
+        }
+        m_WaitAll(future_list);
+        return encrypt_dist_list;
+    }
+
+    /*
+    Slot 0 of each data holder is its number of answers, and the next slots are their square distances, the nearest first.
+    Without a limit, all answers are fetched. Otherwise, the ``limit`` nearest distances over all data holders decide
+    how many answers each data holder returns, so the data holders without any of them are not contacted at all.
+    Only the distances that fit into the slots are known, so a limit is applied to those.
+    */
+    std::vector<size_t> m_GetRangeFetchNum(const std::vector<EncryptDistance>& encrypt_dist_list) {
+        std::vector<std::future<std::vector<double>>> future_list(m_silo_num);
+        for (int i=0; i<m_silo_num; ++i) {
+            future_list[i] = m_decrypt_pool->SubmitRealSlots(encrypt_dist_list[i].edist(), kHePolyModulusDegree);
+        }
+
+        std::vector<size_t> fetch_num_list(m_silo_num, 0);
+        std::vector<std::pair<double, int>> dist_list;
+        for (int i=0; i<m_silo_num; ++i) {
+            std::vector<double> slot_list = future_list[i].get();
+            // the count is approximate in CKKS
+            const size_t count = (size_t)std::max((long long)0, std::llround(slot_list[0]));
+            if (m_range_limit == 0) {
+                fetch_num_list[i] = count;
+                continue;
+            }
+            const size_t known_num = std::min(count, slot_list.size() - 1);
+            for (size_t k=1; k<=known_num; ++k) {
+                dist_list.emplace_back(slot_list[k], i);
+            }
+        }
+
+        if (m_range_limit > 0) {
+            const size_t limit = std::min(m_range_limit, dist_list.size());
+            std::partial_sort(dist_list.begin(), dist_list.begin() + limit, dist_list.end());
+            for (size_t k=0; k<limit; ++k) {
+                ++fetch_num_list[dist_list[k].second];
+            }
+        }
+        return fetch_num_list;
     }
 
-    void m_FinishQueryProcessing() {
+    void m_FinishQueryProcessing(const VidType qid, std::vector<double>& comm_list) {
         const int silo_num = m_silo_ipaddr_list.size();
-        std::vector<std::thread> thread_list(silo_num);
+        std::vector<std::future<void>> future_list(silo_num);
 
         for (int i=0; i<silo_num; ++i) {
-            thread_list[i] = std::thread(DataHolderReceiver::ThreadFinishQueryProcessing, m_silo_receiver_list[i].get());
+            future_list[i] = std::async(std::launch::async, DataHolderReceiver::ThreadFinishQueryProcessing, m_silo_receiver_list[i].get(), qid, std::ref(comm_list[i]));
         }
-        for (int i=0; i<silo_num; ++i) {
-            thread_list[i].join();
+        m_WaitAll(future_list);
+    }
+
+    /*
+    Finish a failed query at every data holder on a best-effort basis, so that they drop its session before it expires.
+    */
+    void m_AbortQuery(const VidType qid) {
+        for (int i=0; i<m_silo_num; ++i) {
+            try {
+                m_silo_receiver_list[i]->FinishQueryProcessing(qid);
+            } catch (const std::exception&) {
+                // the data holder drops the session when it expires
+            }
+        }
+    }
+
+    /*
+    Wait for the RPCs to all data holders, then rethrow the first error,
+    so that a failed RPC fails its query instead of terminating the query user.
+    */
+    static void m_WaitAll(std::vector<std::future<void>>& future_list) {
+        for (auto& future : future_list) {
+            future.wait();
+        }
+        for (auto& future : future_list) {
+            future.get();
+        }
+    }
+
+    /*
+    Process the queries 0, 1, ..., n-1 on min(window, n) threads, with process(query_index).
+    A failed query is aborted at the data holders and no new query is issued afterwards;
+    the first error is rethrown once the queries in flight are done.
+    */
+    template <typename Process>
+    void m_RunQueryWorkers(const int n, const int window, const Process& process) {
+        std::atomic<int> next_query(0);
+        std::atomic<bool> failed(false);
+        std::exception_ptr first_error;
+        std::mutex error_mutex;
+        auto worker = [this, n, &process, &next_query, &failed, &first_error, &error_mutex]() {
+            int query_index;
+            while (!failed && (query_index = next_query.fetch_add(1)) < n) {
+                try {
+                    process(query_index);
+                } catch (...) {
+                    failed = true;
+                    {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (first_error == nullptr) {
+                            first_error = std::current_exception();
+                        }
+                    }
+                    // the qid of a query object is its index
+                    std::cerr << "Query #(" << query_index << ") failed, abort it" << std::endl;
+                    m_AbortQuery(query_index);
+                }
+            }
+        };
+
+        const int worker_num = std::min(window, n);
+        std::vector<std::thread> worker_list;
+        for (int i=0; i<worker_num; ++i) {
+            worker_list.emplace_back(worker);
+        }
+        for (auto& t : worker_list) {
+            t.join();
+        }
+        if (first_error != nullptr) {
+            std::rethrow_exception(first_error);
         }
     }
 
@@ -394,19 +839,16 @@ private:
         file.close();
     }
 
-    void m_InitSealParams() {
-        /*
-        Note that scheme_type is now "bgv".
-        */
-        m_parms = EncryptionParameters(scheme_type::bgv);
-        m_parms.set_poly_modulus_degree(m_poly_modulus_degree);
-
+    void m_InitSealParams(const std::string& snapshot_dir) {
+        #ifdef FLOAT_VECTOR
+        if (m_scheme != HeScheme::CKKS) {
+            throw std::invalid_argument("Float vectors need the CKKS scheme");
+        }
+        #endif
         /*
-        We can certainly use BFVDefault coeff_modulus. In later parts of this example,
-        we will demonstrate how to choose coeff_modulus that is more useful in BGV.
+        BGV for integer distances, or CKKS for real distances, see CreateSealParams.
         */
-        m_parms.set_coeff_modulus(CoeffModulus::BFVDefault(m_poly_modulus_degree));
-        m_parms.set_plain_modulus(PlainModulus::Batching(m_poly_modulus_degree, m_batching_size));
+        m_parms = CreateSealParams(m_scheme);
 
         SEALContext context(m_parms);
         PrintLine(__LINE__);
@@ -419,10 +861,72 @@ private:
         */
         std::cout << "Parameter validation (success): " << context.parameter_error_message() << std::endl;
 
-        KeyGenerator keygen(context);
-        m_secret_key = keygen.secret_key();
-        keygen.create_public_key(m_public_key);
-        keygen.create_relin_keys(m_relin_keys);        
+        // reuse the key pair of the snapshot, so that a restart skips the key generation
+        const std::string snapshot_filename = snapshot_dir.empty() ? "" : SnapshotPath(snapshot_dir, "user-" + m_user_name);
+        if (snapshot_filename.empty() || !m_RestoreSealKeys(context, snapshot_filename)) {
+            KeyGenerator keygen(context);
+            m_secret_key = keygen.secret_key();
+            keygen.create_public_key(m_public_key);
+            keygen.create_relin_keys(m_relin_keys);
+            if (!snapshot_filename.empty()) {
+                m_SaveSealKeys(snapshot_filename);
+            }
+        }
+
+        // the public key is sent with every query, so serialize it only once
+        std::stringstream public_key_sstream;
+        m_public_key.save(public_key_sstream);
+        m_public_key_str = public_key_sstream.str();
+
+        m_decrypt_pool = std::make_unique<DecryptWorkerPool>(context, m_secret_key);
+        std::cout << "Decryption workers: " << m_decrypt_pool->WorkerNum() << std::endl;
+    }
+
+    /*
+    Restore the keys from the snapshot, and return false if there is no snapshot with the same encryption parameters.
+    */
+    bool m_RestoreSealKeys(const SEALContext& context, const std::string& snapshot_filename) {
+        if (!SnapshotReader::Exists(snapshot_filename)) {
+            return false;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        SnapshotReader reader(snapshot_filename);
+
+        std::pair<const char*, size_t> section = reader.Section("seal.parms");
+        if (!SameSealParams(section.first, section.second, m_parms)) {
+            std::cout << "Snapshot " << snapshot_filename << " has other encryption parameters, generate new keys" << std::endl;
+            return false;
+        }
+
+        section = reader.Section("seal.secret_key");
+        m_secret_key.load(context, reinterpret_cast<const seal::seal_byte*>(section.first), section.second);
+        section = reader.Section("seal.public_key");
+        m_public_key.load(context, reinterpret_cast<const seal::seal_byte*>(section.first), section.second);
+        section = reader.Section("seal.relin_keys");
+        m_relin_keys.load(context, reinterpret_cast<const seal::seal_byte*>(section.first), section.second);
+
+        double restore_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Restore keys from " << snapshot_filename << " in " << restore_time << " [ms]" << std::endl;
+        return true;
+    }
+
+    /*
+    The snapshot holds the secret key, so it is readable only by the owner.
+    The keys are saved uncompressed, which makes the restore a plain copy.
+    */
+    void m_SaveSealKeys(const std::string& snapshot_filename) {
+        SnapshotWriter writer(snapshot_filename, 0600);
+        std::stringstream parms_sstream, secret_key_sstream, public_key_sstream, relin_keys_sstream;
+        m_parms.save(parms_sstream, seal::compr_mode_type::none);
+        m_secret_key.save(secret_key_sstream, seal::compr_mode_type::none);
+        m_public_key.save(public_key_sstream, seal::compr_mode_type::none);
+        m_relin_keys.save(relin_keys_sstream, seal::compr_mode_type::none);
+        writer.AddSection("seal.parms", parms_sstream.str());
+        writer.AddSection("seal.secret_key", secret_key_sstream.str());
+        writer.AddSection("seal.public_key", public_key_sstream.str());
+        writer.AddSection("seal.relin_keys", relin_keys_sstream.str());
+        writer.Commit();
+        std::cout << "Save keys to " << snapshot_filename << std::endl;
     }
 
     /*
@@ -480,37 +984,69 @@ private:
         fflush(stdout);
     }
 
-    void m_InitBenchLogger() {
-        for (int silo_id=0; silo_id<m_silo_num; ++silo_id) {
-            m_silo_receiver_list[silo_id]->InitBenchLogger();
-        }
-    }
-
     std::vector<std::shared_ptr<DataHolderReceiver>> m_silo_receiver_list;
     std::vector<std::string> m_silo_ipaddr_list;
     std::vector<std::string> m_silo_name_list;
     std::string m_user_name;
-    VidType m_query_num;
+    std::unique_ptr<VectorFileReader> m_query_file;
+    std::ofstream m_answer_file;
     BenchLogger m_logger;
+    LatencyLogger m_latency_logger;
+    mutable std::mutex m_logger_mutex;
     int m_silo_num;
     int m_dim;
+    int m_window;
+    double m_qps;
+
+    // range query mode if the square radius is non-negative
+    double m_square_radius;
+    size_t m_range_limit;
+    size_t m_chunk_size;
+    double m_throughput;
 
-    // related to the BGV scheme in Microsoft SEAL
+    // encoding of the query objects on the wire
+    bool m_wire_auto;
+    PackedDtype m_wire_dtype;
+
+    // related to the BGV or CKKS scheme in Microsoft SEAL
+    HeScheme m_scheme;
     EncryptionParameters m_parms;
     PublicKey m_public_key;
+    std::string m_public_key_str;
     SecretKey m_secret_key;
     RelinKeys m_relin_keys;
-    static const size_t m_poly_modulus_degree = 8192;
-    static const size_t m_batching_size = 40;
+    std::unique_ptr<DecryptWorkerPool> m_decrypt_pool;
 };
 
 std::unique_ptr<FedSqlServer> fed_sqlserver_ptr = nullptr;
 
-void RunService(const int n, const int dim, const std::string& silo_ip_filename, const std::string& user_name) {
-    fed_sqlserver_ptr = std::make_unique<FedSqlServer>(silo_ip_filename, user_name);
+void RunService(int n, const int dim, const int window, const double qps, const unsigned int seed, const double radius, const size_t range_limit, const size_t chunk_size, const std::string& wire_dtype, const HeScheme scheme,
+                const std::string& query_filename, const std::string& answer_filename, const std::string& snapshot_dir, const std::string& silo_ip_filename, const std::string& user_name) {
+    fed_sqlserver_ptr = std::make_unique<FedSqlServer>(silo_ip_filename, user_name, snapshot_dir, scheme);
+    fed_sqlserver_ptr->SetWireDtype(wire_dtype);
+    // a negative radius means nearest neighbor queries
+    if (radius >= 0) {
+        fed_sqlserver_ptr->SetRangeQuery(radius, range_limit, chunk_size);
+    }
+    if (!answer_filename.empty()) {
+        fed_sqlserver_ptr->SetAnswerFile(answer_filename);
+    }
+
+    if (!query_filename.empty()) {
+        fed_sqlserver_ptr->LoadQueryFile(query_filename);
+        // issue every query object in the file once, unless the number of queries is given
+        if (n <= 0) {
+            n = fed_sqlserver_ptr->QueryFileSize();
+        }
+    }
+    if (n <= 0) {
+        throw std::invalid_argument("n must be a positive integer");
+    }
 
-    for (int i=0; i<n; ++i) {
-        fed_sqlserver_ptr->ProcessANNQ(dim);
+    if (qps > 0) {
+        fed_sqlserver_ptr->RunOpenLoopQueries(n, dim, window, qps, seed);
+    } else {
+        fed_sqlserver_ptr->RunQueries(n, dim, window);
     }
 
     std::string log_info = fed_sqlserver_ptr->to_string();
@@ -536,9 +1072,19 @@ void ResetSignalHandler() {
 }
 
 int main(int argc, char** argv) {
-    int n, dim;
+    int n, dim, window;
+    double qps;
+    unsigned int seed;
+    double radius = -1;
+    size_t range_limit, chunk_size;
     std::string silo_ip_filename;
+    std::string query_filename;
+    std::string answer_filename;
+    std::string snapshot_dir;
     std::string user_name("Tom");
+    std::string wire_dtype;
+    std::string scheme_name;
+    HeScheme scheme;
 
     try { 
         bpo::options_description option_description("Required options");
@@ -546,8 +1092,19 @@ int main(int argc, char** argv) {
             ("help", "produce help message")
             ("ip-file", bpo::value<std::string>(), "Data holder's IP address")
             ("name", bpo::value<std::string>(), "Query user's name")
-            ("n", bpo::value<int>(&n)->default_value(1), "Number of nearest neighbor query")
+            ("n", bpo::value<int>(&n), "Number of nearest neighbor query (default: 1, or the size of the query file)")
             ("dim", bpo::value<int>(&dim)->default_value(128), "Dimension of query obeject")
+            ("window", bpo::value<int>(&window)->default_value(1), "Number of queries in flight")
+            ("query-file", bpo::value<std::string>(), "Vector file of query objects to replay")
+            ("answer-file", bpo::value<std::string>(), "Output file of query answers for the verifier")
+            ("qps", bpo::value<double>(&qps)->default_value(0), "Offered load of the open-loop mode with Poisson arrivals (0 for the closed-loop mode)")
+            ("seed", bpo::value<unsigned int>(&seed)->default_value(0), "Random seed of the arrivals (0 for a random seed)")
+            ("snapshot-dir", bpo::value<std::string>(), "Directory of the query user's key snapshot, which is restored on startup if it exists")
+            ("radius", bpo::value<double>(), "Radius of range queries, which replace nearest neighbor queries if it is set")
+            ("range-limit", bpo::value<size_t>(&range_limit)->default_value(0), "Number of the nearest answers returned by a range query (0 for all)")
+            ("chunk-size", bpo::value<size_t>(&chunk_size)->default_value(0), "Maximum size in bytes of one streamed chunk of range answers (0 for the data holder's default)")
+            ("wire-dtype", bpo::value<std::string>(&wire_dtype)->default_value("auto"), "Encoding of the query objects: auto, varint, int8, int16, int32, int64 or float")
+            ("scheme", bpo::value<std::string>(&scheme_name)->default_value("bgv"), "HE scheme of the distances: bgv, or ckks for float vectors, which must match the data holders'")
         ;
 
         bpo::variables_map variable_map;
@@ -577,6 +1134,35 @@ int main(int argc, char** argv) {
             options_all_set = false;
         }
 
+        if (variable_map.count("query-file")) {
+            query_filename = variable_map["query-file"].as<std::string>();
+            std::cout << "Query file name was set to " << query_filename << "\n";
+        }
+
+        if (variable_map.count("answer-file")) {
+            answer_filename = variable_map["answer-file"].as<std::string>();
+            std::cout << "Answer file name was set to " << answer_filename << "\n";
+        }
+
+        if (variable_map.count("snapshot-dir")) {
+            snapshot_dir = variable_map["snapshot-dir"].as<std::string>();
+            std::cout << "Query user's snapshot directory was set to " << snapshot_dir << "\n";
+        }
+
+        if (variable_map.count("radius")) {
+            radius = variable_map["radius"].as<double>();
+            if (radius < 0) {
+                throw std::invalid_argument("radius must be non-negative");
+            }
+            std::cout << "Range query radius was set to " << radius << "\n";
+        }
+
+        scheme = ParseHeScheme(scheme_name);
+
+        if (!variable_map.count("n")) {
+            n = query_filename.empty() ? 1 : 0;
+        }
+
         if (false == options_all_set) {
             throw std::invalid_argument("Some options were not properly set");
             std::cout.flush();
@@ -589,7 +1175,7 @@ int main(int argc, char** argv) {
     }
 
     ResetSignalHandler();
-    RunService(n, dim, silo_ip_filename, user_name);
+    RunService(n, dim, window, qps, seed, radius, range_limit, chunk_size, wire_dtype, scheme, query_filename, answer_filename, snapshot_dir, silo_ip_filename, user_name);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <limits>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+
+#include <boost/program_options.hpp>
+namespace bpo = boost::program_options;
+
+#include "utils/BenchLogger.hpp"
+#include "utils/DataType.hpp"
+#include "utils/VectorFile.hpp"
+
+/*
+One line of the answer file written by the query user.
+*/
+struct AnswerRecord {
+    VidType qid;
+    int silo_id;
+    VidType vid;
+    double latency;
+    double comm;
+};
+
+/*
+The exact nearest neighbor of a query object over the datasets of all data holders.
+*/
+struct GroundTruth {
+    int silo_id;
+    VidType vid;
+    VectorDimensionType dist;
+};
+
+class Verifier {
+public:
+    Verifier(const std::string& query_filename, const std::vector<std::string>& data_filename_list) {
+        m_query_file = std::make_unique<VectorFileReader>(query_filename);
+        if (m_query_file->Size() == 0) {
+            throw std::invalid_argument("There are no query objects in " + query_filename);
+        }
+        m_dim = m_query_file->Dimension();
+        m_dist_func = GetVectorDistanceFunc(DistanceMetric::L2, m_dim);
+
+        for (const auto& data_filename : data_filename_list) {
+            m_data_file_list.emplace_back(std::make_unique<VectorFileReader>(data_filename));
+            if (m_data_file_list.back()->Dimension() != m_dim) {
+                throw std::invalid_argument("Dimension of " + data_filename + " does not match with the query file");
+            }
+            std::cout << "Data holder #(" << m_data_file_list.size()-1 << "): " << m_data_file_list.back()->Size() << " data objects from " << data_filename << std::endl;
+        }
+        if (m_data_file_list.empty()) {
+            throw std::invalid_argument("There are no data files");
+        }
+    }
+
+    void ReadAnswerFile(const std::string& answer_filename) {
+        std::ifstream file(answer_filename);
+        if (!file.is_open()) {
+            throw std::invalid_argument("Failed to open answer file for reading: " + answer_filename);
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::stringstream ss(line);
+            AnswerRecord record;
+            if (!(ss >> record.qid >> record.silo_id >> record.vid >> record.latency >> record.comm)) {
+                throw std::invalid_argument("Failed to parse line \"" + line + "\" in answer file: " + answer_filename);
+            }
+            m_answer_list.emplace_back(record);
+        }
+        std::cout << "Read " << m_answer_list.size() << " query answers from " << answer_filename << std::endl;
+    }
+
+    /*
+    Compute the exact nearest neighbor of each answered query by scanning all datasets,
+    the queries are split across the threads.
+    */
+    void ComputeGroundTruth(size_t thread_num) {
+        if (thread_num == 0) {
+            thread_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const size_t answer_num = m_answer_list.size();
+        thread_num = std::max((size_t)1, std::min(thread_num, answer_num));
+        m_truth_list.resize(answer_num);
+
+        auto worker = [this, answer_num, thread_num](const size_t thread_id) {
+            for (size_t i=thread_id; i<answer_num; i+=thread_num) {
+                m_truth_list[i] = m_GetNearestNeighbor(m_GetQueryRow(m_answer_list[i].qid));
+            }
+        };
+
+        std::vector<std::thread> thread_list;
+        for (size_t t=0; t<thread_num; ++t) {
+            thread_list.emplace_back(worker, t);
+        }
+        for (auto& t : thread_list) {
+            t.join();
+        }
+    }
+
+    /*
+    Verify the answers of range queries, which are grouped by qid (a query without answers has silo_id -1).
+    The exact answers are all data objects within the square radius, or only the nearest ``limit`` of them.
+    An answer is correct if it is within the square radius (and not farther than the limit-th exact answer),
+    and recall is the fraction of the exact answers that were returned.
+    */
+    void VerifyRange(const double radius, const size_t limit, size_t thread_num, size_t print_size=10) {
+        const VectorDimensionType square_radius = SquareRadius(radius);
+        std::map<VidType, std::vector<const AnswerRecord*>> query_map;
+        for (const auto& record : m_answer_list) {
+            query_map[record.qid].emplace_back(&record);
+        }
+        std::vector<VidType> qid_list;
+        for (const auto& item : query_map) {
+            qid_list.emplace_back(item.first);
+        }
+
+        // the square distances of the exact answers of each query, the nearest first
+        if (thread_num == 0) {
+            thread_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        thread_num = std::max((size_t)1, std::min(thread_num, qid_list.size()));
+        std::vector<std::vector<VectorDimensionType>> truth_list(qid_list.size());
+        auto worker = [this, &qid_list, &truth_list, square_radius, limit, thread_num](const size_t thread_id) {
+            for (size_t i=thread_id; i<qid_list.size(); i+=thread_num) {
+                truth_list[i] = m_GetRangeNeighbors(m_GetQueryRow(qid_list[i]), square_radius, limit);
+            }
+        };
+        std::vector<std::thread> thread_list;
+        for (size_t t=0; t<thread_num; ++t) {
+            thread_list.emplace_back(worker, t);
+        }
+        for (auto& t : thread_list) {
+            t.join();
+        }
+
+        size_t exact_num = 0, print_num = 0, truth_num = 0, found_num = 0, wrong_num = 0;
+        double total_comm = 0;
+        LatencyLogger latency_logger;
+        for (size_t i=0; i<qid_list.size(); ++i) {
+            const std::vector<const AnswerRecord*>& record_list = query_map[qid_list[i]];
+            const std::vector<VectorDimensionType>& truth = truth_list[i];
+            // every line of a query carries the same latency and communication
+            latency_logger.Record(record_list[0]->latency);
+            total_comm += record_list[0]->comm;
+
+            const VectorDimensionType max_dist = truth.empty() ? -1 : truth.back();
+            size_t correct_num = 0, answer_num = 0;
+            for (const AnswerRecord* record : record_list) {
+                if (record->silo_id < 0) continue;
+                ++answer_num;
+                VectorDimensionType dist = std::numeric_limits<VectorDimensionType>::max();
+                if (record->silo_id < (int)m_data_file_list.size()
+                    && record->vid >= 0 && record->vid < (VidType)m_data_file_list[record->silo_id]->Size()) {
+                    dist = m_dist_func(m_data_file_list[record->silo_id]->Row(record->vid), m_GetQueryRow(record->qid), m_dim);
+                }
+                if (dist <= max_dist) {
+                    ++correct_num;
+                }
+            }
+            correct_num = std::min(correct_num, truth.size());
+            truth_num += truth.size();
+            found_num += correct_num;
+            wrong_num += answer_num - correct_num;
+
+            if (correct_num == truth.size() && answer_num == truth.size()) {
+                ++exact_num;
+            } else if (print_num++ < print_size) {
+                std::cout << "Query #(" << qid_list[i] << "): " << answer_num << " answers with " << correct_num << " correct ones, but there are "
+                            << truth.size() << " data objects within square distance " << square_radius << std::endl;
+            }
+        }
+
+        const size_t query_num = qid_list.size();
+        double accuracy = (query_num == 0) ? 0 : (exact_num * 100.0 / query_num);
+        double recall = (truth_num == 0) ? 100.0 : (found_num * 100.0 / truth_num);
+        double avg_comm = (query_num == 0) ? 0 : (total_comm / query_num / 1024.0);
+
+        std::cout << "\n";
+        std::cout << "-------------- Verification Log --------------\n";
+        std::cout << std::fixed << std::setprecision(2)
+                    << query_num << " range queries: accuracy = " << accuracy << "% (" << exact_num << "/" << query_num << "), recall = " << recall
+                    << "% (" << found_num << "/" << truth_num << "), wrong answers = " << wrong_num << ", communication = " << avg_comm << " [KB] per query" << std::endl;
+        std::cout << latency_logger.to_string();
+    }
+
+    /*
+    An answer is correct if its distance equals the nearest distance, so any of the tied objects is accepted.
+    */
+    void Verify(size_t print_size=10) {
+        size_t correct_num = 0, print_num = 0;
+        double total_comm = 0;
+        LatencyLogger latency_logger;
+
+        for (size_t i=0; i<m_answer_list.size(); ++i) {
+            const AnswerRecord& record = m_answer_list[i];
+            const GroundTruth& truth = m_truth_list[i];
+            latency_logger.Record(record.latency);
+            total_comm += record.comm;
+
+            VectorDimensionType dist = std::numeric_limits<VectorDimensionType>::max();
+            if (record.silo_id >= 0 && record.silo_id < (int)m_data_file_list.size()
+                && record.vid >= 0 && record.vid < (VidType)m_data_file_list[record.silo_id]->Size()) {
+                dist = m_dist_func(m_data_file_list[record.silo_id]->Row(record.vid), m_GetQueryRow(record.qid), m_dim);
+            }
+
+            if (dist == truth.dist) {
+                ++correct_num;
+            } else if (print_num++ < print_size) {
+                std::cout << "Query #(" << record.qid << "): answer #" << record.vid << " from data holder #(" << record.silo_id << ") has square distance " << dist
+                            << ", but the nearest neighbor is #" << truth.vid << " from data holder #(" << truth.silo_id << ") with square distance " << truth.dist << std::endl;
+            }
+        }
+
+        const size_t answer_num = m_answer_list.size();
+        double accuracy = (answer_num == 0) ? 0 : (correct_num * 100.0 / answer_num);
+        double avg_comm = (answer_num == 0) ? 0 : (total_comm / answer_num / 1024.0);
+
+        std::cout << "\n";
+        std::cout << "-------------- Verification Log --------------\n";
+        std::cout << std::fixed << std::setprecision(2)
+                    << answer_num << " queries: accuracy = " << accuracy << "% (" << correct_num << "/" << answer_num << "), communication = " << avg_comm << " [KB] per query" << std::endl;
+        std::cout << latency_logger.to_string();
+    }
+
+private:
+    const VectorDimensionType* m_GetQueryRow(const VidType qid) const {
+        return m_query_file->Row(qid % m_query_file->Size());
+    }
+
+    GroundTruth m_GetNearestNeighbor(const VectorDimensionType* query_row) const {
+        GroundTruth truth = {-1, -1, std::numeric_limits<VectorDimensionType>::max()};
+        for (size_t silo_id=0; silo_id<m_data_file_list.size(); ++silo_id) {
+            const VectorFileReader& data_file = *m_data_file_list[silo_id];
+            const size_t n = data_file.Size();
+            for (size_t vid=0; vid<n; ++vid) {
+                VectorDimensionType dist = m_dist_func(data_file.Row(vid), query_row, m_dim);
+                if (dist < truth.dist) {
+                    truth.silo_id = silo_id;
+                    truth.vid = vid;
+                    truth.dist = dist;
+                }
+            }
+        }
+        return truth;
+    }
+
+    std::vector<VectorDimensionType> m_GetRangeNeighbors(const VectorDimensionType* query_row, const VectorDimensionType square_radius, const size_t limit) const {
+        std::vector<VectorDimensionType> dist_list;
+        for (size_t silo_id=0; silo_id<m_data_file_list.size(); ++silo_id) {
+            const VectorFileReader& data_file = *m_data_file_list[silo_id];
+            const size_t n = data_file.Size();
+            for (size_t vid=0; vid<n; ++vid) {
+                VectorDimensionType dist = m_dist_func(data_file.Row(vid), query_row, m_dim);
+                if (dist <= square_radius) {
+                    dist_list.emplace_back(dist);
+                }
+            }
+        }
+        std::sort(dist_list.begin(), dist_list.end());
+        if (limit > 0 && dist_list.size() > limit) {
+            dist_list.resize(limit);
+        }
+        return dist_list;
+    }
+
+    std::unique_ptr<VectorFileReader> m_query_file;
+    std::vector<std::unique_ptr<VectorFileReader>> m_data_file_list;
+    std::vector<AnswerRecord> m_answer_list;
+    std::vector<GroundTruth> m_truth_list;
+    size_t m_dim;
+    VectorDistanceFunc m_dist_func;
+};
+
+int main(int argc, char** argv) {
+    // Expect the following args: --query-file=query.bin --data-file Alice.bin Bob.bin --answer-file=answer.txt
+    size_t thread_num, range_limit;
+    double radius = -1;
+    std::string query_filename, answer_filename;
+    std::vector<std::string> data_filename_list;
+
+    try {
+        bpo::options_description option_description("Required options");
+        option_description.add_options()
+            ("help", "produce help message")
+            ("query-file", bpo::value<std::string>(), "Vector file of query objects")
+            ("data-file", bpo::value<std::vector<std::string>>()->multitoken(), "Vector files of the data holders (in the order of the IP address file)")
+            ("answer-file", bpo::value<std::string>(), "Query answers written by the query user")
+            ("threads", bpo::value<size_t>(&thread_num)->default_value(0), "Number of threads for the exact scan (0 for all cores)")
+            ("radius", bpo::value<double>(&radius), "Radius of the range queries, if the answers are of range queries")
+            ("range-limit", bpo::value<size_t>(&range_limit)->default_value(0), "Number of the nearest answers returned by a range query (0 for all)")
+        ;
+
+        bpo::variables_map variable_map;
+        bpo::store(bpo::parse_command_line(argc, argv, option_description), variable_map);
+        bpo::notify(variable_map);
+
+        if (variable_map.count("help")) {
+            std::cout << option_description << std::endl;
+            return 0;
+        }
+
+        if (!variable_map.count("query-file") || !variable_map.count("data-file") || !variable_map.count("answer-file")) {
+            throw std::invalid_argument("Some options were not properly set");
+        }
+        query_filename = variable_map["query-file"].as<std::string>();
+        data_filename_list = variable_map["data-file"].as<std::vector<std::string>>();
+        answer_filename = variable_map["answer-file"].as<std::string>();
+
+        Verifier verifier(query_filename, data_filename_list);
+        verifier.ReadAnswerFile(answer_filename);
+        if (radius >= 0) {
+            verifier.VerifyRange(radius, range_limit, thread_num);
+        } else {
+            verifier.ComputeGroundTruth(thread_num);
+            verifier.Verify();
+        }
+
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef UTILS_ALLOC_COUNTER_HPP
+#define UTILS_ALLOC_COUNTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/*
+Heap allocation counter of the current thread, which profiles how many allocations a code path makes.
+The counts come from the replaced global operator new, which is defined by the one source file of a program
+that defines ALLOC_COUNTER_REPLACE_NEW before including this header; otherwise they stay at zero.
+*/
+struct AllocStat {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+inline AllocStat& ThreadAllocStat() {
+    static thread_local AllocStat stat = {0, 0};
+    return stat;
+}
+
+/*
+The allocations of the current thread since the scope was created.
+*/
+class AllocScope {
+public:
+    AllocScope() : m_start(ThreadAllocStat()) {}
+
+    AllocStat Delta() const {
+        const AllocStat& now = ThreadAllocStat();
+        return AllocStat{now.count - m_start.count, now.bytes - m_start.bytes};
+    }
+
+private:
+    AllocStat m_start;
+};
+
+#ifdef ALLOC_COUNTER_REPLACE_NEW
+
+static void* CountedAlloc(std::size_t size, std::size_t alignment) {
+    if (size == 0) size = 1;
+    void* ptr = (alignment <= alignof(std::max_align_t)) ? std::malloc(size)
+                    : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (ptr != nullptr) {
+        AllocStat& stat = ThreadAllocStat();
+        ++stat.count;
+        stat.bytes += size;
+    }
+    return ptr;
+}
+
+// not inlined into the delete operators, which would make the compiler pair operator new with free()
+__attribute__((noinline)) static void CountedFree(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void* operator new(std::size_t size) {
+    void* ptr = CountedAlloc(size, alignof(std::max_align_t));
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return CountedAlloc(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return CountedAlloc(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    void* ptr = CountedAlloc(size, (std::size_t)alignment);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return ::operator new(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    CountedFree(ptr);
+}
+
+#endif  // ALLOC_COUNTER_REPLACE_NEW
+
+#endif  // UTILS_ALLOC_COUNTER_HPP
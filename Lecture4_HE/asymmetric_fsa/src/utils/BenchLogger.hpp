@@ -7,6 +7,9 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
 
 /*
 Helper function: Print line number.
@@ -100,6 +103,7 @@ public:
         queryNum = 0;
         queryTime = 0;
         queryComm = 0;    
+        counterMap.clear();
         startTime = std::chrono::steady_clock::now();   
         endTime = startTime; 
     }
@@ -122,6 +126,16 @@ public:
         queryTime += _queryTime;
     }
 
+    void LogAddTime(double _queryTime) {
+        queryTime += _queryTime;
+    }
+
+    void LogOneQuery(double _queryComm, double _queryTime) {
+        LogAddComm(_queryComm);
+        queryNum += 1;
+        queryTime += _queryTime;
+    }
+
     void LogOneQuery(double _queryComm=0.0f) {
         LogAddComm(_queryComm);
 
@@ -134,6 +148,28 @@ public:
         endTime = startTime;
     }
 
+    /*
+    Named counters, e.g., the bytes and the microseconds spent on encoding the query objects,
+    which are summed up and reported per query after the query log.
+    */
+    void AddCounter(const std::string& name, double value) {
+        counterMap[name] += value;
+    }
+
+    double GetCounter(const std::string& name) const {
+        auto iter = counterMap.find(name);
+        return (iter == counterMap.end()) ? 0 : iter->second;
+    }
+
+    std::string counters_to_string(size_t prec=2) const {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(prec);
+        for (const auto& counter : counterMap) {
+            ss << counter.first << " = " << counter.second << " in total, " << ((queryNum==0) ? 0 : (counter.second/queryNum)) << " per query" << std::endl;
+        }
+        return ss.str();
+    }
+
     std::string to_string(size_t prec=2) const {
         float AvgQueryTime = (queryNum==0) ? 0 : (queryTime/queryNum);
         float AvgQueryComm = (queryNum==0) ? 0 : (queryComm/queryNum);
@@ -143,6 +179,7 @@ public:
 
         // ss << "-------------- Query Log --------------\n";
         ss << queryNum << " queries: runtime = " << AvgQueryTime << " [s], communication = " << AvgQueryComm << " [KB] per query" << std::endl;
+        ss << counters_to_string(prec);
 
         return ss.str();
     }
@@ -176,6 +213,59 @@ private:
     size_t queryNum;
     double queryTime;
     double queryComm;
+    std::map<std::string, double> counterMap;
+};
+
+/*
+Per-query latency recorder, which reports the tail latency of a workload.
+*/
+class LatencyLogger {
+public:
+    void Init() {
+        m_latency_list.clear();
+    }
+
+    void Record(double _latency) {
+        m_latency_list.emplace_back(_latency);
+    }
+
+    size_t Count() const {
+        return m_latency_list.size();
+    }
+
+    /*
+    Nearest-rank percentile, p is in [0, 100].
+    */
+    double Percentile(double p) const {
+        if (m_latency_list.empty()) return 0;
+        std::vector<double> sorted_list(m_latency_list);
+        std::sort(sorted_list.begin(), sorted_list.end());
+        size_t rank = (size_t)std::ceil(p / 100.0 * sorted_list.size());
+        rank = std::min(std::max(rank, (size_t)1), sorted_list.size());
+        return sorted_list[rank - 1];
+    }
+
+    double Mean() const {
+        if (m_latency_list.empty()) return 0;
+        double sum = 0;
+        for (double latency : m_latency_list) {
+            sum += latency;
+        }
+        return sum / m_latency_list.size();
+    }
+
+    std::string to_string(size_t prec=2) const {
+        std::stringstream ss;
+
+        ss << std::fixed << std::setprecision(prec);
+        ss << Count() << " queries: latency mean = " << Mean() << ", p50 = " << Percentile(50) << ", p90 = " << Percentile(90)
+            << ", p99 = " << Percentile(99) << ", p99.9 = " << Percentile(99.9) << ", max = " << Percentile(100) << " [ms]" << std::endl;
+
+        return ss.str();
+    }
+
+private:
+    std::vector<double> m_latency_list;
 };
 
 #endif  // UTILS_QUERY_LOGGER_HPP
@@ -13,22 +13,58 @@
 #include <cstdlib>
 #include <cstdint>
 
+#include <random>
+#include <type_traits>
+
+#include "DistanceKernel.hpp"
+
+/*
+The values of the vectors are int64 by default, or float32 embeddings if FLOAT_VECTOR is defined (cmake -DFLOAT_VECTOR=ON).
+All programs of a deployment must be built with the same type, as it is the type of the vector files and snapshots.
+Float vectors need the CKKS scheme, as the BGV scheme only encrypts integer distances.
+*/
+#ifdef FLOAT_VECTOR
+typedef float VectorDimensionType;
+typedef FloatDistanceFunc VectorDistanceFunc;
+// random vector values in [1, 100]
+typedef std::uniform_real_distribution<VectorDimensionType> VectorValueDistribution;
+#else
 typedef int64_t VectorDimensionType;
+typedef DistanceFunc VectorDistanceFunc;
+typedef std::uniform_int_distribution<VectorDimensionType> VectorValueDistribution;
+#endif
 typedef long VidType;
-   
-struct VectorDataType {  
+
+/*
+The distance kernel of the vector value type.
+*/
+inline VectorDistanceFunc GetVectorDistanceFunc(DistanceMetric metric, size_t dim, DistanceISA isa=DetectDistanceISA()) {
+#ifdef FLOAT_VECTOR
+    return GetFloatDistanceFunc(metric, dim, isa);
+#else
+    return GetDistanceFunc(metric, dim, isa);
+#endif
+}
+
+/*
+A vector data object with values of type T, VectorDataType is the one of the vector value type.
+*/
+template <typename T>
+struct BasicVectorData {  
+    typedef T ValueType;
+
     VidType vid;  
-    std::vector<VectorDimensionType> data;  
+    std::vector<T> data;  
 
-    VectorDataType() {}
+    BasicVectorData() {}
 
-    VectorDataType(size_t dim, VidType _vid=0): vid(_vid) {
+    BasicVectorData(size_t dim, VidType _vid=0): vid(_vid) {
         data.reserve(dim);
         data.resize(dim);
-        std::fill(data.begin(), data.end(), (VectorDimensionType)0);
+        std::fill(data.begin(), data.end(), (T)0);
     }
 
-    VectorDataType(size_t dim, VidType _vid, const VectorDataType& vector_point): vid(_vid) {
+    BasicVectorData(size_t dim, VidType _vid, const BasicVectorData& vector_point): vid(_vid) {
         if (vector_point.Dimension() != dim) {
             throw std::invalid_argument("vector data dimension does not match");
             std::exit(EXIT_FAILURE);
@@ -38,7 +74,7 @@ struct VectorDataType {
         std::copy_n(vector_point.data.begin(), dim, data.begin());
     }
 
-    VectorDataType(size_t dim, VidType _vid, const std::vector<VectorDimensionType>& arr) : vid(_vid) {
+    BasicVectorData(size_t dim, VidType _vid, const std::vector<T>& arr) : vid(_vid) {
         if (arr.size() != dim) {
             throw std::invalid_argument("Data size does not match with vector data dimension");
             std::exit(EXIT_FAILURE);
@@ -52,7 +88,7 @@ struct VectorDataType {
         vid = _vid;
     }
 
-    void SetVectorPoint(const VectorDataType& vector_point) {
+    void SetVectorPoint(const BasicVectorData& vector_point) {
         const size_t dim = this->Dimension();
         if (vector_point.Dimension() != dim) {
             throw std::invalid_argument("vector data dimension does not match");
@@ -61,7 +97,7 @@ struct VectorDataType {
         std::copy_n(vector_point.data.begin(), dim, data.begin());
     }
 
-    void SetVectorPoint(const std::vector<VectorDimensionType>& arr) {
+    void SetVectorPoint(const std::vector<T>& arr) {
         const size_t dim = this->Dimension();
         if (arr.size() != dim) {
             throw std::invalid_argument("Data size does not match with vector data dimension");
@@ -70,20 +106,7 @@ struct VectorDataType {
         std::copy_n(arr.begin(), dim, data.begin());
     }
   
-    VectorDataType& operator=(const VectorDataType& other) {
-        if (this != &other) {  
-            const size_t dim = this->Dimension();
-            if (other.Dimension() != dim) {
-                throw std::invalid_argument("Data size does not match with vector data dimension");
-                std::exit(EXIT_FAILURE);
-            }
-            vid = other.vid; 
-            std::copy_n(other.data.begin(), dim, data.begin());
-        }  
-        return *this;  
-    }  
-  
-    bool operator==(const VectorDataType& other) const {  
+    bool operator==(const BasicVectorData& other) const {  
         if (vid != other.vid) return false;
         const size_t dim = this->Dimension();
         if (other.Dimension() != dim) return false;
@@ -96,32 +119,32 @@ struct VectorDataType {
         return true;  
     }  
    
-    bool operator!=(const VectorDataType& other) const {  
+    bool operator!=(const BasicVectorData& other) const {  
         return !(*this == other);  
     }  
   
-    VectorDimensionType& at(size_t k) {  
+    T& at(size_t k) {  
         if (k >= this->Dimension()) {  
             throw std::out_of_range("Index out of range");  
         }  
         return data[k];  
     }  
 
-    const VectorDimensionType& at(size_t k) const {  
+    const T& at(size_t k) const {  
         if (k >= this->Dimension()) {  
             throw std::out_of_range("Index out of range");  
         }  
         return data[k];  
     }  
   
-    VectorDimensionType& operator[](size_t k) {  
+    T& operator[](size_t k) {  
         if (k >= this->Dimension()) {  
             throw std::out_of_range("Index out of range");  
         }  
         return data[k];  
     }  
 
-    const VectorDimensionType& operator[](size_t k) const {  
+    const T& operator[](size_t k) const {  
         if (k >= this->Dimension()) {  
             throw std::out_of_range("Index out of range");  
         }  
@@ -163,33 +186,34 @@ struct VectorDataType {
     } 
 };
 
-VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b);
-double EuclideanDistance(const VectorDataType& a, const VectorDataType& b);
+typedef BasicVectorData<VectorDimensionType> VectorDataType;
 
-VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b) {  
+/*
+The dimension is checked once per call, then the distance is computed by the kernel of utils/DistanceKernel.hpp.
+A scan over many vectors should call GetVectorDistanceFunc() once and use the raw kernel instead.
+*/
+inline VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b) {  
     if (a.Dimension() != b.Dimension()) {
         throw std::invalid_argument("Vector data must have the same dimension");
     }
 
     const size_t dim = a.Dimension();
-    VectorDimensionType sum = 0;  
-    for (size_t i = 0; i < dim; ++i) {  
-        sum += (a[i] - b[i]) * (a[i] - b[i]);  
-    }  
-    return sum;  
+    return GetVectorDistanceFunc(DistanceMetric::L2, dim)(a.data.data(), b.data.data(), dim);
 } 
 
-double EuclideanDistance(const VectorDataType& a, const VectorDataType& b) {  
-    if (a.Dimension() != b.Dimension()) {
-        throw std::invalid_argument("Vector data must have the same dimension");
-    }
-
-    const size_t dim = a.Dimension();
-    VectorDimensionType sum = 0;  
-    for (size_t i = 0; i < dim; ++i) {  
-        sum += (a[i] - b[i]) * (a[i] - b[i]);
-    }  
-    return std::sqrt(sum*1.0);  
+/*
+The square radius of a range query, which is floored for integer vectors, as their square distances are integers.
+*/
+inline VectorDimensionType SquareRadius(const double radius) {
+#ifdef FLOAT_VECTOR
+    return (VectorDimensionType)(radius * radius);
+#else
+    return (VectorDimensionType)std::floor(radius * radius);
+#endif
+}
+
+inline double EuclideanDistance(const VectorDataType& a, const VectorDataType& b) {  
+    return std::sqrt(EuclideanSquareDistance(a, b)*1.0);  
 } 
 
 #endif  // UTILS_DATA_TYPE_HPP
@@ -0,0 +1,233 @@
+#ifndef UTILS_DECRYPT_WORKER_POOL_HPP
+#define UTILS_DECRYPT_WORKER_POOL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "seal/seal.h"
+
+/*
+A pool of decryption workers for the query user.
+Each worker owns a long-lived Decryptor and encoder bound to the shared SEALContext,
+so decrypting the results of many data holders carries no per-ciphertext setup overhead.
+The values of the BGV scheme are integers, the ones of the CKKS scheme are approximate reals:
+Submit/SubmitSlots return integers (CKKS values are rounded), SubmitReal/SubmitRealSlots return reals for both schemes.
+*/
+class DecryptWorkerPool {
+public:
+    DecryptWorkerPool(const seal::SEALContext& context, const seal::SecretKey& secret_key, size_t worker_num=0)
+                        : m_context(context), m_secret_key(secret_key), m_stop(false) {
+        m_ckks = (context.key_context_data()->parms().scheme() == seal::scheme_type::ckks);
+        if (worker_num == 0) {
+            worker_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        m_worker_list.reserve(worker_num);
+        for (size_t i=0; i<worker_num; ++i) {
+            m_worker_list.emplace_back(&DecryptWorkerPool::m_WorkerLoop, this);
+        }
+    }
+
+    ~DecryptWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (auto& worker : m_worker_list) {
+            worker.join();
+        }
+    }
+
+    DecryptWorkerPool(const DecryptWorkerPool&) = delete;
+    DecryptWorkerPool& operator=(const DecryptWorkerPool&) = delete;
+
+    /*
+    Decrypt a serialized ciphertext and return the value in its first slot.
+    The caller must keep edist_str alive until the future is ready.
+    */
+    std::future<int64_t> Submit(const std::string& edist_str) {
+        DecryptTask task;
+        task.edist = &edist_str;
+        task.slot_num = 0;
+        task.real = false;
+        std::future<int64_t> ret = task.result.get_future();
+        m_Enqueue(std::move(task));
+        return ret;
+    }
+
+    /*
+    Decrypt a serialized ciphertext and return the values in its first slot_num slots.
+    */
+    std::future<std::vector<int64_t>> SubmitSlots(const std::string& edist_str, size_t slot_num) {
+        DecryptTask task;
+        task.edist = &edist_str;
+        task.slot_num = std::max((size_t)1, slot_num);
+        task.real = false;
+        std::future<std::vector<int64_t>> ret = task.slot_list.get_future();
+        m_Enqueue(std::move(task));
+        return ret;
+    }
+
+    /*
+    Decrypt a serialized ciphertext and return the real value in its first slot, which is approximate in CKKS.
+    Its sign is exact as long as the value is far from the CKKS noise, unlike a value rounded to an integer.
+    */
+    std::future<double> SubmitReal(const std::string& edist_str) {
+        DecryptTask task;
+        task.edist = &edist_str;
+        task.slot_num = 0;
+        task.real = true;
+        std::future<double> ret = task.real_result.get_future();
+        m_Enqueue(std::move(task));
+        return ret;
+    }
+
+    /*
+    Decrypt a serialized ciphertext and return the real values in its first slot_num slots.
+    */
+    std::future<std::vector<double>> SubmitRealSlots(const std::string& edist_str, size_t slot_num) {
+        DecryptTask task;
+        task.edist = &edist_str;
+        task.slot_num = std::max((size_t)1, slot_num);
+        task.real = true;
+        std::future<std::vector<double>> ret = task.real_slot_list.get_future();
+        m_Enqueue(std::move(task));
+        return ret;
+    }
+
+    size_t WorkerNum() const {
+        return m_worker_list.size();
+    }
+
+private:
+    struct DecryptTask {
+        const std::string* edist;
+        // 0 for the first slot only (result), or the number of slots (slot_list)
+        size_t slot_num;
+        // the real_* promises instead of the integer ones
+        bool real;
+        std::promise<int64_t> result;
+        std::promise<std::vector<int64_t>> slot_list;
+        std::promise<double> real_result;
+        std::promise<std::vector<double>> real_slot_list;
+    };
+
+    void m_Enqueue(DecryptTask&& task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task_queue.emplace(std::move(task));
+        }
+        m_cond.notify_one();
+    }
+
+    static int64_t m_ToInt(const int64_t value) {
+        return value;
+    }
+
+    static int64_t m_ToInt(const double value) {
+        return std::llround(value);
+    }
+
+    template <typename Value>
+    static void m_SetValue(DecryptTask& task, const std::vector<Value>& dist_matrix) {
+        const size_t slot_num = std::min(std::max((size_t)1, task.slot_num), dist_matrix.size());
+        if (task.real) {
+            if (task.slot_num == 0) {
+                task.real_result.set_value((double)dist_matrix[0]);
+            } else {
+                task.real_slot_list.set_value(std::vector<double>(dist_matrix.begin(), dist_matrix.begin() + slot_num));
+            }
+        } else {
+            if (task.slot_num == 0) {
+                task.result.set_value(m_ToInt(dist_matrix[0]));
+            } else {
+                std::vector<int64_t> slot_list(slot_num);
+                for (size_t i=0; i<slot_num; ++i) {
+                    slot_list[i] = m_ToInt(dist_matrix[i]);
+                }
+                task.slot_list.set_value(std::move(slot_list));
+            }
+        }
+    }
+
+    static void m_SetException(DecryptTask& task, std::exception_ptr exception) {
+        if (task.real) {
+            if (task.slot_num == 0) {
+                task.real_result.set_exception(exception);
+            } else {
+                task.real_slot_list.set_exception(exception);
+            }
+        } else {
+            if (task.slot_num == 0) {
+                task.result.set_exception(exception);
+            } else {
+                task.slot_list.set_exception(exception);
+            }
+        }
+    }
+
+    void m_WorkerLoop() {
+        seal::Decryptor decryptor(m_context, m_secret_key);
+        // the BatchEncoder supports BFV and BGV only, the CKKSEncoder CKKS only
+        std::unique_ptr<seal::BatchEncoder> batch_encoder;
+        std::unique_ptr<seal::CKKSEncoder> ckks_encoder;
+        if (m_ckks) {
+            ckks_encoder = std::make_unique<seal::CKKSEncoder>(m_context);
+        } else {
+            batch_encoder = std::make_unique<seal::BatchEncoder>(m_context);
+        }
+        seal::Ciphertext dist_encrypted(m_context);
+        seal::Plaintext dist_decrypted;
+        std::vector<int64_t> dist_matrix;
+        std::vector<double> real_dist_matrix;
+
+        while (true) {
+            DecryptTask task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this] { return m_stop || !m_task_queue.empty(); });
+                if (m_stop && m_task_queue.empty()) return;
+                task = std::move(m_task_queue.front());
+                m_task_queue.pop();
+            }
+
+            try {
+                // load the ciphertext straight from the protobuf bytes
+                const std::string& edist_str = *task.edist;
+                dist_encrypted.load(m_context, reinterpret_cast<const seal::seal_byte*>(edist_str.data()), edist_str.size());
+                decryptor.decrypt(dist_encrypted, dist_decrypted);
+                if (m_ckks) {
+                    ckks_encoder->decode(dist_decrypted, real_dist_matrix);
+                    m_SetValue(task, real_dist_matrix);
+                } else {
+                    batch_encoder->decode(dist_decrypted, dist_matrix);
+                    m_SetValue(task, dist_matrix);
+                }
+            } catch (...) {
+                m_SetException(task, std::current_exception());
+            }
+        }
+    }
+
+    seal::SEALContext m_context;
+    seal::SecretKey m_secret_key;
+    bool m_ckks;
+    std::vector<std::thread> m_worker_list;
+    std::queue<DecryptTask> m_task_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop;
+};
+
+#endif  // UTILS_DECRYPT_WORKER_POOL_HPP
@@ -0,0 +1,502 @@
+#ifndef UTILS_DISTANCE_KERNEL_HPP
+#define UTILS_DISTANCE_KERNEL_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DISTANCE_KERNEL_X86
+#endif
+
+/*
+Distance kernels over raw int64 or float arrays.
+Each kernel is a template on the metric and the dimension (0 for a runtime dimension),
+so the fixed dimensions 64/128/256/960 are fully unrolled, and it is compiled for AVX-512, AVX2 and plain scalar code.
+GetDistanceFunc() (GetFloatDistanceFunc() for float) picks the best kernel for the CPU once, and the caller keeps the function pointer for the whole scan.
+The int64 results wrap around on overflow in the same way for all instruction sets.
+The float kernels accumulate in float with FMA, so the vector kernels differ from the scalar one in the last bits, as they sum in another order.
+*/
+enum class DistanceMetric {
+    L2,     // squared euclidean distance
+    IP,     // inner product
+    L1      // manhattan distance
+};
+
+enum class DistanceISA {
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+typedef int64_t (*DistanceFunc)(const int64_t* a, const int64_t* b, size_t dim);
+typedef float (*FloatDistanceFunc)(const float* a, const float* b, size_t dim);
+
+namespace distance_kernel {
+
+/*
+Wrapping int64 arithmetic, so that the scalar kernels give the same results as the vector ones.
+*/
+inline int64_t WrapAdd(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a + (uint64_t)b);
+}
+
+inline int64_t WrapSub(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+inline int64_t WrapMul(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a * (uint64_t)b);
+}
+
+template <DistanceMetric Metric>
+struct MetricOp;
+
+template <>
+struct MetricOp<DistanceMetric::L2> {
+    static int64_t Scalar(int64_t a, int64_t b) {
+        int64_t d = WrapSub(a, b);
+        return WrapMul(d, d);
+    }
+};
+
+template <>
+struct MetricOp<DistanceMetric::IP> {
+    static int64_t Scalar(int64_t a, int64_t b) {
+        return WrapMul(a, b);
+    }
+};
+
+template <>
+struct MetricOp<DistanceMetric::L1> {
+    static int64_t Scalar(int64_t a, int64_t b) {
+        int64_t d = WrapSub(a, b);
+        int64_t sign = d >> 63;
+        return WrapSub(d ^ sign, sign);
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+int64_t ScalarKernel(const int64_t* a, const int64_t* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    int64_t sum = 0;
+    for (size_t i=0; i<n; ++i) {
+        sum = WrapAdd(sum, MetricOp<Metric>::Scalar(a[i], b[i]));
+    }
+    return sum;
+}
+
+template <DistanceMetric Metric>
+struct FloatMetricOp;
+
+template <>
+struct FloatMetricOp<DistanceMetric::L2> {
+    static float Scalar(float a, float b) {
+        float d = a - b;
+        return d * d;
+    }
+};
+
+template <>
+struct FloatMetricOp<DistanceMetric::IP> {
+    static float Scalar(float a, float b) {
+        return a * b;
+    }
+};
+
+template <>
+struct FloatMetricOp<DistanceMetric::L1> {
+    static float Scalar(float a, float b) {
+        return std::fabs(a - b);
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+float ScalarFloatKernel(const float* a, const float* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    float sum = 0;
+    for (size_t i=0; i<n; ++i) {
+        sum += FloatMetricOp<Metric>::Scalar(a[i], b[i]);
+    }
+    return sum;
+}
+
+#ifdef DISTANCE_KERNEL_X86
+
+/*
+AVX2 has no 64-bit multiplication, so it is composed from the 32x32->64 multiplications:
+a*b = lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)  (mod 2^64)
+*/
+__attribute__((target("avx2")))
+inline __m256i Avx2Mul64(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+template <DistanceMetric Metric>
+struct Avx2Op;
+
+template <>
+struct Avx2Op<DistanceMetric::L2> {
+    __attribute__((target("avx2")))
+    static __m256i Apply(__m256i a, __m256i b) {
+        __m256i d = _mm256_sub_epi64(a, b);
+        return Avx2Mul64(d, d);
+    }
+};
+
+template <>
+struct Avx2Op<DistanceMetric::IP> {
+    __attribute__((target("avx2")))
+    static __m256i Apply(__m256i a, __m256i b) {
+        return Avx2Mul64(a, b);
+    }
+};
+
+template <>
+struct Avx2Op<DistanceMetric::L1> {
+    __attribute__((target("avx2")))
+    static __m256i Apply(__m256i a, __m256i b) {
+        __m256i d = _mm256_sub_epi64(a, b);
+        __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), d);
+        return _mm256_sub_epi64(_mm256_xor_si256(d, sign), sign);
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+__attribute__((target("avx2")))
+int64_t Avx2Kernel(const int64_t* a, const int64_t* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    size_t i = 0;
+    // two accumulators hide the latency of the multiplications
+    const size_t block_end = n - n % 8;
+    for (; i<block_end; i+=8) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 4));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 4));
+        sum0 = _mm256_add_epi64(sum0, Avx2Op<Metric>::Apply(a0, b0));
+        sum1 = _mm256_add_epi64(sum1, Avx2Op<Metric>::Apply(a1, b1));
+    }
+    sum0 = _mm256_add_epi64(sum0, sum1);
+    __m128i sum2 = _mm_add_epi64(_mm256_castsi256_si128(sum0), _mm256_extracti128_si256(sum0, 1));
+    int64_t sum = WrapAdd(_mm_cvtsi128_si64(sum2), _mm_extract_epi64(sum2, 1));
+    for (; i<n; ++i) {
+        sum = WrapAdd(sum, MetricOp<Metric>::Scalar(a[i], b[i]));
+    }
+    return sum;
+}
+
+template <DistanceMetric Metric>
+struct Avx512Op;
+
+template <>
+struct Avx512Op<DistanceMetric::L2> {
+    __attribute__((target("avx512f,avx512dq")))
+    static __m512i Apply(__m512i a, __m512i b) {
+        __m512i d = _mm512_sub_epi64(a, b);
+        return _mm512_mullo_epi64(d, d);
+    }
+};
+
+template <>
+struct Avx512Op<DistanceMetric::IP> {
+    __attribute__((target("avx512f,avx512dq")))
+    static __m512i Apply(__m512i a, __m512i b) {
+        return _mm512_mullo_epi64(a, b);
+    }
+};
+
+template <>
+struct Avx512Op<DistanceMetric::L1> {
+    __attribute__((target("avx512f,avx512dq")))
+    static __m512i Apply(__m512i a, __m512i b) {
+        __m512i d = _mm512_sub_epi64(a, b);
+        __mmask8 sign = _mm512_cmplt_epi64_mask(d, _mm512_setzero_si512());
+        return _mm512_mask_sub_epi64(d, sign, _mm512_setzero_si512(), d);
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+__attribute__((target("avx512f,avx512dq")))
+int64_t Avx512Kernel(const int64_t* a, const int64_t* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+    size_t i = 0;
+    const size_t block_end = n - n % 16;
+    for (; i<block_end; i+=16) {
+        __m512i a0 = _mm512_loadu_si512(a + i);
+        __m512i b0 = _mm512_loadu_si512(b + i);
+        __m512i a1 = _mm512_loadu_si512(a + i + 8);
+        __m512i b1 = _mm512_loadu_si512(b + i + 8);
+        sum0 = _mm512_add_epi64(sum0, Avx512Op<Metric>::Apply(a0, b0));
+        sum1 = _mm512_add_epi64(sum1, Avx512Op<Metric>::Apply(a1, b1));
+    }
+    if (n - i >= 8) {
+        __m512i a0 = _mm512_loadu_si512(a + i);
+        __m512i b0 = _mm512_loadu_si512(b + i);
+        sum0 = _mm512_add_epi64(sum0, Avx512Op<Metric>::Apply(a0, b0));
+        i += 8;
+    }
+    int64_t lane_list[8];
+    _mm512_storeu_si512(lane_list, _mm512_add_epi64(sum0, sum1));
+    int64_t sum = 0;
+    for (int k=0; k<8; ++k) {
+        sum = WrapAdd(sum, lane_list[k]);
+    }
+    for (; i<n; ++i) {
+        sum = WrapAdd(sum, MetricOp<Metric>::Scalar(a[i], b[i]));
+    }
+    return sum;
+}
+
+/*
+The float operations fold the accumulation into the metric, so that L2 and IP are one FMA per lane.
+*/
+template <DistanceMetric Metric>
+struct Avx2FloatOp;
+
+template <>
+struct Avx2FloatOp<DistanceMetric::L2> {
+    __attribute__((target("avx2,fma")))
+    static __m256 Accumulate(__m256 sum, __m256 a, __m256 b) {
+        __m256 d = _mm256_sub_ps(a, b);
+        return _mm256_fmadd_ps(d, d, sum);
+    }
+};
+
+template <>
+struct Avx2FloatOp<DistanceMetric::IP> {
+    __attribute__((target("avx2,fma")))
+    static __m256 Accumulate(__m256 sum, __m256 a, __m256 b) {
+        return _mm256_fmadd_ps(a, b, sum);
+    }
+};
+
+template <>
+struct Avx2FloatOp<DistanceMetric::L1> {
+    __attribute__((target("avx2,fma")))
+    static __m256 Accumulate(__m256 sum, __m256 a, __m256 b) {
+        // clear the sign bits
+        return _mm256_add_ps(sum, _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(a, b)));
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+__attribute__((target("avx2,fma")))
+float Avx2FloatKernel(const float* a, const float* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t i = 0;
+    const size_t block_end = n - n % 16;
+    for (; i<block_end; i+=16) {
+        sum0 = Avx2FloatOp<Metric>::Accumulate(sum0, _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum1 = Avx2FloatOp<Metric>::Accumulate(sum1, _mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+    }
+    if (n - i >= 8) {
+        sum0 = Avx2FloatOp<Metric>::Accumulate(sum0, _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        i += 8;
+    }
+    sum0 = _mm256_add_ps(sum0, sum1);
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+    sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, 1));
+    float sum = _mm_cvtss_f32(sum4);
+    for (; i<n; ++i) {
+        sum += FloatMetricOp<Metric>::Scalar(a[i], b[i]);
+    }
+    return sum;
+}
+
+template <DistanceMetric Metric>
+struct Avx512FloatOp;
+
+template <>
+struct Avx512FloatOp<DistanceMetric::L2> {
+    __attribute__((target("avx512f")))
+    static __m512 Accumulate(__m512 sum, __m512 a, __m512 b) {
+        __m512 d = _mm512_sub_ps(a, b);
+        return _mm512_fmadd_ps(d, d, sum);
+    }
+};
+
+template <>
+struct Avx512FloatOp<DistanceMetric::IP> {
+    __attribute__((target("avx512f")))
+    static __m512 Accumulate(__m512 sum, __m512 a, __m512 b) {
+        return _mm512_fmadd_ps(a, b, sum);
+    }
+};
+
+template <>
+struct Avx512FloatOp<DistanceMetric::L1> {
+    __attribute__((target("avx512f")))
+    static __m512 Accumulate(__m512 sum, __m512 a, __m512 b) {
+        return _mm512_add_ps(sum, _mm512_abs_ps(_mm512_sub_ps(a, b)));
+    }
+};
+
+template <DistanceMetric Metric, size_t Dim>
+__attribute__((target("avx512f")))
+float Avx512FloatKernel(const float* a, const float* b, size_t dim) {
+    const size_t n = (Dim != 0) ? Dim : dim;
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    size_t i = 0;
+    const size_t block_end = n - n % 32;
+    for (; i<block_end; i+=32) {
+        sum0 = Avx512FloatOp<Metric>::Accumulate(sum0, _mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        sum1 = Avx512FloatOp<Metric>::Accumulate(sum1, _mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+    }
+    if (n - i >= 16) {
+        sum0 = Avx512FloatOp<Metric>::Accumulate(sum0, _mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        i += 16;
+    }
+    // the tail is loaded with a mask, the masked-off lanes are zero in both vectors
+    if (i < n) {
+        const __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        sum1 = Avx512FloatOp<Metric>::Accumulate(sum1, _mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+    }
+    float lane_list[16];
+    _mm512_storeu_ps(lane_list, _mm512_add_ps(sum0, sum1));
+    float sum = 0;
+    for (int k=0; k<16; ++k) {
+        sum += lane_list[k];
+    }
+    return sum;
+}
+
+#endif  // DISTANCE_KERNEL_X86
+
+template <DistanceMetric Metric, size_t Dim>
+DistanceFunc SelectKernel(DistanceISA isa) {
+    switch (isa) {
+    #ifdef DISTANCE_KERNEL_X86
+    case DistanceISA::AVX512:
+        return &Avx512Kernel<Metric, Dim>;
+    case DistanceISA::AVX2:
+        return &Avx2Kernel<Metric, Dim>;
+    #endif
+    default:
+        return &ScalarKernel<Metric, Dim>;
+    }
+}
+
+template <DistanceMetric Metric>
+DistanceFunc SelectKernel(size_t dim, DistanceISA isa) {
+    switch (dim) {
+    case 64:
+        return SelectKernel<Metric, 64>(isa);
+    case 128:
+        return SelectKernel<Metric, 128>(isa);
+    case 256:
+        return SelectKernel<Metric, 256>(isa);
+    case 960:
+        return SelectKernel<Metric, 960>(isa);
+    default:
+        return SelectKernel<Metric, 0>(isa);
+    }
+}
+
+template <DistanceMetric Metric, size_t Dim>
+FloatDistanceFunc SelectFloatKernel(DistanceISA isa) {
+    switch (isa) {
+    #ifdef DISTANCE_KERNEL_X86
+    case DistanceISA::AVX512:
+        return &Avx512FloatKernel<Metric, Dim>;
+    case DistanceISA::AVX2:
+        return &Avx2FloatKernel<Metric, Dim>;
+    #endif
+    default:
+        return &ScalarFloatKernel<Metric, Dim>;
+    }
+}
+
+template <DistanceMetric Metric>
+FloatDistanceFunc SelectFloatKernel(size_t dim, DistanceISA isa) {
+    switch (dim) {
+    case 64:
+        return SelectFloatKernel<Metric, 64>(isa);
+    case 128:
+        return SelectFloatKernel<Metric, 128>(isa);
+    case 256:
+        return SelectFloatKernel<Metric, 256>(isa);
+    case 960:
+        return SelectFloatKernel<Metric, 960>(isa);
+    default:
+        return SelectFloatKernel<Metric, 0>(isa);
+    }
+}
+
+}  // namespace distance_kernel
+
+/*
+The best instruction set of this CPU, it can be lowered by the environment variable DISTANCE_ISA=scalar|avx2|avx512.
+*/
+inline DistanceISA DetectDistanceISA() {
+    static const DistanceISA isa = []() {
+        DistanceISA best = DistanceISA::SCALAR;
+        #ifdef DISTANCE_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+            best = DistanceISA::AVX512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            best = DistanceISA::AVX2;
+        }
+        #endif
+        const char* env = std::getenv("DISTANCE_ISA");
+        if (env != nullptr) {
+            std::string name(env);
+            if (name == "scalar") {
+                best = DistanceISA::SCALAR;
+            } else if (name == "avx2" && best == DistanceISA::AVX512) {
+                best = DistanceISA::AVX2;
+            }
+        }
+        return best;
+    }();
+    return isa;
+}
+
+inline std::string DistanceISAName(DistanceISA isa) {
+    switch (isa) {
+    case DistanceISA::AVX512:
+        return "avx512";
+    case DistanceISA::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+inline DistanceFunc GetDistanceFunc(DistanceMetric metric, size_t dim, DistanceISA isa=DetectDistanceISA()) {
+    switch (metric) {
+    case DistanceMetric::IP:
+        return distance_kernel::SelectKernel<DistanceMetric::IP>(dim, isa);
+    case DistanceMetric::L1:
+        return distance_kernel::SelectKernel<DistanceMetric::L1>(dim, isa);
+    default:
+        return distance_kernel::SelectKernel<DistanceMetric::L2>(dim, isa);
+    }
+}
+
+inline FloatDistanceFunc GetFloatDistanceFunc(DistanceMetric metric, size_t dim, DistanceISA isa=DetectDistanceISA()) {
+    switch (metric) {
+    case DistanceMetric::IP:
+        return distance_kernel::SelectFloatKernel<DistanceMetric::IP>(dim, isa);
+    case DistanceMetric::L1:
+        return distance_kernel::SelectFloatKernel<DistanceMetric::L1>(dim, isa);
+    default:
+        return distance_kernel::SelectFloatKernel<DistanceMetric::L2>(dim, isa);
+    }
+}
+
+#endif  // UTILS_DISTANCE_KERNEL_HPP
@@ -0,0 +1,78 @@
+#ifndef UTILS_HE_SCHEME_HPP
+#define UTILS_HE_SCHEME_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include "seal/seal.h"
+
+/*
+The HE scheme of the distance comparisons, the values match HeScheme in FedSql.proto.
+BGV encrypts integer distances exactly, CKKS encrypts real distances approximately, which the float vectors need.
+*/
+enum class HeScheme : int {
+    BGV = 0,
+    CKKS = 1,
+};
+
+inline const char* HeSchemeName(const HeScheme scheme) {
+    switch (scheme) {
+        case HeScheme::BGV: return "bgv";
+        case HeScheme::CKKS: return "ckks";
+        default: return "unknown";
+    }
+}
+
+inline HeScheme ParseHeScheme(const std::string& name) {
+    if (name == "bgv") return HeScheme::BGV;
+    if (name == "ckks") return HeScheme::CKKS;
+    throw std::invalid_argument("Unknown HE scheme: " + name);
+}
+
+static const size_t kHePolyModulusDegree = 8192;
+// BGV: the batching plain modulus bounds the perturbed distance differences to 2^39
+static const int kBgvPlainModulusBits = 40;
+/*
+CKKS: the distances are encrypted at scale 2^40. The perturbations multiply by small integers encoded at scale 1,
+so the scale never grows and no ciphertext is rescaled: the chain is one 40-bit prime on top of the 60-bit base prime
+(plus the 60-bit special prime), which leaves 2^59 for the perturbed distance differences and halves the ciphertexts of BGV.
+*/
+static const int kCkksScaleBits = 40;
+
+inline double CkksScale() {
+    return std::ldexp(1.0, kCkksScaleBits);
+}
+
+inline seal::EncryptionParameters CreateSealParams(const HeScheme scheme) {
+    if (scheme == HeScheme::CKKS) {
+        seal::EncryptionParameters parms(seal::scheme_type::ckks);
+        parms.set_poly_modulus_degree(kHePolyModulusDegree);
+        parms.set_coeff_modulus(seal::CoeffModulus::Create(kHePolyModulusDegree, {60, kCkksScaleBits, 60}));
+        return parms;
+    }
+
+    seal::EncryptionParameters parms(seal::scheme_type::bgv);
+    parms.set_poly_modulus_degree(kHePolyModulusDegree);
+    parms.set_coeff_modulus(seal::CoeffModulus::BFVDefault(kHePolyModulusDegree));
+    parms.set_plain_modulus(seal::PlainModulus::Batching(kHePolyModulusDegree, kBgvPlainModulusBits));
+    return parms;
+}
+
+/*
+Whether the serialized encryption parameters (e.g., of a snapshot) are the same as parms.
+The parms_id is a hash of the scheme, the poly modulus degree, every coefficient modulus and the plain modulus,
+so the keys of other moduli (e.g., other bit sizes of the same count) are regenerated instead of failing to load.
+*/
+inline bool SameSealParams(const char* parms_data, const size_t parms_size, const seal::EncryptionParameters& parms) {
+    seal::EncryptionParameters saved_parms;
+    try {
+        saved_parms.load(reinterpret_cast<const seal::seal_byte*>(parms_data), parms_size);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return saved_parms.parms_id() == parms.parms_id();
+}
+
+#endif  // UTILS_HE_SCHEME_HPP
@@ -0,0 +1,222 @@
+#ifndef UTILS_PACKED_VECTOR_HPP
+#define UTILS_PACKED_VECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "DataType.hpp"
+
+/*
+Vectors packed into protobuf bytes as raw little-endian values of a declared type,
+which replaces the varint encoding of repeated int64 with one fixed-size value per dimension.
+The values match VectorDtype in FedSql.proto, VARINT means the vector is in the repeated int64 field instead.
+*/
+enum class PackedDtype : int {
+    VARINT = 0,
+    INT8 = 1,
+    INT16 = 2,
+    INT32 = 3,
+    INT64 = 4,
+    FLOAT32 = 5,
+};
+
+inline size_t PackedDtypeSize(const PackedDtype dtype) {
+    switch (dtype) {
+        case PackedDtype::INT8: return 1;
+        case PackedDtype::INT16: return 2;
+        case PackedDtype::INT32: return 4;
+        case PackedDtype::INT64: return 8;
+        case PackedDtype::FLOAT32: return 4;
+        default: throw std::invalid_argument("Vector data type is not packed");
+    }
+}
+
+inline const char* PackedDtypeName(const PackedDtype dtype) {
+    switch (dtype) {
+        case PackedDtype::VARINT: return "varint";
+        case PackedDtype::INT8: return "int8";
+        case PackedDtype::INT16: return "int16";
+        case PackedDtype::INT32: return "int32";
+        case PackedDtype::INT64: return "int64";
+        case PackedDtype::FLOAT32: return "float";
+        default: return "unknown";
+    }
+}
+
+inline PackedDtype ParsePackedDtype(const std::string& name) {
+    for (int i=(int)PackedDtype::VARINT; i<=(int)PackedDtype::FLOAT32; ++i) {
+        if (name == PackedDtypeName((PackedDtype)i)) return (PackedDtype)i;
+    }
+    throw std::invalid_argument("Unknown vector data type: " + name);
+}
+
+inline bool IsPackedDtype(const int dtype) {
+    return dtype > (int)PackedDtype::VARINT && dtype <= (int)PackedDtype::FLOAT32;
+}
+
+/*
+Whether every value of the vector is exactly representable in the type,
+a float holds the integers up to 2^24 exactly, and float vectors fit into an integer type only if all their values are integers.
+*/
+inline bool CanPackAs(const PackedDtype dtype, const VectorDimensionType* row, const size_t dim) {
+    constexpr bool float_vector = std::is_floating_point<VectorDimensionType>::value;
+    VectorDimensionType lo, hi;
+    switch (dtype) {
+        case PackedDtype::VARINT:
+        case PackedDtype::INT64:
+            if constexpr (!float_vector) return true;
+            lo = (VectorDimensionType)-std::ldexp(1.0, 62); hi = (VectorDimensionType)std::ldexp(1.0, 62); break;
+        case PackedDtype::INT8: lo = std::numeric_limits<int8_t>::min(); hi = std::numeric_limits<int8_t>::max(); break;
+        case PackedDtype::INT16: lo = std::numeric_limits<int16_t>::min(); hi = std::numeric_limits<int16_t>::max(); break;
+        case PackedDtype::INT32: lo = std::numeric_limits<int32_t>::min(); hi = std::numeric_limits<int32_t>::max(); break;
+        case PackedDtype::FLOAT32:
+            if constexpr (float_vector) return true;
+            lo = -(1 << 24); hi = (1 << 24); break;
+        default: return false;
+    }
+    for (size_t i=0; i<dim; ++i) {
+        if (row[i] < lo || row[i] > hi) return false;
+        if constexpr (float_vector) {
+            if (row[i] != std::trunc(row[i])) return false;
+        }
+    }
+    return true;
+}
+
+/*
+The narrowest type that holds the row exactly, the types are ordered by width (std::max of two rows covers both).
+A float vector is packed as int8 or int16 if all its values are such integers, and as float otherwise.
+*/
+inline PackedDtype NarrowestPackedDtype(const VectorDimensionType* row, const size_t dim) {
+    VectorDimensionType lo = 0, hi = 0;
+    for (size_t i=0; i<dim; ++i) {
+        if constexpr (std::is_floating_point<VectorDimensionType>::value) {
+            if (row[i] != std::trunc(row[i])) return PackedDtype::FLOAT32;
+        }
+        lo = std::min(lo, row[i]);
+        hi = std::max(hi, row[i]);
+    }
+    if (lo >= std::numeric_limits<int8_t>::min() && hi <= std::numeric_limits<int8_t>::max()) return PackedDtype::INT8;
+    if (lo >= std::numeric_limits<int16_t>::min() && hi <= std::numeric_limits<int16_t>::max()) return PackedDtype::INT16;
+    if constexpr (std::is_floating_point<VectorDimensionType>::value) return PackedDtype::FLOAT32;
+    if (lo >= std::numeric_limits<int32_t>::min() && hi <= std::numeric_limits<int32_t>::max()) return PackedDtype::INT32;
+    return PackedDtype::INT64;
+}
+
+template <typename T>
+inline void StorePackedValue(char* dst, const T value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    for (size_t i=0; i<sizeof(T); ++i) dst[i] = bytes[sizeof(T) - 1 - i];
+#else
+    std::memcpy(dst, &value, sizeof(T));
+#endif
+}
+
+template <typename T>
+inline T LoadPackedValue(const char* src) {
+    T value;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    char bytes[sizeof(T)];
+    for (size_t i=0; i<sizeof(T); ++i) bytes[i] = src[sizeof(T) - 1 - i];
+    std::memcpy(&value, bytes, sizeof(T));
+#else
+    std::memcpy(&value, src, sizeof(T));
+#endif
+    return value;
+}
+
+template <typename T>
+inline void AppendPackedValues(char* dst, const VectorDimensionType* row, const size_t dim) {
+    for (size_t i=0; i<dim; ++i) {
+        StorePackedValue<T>(dst + i * sizeof(T), (T)row[i]);
+    }
+}
+
+/*
+Append one row to the packed bytes, the values must be representable in the type (see CanPackAs).
+*/
+inline void AppendPackedRow(std::string& packed, const PackedDtype dtype, const VectorDimensionType* row, const size_t dim) {
+    if (!CanPackAs(dtype, row, dim)) {
+        throw std::invalid_argument(std::string("Vector data does not fit into ") + PackedDtypeName(dtype));
+    }
+    const size_t offset = packed.size();
+    packed.resize(offset + dim * PackedDtypeSize(dtype));
+    char* dst = &packed[offset];
+    switch (dtype) {
+        case PackedDtype::INT8: AppendPackedValues<int8_t>(dst, row, dim); break;
+        case PackedDtype::INT16: AppendPackedValues<int16_t>(dst, row, dim); break;
+        case PackedDtype::INT32: AppendPackedValues<int32_t>(dst, row, dim); break;
+        case PackedDtype::INT64: AppendPackedValues<int64_t>(dst, row, dim); break;
+        case PackedDtype::FLOAT32: AppendPackedValues<float>(dst, row, dim); break;
+        default: throw std::invalid_argument("Vector data type is not packed");
+    }
+}
+
+/*
+A view of row_num packed rows in place (e.g., in the bytes of a received message),
+the rows are widened straight into the caller's buffer without an intermediate copy.
+*/
+class PackedVectorView {
+public:
+    PackedVectorView(const std::string& packed, const int dtype, const size_t row_num, const size_t dim)
+                    : m_data(packed.data()), m_dtype((PackedDtype)dtype), m_row_num(row_num), m_dim(dim) {
+        if (!IsPackedDtype(dtype)) {
+            throw std::invalid_argument("Unknown packed vector data type " + std::to_string(dtype));
+        }
+        if (packed.size() != row_num * dim * PackedDtypeSize(m_dtype)) {
+            throw std::invalid_argument("Size of packed vector data does not match with its dimension");
+        }
+    }
+
+    size_t RowNum() const {
+        return m_row_num;
+    }
+
+    size_t Dimension() const {
+        return m_dim;
+    }
+
+    PackedDtype Dtype() const {
+        return m_dtype;
+    }
+
+    void CopyRow(const size_t i, VectorDimensionType* row) const {
+        const char* src = m_data + i * m_dim * PackedDtypeSize(m_dtype);
+        switch (m_dtype) {
+            case PackedDtype::INT8: m_CopyRow<int8_t>(src, row); break;
+            case PackedDtype::INT16: m_CopyRow<int16_t>(src, row); break;
+            case PackedDtype::INT32: m_CopyRow<int32_t>(src, row); break;
+            case PackedDtype::INT64: m_CopyRow<int64_t>(src, row); break;
+            case PackedDtype::FLOAT32: m_CopyRow<float>(src, row); break;
+            default: break;
+        }
+    }
+
+private:
+    template <typename T>
+    void m_CopyRow(const char* src, VectorDimensionType* row) const {
+        for (size_t i=0; i<m_dim; ++i) {
+            // floats are rounded into integer vectors
+            if constexpr (std::is_floating_point<T>::value && !std::is_floating_point<VectorDimensionType>::value) {
+                row[i] = (VectorDimensionType)std::llround(LoadPackedValue<T>(src + i * sizeof(T)));
+            } else {
+                row[i] = (VectorDimensionType)LoadPackedValue<T>(src + i * sizeof(T));
+            }
+        }
+    }
+
+    const char* m_data;
+    PackedDtype m_dtype;
+    size_t m_row_num;
+    size_t m_dim;
+};
+
+#endif  // UTILS_PACKED_VECTOR_HPP
@@ -0,0 +1,409 @@
+#ifndef UTILS_QUANTIZER_HPP
+#define UTILS_QUANTIZER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "DataType.hpp"
+#include "Snapshot.hpp"
+#include "VectorFile.hpp"
+
+/*
+Compressed in-memory copies of a dataset for the local nearest neighbor scan.
+The scan over the codes only returns candidates, which are re-ranked with the exact distances
+of the full-precision vectors in the (memory-mapped) data file.
+*/
+enum class QuantizerType {
+    NONE,
+    SQ8,    // scalar quantization: one byte per dimension
+    PQ      // product quantization: one byte per subspace
+};
+
+inline QuantizerType ParseQuantizerType(const std::string& name) {
+    if (name == "none") return QuantizerType::NONE;
+    if (name == "sq8") return QuantizerType::SQ8;
+    if (name == "pq") return QuantizerType::PQ;
+    throw std::invalid_argument("Unknown quantizer: " + name + " (none|sq8|pq)");
+}
+
+inline std::string QuantizerName(QuantizerType type) {
+    switch (type) {
+    case QuantizerType::SQ8:
+        return "sq8";
+    case QuantizerType::PQ:
+        return "pq";
+    default:
+        return "none";
+    }
+}
+
+/*
+Per-dimension scalar quantizer: x is stored as (x - min) / step in one byte.
+The step is an integer, so a range of at most 256 values (e.g., [1, 100]) is stored exactly,
+and a wider range takes the smallest step that keeps its maximum within one byte (e.g., 2 for [0, 256]).
+Float vectors (FLOAT_VECTOR) split the range into 255 steps and round to the nearest one.
+*/
+class ScalarQuantizer {
+public:
+    void Train(const VectorFileReader& data_file) {
+        const size_t n = data_file.Size(), dim = data_file.Dimension();
+        std::vector<VectorDimensionType> max_list(dim, std::numeric_limits<VectorDimensionType>::lowest());
+        m_min_list.assign(dim, std::numeric_limits<VectorDimensionType>::max());
+        for (size_t i=0; i<n; ++i) {
+            const VectorDimensionType* row = data_file.Row(i);
+            for (size_t j=0; j<dim; ++j) {
+                m_min_list[j] = std::min(m_min_list[j], row[j]);
+                max_list[j] = std::max(max_list[j], row[j]);
+            }
+        }
+        m_step_list.resize(dim);
+        for (size_t j=0; j<dim; ++j) {
+            const VectorDimensionType range = (n == 0) ? 0 : (max_list[j] - m_min_list[j]);
+            if constexpr (std::is_floating_point<VectorDimensionType>::value) {
+                m_step_list[j] = (range > 0) ? range / 255 : 1;
+            } else {
+                m_step_list[j] = range / 256 + 1;
+            }
+        }
+    }
+
+    size_t CodeSize() const {
+        return m_min_list.size();
+    }
+
+    void Encode(const VectorDimensionType* row, uint8_t* code) const {
+        for (size_t j=0; j<m_min_list.size(); ++j) {
+            VectorDimensionType c = (row[j] - m_min_list[j]) / m_step_list[j];
+            if constexpr (std::is_floating_point<VectorDimensionType>::value) {
+                c = std::round(c);
+            }
+            code[j] = (uint8_t)std::min(std::max(c, (VectorDimensionType)0), (VectorDimensionType)255);
+        }
+    }
+
+    /*
+    Shift the query into the code space once, then the distance to a code is a plain integer loop.
+    */
+    void PrepareQuery(const VectorDimensionType* query, std::vector<VectorDimensionType>& shifted_query) const {
+        shifted_query.resize(m_min_list.size());
+        for (size_t j=0; j<m_min_list.size(); ++j) {
+            shifted_query[j] = query[j] - m_min_list[j];
+        }
+    }
+
+    VectorDimensionType Distance(const std::vector<VectorDimensionType>& shifted_query, const uint8_t* code) const {
+        VectorDimensionType sum = 0;
+        for (size_t j=0; j<shifted_query.size(); ++j) {
+            VectorDimensionType d = shifted_query[j] - code[j] * m_step_list[j];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.AddArray("sq.min", m_min_list);
+        writer.AddArray("sq.step", m_step_list);
+    }
+
+    void Load(const SnapshotReader& reader) {
+        m_min_list = reader.CopyArray<VectorDimensionType>("sq.min");
+        m_step_list = reader.CopyArray<VectorDimensionType>("sq.step");
+        if (m_min_list.size() != m_step_list.size()) {
+            throw std::invalid_argument("Invalid scalar quantizer in snapshot " + reader.FileName());
+        }
+    }
+
+private:
+    std::vector<VectorDimensionType> m_min_list;
+    std::vector<VectorDimensionType> m_step_list;
+};
+
+/*
+Product quantizer: the dimensions are split into m subspaces, and each sub-vector is replaced by the nearest of 256 centroids.
+The distances are computed asymmetrically (ADC): the query stays in full precision,
+and a lookup table of the distances from each query sub-vector to all centroids is built once per query.
+*/
+class ProductQuantizer {
+public:
+    static const size_t kCentroidNum = 256;
+
+    void Train(const VectorFileReader& data_file, const size_t subspace_num, const size_t sample_size=20000, const int iteration_num=10, const unsigned int seed=1) {
+        const size_t n = data_file.Size(), dim = data_file.Dimension();
+        if (subspace_num == 0 || dim % subspace_num != 0) {
+            throw std::invalid_argument("The dimension should be divisible by the number of PQ subspaces");
+        }
+        if (n == 0) {
+            throw std::invalid_argument("There are no data objects to train the product quantizer");
+        }
+        m_subspace_num = subspace_num;
+        m_sub_dim = dim / subspace_num;
+        m_centroid_list.assign(m_subspace_num * kCentroidNum * m_sub_dim, 0.0f);
+
+        // train on a random sample
+        std::mt19937_64 eng(seed);
+        std::vector<size_t> sample_list(n);
+        for (size_t i=0; i<n; ++i) sample_list[i] = i;
+        std::shuffle(sample_list.begin(), sample_list.end(), eng);
+        sample_list.resize(std::min(n, sample_size));
+
+        for (size_t m=0; m<m_subspace_num; ++m) {
+            m_TrainSubspace(data_file, sample_list, m, iteration_num);
+        }
+    }
+
+    size_t CodeSize() const {
+        return m_subspace_num;
+    }
+
+    void Encode(const VectorDimensionType* row, uint8_t* code) const {
+        for (size_t m=0; m<m_subspace_num; ++m) {
+            code[m] = (uint8_t)m_NearestCentroid(m, row + m * m_sub_dim);
+        }
+    }
+
+    /*
+    table[m * 256 + c] is the squared distance from the m-th query sub-vector to the c-th centroid of subspace m.
+    */
+    void ComputeDistanceTable(const VectorDimensionType* query, std::vector<float>& table) const {
+        table.resize(m_subspace_num * kCentroidNum);
+        for (size_t m=0; m<m_subspace_num; ++m) {
+            for (size_t c=0; c<kCentroidNum; ++c) {
+                table[m * kCentroidNum + c] = m_SubDistance(m_Centroid(m, c), query + m * m_sub_dim);
+            }
+        }
+    }
+
+    float Distance(const std::vector<float>& table, const uint8_t* code) const {
+        float sum = 0;
+        for (size_t m=0; m<m_subspace_num; ++m) {
+            sum += table[m * kCentroidNum + code[m]];
+        }
+        return sum;
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.AddValue<uint64_t>("pq.subspace_num", m_subspace_num);
+        writer.AddValue<uint64_t>("pq.sub_dim", m_sub_dim);
+        writer.AddArray("pq.centroid", m_centroid_list);
+    }
+
+    void Load(const SnapshotReader& reader) {
+        m_subspace_num = reader.GetValue<uint64_t>("pq.subspace_num");
+        m_sub_dim = reader.GetValue<uint64_t>("pq.sub_dim");
+        m_centroid_list = reader.CopyArray<float>("pq.centroid");
+        if (m_centroid_list.size() != m_subspace_num * kCentroidNum * m_sub_dim) {
+            throw std::invalid_argument("Invalid product quantizer in snapshot " + reader.FileName());
+        }
+    }
+
+private:
+    const float* m_Centroid(size_t m, size_t c) const {
+        return m_centroid_list.data() + (m * kCentroidNum + c) * m_sub_dim;
+    }
+
+    float* m_Centroid(size_t m, size_t c) {
+        return m_centroid_list.data() + (m * kCentroidNum + c) * m_sub_dim;
+    }
+
+    float m_SubDistance(const float* centroid, const VectorDimensionType* sub_vector) const {
+        float sum = 0;
+        for (size_t j=0; j<m_sub_dim; ++j) {
+            float d = centroid[j] - sub_vector[j];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    size_t m_NearestCentroid(size_t m, const VectorDimensionType* sub_vector) const {
+        size_t nearest = 0;
+        float min_dist = std::numeric_limits<float>::max();
+        for (size_t c=0; c<kCentroidNum; ++c) {
+            float dist = m_SubDistance(m_Centroid(m, c), sub_vector);
+            if (dist < min_dist) {
+                min_dist = dist;
+                nearest = c;
+            }
+        }
+        return nearest;
+    }
+
+    // Lloyd's k-means over the sub-vectors of subspace m
+    void m_TrainSubspace(const VectorFileReader& data_file, const std::vector<size_t>& sample_list, size_t m, int iteration_num) {
+        const size_t sample_num = sample_list.size();
+        for (size_t c=0; c<kCentroidNum; ++c) {
+            const VectorDimensionType* sub_vector = data_file.Row(sample_list[c % sample_num]) + m * m_sub_dim;
+            std::copy_n(sub_vector, m_sub_dim, m_Centroid(m, c));
+        }
+
+        std::vector<double> sum_list(kCentroidNum * m_sub_dim);
+        std::vector<size_t> count_list(kCentroidNum);
+        for (int iter=0; iter<iteration_num; ++iter) {
+            std::fill(sum_list.begin(), sum_list.end(), 0.0);
+            std::fill(count_list.begin(), count_list.end(), 0);
+            for (size_t i : sample_list) {
+                const VectorDimensionType* sub_vector = data_file.Row(i) + m * m_sub_dim;
+                const size_t c = m_NearestCentroid(m, sub_vector);
+                for (size_t j=0; j<m_sub_dim; ++j) {
+                    sum_list[c * m_sub_dim + j] += sub_vector[j];
+                }
+                ++count_list[c];
+            }
+            // an empty cluster keeps its centroid
+            for (size_t c=0; c<kCentroidNum; ++c) {
+                if (count_list[c] == 0) continue;
+                for (size_t j=0; j<m_sub_dim; ++j) {
+                    m_Centroid(m, c)[j] = sum_list[c * m_sub_dim + j] / count_list[c];
+                }
+            }
+        }
+    }
+
+    size_t m_subspace_num = 0;
+    size_t m_sub_dim = 0;
+    std::vector<float> m_centroid_list;
+};
+
+/*
+The codes of a whole dataset, the vid of a vector is its row in the data file.
+*/
+class QuantizedIndex {
+public:
+    QuantizedIndex(const VectorFileReader& data_file, const QuantizerType type, const size_t pq_subspace_num)
+                    : m_type(type), m_n(data_file.Size()) {
+        if (m_type == QuantizerType::SQ8) {
+            m_sq.Train(data_file);
+            m_code_size = m_sq.CodeSize();
+        } else if (m_type == QuantizerType::PQ) {
+            m_pq.Train(data_file, pq_subspace_num);
+            m_code_size = m_pq.CodeSize();
+        } else {
+            throw std::invalid_argument("QuantizedIndex needs a quantizer");
+        }
+
+        m_code_list.resize(m_n * m_code_size);
+        m_EncodeAll(data_file);
+    }
+
+    /*
+    Restore the trained quantizer and the codes from a snapshot, without training or encoding.
+    */
+    explicit QuantizedIndex(const SnapshotReader& reader) {
+        m_type = (QuantizerType)reader.GetValue<uint32_t>("quantizer.type");
+        m_n = reader.GetValue<uint64_t>("quantizer.n");
+        if (m_type == QuantizerType::SQ8) {
+            m_sq.Load(reader);
+            m_code_size = m_sq.CodeSize();
+        } else if (m_type == QuantizerType::PQ) {
+            m_pq.Load(reader);
+            m_code_size = m_pq.CodeSize();
+        } else {
+            throw std::invalid_argument("QuantizedIndex needs a quantizer");
+        }
+        m_code_list = reader.CopyArray<uint8_t>("quantizer.code");
+        if (m_code_list.size() != m_n * m_code_size) {
+            throw std::invalid_argument("Invalid quantized codes in snapshot " + reader.FileName());
+        }
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.AddValue<uint32_t>("quantizer.type", (uint32_t)m_type);
+        writer.AddValue<uint64_t>("quantizer.n", m_n);
+        if (m_type == QuantizerType::SQ8) {
+            m_sq.Save(writer);
+        } else {
+            m_pq.Save(writer);
+        }
+        writer.AddArray("quantizer.code", m_code_list);
+    }
+
+    /*
+    Return the vids of the top-k vectors by the approximate distance, the nearest first.
+    Only the rows [begin, end) are scanned, so that the shards of a data holder can scan their own ranges in parallel.
+    */
+    std::vector<VidType> Search(const VectorDimensionType* query, const size_t topk, size_t begin=0, size_t end=SIZE_MAX) const {
+        end = std::min(end, m_n);
+        if (m_type == QuantizerType::SQ8) {
+            std::vector<VectorDimensionType> shifted_query;
+            m_sq.PrepareQuery(query, shifted_query);
+            return m_TopK<VectorDimensionType>(topk, begin, end, [&](const uint8_t* code) { return m_sq.Distance(shifted_query, code); });
+        } else {
+            std::vector<float> table;
+            m_pq.ComputeDistanceTable(query, table);
+            return m_TopK<float>(topk, begin, end, [&](const uint8_t* code) { return m_pq.Distance(table, code); });
+        }
+    }
+
+    size_t Size() const {
+        return m_n;
+    }
+
+    size_t CodeBytes() const {
+        return m_code_list.size();
+    }
+
+    QuantizerType Type() const {
+        return m_type;
+    }
+
+private:
+    void m_EncodeAll(const VectorFileReader& data_file) {
+        const size_t thread_num = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> thread_list;
+        for (size_t t=0; t<thread_num; ++t) {
+            thread_list.emplace_back([this, &data_file, t, thread_num]() {
+                for (size_t i=t; i<m_n; i+=thread_num) {
+                    uint8_t* code = m_code_list.data() + i * m_code_size;
+                    if (m_type == QuantizerType::SQ8) {
+                        m_sq.Encode(data_file.Row(i), code);
+                    } else {
+                        m_pq.Encode(data_file.Row(i), code);
+                    }
+                }
+            });
+        }
+        for (auto& t : thread_list) {
+            t.join();
+        }
+    }
+
+    template <typename DistType, typename Func>
+    std::vector<VidType> m_TopK(const size_t topk, const size_t begin, const size_t end, Func distance) const {
+        // max-heap of the k nearest candidates so far
+        std::priority_queue<std::pair<DistType, VidType>> heap;
+        for (size_t i=begin; i<end; ++i) {
+            DistType dist = distance(m_code_list.data() + i * m_code_size);
+            if (heap.size() < topk) {
+                heap.emplace(dist, i);
+            } else if (dist < heap.top().first) {
+                heap.pop();
+                heap.emplace(dist, i);
+            }
+        }
+
+        std::vector<VidType> vid_list(heap.size());
+        for (size_t k=heap.size(); k>0; --k) {
+            vid_list[k-1] = heap.top().second;
+            heap.pop();
+        }
+        return vid_list;
+    }
+
+    QuantizerType m_type;
+    size_t m_n;
+    size_t m_code_size;
+    ScalarQuantizer m_sq;
+    ProductQuantizer m_pq;
+    std::vector<uint8_t> m_code_list;
+};
+
+#endif  // UTILS_QUANTIZER_HPP
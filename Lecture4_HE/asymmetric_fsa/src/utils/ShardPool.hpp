@@ -0,0 +1,230 @@
+#ifndef UTILS_SHARD_POOL_HPP
+#define UTILS_SHARD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+The CPUs of each NUMA node, read from /sys/devices/system/node.
+Without NUMA information, all CPUs are treated as one node.
+*/
+class NumaTopology {
+public:
+    NumaTopology() {
+        for (int node=0; ; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!file.is_open()) break;
+            std::string cpulist;
+            std::getline(file, cpulist);
+            std::vector<int> cpu_list = ParseCpuList(cpulist);
+            if (!cpu_list.empty()) {
+                m_node_cpu_list.emplace_back(std::move(cpu_list));
+            }
+        }
+        if (m_node_cpu_list.empty()) {
+            const int cpu_num = std::max(1u, std::thread::hardware_concurrency());
+            m_node_cpu_list.emplace_back();
+            for (int cpu=0; cpu<cpu_num; ++cpu) {
+                m_node_cpu_list.back().emplace_back(cpu);
+            }
+        }
+    }
+
+    size_t NodeNum() const {
+        return m_node_cpu_list.size();
+    }
+
+    const std::vector<int>& CpuList(size_t node) const {
+        return m_node_cpu_list[node];
+    }
+
+    // parse a cpulist such as "0-3,8,10-11"
+    static std::vector<int> ParseCpuList(const std::string& cpulist) {
+        std::vector<int> cpu_list;
+        std::stringstream ss(cpulist);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            if (range.empty()) continue;
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu=first; cpu<=last; ++cpu) {
+                cpu_list.emplace_back(cpu);
+            }
+        }
+        return cpu_list;
+    }
+
+private:
+    std::vector<std::vector<int>> m_node_cpu_list;
+};
+
+/*
+One worker thread per shard, pinned to one CPU. The shards are spread over the NUMA nodes round-robin,
+and the CPUs of a node are handed out in order.
+All the work on a shard (loading, scanning and updating) runs on its own worker, so under the default first-touch policy
+the memory of a shard is allocated on the node that scans it, and a scan never reads across the interconnect.
+*/
+class ShardPool {
+public:
+    explicit ShardPool(size_t shard_num, bool pin=true) {
+        if (shard_num == 0) {
+            throw std::invalid_argument("shard_num must be a positive integer");
+        }
+        const size_t node_num = m_topology.NodeNum();
+        std::vector<size_t> next_cpu(node_num, 0);
+        m_worker_list.reserve(shard_num);
+        for (size_t s=0; s<shard_num; ++s) {
+            auto worker = std::make_unique<Worker>();
+            worker->node = s % node_num;
+            const std::vector<int>& cpu_list = m_topology.CpuList(worker->node);
+            worker->cpu = pin ? cpu_list[next_cpu[worker->node]++ % cpu_list.size()] : -1;
+            m_worker_list.emplace_back(std::move(worker));
+        }
+        for (size_t s=0; s<shard_num; ++s) {
+            m_worker_list[s]->thread = std::thread(&ShardPool::m_WorkerLoop, this, s);
+        }
+    }
+
+    ~ShardPool() {
+        for (auto& worker : m_worker_list) {
+            {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+                worker->stop = true;
+            }
+            worker->cond.notify_all();
+        }
+        for (auto& worker : m_worker_list) {
+            worker->thread.join();
+        }
+    }
+
+    ShardPool(const ShardPool&) = delete;
+    ShardPool& operator=(const ShardPool&) = delete;
+
+    /*
+    Run func() on the worker of the shard, the tasks of one shard run in the order of submission.
+    */
+    template <typename Func>
+    auto Submit(size_t shard_id, Func func) -> std::future<decltype(func())> {
+        using ResultType = decltype(func());
+        auto task = std::make_shared<std::packaged_task<ResultType()>>(std::move(func));
+        std::future<ResultType> ret = task->get_future();
+        Worker& worker = *m_worker_list[shard_id];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.task_queue.emplace([task]() { (*task)(); });
+        }
+        worker.cond.notify_one();
+        return ret;
+    }
+
+    /*
+    Run func(shard_id) on every shard in parallel and return the results in the order of the shards.
+    The first exception of a shard is rethrown after all shards have finished.
+    */
+    template <typename Func>
+    auto RunAll(Func func) -> std::vector<decltype(func(size_t()))> {
+        using ResultType = decltype(func(size_t()));
+        std::vector<std::future<ResultType>> future_list;
+        future_list.reserve(m_worker_list.size());
+        for (size_t s=0; s<m_worker_list.size(); ++s) {
+            future_list.emplace_back(Submit(s, [func, s]() { return func(s); }));
+        }
+        for (auto& future : future_list) {
+            future.wait();
+        }
+        std::vector<ResultType> result_list;
+        result_list.reserve(future_list.size());
+        for (auto& future : future_list) {
+            result_list.emplace_back(future.get());
+        }
+        return result_list;
+    }
+
+    /*
+    Pin the calling thread to the CPUs of the shard's node, e.g., a background thread that allocates memory for the shard.
+    */
+    void PinToNode(size_t shard_id) const {
+        if (m_worker_list[shard_id]->cpu < 0) return;
+        m_PinCurrentThread(m_topology.CpuList(m_worker_list[shard_id]->node));
+    }
+
+    size_t ShardNum() const {
+        return m_worker_list.size();
+    }
+
+    size_t NodeNum() const {
+        return m_topology.NodeNum();
+    }
+
+    size_t NodeOf(size_t shard_id) const {
+        return m_worker_list[shard_id]->node;
+    }
+
+    int CpuOf(size_t shard_id) const {
+        return m_worker_list[shard_id]->cpu;
+    }
+
+private:
+    struct Worker {
+        size_t node = 0;
+        int cpu = -1;
+        std::thread thread;
+        std::queue<std::function<void()>> task_queue;
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool stop = false;
+    };
+
+    static void m_PinCurrentThread(const std::vector<int>& cpu_list) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu : cpu_list) {
+            CPU_SET(cpu, &cpu_set);
+        }
+        // pinning is only a hint for the placement, so a failure is not fatal
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+
+    void m_WorkerLoop(const size_t shard_id) {
+        Worker& worker = *m_worker_list[shard_id];
+        if (worker.cpu >= 0) {
+            m_PinCurrentThread(std::vector<int>{worker.cpu});
+        }
+
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                worker.cond.wait(lock, [&worker] { return worker.stop || !worker.task_queue.empty(); });
+                if (worker.stop && worker.task_queue.empty()) return;
+                task = std::move(worker.task_queue.front());
+                worker.task_queue.pop();
+            }
+            task();
+        }
+    }
+
+    NumaTopology m_topology;
+    std::vector<std::unique_ptr<Worker>> m_worker_list;
+};
+
+#endif  // UTILS_SHARD_POOL_HPP
@@ -0,0 +1,181 @@
+#ifndef UTILS_SHARDED_VECTOR_STORE_HPP
+#define UTILS_SHARDED_VECTOR_STORE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DataType.hpp"
+#include "ShardPool.hpp"
+#include "VectorStore.hpp"
+
+/*
+A dataset partitioned into the shards of a ShardPool, one VectorStore per shard.
+The initial dataset is split into contiguous vid ranges, and each shard builds, scans and updates its store on its own worker.
+The vids are handed out here, so they stay unique across the shards.
+*/
+class ShardedVectorStore {
+public:
+    explicit ShardedVectorStore(ShardPool& shard_pool) : m_shard_pool(shard_pool), m_dim(0), m_next_vid(0) {
+        for (size_t s=0; s<m_shard_pool.ShardNum(); ++s) {
+            m_store_list.emplace_back(std::make_unique<VectorStore>());
+        }
+    }
+
+    ShardedVectorStore(const ShardedVectorStore&) = delete;
+    ShardedVectorStore& operator=(const ShardedVectorStore&) = delete;
+
+    /*
+    Load n vectors, split into contiguous ranges of rows. build(begin, end) returns the vectors of the rows [begin, end)
+    (usually with the vids [begin, end)), it runs on the worker of each shard in parallel, so it must be thread-safe.
+    */
+    template <typename Func>
+    void Load(const size_t dim, const size_t n, Func build) {
+        m_dim = dim;
+        std::vector<VidType> next_vid_list = m_shard_pool.RunAll([this, dim, n, &build](const size_t shard_id) {
+            const size_t shard_num = m_shard_pool.ShardNum();
+            const size_t begin = n * shard_id / shard_num;
+            const size_t end = n * (shard_id + 1) / shard_num;
+            std::vector<VectorDataType> data_list = build(begin, end);
+            VidType next_vid = 0;
+            for (const auto& vector_data : data_list) {
+                next_vid = std::max(next_vid, vector_data.vid + 1);
+            }
+            VectorStore& store = *m_store_list[shard_id];
+            store.Reset(dim, std::move(data_list));
+            store.StartCompaction(std::chrono::milliseconds(1000), [this, shard_id]() { m_shard_pool.PinToNode(shard_id); });
+            return next_vid;
+        });
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        m_next_vid = *std::max_element(next_vid_list.begin(), next_vid_list.end());
+    }
+
+    /*
+    Append the vectors to the smallest shard and return their vids.
+    The shard's worker copies them, so the new segment is allocated on the shard's node.
+    */
+    std::vector<VidType> Insert(const std::vector<VectorDataType>& data_list) {
+        std::vector<VidType> vid_list;
+        if (data_list.empty()) return vid_list;
+        for (const auto& vector_data : data_list) {
+            if (vector_data.Dimension() != m_dim) {
+                throw std::invalid_argument("vector data dimension does not match");
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        size_t target = 0;
+        for (size_t s=1; s<m_store_list.size(); ++s) {
+            if (m_store_list[s]->Size() < m_store_list[target]->Size()) target = s;
+        }
+        for (size_t i=0; i<data_list.size(); ++i) {
+            vid_list.emplace_back(m_next_vid++);
+        }
+
+        VectorStore& store = *m_store_list[target];
+        m_shard_pool.Submit(target, [&store, &data_list, &vid_list]() {
+            std::vector<VectorDataType> local_list(data_list);
+            for (size_t i=0; i<local_list.size(); ++i) {
+                local_list[i].SetVid(vid_list[i]);
+            }
+            store.Append(std::move(local_list));
+        }).get();
+
+        return vid_list;
+    }
+
+    /*
+    Mark the vectors as deleted in every shard and return how many of them were found.
+    */
+    size_t Delete(const std::vector<VidType>& vid_list) {
+        std::vector<size_t> deleted_list = m_shard_pool.RunAll([this, &vid_list](const size_t shard_id) {
+            return m_store_list[shard_id]->Delete(vid_list);
+        });
+        size_t deleted_num = 0;
+        for (size_t deleted : deleted_list) {
+            deleted_num += deleted;
+        }
+        return deleted_num;
+    }
+
+    /*
+    Run scan(shard_id, snapshot) on the current snapshot of every shard in parallel,
+    and return the per-shard results for the caller to merge.
+    A single shard is scanned on the calling thread, so that concurrent queries are not serialized on one worker.
+    */
+    template <typename Func>
+    auto Scan(Func scan) -> std::vector<decltype(scan(size_t(), std::declval<const VectorSnapshot&>()))> {
+        if (m_store_list.size() == 1) {
+            std::shared_ptr<const VectorSnapshot> snapshot = m_store_list[0]->GetSnapshot();
+            return {scan(0, *snapshot)};
+        }
+        return m_shard_pool.RunAll([this, &scan](const size_t shard_id) {
+            std::shared_ptr<const VectorSnapshot> snapshot = m_store_list[shard_id]->GetSnapshot();
+            return scan(shard_id, *snapshot);
+        });
+    }
+
+    /*
+    The current snapshots of all shards, e.g., to save the whole dataset.
+    */
+    std::vector<std::shared_ptr<const VectorSnapshot>> GetSnapshotList() const {
+        std::vector<std::shared_ptr<const VectorSnapshot>> snapshot_list;
+        for (const auto& store : m_store_list) {
+            snapshot_list.emplace_back(store->GetSnapshot());
+        }
+        return snapshot_list;
+    }
+
+    size_t Dimension() const {
+        return m_dim;
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (const auto& store : m_store_list) {
+            size += store->Size();
+        }
+        return size;
+    }
+
+    size_t SegmentNum() const {
+        size_t segment_num = 0;
+        for (const auto& store : m_store_list) {
+            segment_num += store->SegmentNum();
+        }
+        return segment_num;
+    }
+
+    size_t CompactNum() const {
+        size_t compact_num = 0;
+        for (const auto& store : m_store_list) {
+            compact_num += store->CompactNum();
+        }
+        return compact_num;
+    }
+
+    size_t ShardNum() const {
+        return m_store_list.size();
+    }
+
+    size_t ShardSize(size_t shard_id) const {
+        return m_store_list[shard_id]->Size();
+    }
+
+private:
+    ShardPool& m_shard_pool;
+    std::vector<std::unique_ptr<VectorStore>> m_store_list;
+    size_t m_dim;
+
+    // serializes the insertions, so that the vids and the choice of the smallest shard are consistent
+    std::mutex m_writer_mutex;
+    VidType m_next_vid;
+};
+
+#endif  // UTILS_SHARDED_VECTOR_STORE_HPP
@@ -0,0 +1,308 @@
+#ifndef UTILS_SNAPSHOT_HPP
+#define UTILS_SNAPSHOT_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Binary snapshot of a process state, so that a restart loads it instead of rebuilding it:
+    header:   magic "SNAP", version, number of sections, offset of the section table
+    payloads: the bytes of each section, every payload starts at a 64-byte aligned offset
+    table:    name, offset and size of each section
+The table is written last, so large sections are streamed to the file without being buffered.
+The file is written under a temporary name and renamed on Commit(), so a crash never leaves a partial snapshot behind,
+and it is read in place through a read-only memory mapping.
+*/
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t section_num;
+    uint32_t reserved;
+    uint64_t table_offset;
+};
+
+struct SnapshotSection {
+    char name[48];
+    uint64_t offset;
+    uint64_t size;
+};
+
+/*
+Path of the snapshot "name" in the directory, which is created if it does not exist.
+*/
+inline std::string SnapshotPath(const std::string& dir, const std::string& name) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::invalid_argument("Failed to create snapshot directory: " + dir);
+    }
+    return dir + "/" + name + ".snap";
+}
+
+static const char kSnapshotMagic[4] = {'S', 'N', 'A', 'P'};
+static const uint32_t kSnapshotVersion = 1;
+static const size_t kSnapshotAlignment = 64;
+
+class SnapshotWriter {
+public:
+    /*
+    mode is the permission of the new file, e.g., 0600 for a snapshot with secret keys.
+    */
+    explicit SnapshotWriter(const std::string& file_name, mode_t mode=0644)
+                            : m_file_name(file_name), m_tmp_file_name(file_name + ".tmp"), m_offset(0), m_in_section(false) {
+        int fd = open(m_tmp_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (fd < 0) {
+            throw std::invalid_argument("Failed to open snapshot file for writing: " + m_tmp_file_name);
+        }
+        m_file = fdopen(fd, "wb");
+        if (m_file == nullptr) {
+            close(fd);
+            throw std::invalid_argument("Failed to open snapshot file for writing: " + m_tmp_file_name);
+        }
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        m_Write(&header, sizeof(header));
+    }
+
+    ~SnapshotWriter() {
+        // an uncommitted snapshot is discarded
+        if (m_file != nullptr) {
+            std::fclose(m_file);
+            std::remove(m_tmp_file_name.c_str());
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    void AddSection(const std::string& name, const void* data, size_t size) {
+        BeginSection(name);
+        Append(data, size);
+        EndSection();
+    }
+
+    void AddSection(const std::string& name, const std::string& data) {
+        AddSection(name, data.data(), data.size());
+    }
+
+    template <typename T>
+    void AddValue(const std::string& name, const T& value) {
+        AddSection(name, &value, sizeof(T));
+    }
+
+    template <typename T>
+    void AddArray(const std::string& name, const std::vector<T>& array) {
+        AddSection(name, array.data(), array.size() * sizeof(T));
+    }
+
+    /*
+    Stream a large section: BeginSection(), any number of Append(), then EndSection().
+    */
+    void BeginSection(const std::string& name) {
+        if (m_in_section) {
+            throw std::invalid_argument("Snapshot section " + std::string(m_section_list.back().name) + " is not finished");
+        }
+        if (name.empty() || name.size() >= sizeof(SnapshotSection::name)) {
+            throw std::invalid_argument("Invalid snapshot section name: " + name);
+        }
+        m_Pad();
+        SnapshotSection section;
+        std::memset(&section, 0, sizeof(section));
+        std::memcpy(section.name, name.data(), name.size());
+        section.offset = m_offset;
+        m_section_list.emplace_back(section);
+        m_in_section = true;
+    }
+
+    void Append(const void* data, size_t size) {
+        if (!m_in_section) {
+            throw std::invalid_argument("Snapshot data must be appended to a section");
+        }
+        m_Write(data, size);
+        m_section_list.back().size += size;
+    }
+
+    void EndSection() {
+        m_in_section = false;
+    }
+
+    /*
+    Write the section table and the header, then atomically replace the old snapshot.
+    */
+    void Commit() {
+        if (m_in_section) {
+            throw std::invalid_argument("Snapshot section " + std::string(m_section_list.back().name) + " is not finished");
+        }
+        m_Pad();
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+        header.version = kSnapshotVersion;
+        header.section_num = m_section_list.size();
+        header.table_offset = m_offset;
+        m_Write(m_section_list.data(), m_section_list.size() * sizeof(SnapshotSection));
+
+        if (std::fseek(m_file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, m_file) != 1
+            || std::fflush(m_file) != 0 || fsync(fileno(m_file)) != 0) {
+            throw std::invalid_argument("Failed to write snapshot file: " + m_tmp_file_name);
+        }
+        std::fclose(m_file);
+        m_file = nullptr;
+        if (std::rename(m_tmp_file_name.c_str(), m_file_name.c_str()) != 0) {
+            std::remove(m_tmp_file_name.c_str());
+            throw std::invalid_argument("Failed to rename snapshot file: " + m_file_name);
+        }
+    }
+
+private:
+    void m_Write(const void* data, size_t size) {
+        if (size > 0 && std::fwrite(data, 1, size, m_file) != size) {
+            throw std::invalid_argument("Failed to write snapshot file: " + m_tmp_file_name);
+        }
+        m_offset += size;
+    }
+
+    void m_Pad() {
+        static const char zero_list[kSnapshotAlignment] = {0};
+        m_Write(zero_list, (kSnapshotAlignment - m_offset % kSnapshotAlignment) % kSnapshotAlignment);
+    }
+
+    std::string m_file_name;
+    std::string m_tmp_file_name;
+    std::FILE* m_file;
+    uint64_t m_offset;
+    std::vector<SnapshotSection> m_section_list;
+    bool m_in_section;
+};
+
+/*
+Read-only memory mapping of a snapshot, the sections are read in place.
+*/
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& file_name) : m_file_name(file_name), m_addr(nullptr), m_length(0) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::invalid_argument("Failed to open snapshot file: " + file_name);
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(SnapshotHeader)) {
+            close(fd);
+            throw std::invalid_argument("Snapshot file is too short: " + file_name);
+        }
+        m_length = file_stat.st_size;
+
+        m_addr = mmap(nullptr, m_length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m_addr == MAP_FAILED) {
+            m_addr = nullptr;
+            throw std::invalid_argument("Failed to map snapshot file: " + file_name);
+        }
+
+        const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(m_addr);
+        if (std::memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 || header->version != kSnapshotVersion
+            || header->table_offset + header->section_num * sizeof(SnapshotSection) > m_length) {
+            munmap(m_addr, m_length);
+            throw std::invalid_argument("Invalid snapshot file header: " + file_name);
+        }
+        const SnapshotSection* table = reinterpret_cast<const SnapshotSection*>(m_Data() + header->table_offset);
+        for (uint32_t i=0; i<header->section_num; ++i) {
+            if (table[i].offset + table[i].size > m_length || table[i].name[sizeof(SnapshotSection::name) - 1] != '\0') {
+                munmap(m_addr, m_length);
+                throw std::invalid_argument("Snapshot file is truncated: " + file_name);
+            }
+            m_section_list.emplace_back(table[i]);
+        }
+    }
+
+    ~SnapshotReader() {
+        if (m_addr != nullptr) {
+            munmap(m_addr, m_length);
+        }
+    }
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    static bool Exists(const std::string& file_name) {
+        struct stat file_stat;
+        return stat(file_name.c_str(), &file_stat) == 0;
+    }
+
+    bool Has(const std::string& name) const {
+        return m_Find(name) != nullptr;
+    }
+
+    /*
+    Return the address and the size of a section, which stay valid as long as the reader.
+    */
+    std::pair<const char*, size_t> Section(const std::string& name) const {
+        const SnapshotSection* section = m_Find(name);
+        if (section == nullptr) {
+            throw std::invalid_argument("Snapshot section " + name + " is missing in " + m_file_name);
+        }
+        return std::make_pair(m_Data() + section->offset, (size_t)section->size);
+    }
+
+    template <typename T>
+    T GetValue(const std::string& name) const {
+        std::pair<const char*, size_t> section = Section(name);
+        if (section.second != sizeof(T)) {
+            throw std::invalid_argument("Snapshot section " + name + " has a wrong size in " + m_file_name);
+        }
+        T value;
+        std::memcpy(&value, section.first, sizeof(T));
+        return value;
+    }
+
+    /*
+    Return the elements of an array section in place, the payload is aligned for any element type.
+    */
+    template <typename T>
+    std::pair<const T*, size_t> GetArray(const std::string& name) const {
+        std::pair<const char*, size_t> section = Section(name);
+        if (section.second % sizeof(T) != 0) {
+            throw std::invalid_argument("Snapshot section " + name + " has a wrong size in " + m_file_name);
+        }
+        return std::make_pair(reinterpret_cast<const T*>(section.first), section.second / sizeof(T));
+    }
+
+    template <typename T>
+    std::vector<T> CopyArray(const std::string& name) const {
+        std::pair<const T*, size_t> array = GetArray<T>(name);
+        return std::vector<T>(array.first, array.first + array.second);
+    }
+
+    const std::string& FileName() const {
+        return m_file_name;
+    }
+
+private:
+    const char* m_Data() const {
+        return reinterpret_cast<const char*>(m_addr);
+    }
+
+    const SnapshotSection* m_Find(const std::string& name) const {
+        for (const auto& section : m_section_list) {
+            if (name == section.name) return &section;
+        }
+        return nullptr;
+    }
+
+    std::string m_file_name;
+    void* m_addr;
+    size_t m_length;
+    std::vector<SnapshotSection> m_section_list;
+};
+
+#endif  // UTILS_SNAPSHOT_HPP
@@ -0,0 +1,190 @@
+#ifndef UTILS_VECTOR_FILE_HPP
+#define UTILS_VECTOR_FILE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DataType.hpp"
+
+/*
+Binary file of vector data objects, which is used for both datasets and query workloads:
+    header: magic "VECF", version, size of one value, dimension, number of vectors
+    body:   n * dim values of VectorDimensionType in row-major order
+The vector in row i has vid i. The body starts at an 8-byte aligned offset,
+so the file can be mapped into memory and read in place.
+*/
+struct VectorFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t reserved;
+    uint64_t dim;
+    uint64_t n;
+};
+
+static_assert(sizeof(VectorFileHeader) % sizeof(VectorDimensionType) == 0, "the vector file body must be aligned");
+
+static const char kVectorFileMagic[4] = {'V', 'E', 'C', 'F'};
+static const uint32_t kVectorFileVersion = 1;
+
+/*
+Read-only memory mapping of a vector file.
+*/
+class VectorFileReader {
+public:
+    explicit VectorFileReader(const std::string& file_name) : m_file_name(file_name), m_addr(nullptr), m_length(0) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::invalid_argument("Failed to open vector file: " + file_name);
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(VectorFileHeader)) {
+            close(fd);
+            throw std::invalid_argument("Vector file is too short: " + file_name);
+        }
+        m_length = file_stat.st_size;
+
+        m_addr = mmap(nullptr, m_length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m_addr == MAP_FAILED) {
+            m_addr = nullptr;
+            throw std::invalid_argument("Failed to map vector file: " + file_name);
+        }
+
+        const VectorFileHeader* header = reinterpret_cast<const VectorFileHeader*>(m_addr);
+        if (std::memcmp(header->magic, kVectorFileMagic, sizeof(kVectorFileMagic)) != 0
+            || header->version != kVectorFileVersion
+            || header->value_size != sizeof(VectorDimensionType)) {
+            munmap(m_addr, m_length);
+            throw std::invalid_argument("Invalid vector file header: " + file_name);
+        }
+        m_dim = header->dim;
+        m_n = header->n;
+        if (m_length < sizeof(VectorFileHeader) + m_n * m_dim * sizeof(VectorDimensionType)) {
+            munmap(m_addr, m_length);
+            throw std::invalid_argument("Vector file is truncated: " + file_name);
+        }
+        m_body = reinterpret_cast<const VectorDimensionType*>(reinterpret_cast<const char*>(m_addr) + sizeof(VectorFileHeader));
+    }
+
+    ~VectorFileReader() {
+        if (m_addr != nullptr) {
+            munmap(m_addr, m_length);
+        }
+    }
+
+    VectorFileReader(const VectorFileReader&) = delete;
+    VectorFileReader& operator=(const VectorFileReader&) = delete;
+
+    size_t Size() const {
+        return m_n;
+    }
+
+    size_t Dimension() const {
+        return m_dim;
+    }
+
+    const VectorDimensionType* Row(size_t i) const {
+        if (i >= m_n) {
+            throw std::out_of_range("Row index out of range");
+        }
+        return m_body + i * m_dim;
+    }
+
+    /*
+    Copy row i into a vector data object with the given vid.
+    */
+    VectorDataType GetVector(size_t i, VidType vid) const {
+        const VectorDimensionType* row = Row(i);
+        VectorDataType vector_data(m_dim, vid);
+        std::copy_n(row, m_dim, vector_data.data.begin());
+        return vector_data;
+    }
+
+    const std::string& FileName() const {
+        return m_file_name;
+    }
+
+private:
+    std::string m_file_name;
+    void* m_addr;
+    size_t m_length;
+    size_t m_dim;
+    size_t m_n;
+    const VectorDimensionType* m_body;
+};
+
+/*
+Append vectors to a new vector file, the number of vectors is written into the header on Close().
+*/
+class VectorFileWriter {
+public:
+    VectorFileWriter(const std::string& file_name, size_t dim) : m_file_name(file_name), m_dim(dim), m_n(0) {
+        m_file = std::fopen(file_name.c_str(), "wb");
+        if (m_file == nullptr) {
+            throw std::invalid_argument("Failed to open vector file for writing: " + file_name);
+        }
+        m_WriteHeader();
+    }
+
+    ~VectorFileWriter() {
+        if (m_file != nullptr) {
+            Close();
+        }
+    }
+
+    VectorFileWriter(const VectorFileWriter&) = delete;
+    VectorFileWriter& operator=(const VectorFileWriter&) = delete;
+
+    void Append(const VectorDataType& vector_data) {
+        if (vector_data.Dimension() != m_dim) {
+            throw std::invalid_argument("vector data dimension does not match");
+        }
+        if (std::fwrite(vector_data.data.data(), sizeof(VectorDimensionType), m_dim, m_file) != m_dim) {
+            throw std::invalid_argument("Failed to write vector file: " + m_file_name);
+        }
+        ++m_n;
+    }
+
+    void Close() {
+        std::fseek(m_file, 0, SEEK_SET);
+        m_WriteHeader();
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+
+    size_t Size() const {
+        return m_n;
+    }
+
+private:
+    void m_WriteHeader() {
+        VectorFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kVectorFileMagic, sizeof(kVectorFileMagic));
+        header.version = kVectorFileVersion;
+        header.value_size = sizeof(VectorDimensionType);
+        header.dim = m_dim;
+        header.n = m_n;
+        if (std::fwrite(&header, sizeof(header), 1, m_file) != 1) {
+            throw std::invalid_argument("Failed to write vector file header: " + m_file_name);
+        }
+    }
+
+    std::string m_file_name;
+    std::FILE* m_file;
+    size_t m_dim;
+    size_t m_n;
+};
+
+#endif  // UTILS_VECTOR_FILE_HPP
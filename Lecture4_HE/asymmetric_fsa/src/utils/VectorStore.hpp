@@ -0,0 +1,372 @@
+#ifndef UTILS_VECTOR_STORE_HPP
+#define UTILS_VECTOR_STORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "DataType.hpp"
+
+/*
+Deleted rows of one segment, one bit per row.
+*/
+class TombstoneBitmap {
+public:
+    explicit TombstoneBitmap(size_t n=0) : m_word_list((n + 63) / 64, 0), m_count(0) {}
+
+    bool Test(size_t i) const {
+        return (m_word_list[i >> 6] >> (i & 63)) & 1;
+    }
+
+    // return false if row i has already been deleted
+    bool Set(size_t i) {
+        if (Test(i)) return false;
+        m_word_list[i >> 6] |= (uint64_t)1 << (i & 63);
+        ++m_count;
+        return true;
+    }
+
+    size_t Count() const {
+        return m_count;
+    }
+
+private:
+    std::vector<uint64_t> m_word_list;
+    size_t m_count;
+};
+
+/*
+An immutable batch of vectors, which is never changed once it is published.
+*/
+struct VectorSegment {
+    uint64_t segment_id;
+    std::vector<VectorDataType> data_list;
+};
+
+/*
+A consistent view of the store: the segments and their tombstones at one point in time.
+*/
+struct VectorSnapshot {
+    std::vector<std::shared_ptr<const VectorSegment>> segment_list;
+    std::vector<std::shared_ptr<const TombstoneBitmap>> tombstone_list;
+    size_t row_num = 0;
+    size_t deleted_num = 0;
+
+    size_t Size() const {
+        return row_num - deleted_num;
+    }
+
+    // call func(vector_data) on every vector that has not been deleted
+    template <typename Func>
+    void ForEach(Func func) const {
+        for (size_t s=0; s<segment_list.size(); ++s) {
+            const std::vector<VectorDataType>& data_list = segment_list[s]->data_list;
+            const TombstoneBitmap& tombstone = *tombstone_list[s];
+            const size_t n = data_list.size();
+            if (tombstone.Count() == 0) {
+                for (size_t i=0; i<n; ++i) {
+                    func(data_list[i]);
+                }
+            } else {
+                for (size_t i=0; i<n; ++i) {
+                    if (!tombstone.Test(i)) func(data_list[i]);
+                }
+            }
+        }
+    }
+};
+
+/*
+Append-only segmented vector store with deletion by tombstones.
+Readers take the current snapshot with one atomic load and never wait for writers:
+writers build a new snapshot under the writer mutex (copying only the segment list and the changed tombstones),
+then publish it atomically, and the old snapshot is freed when its last reader drops it.
+A background thread merges the segments and drops the deleted rows.
+*/
+class VectorStore {
+public:
+    VectorStore(size_t max_segment_num=8, double max_deleted_ratio=0.2)
+                : m_max_segment_num(max_segment_num), m_max_deleted_ratio(max_deleted_ratio),
+                  m_dim(0), m_next_vid(0), m_next_segment_id(0), m_compact_num(0), m_stop(false) {
+        m_snapshot = std::make_shared<const VectorSnapshot>();
+    }
+
+    ~VectorStore() {
+        StopCompaction();
+    }
+
+    VectorStore(const VectorStore&) = delete;
+    VectorStore& operator=(const VectorStore&) = delete;
+
+    /*
+    Replace the whole store with the initial dataset, the vids of data_list are kept.
+    */
+    void Reset(const size_t dim, std::vector<VectorDataType>&& data_list) {
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        m_dim = dim;
+        m_location_map.clear();
+        m_next_vid = 0;
+
+        auto snapshot = std::make_shared<VectorSnapshot>();
+        if (!data_list.empty()) {
+            auto segment = std::make_shared<VectorSegment>();
+            segment->segment_id = m_next_segment_id++;
+            segment->data_list = std::move(data_list);
+            m_IndexSegment(*segment);
+            snapshot->row_num = segment->data_list.size();
+            snapshot->tombstone_list.emplace_back(std::make_shared<const TombstoneBitmap>(segment->data_list.size()));
+            snapshot->segment_list.emplace_back(std::move(segment));
+        }
+        m_Publish(std::move(snapshot));
+    }
+
+    std::shared_ptr<const VectorSnapshot> GetSnapshot() const {
+        return std::atomic_load(&m_snapshot);
+    }
+
+    /*
+    Append the vectors as a new segment and return their vids.
+    */
+    std::vector<VidType> Insert(std::vector<VectorDataType>&& data_list) {
+        std::vector<VidType> vid_list;
+        if (data_list.empty()) return vid_list;
+
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        for (auto& vector_data : data_list) {
+            if (vector_data.Dimension() != m_dim) {
+                throw std::invalid_argument("vector data dimension does not match");
+            }
+            vector_data.SetVid(m_next_vid++);
+            vid_list.emplace_back(vector_data.vid);
+        }
+        m_AppendSegment(std::move(data_list));
+
+        return vid_list;
+    }
+
+    /*
+    Append the vectors as a new segment and keep their vids, which the caller must keep unique,
+    e.g., a sharded dataset that hands out the vids across its stores.
+    */
+    void Append(std::vector<VectorDataType>&& data_list) {
+        if (data_list.empty()) return;
+
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        for (const auto& vector_data : data_list) {
+            if (vector_data.Dimension() != m_dim) {
+                throw std::invalid_argument("vector data dimension does not match");
+            }
+        }
+        m_AppendSegment(std::move(data_list));
+    }
+
+    /*
+    Mark the vectors as deleted and return how many of them were found.
+    */
+    size_t Delete(const std::vector<VidType>& vid_list) {
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        auto snapshot = std::make_shared<VectorSnapshot>(*std::atomic_load(&m_snapshot));
+
+        // copy each changed tombstone bitmap once per call
+        std::unordered_map<uint64_t, size_t> segment_index_map;
+        for (size_t s=0; s<snapshot->segment_list.size(); ++s) {
+            segment_index_map[snapshot->segment_list[s]->segment_id] = s;
+        }
+        std::unordered_map<size_t, std::shared_ptr<TombstoneBitmap>> changed_map;
+
+        size_t deleted_num = 0;
+        for (VidType vid : vid_list) {
+            auto iter = m_location_map.find(vid);
+            if (iter == m_location_map.end()) continue;
+            const size_t s = segment_index_map.at(iter->second.first);
+
+            auto& tombstone = changed_map[s];
+            if (tombstone == nullptr) {
+                tombstone = std::make_shared<TombstoneBitmap>(*snapshot->tombstone_list[s]);
+            }
+            if (tombstone->Set(iter->second.second)) {
+                ++deleted_num;
+            }
+            m_location_map.erase(iter);
+        }
+        if (deleted_num == 0) return 0;
+
+        for (auto& changed : changed_map) {
+            snapshot->tombstone_list[changed.first] = std::move(changed.second);
+        }
+        snapshot->deleted_num += deleted_num;
+        m_Publish(std::move(snapshot));
+
+        return deleted_num;
+    }
+
+    /*
+    Merge all segments into one and drop the deleted rows.
+    The merge runs without the writer mutex, and the rows deleted in the meantime are carried over as tombstones.
+    */
+    void Compact() {
+        std::shared_ptr<const VectorSnapshot> base = GetSnapshot();
+        if (base->segment_list.size() <= 1 && base->deleted_num == 0) return;
+
+        auto merged = std::make_shared<VectorSegment>();
+        std::vector<std::pair<size_t, size_t>> source_list;
+        merged->data_list.reserve(base->Size());
+        source_list.reserve(base->Size());
+        for (size_t s=0; s<base->segment_list.size(); ++s) {
+            const std::vector<VectorDataType>& data_list = base->segment_list[s]->data_list;
+            const TombstoneBitmap& tombstone = *base->tombstone_list[s];
+            for (size_t i=0; i<data_list.size(); ++i) {
+                if (tombstone.Test(i)) continue;
+                merged->data_list.emplace_back(data_list[i]);
+                source_list.emplace_back(s, i);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        std::shared_ptr<const VectorSnapshot> current = std::atomic_load(&m_snapshot);
+        const size_t base_segment_num = base->segment_list.size();
+        if (current->segment_list.size() < base_segment_num) return;
+        for (size_t s=0; s<base_segment_num; ++s) {
+            // the store was reset or compacted by someone else
+            if (current->segment_list[s] != base->segment_list[s]) return;
+        }
+
+        merged->segment_id = m_next_segment_id++;
+        auto tombstone = std::make_shared<TombstoneBitmap>(merged->data_list.size());
+        for (size_t i=0; i<merged->data_list.size(); ++i) {
+            const auto& source = source_list[i];
+            if (current->tombstone_list[source.first]->Test(source.second)) {
+                tombstone->Set(i);
+            } else {
+                m_location_map[merged->data_list[i].vid] = std::make_pair(merged->segment_id, i);
+            }
+        }
+
+        auto snapshot = std::make_shared<VectorSnapshot>();
+        snapshot->row_num = merged->data_list.size();
+        snapshot->deleted_num = tombstone->Count();
+        snapshot->segment_list.emplace_back(std::move(merged));
+        snapshot->tombstone_list.emplace_back(std::move(tombstone));
+        for (size_t s=base_segment_num; s<current->segment_list.size(); ++s) {
+            snapshot->segment_list.emplace_back(current->segment_list[s]);
+            snapshot->tombstone_list.emplace_back(current->tombstone_list[s]);
+            snapshot->row_num += current->segment_list[s]->data_list.size();
+            snapshot->deleted_num += current->tombstone_list[s]->Count();
+        }
+        m_Publish(std::move(snapshot));
+        ++m_compact_num;
+    }
+
+    /*
+    Compact in the background whenever there are too many segments or deleted rows.
+    thread_init runs first on the compaction thread, e.g., to pin it to the NUMA node of the store,
+    because the merged segments are allocated by this thread.
+    */
+    void StartCompaction(const std::chrono::milliseconds& interval=std::chrono::milliseconds(1000), std::function<void()> thread_init=nullptr) {
+        std::lock_guard<std::mutex> lock(m_compact_mutex);
+        if (m_compact_thread.joinable()) return;
+        m_stop = false;
+        m_compact_thread = std::thread([this, interval, thread_init]() {
+            if (thread_init) thread_init();
+            std::unique_lock<std::mutex> lock(m_compact_mutex);
+            while (!m_stop) {
+                m_compact_cond.wait_for(lock, interval);
+                if (m_stop) break;
+                if (!m_NeedCompaction()) continue;
+                lock.unlock();
+                Compact();
+                lock.lock();
+            }
+        });
+    }
+
+    void StopCompaction() {
+        {
+            std::lock_guard<std::mutex> lock(m_compact_mutex);
+            m_stop = true;
+        }
+        m_compact_cond.notify_all();
+        if (m_compact_thread.joinable()) {
+            m_compact_thread.join();
+        }
+    }
+
+    size_t Size() const {
+        return GetSnapshot()->Size();
+    }
+
+    size_t SegmentNum() const {
+        return GetSnapshot()->segment_list.size();
+    }
+
+    size_t CompactNum() const {
+        return m_compact_num;
+    }
+
+private:
+    // the writer mutex must be held
+    void m_AppendSegment(std::vector<VectorDataType>&& data_list) {
+        auto segment = std::make_shared<VectorSegment>();
+        segment->segment_id = m_next_segment_id++;
+        segment->data_list = std::move(data_list);
+        m_IndexSegment(*segment);
+
+        auto snapshot = std::make_shared<VectorSnapshot>(*std::atomic_load(&m_snapshot));
+        snapshot->row_num += segment->data_list.size();
+        snapshot->tombstone_list.emplace_back(std::make_shared<const TombstoneBitmap>(segment->data_list.size()));
+        snapshot->segment_list.emplace_back(std::move(segment));
+        m_Publish(std::move(snapshot));
+    }
+
+    void m_IndexSegment(const VectorSegment& segment) {
+        for (size_t i=0; i<segment.data_list.size(); ++i) {
+            const VidType vid = segment.data_list[i].vid;
+            m_location_map[vid] = std::make_pair(segment.segment_id, i);
+            m_next_vid = std::max(m_next_vid, vid + 1);
+        }
+    }
+
+    void m_Publish(std::shared_ptr<const VectorSnapshot> snapshot) {
+        std::atomic_store(&m_snapshot, std::move(snapshot));
+        if (m_NeedCompaction()) {
+            m_compact_cond.notify_one();
+        }
+    }
+
+    bool m_NeedCompaction() const {
+        std::shared_ptr<const VectorSnapshot> snapshot = GetSnapshot();
+        if (snapshot->segment_list.size() > m_max_segment_num) return true;
+        return snapshot->row_num > 0 && snapshot->deleted_num > m_max_deleted_ratio * snapshot->row_num;
+    }
+
+    size_t m_max_segment_num;
+    double m_max_deleted_ratio;
+    size_t m_dim;
+
+    // the published snapshot, which is read and replaced by std::atomic_load and std::atomic_store
+    std::shared_ptr<const VectorSnapshot> m_snapshot;
+
+    // writer state: vid -> (segment_id, row in the segment)
+    std::mutex m_writer_mutex;
+    std::unordered_map<VidType, std::pair<uint64_t, size_t>> m_location_map;
+    VidType m_next_vid;
+    uint64_t m_next_segment_id;
+
+    // background compaction
+    std::atomic<size_t> m_compact_num;
+    std::thread m_compact_thread;
+    std::mutex m_compact_mutex;
+    std::condition_variable m_compact_cond;
+    bool m_stop;
+};
+
+#endif  // UTILS_VECTOR_STORE_HPP
@@ -194,9 +194,12 @@ private:
         int min_id = -1;
         const int n = m_data_list.size();
 
+        // select the distance kernel once for the whole scan
+        const DistanceFunc dist_func = GetDistanceFunc(DistanceMetric::L2, m_dim);
+        const VectorDimensionType* query_ptr = query_data.data.data();
         for (int i=0; i<n; ++i) {
             const VectorDataType& vector_data = m_data_list[i];
-            VectorDimensionType dist = EuclideanSquareDistance(vector_data, query_data);
+            VectorDimensionType dist = dist_func(vector_data.data.data(), query_ptr, m_dim);
             if (dist < min_dist) {
                 min_dist = dist;
                 min_id = i;
@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <future>
 #include <cctype>
 #include <cstdlib>
 #include <random>
@@ -28,6 +29,7 @@ namespace bpo = boost::program_options;
 
 #include "utils/BenchLogger.hpp"
 #include "utils/DataType.hpp"
+#include "utils/DecryptWorkerPool.hpp"
 #include "FedSql.grpc.pb.h"
 
 using grpc::Channel;
@@ -124,7 +126,7 @@ public:
         m_logger.LogAddComm(grpc_comm);
     } 
 
-    EncryptDistance GetEncryptDistance() const {
+    const EncryptDistance& GetEncryptDistance() const {
         return m_encrypt_dist;
     }
 
@@ -140,25 +142,6 @@ public:
         silo_receiver->GetEncryptDistance(query_object);
     }
 
-    static void ThreadGetDecryptDistance(DataHolderReceiver* silo_receiver, const std::string& edist_str, const EncryptionParameters& params, const SecretKey& secret_key, VectorDimensionType& dist) {  
-        SEALContext context(params);
-
-        Decryptor decryptor(context, secret_key);
-        BatchEncoder batch_encoder(context);
-
-        std::stringstream edist_sstream(edist_str);
-
-        Ciphertext dist_encrypted;
-        dist_encrypted.load(context, edist_sstream);
-
-        Plaintext dist_decrypted;
-        std::vector<int64_t> dist_matrix;
-        decryptor.decrypt(dist_encrypted, dist_decrypted);
-        batch_encoder.decode(dist_decrypted, dist_matrix);
-
-        dist = dist_matrix[0];
-    }    
-
     static void ThreadFinishQueryProcessing(DataHolderReceiver* silo_receiver) {
         silo_receiver->FinishQueryProcessing();
     }   
@@ -273,16 +256,16 @@ private:
 
     int m_GetDecryptNearestDistance() {
         const int silo_num = m_silo_ipaddr_list.size();
-        std::vector<std::thread> thread_list(silo_num);
         std::vector<VectorDimensionType> dist_list(silo_num);
+        std::vector<std::future<VectorDimensionType>> future_list(silo_num);
 
+        // Decrypt the distances of all data holders in parallel with the decryption workers
         for (int i=0; i<silo_num; ++i) {
-            EncryptDistance encrypt_dist = m_silo_receiver_list[i]->GetEncryptDistance();
-            std::string edist_str = encrypt_dist.edist();
-            thread_list[i] = std::thread(DataHolderReceiver::ThreadGetDecryptDistance, m_silo_receiver_list[i].get(), edist_str, m_parms, m_secret_key, std::ref(dist_list[i]));
+            const std::string& edist_str = m_silo_receiver_list[i]->GetEncryptDistance().edist();
+            future_list[i] = m_decrypt_pool->Submit(edist_str);
         }
         for (int i=0; i<silo_num; ++i) {
-            thread_list[i].join();
+            dist_list[i] = future_list[i].get();
         }
 
         int nearest_silo_id = 0;
@@ -381,7 +364,10 @@ private:
         KeyGenerator keygen(context);
         m_secret_key = keygen.secret_key();
         keygen.create_public_key(m_public_key);
-        keygen.create_relin_keys(m_relin_keys);        
+        keygen.create_relin_keys(m_relin_keys);
+
+        m_decrypt_pool = std::make_unique<DecryptWorkerPool>(context, m_secret_key);
+        std::cout << "Decryption workers: " << m_decrypt_pool->WorkerNum() << std::endl;
     }
 
     /*
@@ -458,6 +444,7 @@ private:
     PublicKey m_public_key;
     SecretKey m_secret_key;
     RelinKeys m_relin_keys;
+    std::unique_ptr<DecryptWorkerPool> m_decrypt_pool;
     static const size_t m_poly_modulus_degree = 8192;
     static const size_t m_batching_size = 40; 
 };
@@ -13,6 +13,8 @@
 #include <cstdlib>
 #include <cstdint>
 
+#include "DistanceKernel.hpp"
+
 typedef int64_t VectorDimensionType;
 typedef long VidType;
    
@@ -70,19 +72,6 @@ struct VectorDataType {
         std::copy_n(arr.begin(), dim, data.begin());
     }
   
-    VectorDataType& operator=(const VectorDataType& other) {
-        if (this != &other) {  
-            const size_t dim = this->Dimension();
-            if (other.Dimension() != dim) {
-                throw std::invalid_argument("Data size does not match with vector data dimension");
-                std::exit(EXIT_FAILURE);
-            }
-            vid = other.vid; 
-            std::copy_n(other.data.begin(), dim, data.begin());
-        }  
-        return *this;  
-    }  
-  
     bool operator==(const VectorDataType& other) const {  
         if (vid != other.vid) return false;
         const size_t dim = this->Dimension();
@@ -163,33 +152,21 @@ struct VectorDataType {
     } 
 };
 
-VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b);
-double EuclideanDistance(const VectorDataType& a, const VectorDataType& b);
-
-VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b) {  
+/*
+The dimension is checked once per call, then the distance is computed by the kernel of utils/DistanceKernel.hpp.
+A scan over many vectors should call GetDistanceFunc() once and use the raw kernel instead.
+*/
+inline VectorDimensionType EuclideanSquareDistance(const VectorDataType& a, const VectorDataType& b) {  
     if (a.Dimension() != b.Dimension()) {
         throw std::invalid_argument("Vector data must have the same dimension");
     }
 
     const size_t dim = a.Dimension();
-    VectorDimensionType sum = 0;  
-    for (size_t i = 0; i < dim; ++i) {  
-        sum += (a[i] - b[i]) * (a[i] - b[i]);  
-    }  
-    return sum;  
+    return GetDistanceFunc(DistanceMetric::L2, dim)(a.data.data(), b.data.data(), dim);
 } 
 
-double EuclideanDistance(const VectorDataType& a, const VectorDataType& b) {  
-    if (a.Dimension() != b.Dimension()) {
-        throw std::invalid_argument("Vector data must have the same dimension");
-    }
-
-    const size_t dim = a.Dimension();
-    VectorDimensionType sum = 0;  
-    for (size_t i = 0; i < dim; ++i) {  
-        sum += (a[i] - b[i]) * (a[i] - b[i]);
-    }  
-    return std::sqrt(sum*1.0);  
+inline double EuclideanDistance(const VectorDataType& a, const VectorDataType& b) {  
+    return std::sqrt(EuclideanSquareDistance(a, b)*1.0);  
 } 
 
 #endif  // UTILS_DATA_TYPE_HPP
@@ -0,0 +1,115 @@
+#ifndef UTILS_DECRYPT_WORKER_POOL_HPP
+#define UTILS_DECRYPT_WORKER_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "seal/seal.h"
+
+/*
+A pool of decryption workers for the query user.
+Each worker owns a long-lived Decryptor and BatchEncoder bound to the shared SEALContext,
+so decrypting the results of many data holders carries no per-ciphertext setup overhead.
+*/
+class DecryptWorkerPool {
+public:
+    DecryptWorkerPool(const seal::SEALContext& context, const seal::SecretKey& secret_key, size_t worker_num=0)
+                        : m_context(context), m_secret_key(secret_key), m_stop(false) {
+        if (worker_num == 0) {
+            worker_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        m_worker_list.reserve(worker_num);
+        for (size_t i=0; i<worker_num; ++i) {
+            m_worker_list.emplace_back(&DecryptWorkerPool::m_WorkerLoop, this);
+        }
+    }
+
+    ~DecryptWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (auto& worker : m_worker_list) {
+            worker.join();
+        }
+    }
+
+    DecryptWorkerPool(const DecryptWorkerPool&) = delete;
+    DecryptWorkerPool& operator=(const DecryptWorkerPool&) = delete;
+
+    /*
+    Decrypt a serialized ciphertext and return the value in its first slot.
+    The caller must keep edist_str alive until the future is ready.
+    */
+    std::future<int64_t> Submit(const std::string& edist_str) {
+        DecryptTask task;
+        task.edist = &edist_str;
+        std::future<int64_t> ret = task.result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task_queue.emplace(std::move(task));
+        }
+        m_cond.notify_one();
+        return ret;
+    }
+
+    size_t WorkerNum() const {
+        return m_worker_list.size();
+    }
+
+private:
+    struct DecryptTask {
+        const std::string* edist;
+        std::promise<int64_t> result;
+    };
+
+    void m_WorkerLoop() {
+        seal::Decryptor decryptor(m_context, m_secret_key);
+        seal::BatchEncoder batch_encoder(m_context);
+        seal::Ciphertext dist_encrypted(m_context);
+        seal::Plaintext dist_decrypted;
+        std::vector<int64_t> dist_matrix(batch_encoder.slot_count());
+
+        while (true) {
+            DecryptTask task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this] { return m_stop || !m_task_queue.empty(); });
+                if (m_stop && m_task_queue.empty()) return;
+                task = std::move(m_task_queue.front());
+                m_task_queue.pop();
+            }
+
+            try {
+                // load the ciphertext straight from the protobuf bytes
+                const std::string& edist_str = *task.edist;
+                dist_encrypted.load(m_context, reinterpret_cast<const seal::seal_byte*>(edist_str.data()), edist_str.size());
+                decryptor.decrypt(dist_encrypted, dist_decrypted);
+                batch_encoder.decode(dist_decrypted, dist_matrix);
+                task.result.set_value(dist_matrix[0]);
+            } catch (...) {
+                task.result.set_exception(std::current_exception());
+            }
+        }
+    }
+
+    seal::SEALContext m_context;
+    seal::SecretKey m_secret_key;
+    std::vector<std::thread> m_worker_list;
+    std::queue<DecryptTask> m_task_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop;
+};
+
+#endif  // UTILS_DECRYPT_WORKER_POOL_HPP